@@ -0,0 +1,165 @@
+import array
+import mmap
+
+import ctools
+
+max_item = 1024
+
+
+def get_keys():
+    return list(range(max_item))
+
+
+def get_cache_map():
+    c = ctools.CacheMap(max_item * 2)
+    for i in range(max_item):
+        c[i] = i
+    return c
+
+
+def get_ttl_cache():
+    c = ctools.TTLCache(3600)
+    for i in range(max_item):
+        c[i] = i
+    return c
+
+
+def get_int_cache_map():
+    c = ctools.IntCacheMap(max_item * 2)
+    for i in range(max_item):
+        c[i] = i
+    return c
+
+
+def get_bytes_cache():
+    c = ctools.BytesCache(max_item * 2)
+    for i in range(max_item):
+        c[b"%d" % i] = b"%d" % i
+    return c
+
+
+def get_shared_cache():
+    buf = mmap.mmap(-1, ctools.SharedCache.nbytes(max_item * 2))
+    c = ctools.SharedCache(buf, create=True)
+    for i in range(max_item):
+        c[b"%d" % i] = b"%d" % i
+    return c
+
+
+def get_bytes_keys():
+    return [b"%d" % i for i in range(max_item)]
+
+
+def get_int_keys():
+    return array.array("q", range(max_item))
+
+
+def get_sorted_map():
+    s = ctools.SortedMap()
+    for i in range(max_item):
+        s[i] = i
+    return s
+
+
+@benchmark_setup(c=get_cache_map, keys=get_keys)
+def benchmark_cache_map_get(c, keys):
+    get = c.get
+    for i in keys:
+        get(i)
+
+
+@benchmark_setup(c=get_cache_map, keys=get_keys)
+def benchmark_cache_map_get_default(c, keys):
+    get = c.get
+    for i in keys:
+        get(i, None)
+
+
+@benchmark_setup(c=get_cache_map, keys=get_keys)
+def benchmark_cache_map_set(c, keys):
+    set_ = c.set
+    for i in keys:
+        set_(i, i)
+
+
+@benchmark_setup(c=get_cache_map, keys=get_keys)
+def benchmark_cache_map_setdefault(c, keys):
+    setdefault = c.setdefault
+    for i in keys:
+        setdefault(i, i)
+
+
+@benchmark_setup(c=get_cache_map, keys=get_keys)
+def benchmark_cache_map_get_many(c, keys):
+    c.get_many(keys)
+
+
+@benchmark_setup(c=get_cache_map, keys=get_keys)
+def benchmark_cache_map_set_many(c, keys):
+    c.set_many(zip(keys, keys))
+
+
+@benchmark_setup(c=get_int_cache_map, keys=get_keys)
+def benchmark_int_cache_map_get(c, keys):
+    get = c.get
+    for i in keys:
+        get(i)
+
+
+@benchmark_setup(c=get_int_cache_map, keys=get_int_keys)
+def benchmark_int_cache_map_get_many(c, keys):
+    c.get_many(keys)
+
+
+@benchmark_setup(c=get_bytes_cache, keys=get_bytes_keys)
+def benchmark_bytes_cache_get(c, keys):
+    get = c.get
+    for i in keys:
+        get(i)
+
+
+@benchmark_setup(c=get_shared_cache, keys=get_bytes_keys)
+def benchmark_shared_cache_get(c, keys):
+    get = c.get
+    for i in keys:
+        get(i)
+
+
+@benchmark_setup(c=get_ttl_cache, keys=get_keys)
+def benchmark_ttl_cache_get_many(c, keys):
+    c.get_many(keys)
+
+
+@benchmark_setup(c=get_ttl_cache, keys=get_keys)
+def benchmark_ttl_cache_get(c, keys):
+    get = c.get
+    for i in keys:
+        get(i)
+
+
+@benchmark_setup(c=get_ttl_cache, keys=get_keys)
+def benchmark_ttl_cache_set(c, keys):
+    set_ = c.set
+    for i in keys:
+        set_(i, i)
+
+
+@benchmark_setup(s=get_sorted_map, keys=get_keys)
+def benchmark_sorted_map_get_method(s, keys):
+    get = s.get
+    for i in keys:
+        get(i)
+
+
+@benchmark_setup(keys=get_keys)
+def benchmark_jump_consistent_hash_calls(keys):
+    jump = ctools.jump_consistent_hash
+    for i in keys:
+        jump(i, 1024)
+
+
+@benchmark_setup(keys=get_keys)
+def benchmark_strhash_calls(keys):
+    strhash = ctools.strhash
+    for _ in keys:
+        strhash("ctools", "fnv1")
@@ -22,6 +22,7 @@ build_with_debug = _ctools.build_with_debug
 strhash = _ctools.strhash
 int8_to_datetime = _ctools.int8_to_datetime
 jump_consistent_hash = _ctools.jump_consistent_hash
+freelist_stats = _ctools.freelist_stats
 
 try:
     from collections.abc import MutableMapping  # noqa
@@ -31,12 +32,24 @@ except ImportError:
 CacheMap = _ctools.CacheMap
 TTLCache = _ctools.TTLCache
 Channel = _ctools.Channel
+PriorityChannel = _ctools.PriorityChannel
+SharedChannel = _ctools.SharedChannel
+SharedCache = _ctools.SharedCache
+select = _ctools.select
 SortedMap = _ctools.SortedMap
+cached = _ctools.cached
+IntCacheMap = _ctools.IntCacheMap
+IntTTLCache = _ctools.IntTTLCache
+BytesCache = _ctools.BytesCache
+
+from ctools._singleflight import asetnx  # noqa
 
 try:
     MutableMapping.register(CacheMap)
     MutableMapping.register(TTLCache)
     MutableMapping.register(SortedMap)
+    MutableMapping.register(IntCacheMap)
+    MutableMapping.register(IntTTLCache)
 except Exception:  # noqa
     pass
 
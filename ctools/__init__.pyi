@@ -15,10 +15,13 @@ limitations under the License.
 """
 
 from datetime import datetime
-from typing import Any, Mapping, Iterable, Tuple, Callable, Optional
+from typing import Any, Awaitable, Dict, List, Mapping, Iterable, Iterator, ItemsView, KeysView, Tuple, ValuesView, Callable, MutableMapping, Optional, Union
 
 __version__: str
 
+# objects exporting the buffer protocol, such as array.array or memoryview
+_Buffer = Any
+
 
 def jump_consistent_hash(key: int, num_bucket: int) -> int: ...
 
@@ -29,11 +32,39 @@ def strhash(s: str, method: str = 'fnv1a') -> int: ...
 def int8_to_datetime(date_integer: int) -> datetime: ...
 
 
+def freelist_stats() -> Dict[str, Dict[str, int]]: ...
+
+
+async def asetnx(cache: Union[CacheMap, TTLCache], key,
+                 fn: Callable[[Any], Awaitable]) -> Any: ...
+
+
+def cached(cache: Union[None, Callable, CacheMap, TTLCache,
+                        MutableMapping] = None,
+           typed: bool = False) -> Callable: ...
+
+
+def select(channels: Iterable[Union[Channel, PriorityChannel]],
+           timeout: Optional[float] = None) -> Tuple[Any, Any]: ...
+
+
 MAX_INT32 = 1 << 31 - 1
 
 
 class CacheMap:
-    def __init__(self, capacity: int = MAX_INT32) -> None: ...
+    policy: str
+    max_bytes: Optional[int]
+    weight: int
+
+    def __init__(self, capacity: int = MAX_INT32, policy: str = 'lfu',
+                 max_bytes: Optional[int] = None,
+                 sizeof: Optional[Callable[[Any], int]] = None,
+                 latency: bool = False,
+                 on_evict: Optional[Callable[[List[Tuple[Any, Any, str]]], Any]] = None,
+                 l2_path: Optional[str] = None,
+                 l2_max_bytes: int = 1 << 30,
+                 memory_high: Optional[float] = None,
+                 memory_limit: Optional[int] = None) -> None: ...
 
     def __getitem__(self, item): ...
 
@@ -49,6 +80,18 @@ class CacheMap:
 
     def get(self, key, default=None): ...
 
+    def set(self, key, value, weight: Optional[int] = None) -> None: ...
+
+    def get_many(self, keys: Iterable, default=None) -> List[Any]: ...
+
+    def set_many(self, items: Union[Mapping, Iterable[Tuple[Any, Any]]]) -> None: ...
+
+    def delete_many(self, keys: Iterable) -> int: ...
+
+    def dump(self, path: str, serializer: Any = None) -> int: ...
+
+    def load(self, path: str, serializer: Any = None) -> int: ...
+
     def pop(self, key, default=None): ...
 
     def popitem(self) -> Tuple[Any, Any]: ...
@@ -57,27 +100,44 @@ class CacheMap:
 
     def update(self, mp: Optional[Mapping] = None, **kwargs) -> None: ...
 
-    def keys(self) -> Iterable: ...
+    def keys(self) -> KeysView: ...
 
-    def values(self) -> Iterable: ...
+    def values(self) -> ValuesView: ...
 
-    def items(self) -> Iterable[Tuple]: ...
+    def items(self) -> ItemsView: ...
 
     def clear(self): ...
 
-    def evict(self) -> None: ...
+    def evict(self, n: int = 1) -> int: ...
 
     def set_capacity(self, capacity: int) -> None: ...
 
-    def hints(self) -> (int, int, int): ...
+    def hit_info(self) -> Tuple[int, int, int]: ...
+
+    def stats(self, reset: bool = False) -> Dict[str, Any]: ...
 
     def next_evict_key(self) -> Any: ...
 
-    def setnx(self, key, fn: Callable[[Any], Any]): ...
+    def setnx(self, key, fn: Callable[[Any], Any],
+              singleflight: bool = False): ...
 
 
 class TTLCache:
-    def __init__(self, ttl: int = MAX_INT32) -> None: ...
+    max_bytes: Optional[int]
+    weight: int
+
+    def __init__(self, ttl: int = MAX_INT32, max_bytes: Optional[int] = None,
+                 sizeof: Optional[Callable[[Any], int]] = None,
+                 latency: bool = False,
+                 on_evict: Optional[Callable[[List[Tuple[Any, Any, str]]], Any]] = None,
+                 on_expire: Optional[Callable[[List[Tuple[Any, Any, str]]], Any]] = None,
+                 soft_ttl: Optional[int] = None,
+                 refresh: Optional[Callable[[Any], Any]] = None,
+                 xfetch: float = 0,
+                 memory_high: Optional[float] = None,
+                 memory_limit: Optional[int] = None,
+                 executor: Optional[Any] = None,
+                 timer: Optional[Callable[[], float]] = None) -> None: ...
 
     def __getitem__(self, item): ...
 
@@ -93,6 +153,18 @@ class TTLCache:
 
     def get(self, key, default=None): ...
 
+    def set(self, key, value, weight: Optional[int] = None) -> None: ...
+
+    def get_many(self, keys: Iterable, default=None) -> List[Any]: ...
+
+    def set_many(self, items: Union[Mapping, Iterable[Tuple[Any, Any]]]) -> None: ...
+
+    def delete_many(self, keys: Iterable) -> int: ...
+
+    def dump(self, path: str, serializer: Any = None) -> int: ...
+
+    def load(self, path: str, serializer: Any = None) -> int: ...
+
     def pop(self, key, default=None): ...
 
     def popitem(self) -> Tuple[Any, Any]: ...
@@ -101,6 +173,8 @@ class TTLCache:
 
     def update(self, mp: Optional[Mapping] = None) -> None: ...
 
+    def stats(self, reset: bool = False) -> Dict[str, Any]: ...
+
     def keys(self) -> Iterable: ...
 
     def values(self) -> Iterable: ...
@@ -113,11 +187,134 @@ class TTLCache:
 
     def get_default_ttl(self) -> int: ...
 
-    def setnx(self, key, fn: Callable[[Any], Any]): ...
+    def setnx(self, key, fn: Callable[[Any], Any],
+              singleflight: bool = False): ...
+
+
+class _IntCache:
+    def __getitem__(self, item: int): ...
+
+    def __setitem__(self, key: int, value): ...
+
+    def __delitem__(self, key: int): ...
+
+    def __contains__(self, item): ...
+
+    def __len__(self): ...
+
+    def __iter__(self) -> Iterator[int]: ...
+
+    def get(self, key: int, default=None): ...
+
+    def set(self, key: int, value) -> None: ...
+
+    def get_many(self, keys: Union[Iterable[int], _Buffer], default=None) -> List[Any]: ...
+
+    def set_many(self, items: Union[Mapping[int, Any], Iterable[Tuple[int, Any]]]) -> None: ...
+
+    def delete_many(self, keys: Union[Iterable[int], _Buffer]) -> int: ...
+
+    def pop(self, key: int, default=None): ...
+
+    def setdefault(self, key: int, default=None): ...
+
+    def stats(self, reset: bool = False) -> Dict[str, Any]: ...
+
+    def keys(self) -> Iterator[int]: ...
+
+    def values(self) -> Iterator[Any]: ...
+
+    def items(self) -> Iterator[Tuple[int, Any]]: ...
+
+    def clear(self) -> None: ...
+
+
+class IntCacheMap(_IntCache):
+    capacity: int
+
+    def __init__(self, capacity: int = MAX_INT32) -> None: ...
+
+    def evict(self, n: int = 1) -> int: ...
+
+
+class IntTTLCache(_IntCache):
+    ttl: int
+
+    def __init__(self, ttl: int = 60) -> None: ...
+
+
+class BytesCache:
+    capacity: int
+    max_bytes: Optional[int]
+    weight: int
+    arena_bytes: int
+
+    def __init__(self, capacity: int = MAX_INT32, max_bytes: Optional[int] = None) -> None: ...
+
+    def __getitem__(self, item: Union[bytes, str]) -> Union[bytes, str]: ...
+
+    def __setitem__(self, key: Union[bytes, str], value: Union[bytes, str, _Buffer]): ...
+
+    def __delitem__(self, key: Union[bytes, str]): ...
+
+    def __contains__(self, item): ...
+
+    def __len__(self): ...
+
+    def __iter__(self) -> Iterator[bytes]: ...
+
+    def get(self, key: Union[bytes, str], default=None): ...
+
+    def view(self, key: Union[bytes, str], default=None) -> Optional[memoryview]: ...
+
+    def set(self, key: Union[bytes, str], value: Union[bytes, str, _Buffer]) -> None: ...
+
+    def pop(self, key: Union[bytes, str], default=None): ...
+
+    def evict(self, n: int = 1) -> int: ...
+
+    def stats(self, reset: bool = False) -> Dict[str, Any]: ...
+
+    def clear(self) -> None: ...
+
+
+class SharedCache:
+    capacity: int
+    item_size: int
+    stripes: int
+
+    def __init__(self, buffer: _Buffer, create: bool = False, item_size: int = 1000, stripes: int = 64) -> None: ...
+
+    @classmethod
+    def nbytes(cls, capacity: int, item_size: int = 1000, stripes: int = 64) -> int: ...
+
+    def __getitem__(self, item: Union[bytes, str]) -> bytes: ...
+
+    def __setitem__(self, key: Union[bytes, str], value: _Buffer): ...
+
+    def __delitem__(self, key: Union[bytes, str]): ...
+
+    def __contains__(self, item): ...
+
+    def __len__(self): ...
+
+    def get(self, key: Union[bytes, str], default=None): ...
+
+    def set(self, key: Union[bytes, str], value: _Buffer) -> None: ...
+
+    def pop(self, key: Union[bytes, str], default=None): ...
+
+    def evict(self, n: int = 1) -> int: ...
+
+    def stats(self, reset: bool = False) -> Dict[str, Any]: ...
+
+    def clear(self) -> None: ...
 
 
 class Channel:
-    def __init__(self, size: int = MAX_INT32) -> None: ...
+    mode: str
+
+    def __init__(self, size: int = MAX_INT32, mode: Optional[str] = None) -> None: ...
 
     def clear(self) -> None: ...
 
@@ -136,6 +333,49 @@ class Channel:
     def size(self) -> int: ...
 
 
+class PriorityChannel:
+    lanes: int
+
+    def __init__(self, size: Optional[int] = MAX_INT32, lanes: int = 4) -> None: ...
+
+    def __len__(self) -> int: ...
+
+    def clear(self) -> None: ...
+
+    def close(self, send: bool = True, recv: bool = True) -> None: ...
+
+    def recv(self) -> Tuple[Any, bool]: ...
+
+    def recvable(self) -> bool: ...
+
+    def safe_consume(self, fn) -> bool: ...
+
+    def send(self, o: Any, priority: int = 0) -> bool: ...
+
+    def sendable(self) -> bool: ...
+
+    def size(self) -> int: ...
+
+
+class SharedChannel:
+    def __init__(self, buffer, create: bool = False) -> None: ...
+
+    @classmethod
+    def nbytes(cls, size: int) -> int: ...
+
+    def close(self, send: bool = True, recv: bool = True) -> None: ...
+
+    def recv(self, timeout: Optional[float] = 0) -> Tuple[Optional[bytes], bool]: ...
+
+    def recvable(self) -> bool: ...
+
+    def send(self, data: bytes, timeout: Optional[float] = 0) -> bool: ...
+
+    def sendable(self) -> bool: ...
+
+    def size(self) -> int: ...
+
+
 class SortedMap:
     def __init__(self, cmp: Callable[[Any], int] = None) -> None: ...
 
@@ -0,0 +1,75 @@
+"""
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+"""
+
+import asyncio
+
+_MISSING = object()
+
+# (loop, id(cache), key) -> future of the load in progress. The loading task
+# keeps the cache alive, so its id is not reused while the entry exists. A
+# future only serves coroutines of the loop it belongs to.
+_inflight = {}
+
+
+async def asetnx(cache, key, fn):
+    """Like ``cache.setnx(key, fn, singleflight=True)`` for a coroutine
+    function ``fn``.
+
+    Coroutines missing a key that another one is loading await that load
+    instead of calling ``fn`` again.
+
+    Parameters
+    ----------
+    cache : CacheMap or TTLCache
+        The cache.
+    key : object
+        Hash key.
+    fn : typing.Callable[[typing.Any], typing.Awaitable]
+        Coroutine function that accept key as only one argument, awaited
+        when key not exists.
+
+    Returns
+    -------
+    object
+        The found value or what ``fn`` return.
+    """
+    value = cache.get(key, _MISSING)
+    if value is not _MISSING:
+        return value
+    loop = asyncio.get_running_loop()
+    flight = (loop, id(cache), key)
+    future = _inflight.get(flight)
+    if future is not None:
+        # a waiter being cancelled must not cancel the load of the others
+        return await asyncio.shield(future)
+
+    future = loop.create_future()
+    _inflight[flight] = future
+    try:
+        value = await fn(key)
+        cache[key] = value
+    except asyncio.CancelledError:
+        future.cancel()
+        raise
+    except BaseException as e:
+        future.set_exception(e)
+        future.exception()  # retrieved, waiters are optional
+        raise
+    else:
+        future.set_result(value)
+    finally:
+        del _inflight[flight]
+    return value
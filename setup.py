@@ -86,12 +86,17 @@ extensions = [
     Extension(
         "ctools._ctools",
         source(
+            "bytescache.c",
             "cachemap.c",
+            "cached.c",
             "channel.c",
             "ttlcache.c",
             "functions.c",
+            "intcache.c",
             "module.c",
             "rbtree.c",
+            "sharedcache.c",
+            "sharedchannel.c",
         ),
         language="c",
         **extra_extension_args
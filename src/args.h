@@ -0,0 +1,218 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _CTOOLS_ARGS_H_
+#define _CTOOLS_ARGS_H_
+
+#include "core.h"
+
+/* Argument parsing of METH_FASTCALL methods, in the spirit of the parsers
+ * Argument Clinic generates. Methods are declared as
+ *
+ *   static PyObject *X_get(X *self, CtsArg_PARAMS) {
+ *     static const char *const kwlist[] = {"key", "default", NULL};
+ *     static CtsArg_Parser parser = {"get", kwlist, 1, 2};
+ *     PyObject *argv[2];
+ *     if (CtsArg_UNPACK(&parser, argv)) ...
+ *
+ * and listed with CtsArg_METH. Positional calls are unpacked without any
+ * allocation, keywords are matched against interned names. Pythons without
+ * METH_FASTCALL fall back to METH_VARARGS | METH_KEYWORDS. */
+#if PY_VERSION_HEX >= 0x03070000
+#define CTS_HAVE_FASTCALL
+#endif
+
+typedef struct {
+  const char *fname;
+  const char *const *kwlist; /* NULL terminated, "" if positional only */
+  Py_ssize_t required;       /* leading parameters without default */
+  Py_ssize_t maxpos;         /* parameters that may be passed by position */
+  Py_ssize_t nparams;        /* set on first keyword call */
+  PyObject **names;          /* interned kwlist, set on first keyword call */
+} CtsArg_Parser;
+
+#ifdef CTS_HAVE_FASTCALL
+#define CtsArg_METH (METH_FASTCALL | METH_KEYWORDS)
+#define CtsArg_PARAMS                                                          \
+  PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames
+#define CtsArg_UNPACK(parser, argv)                                            \
+  CtsArg_Unpack((parser), args, nargs, kwnames, NULL, (argv))
+#else
+#define CtsArg_METH (METH_VARARGS | METH_KEYWORDS)
+#define CtsArg_PARAMS PyObject *args, PyObject *kwargs
+#define CtsArg_UNPACK(parser, argv)                                            \
+  CtsArg_Unpack((parser), &PyTuple_GET_ITEM(args, 0),                        \
+                PyTuple_GET_SIZE(args), NULL, kwargs, (argv))
+#endif
+
+static int CtsArg_InitNames(CtsArg_Parser *parser) {
+  Py_ssize_t n = 0, i;
+  PyObject **names;
+  while (parser->kwlist[n]) {
+    n++;
+  }
+  names = (PyObject **)PyMem_Calloc(n ? n : 1, sizeof(PyObject *));
+  if (names == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  for (i = 0; i < n; i++) {
+    if (parser->kwlist[i][0] == '\0') {
+      continue;
+    }
+    names[i] = PyUnicode_InternFromString(parser->kwlist[i]);
+    if (names[i] == NULL) {
+      while (i--) {
+        Py_XDECREF(names[i]);
+      }
+      PyMem_Free(names);
+      return -1;
+    }
+  }
+  /* kept for the life of the process, like the parsers of CPython */
+  parser->nparams = n;
+  parser->names = names;
+  return 0;
+}
+
+static int CtsArg_Keyword(CtsArg_Parser *parser, PyObject *name,
+                          PyObject *value, Py_ssize_t nargs,
+                          PyObject **argv) {
+  Py_ssize_t i;
+  int eq;
+  if (!PyUnicode_Check(name)) {
+    PyErr_Format(PyExc_TypeError, "%s() keywords must be strings",
+                 parser->fname);
+    return -1;
+  }
+  for (i = 0; i < parser->nparams; i++) {
+    if (parser->names[i] == name) {
+      break;
+    }
+  }
+  if (i == parser->nparams) {
+    /* names built at runtime are not interned */
+    for (i = 0; i < parser->nparams; i++) {
+      if (parser->names[i] == NULL) {
+        continue;
+      }
+      eq = PyUnicode_Compare(parser->names[i], name);
+      if (eq == -1 && PyErr_Occurred()) {
+        return -1;
+      }
+      if (eq == 0) {
+        break;
+      }
+    }
+  }
+  if (i == parser->nparams) {
+    PyErr_Format(PyExc_TypeError,
+                 "%s() got an unexpected keyword argument '%S'",
+                 parser->fname, name);
+    return -1;
+  }
+  if (i < nargs || argv[i]) {
+    PyErr_Format(PyExc_TypeError,
+                 "%s() got multiple values for argument '%S'", parser->fname,
+                 name);
+    return -1;
+  }
+  argv[i] = value;
+  return 0;
+}
+
+/* Fill `argv` with borrowed references of the parameters in order of
+ * kwlist, NULL for those not given. Keywords are either the names of
+ * fastcall values following `args`, or the dict `kwargs`. */
+static int CtsArg_Unpack(CtsArg_Parser *parser, PyObject *const *args,
+                         Py_ssize_t nargs, PyObject *kwnames,
+                         PyObject *kwargs, PyObject **argv) {
+  Py_ssize_t i, nkw = 0, pos = 0;
+  PyObject *name, *value;
+  if (kwnames) {
+    nkw = PyTuple_GET_SIZE(kwnames);
+  } else if (kwargs) {
+    nkw = PyDict_Size(kwargs);
+  }
+  if (nargs > parser->maxpos) {
+    PyErr_Format(PyExc_TypeError,
+                 "%s() takes at most %zd positional arguments (%zd given)",
+                 parser->fname, parser->maxpos, nargs);
+    return -1;
+  }
+  if (nkw == 0 && nargs >= parser->required) {
+    /* positional only call, the common case */
+    for (i = 0; i < nargs; i++) {
+      argv[i] = args[i];
+    }
+    while (parser->kwlist[i]) {
+      argv[i++] = NULL;
+    }
+    return 0;
+  }
+  if (parser->names == NULL && CtsArg_InitNames(parser)) {
+    return -1;
+  }
+  for (i = 0; i < parser->nparams; i++) {
+    argv[i] = i < nargs ? args[i] : NULL;
+  }
+  if (kwnames) {
+    for (i = 0; i < nkw; i++) {
+      if (CtsArg_Keyword(parser, PyTuple_GET_ITEM(kwnames, i),
+                         args[nargs + i], nargs, argv)) {
+        return -1;
+      }
+    }
+  } else if (kwargs) {
+    while (PyDict_Next(kwargs, &pos, &name, &value)) {
+      if (CtsArg_Keyword(parser, name, value, nargs, argv)) {
+        return -1;
+      }
+    }
+  }
+  for (i = 0; i < parser->required; i++) {
+    if (argv[i] == NULL) {
+      if (parser->kwlist[i][0]) {
+        PyErr_Format(PyExc_TypeError,
+                     "%s() missing required argument '%s' (pos %zd)",
+                     parser->fname, parser->kwlist[i], i + 1);
+      } else {
+        PyErr_Format(PyExc_TypeError,
+                     "%s() takes at least %zd positional arguments "
+                     "(%zd given)",
+                     parser->fname, parser->required, nargs);
+      }
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* "p" of PyArg_Parse, `ob` is NULL if not given. */
+static inline int CtsArg_Bool(PyObject *ob, int *out) {
+  int rv;
+  if (ob == NULL) {
+    return 0;
+  }
+  rv = PyObject_IsTrue(ob);
+  if (rv < 0) {
+    return -1;
+  }
+  *out = rv;
+  return 0;
+}
+
+#endif /* _CTOOLS_ARGS_H_ */
@@ -0,0 +1,123 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _CTOOLS_ATOMIC_H_
+#define _CTOOLS_ATOMIC_H_
+
+#include "core.h"
+
+#include <stddef.h>
+
+/* Size of a cache line, used to pad indices touched by different threads. */
+#define CTS_CACHELINE 64
+
+/* Atomic operations on size_t values.
+ * Only the handful of operations the lock-free containers need. */
+#if defined(__GNUC__) || defined(__clang__)
+
+#define Cts_AtomicLoadRelaxed(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define Cts_AtomicLoadAcquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define Cts_AtomicStoreRelease(p, v)                                           \
+  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define Cts_AtomicStoreRelaxed(p, v)                                           \
+  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+/* Weak CAS, on failure `*expected` is updated to the current value. */
+#define Cts_AtomicCAS(p, expected, desired)                                    \
+  __atomic_compare_exchange_n((p), (expected), (desired), 1, __ATOMIC_RELAXED, \
+                              __ATOMIC_RELAXED)
+#define Cts_AtomicFetchAdd(p, v) __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+/* Order the loads after a relaxed CAS that took a lock. */
+#define Cts_AtomicFenceAcquire() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define Cts_CpuRelax() ((void)0)
+
+#elif defined(_MSC_VER)
+
+#include <intrin.h>
+
+/* MSVC volatile accesses have acquire/release semantics on x86 and x64. */
+#define Cts_AtomicLoadRelaxed(p) (*(volatile size_t *)(p))
+#define Cts_AtomicLoadAcquire(p) (*(volatile size_t *)(p))
+#define Cts_AtomicStoreRelease(p, v) (*(volatile size_t *)(p) = (v))
+#define Cts_AtomicStoreRelaxed(p, v) (*(volatile size_t *)(p) = (v))
+
+static inline int Cts_AtomicCAS(size_t *p, size_t *expected, size_t desired) {
+  size_t prev;
+#ifdef _WIN64
+  prev = (size_t)_InterlockedCompareExchange64((volatile __int64 *)p,
+                                               (__int64)desired,
+                                               (__int64)*expected);
+#else
+  prev = (size_t)_InterlockedCompareExchange((volatile long *)p, (long)desired,
+                                             (long)*expected);
+#endif
+  if (prev == *expected) {
+    return 1;
+  }
+  *expected = prev;
+  return 0;
+}
+
+static inline size_t Cts_AtomicFetchAdd(size_t *p, size_t v) {
+#ifdef _WIN64
+  return (size_t)_InterlockedExchangeAdd64((volatile __int64 *)p, (__int64)v);
+#else
+  return (size_t)_InterlockedExchangeAdd((volatile long *)p, (long)v);
+#endif
+}
+#define Cts_AtomicFenceAcquire() _ReadWriteBarrier()
+#define Cts_CpuRelax() _mm_pause()
+
+#else
+
+/* Unknown compiler: fall back to plain accesses, only safe under the GIL. */
+#define Cts_AtomicLoadRelaxed(p) (*(volatile size_t *)(p))
+#define Cts_AtomicLoadAcquire(p) (*(volatile size_t *)(p))
+#define Cts_AtomicStoreRelease(p, v) (*(volatile size_t *)(p) = (v))
+#define Cts_AtomicStoreRelaxed(p, v) (*(volatile size_t *)(p) = (v))
+
+static inline int Cts_AtomicCAS(size_t *p, size_t *expected, size_t desired) {
+  if (*p == *expected) {
+    *p = desired;
+    return 1;
+  }
+  *expected = *p;
+  return 0;
+}
+
+static inline size_t Cts_AtomicFetchAdd(size_t *p, size_t v) {
+  size_t prev = *p;
+  *p += v;
+  return prev;
+}
+#define Cts_AtomicFenceAcquire() ((void)0)
+#define Cts_CpuRelax() ((void)0)
+
+#endif
+
+/* Allocate `size` bytes aligned to a cache line, `*raw` receives the pointer
+ * that must be given to PyMem_Free. */
+static inline void *Cts_AlignedCalloc(size_t size, void **raw) {
+  char *p = (char *)PyMem_Calloc(1, size + CTS_CACHELINE);
+  if (p == NULL) {
+    *raw = NULL;
+    return NULL;
+  }
+  *raw = p;
+  return (void *)(((uintptr_t)p + CTS_CACHELINE - 1) &
+                  ~(uintptr_t)(CTS_CACHELINE - 1));
+}
+
+#endif /* _CTOOLS_ATOMIC_H_ */
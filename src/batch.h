@@ -0,0 +1,74 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _CTOOLS_BATCH_H_
+#define _CTOOLS_BATCH_H_
+
+#include "core.h"
+
+/* Called for each item of a batch, with the cache and the state of the
+ * batch. */
+typedef int (*CtsBatch_PairFunc)(PyObject *self, PyObject *key,
+                                 PyObject *value, void *arg);
+
+/* Call `fn` for each (key, value) of a dict, or of an iterable of pairs. */
+static int CtsBatch_ForEachPair(PyObject *self, PyObject *items,
+                                CtsBatch_PairFunc fn, void *arg) {
+  PyObject *key, *value, *it, *item, *pair;
+  Py_ssize_t pos = 0;
+  int rv = 0;
+  if (PyDict_Check(items)) {
+    while (PyDict_Next(items, &pos, &key, &value)) {
+      Py_INCREF(key);
+      Py_INCREF(value);
+      rv = fn(self, key, value, arg);
+      Py_DECREF(key);
+      Py_DECREF(value);
+      if (rv) {
+        return -1;
+      }
+    }
+    return 0;
+  }
+  it = PyObject_GetIter(items);
+  ReturnIfNULL(it, -1);
+  while ((item = PyIter_Next(it)) != NULL) {
+    pair = PySequence_Fast(item, "items should be pairs.");
+    Py_DECREF(item);
+    if (pair == NULL) {
+      rv = -1;
+      break;
+    }
+    if (PySequence_Fast_GET_SIZE(pair) != 2) {
+      PyErr_SetString(PyExc_ValueError, "items should be pairs.");
+      rv = -1;
+    } else {
+      rv = fn(self, PySequence_Fast_GET_ITEM(pair, 0),
+              PySequence_Fast_GET_ITEM(pair, 1), arg);
+    }
+    Py_DECREF(pair);
+    if (rv) {
+      break;
+    }
+  }
+  Py_DECREF(it);
+  if (rv == 0 && PyErr_Occurred()) {
+    rv = -1;
+  }
+  return rv;
+}
+
+#endif /* _CTOOLS_BATCH_H_ */
@@ -0,0 +1,945 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "args.h"
+#include "core.h"
+#include "hash.h"
+#include "lfu.h"
+#include "stats.h"
+#include "table.h"
+
+#include <Python.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BytesCache_EMPTY CtsTable_EMPTY
+
+/* Items are carved from slabs of this size, in chunks of a few size
+ * classes growing by 1/4. Larger items are allocated alone. */
+#define BytesCache_SLAB_SIZE (1 << 20)
+#define BytesCache_MIN_CHUNK 64
+#define BytesCache_MAX_CHUNK (BytesCache_SLAB_SIZE / 16)
+#define BytesCache_MAX_CLASSES 64
+#define BytesCache_LARGE 255
+
+#define BytesItem_STR 1 /* the value was a str, stored as UTF-8 */
+
+/* An item is a header followed by the key and the value. */
+typedef struct {
+  uint64_t hash;
+  uint32_t klen;
+  uint32_t vlen;
+  uint32_t visits;
+  int32_t pos;   /* in items of the cache, -1 once removed */
+  uint32_t pins; /* views reading the value, the chunk is kept until 0 */
+  uint8_t cls;   /* size class of the chunk */
+  uint8_t flags;
+  char data[1];
+} CtsBytesItem;
+
+#define BytesItem_HEADER offsetof(CtsBytesItem, data)
+#define BytesItem_Key(item) ((item)->data)
+#define BytesItem_Value(item) ((item)->data + (item)->klen)
+
+/* A free chunk of a size class. */
+typedef struct _cts_bytes_chunk {
+  struct _cts_bytes_chunk *next;
+} CtsBytesChunk;
+
+typedef struct {
+  Py_ssize_t size;     /* bytes per chunk */
+  CtsBytesChunk *free; /* freed chunks */
+  char *carve;         /* unused part of the last slab of this class */
+  char *end;
+} CtsBytesClass;
+
+/* clang-format off */
+typedef struct {
+  PyObject_HEAD
+  CtsBytesItem **items; /* dense, sampled by LFU */
+  Py_ssize_t size;
+  Py_ssize_t allocated;
+  CtsTable table;       /* positions of items */
+  uint64_t seed;
+  Py_ssize_t capacity;
+  Py_ssize_t max_bytes;
+  Py_ssize_t weight;    /* bytes of chunks in use */
+  Py_ssize_t ops;       /* clock of LFU aging */
+  char **slabs;
+  Py_ssize_t nslabs;
+  Py_ssize_t slabs_allocated;
+  Py_ssize_t large;     /* bytes of items allocated alone */
+  int nclasses;
+  CtsBytesClass classes[BytesCache_MAX_CLASSES];
+  CtsCacheStats stats;
+} CtsBytesCache;
+
+/* Exports the value of a pinned item to a memoryview. */
+typedef struct {
+  PyObject_HEAD
+  CtsBytesCache *cache;
+  CtsBytesItem *item;
+} CtsBytesCacheValue;
+/* clang-format on */
+
+static PyTypeObject BytesCache_Type;
+static PyTypeObject BytesCacheValue_Type;
+
+/* A key looked up in the index. */
+typedef struct {
+  const char *p;
+  Py_ssize_t n;
+  uint64_t hash;
+} CtsBytesKey;
+
+static uint64_t BytesCache_HashOf(void *owner, int32_t e) {
+  return ((CtsBytesCache *)owner)->items[e]->hash;
+}
+
+static int BytesCache_Match(void *owner, int32_t e, const void *key) {
+  CtsBytesItem *item = ((CtsBytesCache *)owner)->items[e];
+  const CtsBytesKey *k = (const CtsBytesKey *)key;
+  return item->hash == k->hash && item->klen == (uint32_t)k->n &&
+         memcmp(BytesItem_Key(item), k->p, (size_t)k->n) == 0;
+}
+
+static uint32_t *BytesCache_VisitsOf(void *owner, Py_ssize_t pos) {
+  return &((CtsBytesCache *)owner)->items[pos]->visits;
+}
+
+/* Bytes of a key or a value, a str is read as UTF-8. `flags` is set for a
+ * str if not NULL. */
+static int BytesCache_AsBytes(PyObject *ob, const char **p, Py_ssize_t *n,
+                              uint8_t *flags) {
+  if (PyBytes_Check(ob)) {
+    *p = PyBytes_AS_STRING(ob);
+    *n = PyBytes_GET_SIZE(ob);
+  } else if (PyUnicode_Check(ob)) {
+    *p = PyUnicode_AsUTF8AndSize(ob, n);
+    ReturnIfNULL(*p, -1);
+    if (flags) {
+      *flags |= BytesItem_STR;
+    }
+  } else {
+    PyErr_Format(PyExc_TypeError, "expect bytes or str, not %.100s",
+                 Py_TYPE(ob)->tp_name);
+    return -1;
+  }
+  if ((uint64_t)*n > UINT32_MAX) {
+    PyErr_SetString(PyExc_OverflowError, "bytes longer than 4GB");
+    return -1;
+  }
+  return 0;
+}
+
+/* The index slot of a key, or the empty slot ending its probe. */
+static Py_ssize_t BytesCache_Probe(CtsBytesCache *self, const char *key,
+                                   Py_ssize_t klen, uint64_t hash) {
+  CtsBytesKey k = {key, klen, hash};
+  return CtsTable_Probe(&self->table, hash, BytesCache_Match, &k);
+}
+
+/* The index slot of an item in cache. */
+static Py_ssize_t BytesCache_SlotOf(CtsBytesCache *self, CtsBytesItem *item) {
+  return CtsTable_SlotOf(&self->table, item->pos);
+}
+
+/* Make room for one more item. */
+static int BytesCache_Reserve(CtsBytesCache *self) {
+  CtsBytesItem **items = (CtsBytesItem **)CtsTable_Grow(
+      self->items, &self->allocated, self->size, sizeof(CtsBytesItem *));
+  ReturnIfNULL(items, -1);
+  self->items = items;
+  return CtsTable_Reserve(&self->table, self->size);
+}
+
+/* Size classes from BytesCache_MIN_CHUNK to BytesCache_MAX_CHUNK. */
+static void BytesCache_InitClasses(CtsBytesCache *self) {
+  Py_ssize_t size = BytesCache_MIN_CHUNK;
+  int n = 0;
+  while (n < BytesCache_MAX_CLASSES - 1 && size < BytesCache_MAX_CHUNK) {
+    self->classes[n++].size = size;
+    size = (size + size / 4 + 7) & ~(Py_ssize_t)7;
+  }
+  self->classes[n++].size = BytesCache_MAX_CHUNK;
+  for (int i = 0; i < n; i++) {
+    self->classes[i].free = NULL;
+    self->classes[i].carve = self->classes[i].end = NULL;
+  }
+  self->nclasses = n;
+}
+
+/* Size class of an item of n bytes, BytesCache_LARGE if it has none. */
+static int BytesCache_ClassOf(CtsBytesCache *self, Py_ssize_t n) {
+  int lo = 0, hi = self->nclasses, mid;
+  if (n > BytesCache_MAX_CHUNK) {
+    return BytesCache_LARGE;
+  }
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (self->classes[mid].size < n) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+#define BytesCache_ChunkSize(self, cls, n)                                     \
+  ((cls) == BytesCache_LARGE ? (n) : (self)->classes[(cls)].size)
+
+static CtsBytesItem *BytesCache_AllocChunk(CtsBytesCache *self, int cls,
+                                           Py_ssize_t n) {
+  CtsBytesClass *c;
+  CtsBytesChunk *chunk;
+  char *slab, **slabs;
+  if (cls == BytesCache_LARGE) {
+    chunk = (CtsBytesChunk *)PyMem_Malloc((size_t)n);
+    if (chunk) {
+      self->large += n;
+    }
+  } else if ((chunk = (c = &self->classes[cls])->free) != NULL) {
+    c->free = chunk->next;
+  } else {
+    if (c->carve == NULL || c->end - c->carve < c->size) {
+      if (self->nslabs == self->slabs_allocated) {
+        slabs = self->slabs;
+        PyMem_Resize(slabs, char *, (size_t)self->slabs_allocated * 2 + 8);
+        if (slabs == NULL) {
+          return (CtsBytesItem *)PyErr_NoMemory();
+        }
+        self->slabs = slabs;
+        self->slabs_allocated = self->slabs_allocated * 2 + 8;
+      }
+      slab = (char *)PyMem_Malloc(BytesCache_SLAB_SIZE);
+      if (slab == NULL) {
+        return (CtsBytesItem *)PyErr_NoMemory();
+      }
+      self->slabs[self->nslabs++] = slab;
+      c->carve = slab;
+      c->end = slab + BytesCache_SLAB_SIZE;
+    }
+    chunk = (CtsBytesChunk *)c->carve;
+    c->carve += c->size;
+  }
+  if (chunk == NULL) {
+    PyErr_NoMemory();
+  }
+  return (CtsBytesItem *)chunk;
+}
+
+/* Return the chunk of a removed item, unless a view still reads it. */
+static void BytesCache_FreeItem(CtsBytesCache *self, CtsBytesItem *item) {
+  CtsBytesChunk *chunk = (CtsBytesChunk *)item;
+  if (item->pins) {
+    return;
+  }
+  if (item->cls == BytesCache_LARGE) {
+    self->large -= BytesItem_HEADER + item->klen + item->vlen;
+    PyMem_Free(item);
+    return;
+  }
+  chunk->next = self->classes[item->cls].free;
+  self->classes[item->cls].free = chunk;
+}
+
+/* Remove the item at index slot `i` and free it. */
+static void BytesCache_Remove(CtsBytesCache *self, Py_ssize_t i) {
+  int32_t e = CtsTable_Remove(&self->table, i, self->size), last;
+  CtsBytesItem *item = self->items[e];
+  last = (int32_t)--self->size;
+  if (e != last) {
+    self->items[e] = self->items[last];
+    self->items[e]->pos = e;
+  }
+  self->weight -= BytesCache_ChunkSize(
+      self, item->cls, (Py_ssize_t)BytesItem_HEADER + item->klen + item->vlen);
+  item->pos = -1;
+  BytesCache_FreeItem(self, item);
+}
+
+/* Evict until there are at most `size` items and `bytes` more fit. */
+static void BytesCache_MakeRoom(CtsBytesCache *self, Py_ssize_t size,
+                                Py_ssize_t bytes) {
+  Py_ssize_t pos;
+  while ((self->size > size || self->weight + bytes > self->max_bytes) &&
+         (pos = CtsLFU_Victim(self->size, BytesCache_VisitsOf, self)) >= 0) {
+    BytesCache_Remove(self, BytesCache_SlotOf(self, self->items[pos]));
+    self->stats.evictions++;
+  }
+}
+
+/* Borrowed item of a key, NULL if missing. */
+static CtsBytesItem *BytesCache_Find(CtsBytesCache *self, PyObject *key) {
+  const char *k;
+  Py_ssize_t klen;
+  int32_t e;
+  if (BytesCache_AsBytes(key, &k, &klen, NULL)) {
+    return NULL;
+  }
+  e = self->table.index[BytesCache_Probe(self, k, klen,
+                                         CtsHash_Bytes(self->seed, k, klen))];
+  return e == BytesCache_EMPTY ? NULL : self->items[e];
+}
+
+/* Find an item and count the lookup. */
+static CtsBytesItem *BytesCache_Hit(CtsBytesCache *self, PyObject *key) {
+  CtsBytesItem *item = BytesCache_Find(self, key);
+  if (item == NULL) {
+    if (!PyErr_Occurred()) {
+      self->stats.misses++;
+    }
+    return NULL;
+  }
+  self->stats.hits++;
+  CtsLFU_Visit(&item->visits);
+  CtsLFU_Tick(&self->ops, self->size, BytesCache_VisitsOf, self);
+  return item;
+}
+
+/* New reference, a copy of the value. */
+static PyObject *BytesItem_GetValue(CtsBytesItem *item) {
+  if (item->flags & BytesItem_STR) {
+    return PyUnicode_DecodeUTF8(BytesItem_Value(item), item->vlen, NULL);
+  }
+  return PyBytes_FromStringAndSize(BytesItem_Value(item), item->vlen);
+}
+
+static int BytesCache_SetItem(CtsBytesCache *self, PyObject *key,
+                              PyObject *value) {
+  const char *k, *v;
+  Py_ssize_t klen, vlen, n, chunk, i;
+  uint8_t flags = 0;
+  uint32_t visits = CtsLFU_INIT_VISITS;
+  uint64_t hash;
+  CtsBytesItem *item;
+  Py_buffer view;
+  int rv = -1, cls;
+  if (BytesCache_AsBytes(key, &k, &klen, NULL)) {
+    return -1;
+  }
+  if (PyBytes_Check(value) || PyUnicode_Check(value)) {
+    if (BytesCache_AsBytes(value, &v, &vlen, &flags)) {
+      return -1;
+    }
+    view.obj = NULL;
+  } else {
+    /* bytearray, memoryview and other contiguous buffers */
+    if (PyObject_GetBuffer(value, &view, PyBUF_SIMPLE)) {
+      return -1;
+    }
+    v = (const char *)view.buf;
+    vlen = view.len;
+    if ((uint64_t)vlen > UINT32_MAX) {
+      PyErr_SetString(PyExc_OverflowError, "bytes longer than 4GB");
+      goto DONE;
+    }
+  }
+  n = (Py_ssize_t)BytesItem_HEADER + klen + vlen;
+  cls = BytesCache_ClassOf(self, n);
+  chunk = BytesCache_ChunkSize(self, cls, n);
+  if (chunk > self->max_bytes) {
+    PyErr_SetString(PyExc_ValueError, "item is larger than max_bytes");
+    goto DONE;
+  }
+  hash = CtsHash_Bytes(self->seed, k, klen);
+  i = BytesCache_Probe(self, k, klen, hash);
+  if (self->table.index[i] != BytesCache_EMPTY) {
+    /* replaced, the new value keeps the visits of the key */
+    visits = self->items[self->table.index[i]]->visits;
+    BytesCache_Remove(self, i);
+  } else {
+    self->stats.insertions++;
+  }
+  BytesCache_MakeRoom(self, self->capacity - 1, chunk);
+  if (BytesCache_Reserve(self)) {
+    goto DONE;
+  }
+  item = BytesCache_AllocChunk(self, cls, n);
+  if (item == NULL) {
+    goto DONE;
+  }
+  item->hash = hash;
+  item->klen = (uint32_t)klen;
+  item->vlen = (uint32_t)vlen;
+  item->visits = visits;
+  item->pins = 0;
+  item->cls = (uint8_t)cls;
+  item->flags = flags;
+  memcpy(BytesItem_Key(item), k, (size_t)klen);
+  memcpy(BytesItem_Value(item), v, (size_t)vlen);
+  item->pos = (int32_t)self->size;
+  self->items[self->size++] = item;
+  self->table.index[BytesCache_Probe(self, k, klen, hash)] = item->pos;
+  self->weight += chunk;
+  rv = 0;
+DONE:
+  if (view.obj) {
+    PyBuffer_Release(&view);
+  }
+  return rv;
+}
+
+static int BytesCache_DelItem(CtsBytesCache *self, PyObject *key) {
+  CtsBytesItem *item = BytesCache_Find(self, key);
+  if (item == NULL) {
+    if (!PyErr_Occurred()) {
+      PyErr_SetObject(PyExc_KeyError, key);
+    }
+    return -1;
+  }
+  BytesCache_Remove(self, BytesCache_SlotOf(self, item));
+  return 0;
+}
+
+static void BytesCache_Clear(CtsBytesCache *self) {
+  while (self->size) {
+    BytesCache_Remove(self, BytesCache_SlotOf(self, self->items[0]));
+  }
+  self->ops = 0;
+}
+
+static Py_ssize_t BytesCache_mp_length(CtsBytesCache *self) {
+  return self->size;
+}
+
+static PyObject *BytesCache_mp_subscript(CtsBytesCache *self,
+                                         PyObject *key) {
+  CtsBytesItem *item = BytesCache_Hit(self, key);
+  if (item == NULL) {
+    if (!PyErr_Occurred()) {
+      PyErr_SetObject(PyExc_KeyError, key);
+    }
+    return NULL;
+  }
+  return BytesItem_GetValue(item);
+}
+
+static int BytesCache_mp_ass_sub(CtsBytesCache *self, PyObject *key,
+                                 PyObject *value) {
+  return value ? BytesCache_SetItem(self, key, value)
+               : BytesCache_DelItem(self, key);
+}
+
+static PyMappingMethods BytesCache_as_mapping = {
+    (lenfunc)BytesCache_mp_length,        /* mp_length */
+    (binaryfunc)BytesCache_mp_subscript,  /* mp_subscript */
+    (objobjargproc)BytesCache_mp_ass_sub, /* mp_ass_subscript */
+};
+
+/* Not counted as a hit. */
+static int BytesCache_sq_contains(CtsBytesCache *self, PyObject *key) {
+  if (!PyBytes_Check(key) && !PyUnicode_Check(key)) {
+    return 0;
+  }
+  if (BytesCache_Find(self, key)) {
+    return 1;
+  }
+  return PyErr_Occurred() ? -1 : 0;
+}
+
+static PySequenceMethods BytesCache_as_sequence = {
+    0,                                   /* sq_length */
+    0,                                   /* sq_concat */
+    0,                                   /* sq_repeat */
+    0,                                   /* sq_item */
+    0,                                   /* sq_slice */
+    0,                                   /* sq_ass_item */
+    0,                                   /* sq_ass_slice */
+    (objobjproc)BytesCache_sq_contains,  /* sq_contains */
+    0,                                   /* sq_inplace_concat */
+    0,                                   /* sq_inplace_repeat */
+};
+
+static PyObject *BytesCache_get(CtsBytesCache *self, CtsArg_PARAMS) {
+  PyObject *argv[2], *value;
+  CtsBytesItem *item;
+
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"get", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  item = BytesCache_Hit(self, argv[0]);
+  if (item) {
+    return BytesItem_GetValue(item);
+  }
+  ReturnIfErrorSet(NULL);
+  value = argv[1] ? argv[1] : Py_None;
+  Py_INCREF(value);
+  return value;
+}
+
+static PyObject *BytesCache_view(CtsBytesCache *self, CtsArg_PARAMS) {
+  PyObject *argv[2], *value, *rv;
+  CtsBytesCacheValue *exporter;
+  CtsBytesItem *item;
+
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"view", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  item = BytesCache_Hit(self, argv[0]);
+  if (item == NULL) {
+    ReturnIfErrorSet(NULL);
+    value = argv[1] ? argv[1] : Py_None;
+    Py_INCREF(value);
+    return value;
+  }
+  exporter = PyObject_New(CtsBytesCacheValue, &BytesCacheValue_Type);
+  ReturnIfNULL(exporter, NULL);
+  Py_INCREF(self);
+  exporter->cache = self;
+  exporter->item = item;
+  item->pins++;
+  rv = PyMemoryView_FromObject((PyObject *)exporter);
+  Py_DECREF(exporter);
+  return rv;
+}
+
+static PyObject *BytesCache_set(CtsBytesCache *self, CtsArg_PARAMS) {
+  PyObject *argv[2];
+
+  static const char *const kwlist[] = {"key", "value", NULL};
+  static CtsArg_Parser parser = {"set", kwlist, 2, 2};
+  if (CtsArg_UNPACK(&parser, argv) ||
+      BytesCache_SetItem(self, argv[0], argv[1])) {
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *BytesCache_pop(CtsBytesCache *self, CtsArg_PARAMS) {
+  PyObject *argv[2], *value;
+  CtsBytesItem *item;
+
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"pop", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  item = BytesCache_Find(self, argv[0]);
+  if (item == NULL) {
+    ReturnIfErrorSet(NULL);
+    value = argv[1] ? argv[1] : Py_None;
+    Py_INCREF(value);
+    return value;
+  }
+  value = BytesItem_GetValue(item);
+  ReturnIfNULL(value, NULL);
+  BytesCache_Remove(self, BytesCache_SlotOf(self, item));
+  return value;
+}
+
+/* Return the number of items evicted. */
+static PyObject *BytesCache_evict(CtsBytesCache *self, CtsArg_PARAMS) {
+  PyObject *argv[1];
+  Py_ssize_t n = 1, size = self->size;
+
+  static const char *const kwlist[] = {"n", NULL};
+  static CtsArg_Parser parser = {"evict", kwlist, 0, 1};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  if (argv[0] && (n = PyLong_AsSsize_t(argv[0])) < 0) {
+    if (!PyErr_Occurred()) {
+      PyErr_SetString(PyExc_ValueError, "n should not be negative");
+    }
+    return NULL;
+  }
+  BytesCache_MakeRoom(self, n < size ? size - n : 0, 0);
+  return PyLong_FromSsize_t(size - self->size);
+}
+
+static PyObject *BytesCache_clear(CtsBytesCache *self,
+                                  PyObject *Py_UNUSED(ignore)) {
+  BytesCache_Clear(self);
+  Py_RETURN_NONE;
+}
+
+static PyObject *BytesCache_stats(CtsBytesCache *self, CtsArg_PARAMS) {
+  PyObject *argv[1], *rv;
+  int reset = 0;
+
+  static const char *const kwlist[] = {"reset", NULL};
+  static CtsArg_Parser parser = {"stats", kwlist, 0, 1};
+  if (CtsArg_UNPACK(&parser, argv) || CtsArg_Bool(argv[0], &reset)) {
+    return NULL;
+  }
+  rv = CtsStats_AsDict(&self->stats);
+  if (rv && reset) {
+    CtsStats_Reset(&self->stats);
+  }
+  return rv;
+}
+
+/* clang-format off */
+typedef struct {
+  PyObject_HEAD
+  CtsBytesCache *cache; /* NULL once exhausted */
+  Py_ssize_t pos;
+  Py_ssize_t size;      /* size of the cache when the iteration started */
+} CtsBytesCacheIter;
+/* clang-format on */
+
+static PyTypeObject BytesCacheIter_Type;
+
+static PyObject *BytesCacheIter_tp_iternext(CtsBytesCacheIter *it) {
+  CtsBytesCache *cache = it->cache;
+  CtsBytesItem *item;
+  if (cache == NULL) {
+    return NULL;
+  }
+  if (cache->size != it->size) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "BytesCache changed size during iteration");
+    it->size = -1; /* keep raising */
+    return NULL;
+  }
+  if (it->pos < cache->size) {
+    item = cache->items[it->pos++];
+    return PyBytes_FromStringAndSize(BytesItem_Key(item), item->klen);
+  }
+  it->cache = NULL;
+  Py_DECREF(cache);
+  return NULL;
+}
+
+static void BytesCacheIter_tp_dealloc(CtsBytesCacheIter *it) {
+  Py_XDECREF(it->cache);
+  PyObject_Del(it);
+}
+
+static PyTypeObject BytesCacheIter_Type = {
+    /* clang-format off */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    /* clang-format on */
+    "ctools.BytesCacheIterator",              /* tp_name */
+    sizeof(CtsBytesCacheIter),                /* tp_basicsize */
+    0,                                        /* tp_itemsize */
+    (destructor)BytesCacheIter_tp_dealloc,    /* tp_dealloc */
+    0,                                        /* tp_print */
+    0,                                        /* tp_getattr */
+    0,                                        /* tp_setattr */
+    0,                                        /* tp_compare */
+    0,                                        /* tp_repr */
+    0,                                        /* tp_as_number */
+    0,                                        /* tp_as_sequence */
+    0,                                        /* tp_as_mapping */
+    0,                                        /* tp_hash */
+    0,                                        /* tp_call */
+    0,                                        /* tp_str */
+    0,                                        /* tp_getattro */
+    0,                                        /* tp_setattro */
+    0,                                        /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                       /* tp_flags */
+    0,                                        /* tp_doc */
+    0,                                        /* tp_traverse */
+    0,                                        /* tp_clear */
+    0,                                        /* tp_richcompare */
+    0,                                        /* tp_weaklistoffset */
+    PyObject_SelfIter,                        /* tp_iter */
+    (iternextfunc)BytesCacheIter_tp_iternext, /* tp_iternext */
+};
+
+/* Keys as bytes, not counted as hits. */
+static PyObject *BytesCache_tp_iter(CtsBytesCache *self) {
+  CtsBytesCacheIter *it = PyObject_New(CtsBytesCacheIter,
+                                       &BytesCacheIter_Type);
+  ReturnIfNULL(it, NULL);
+  Py_INCREF(self);
+  it->cache = self;
+  it->pos = 0;
+  it->size = self->size;
+  return (PyObject *)it;
+}
+
+static int BytesCacheValue_getbuffer(CtsBytesCacheValue *self,
+                                     Py_buffer *view, int flags) {
+  return PyBuffer_FillInfo(view, (PyObject *)self,
+                           BytesItem_Value(self->item), self->item->vlen, 1,
+                           flags);
+}
+
+static PyBufferProcs BytesCacheValue_as_buffer = {
+    (getbufferproc)BytesCacheValue_getbuffer, /* bf_getbuffer */
+    0,                                        /* bf_releasebuffer */
+};
+
+static void BytesCacheValue_tp_dealloc(CtsBytesCacheValue *self) {
+  CtsBytesItem *item = self->item;
+  if (--item->pins == 0 && item->pos < 0) {
+    BytesCache_FreeItem(self->cache, item);
+  }
+  Py_DECREF(self->cache);
+  PyObject_Del(self);
+}
+
+static PyTypeObject BytesCacheValue_Type = {
+    /* clang-format off */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    /* clang-format on */
+    "ctools.BytesCacheValue",                 /* tp_name */
+    sizeof(CtsBytesCacheValue),               /* tp_basicsize */
+    0,                                        /* tp_itemsize */
+    (destructor)BytesCacheValue_tp_dealloc,   /* tp_dealloc */
+    0,                                        /* tp_print */
+    0,                                        /* tp_getattr */
+    0,                                        /* tp_setattr */
+    0,                                        /* tp_compare */
+    0,                                        /* tp_repr */
+    0,                                        /* tp_as_number */
+    0,                                        /* tp_as_sequence */
+    0,                                        /* tp_as_mapping */
+    0,                                        /* tp_hash */
+    0,                                        /* tp_call */
+    0,                                        /* tp_str */
+    0,                                        /* tp_getattro */
+    0,                                        /* tp_setattro */
+    &BytesCacheValue_as_buffer,               /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                       /* tp_flags */
+};
+
+static void BytesCache_tp_dealloc(CtsBytesCache *self) {
+  /* views keep the cache alive, no item is pinned here */
+  for (Py_ssize_t i = 0; i < self->size; i++) {
+    if (self->items[i]->cls == BytesCache_LARGE) {
+      PyMem_Free(self->items[i]);
+    }
+  }
+  for (Py_ssize_t i = 0; i < self->nslabs; i++) {
+    PyMem_Free(self->slabs[i]);
+  }
+  PyMem_Free(self->slabs);
+  PyMem_Free(self->items);
+  CtsTable_Free(&self->table);
+  CtsStats_Free(&self->stats);
+  PyObject_Del(self);
+}
+
+static PyObject *BytesCache_tp_new(PyTypeObject *Py_UNUSED(type),
+                                   PyObject *args, PyObject *kwds) {
+  Py_ssize_t capacity = INT32_MAX;
+  PyObject *max_bytes = Py_None;
+  Py_ssize_t nbytes = PY_SSIZE_T_MAX;
+  CtsBytesCache *self;
+  static char *kwlist[] = {"capacity", "max_bytes", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nO", kwlist, &capacity,
+                                   &max_bytes)) {
+    return NULL;
+  }
+  if (capacity <= 0 || capacity > INT32_MAX) {
+    PyErr_SetString(PyExc_ValueError,
+                    "capacity should be a positive int32 integer");
+    return NULL;
+  }
+  if (max_bytes != Py_None) {
+    nbytes = PyLong_AsSsize_t(max_bytes);
+    if (nbytes <= 0) {
+      if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_ValueError,
+                        "max_bytes should be a positive integer");
+      }
+      return NULL;
+    }
+  }
+  self = PyObject_New(CtsBytesCache, &BytesCache_Type);
+  ReturnIfNULL(self, NULL);
+  self->items = NULL;
+  self->size = 0;
+  self->allocated = 0;
+  /* keys of one cache do not collide alike in another */
+  self->seed = (uint64_t)(uintptr_t)self * 0x9E3779B97F4A7C15ULL ^
+               (uint64_t)time(NULL);
+  self->capacity = capacity;
+  self->max_bytes = nbytes;
+  self->weight = 0;
+  self->ops = 0;
+  self->slabs = NULL;
+  self->nslabs = 0;
+  self->slabs_allocated = 0;
+  self->large = 0;
+  BytesCache_InitClasses(self);
+  CtsStats_Init(&self->stats);
+  if (CtsTable_Init(&self->table, BytesCache_HashOf, self)) {
+    Py_DECREF(self);
+    return NULL;
+  }
+  return (PyObject *)self;
+}
+
+static PyObject *BytesCache_repr(CtsBytesCache *self) {
+  return PyUnicode_FromFormat("BytesCache(size=%zd, weight=%zd)", self->size,
+                              self->weight);
+}
+
+static PyObject *BytesCache_get_capacity(CtsBytesCache *self,
+                                         void *Py_UNUSED(closure)) {
+  return PyLong_FromSsize_t(self->capacity);
+}
+
+static PyObject *BytesCache_get_max_bytes(CtsBytesCache *self,
+                                          void *Py_UNUSED(closure)) {
+  if (self->max_bytes == PY_SSIZE_T_MAX) {
+    Py_RETURN_NONE;
+  }
+  return PyLong_FromSsize_t(self->max_bytes);
+}
+
+static PyObject *BytesCache_get_weight(CtsBytesCache *self,
+                                       void *Py_UNUSED(closure)) {
+  return PyLong_FromSsize_t(self->weight);
+}
+
+static PyObject *BytesCache_get_arena_bytes(CtsBytesCache *self,
+                                            void *Py_UNUSED(closure)) {
+  return PyLong_FromSsize_t(self->nslabs * BytesCache_SLAB_SIZE +
+                            self->large);
+}
+
+static PyGetSetDef BytesCache_getset[] = {
+    {"capacity", (getter)BytesCache_get_capacity, NULL, "Max size of cache.",
+     NULL},
+    {"max_bytes", (getter)BytesCache_get_max_bytes, NULL,
+     "Max bytes of items, None if unbounded.", NULL},
+    {"weight", (getter)BytesCache_get_weight, NULL,
+     "Bytes of the chunks holding items.", NULL},
+    {"arena_bytes", (getter)BytesCache_get_arena_bytes, NULL,
+     "Bytes allocated for slabs and large items.", NULL},
+    {NULL, NULL, NULL, NULL, NULL} /* Sentinel */
+};
+
+static PyMethodDef BytesCache_methods[] = {
+    {"get", (PyCFunction)BytesCache_get, CtsArg_METH,
+     "get(key, default=None)\n--\n\nGet a copy of the value of key."},
+    {"view", (PyCFunction)BytesCache_view, CtsArg_METH,
+     "view(key, default=None)\n--\n\nGet a read only memoryview of the "
+     "value of key, without copying it. The memory stays valid until the "
+     "view is released, even if the key is evicted or replaced."},
+    {"set", (PyCFunction)BytesCache_set, CtsArg_METH,
+     "set(key, value)\n--\n\nCopy key and value into cache."},
+    {"pop", (PyCFunction)BytesCache_pop, CtsArg_METH,
+     "pop(key, default=None)\n--\n\nPop an item from cache, if key not "
+     "exists return default."},
+    {"evict", (PyCFunction)BytesCache_evict, CtsArg_METH,
+     "evict(n=1)\n--\n\nEvict up to ``n`` of the least used items, return "
+     "the number evicted."},
+    {"clear", (PyCFunction)BytesCache_clear, METH_NOARGS,
+     "clear()\n--\n\nRemove all items, stats and slabs are kept."},
+    {"stats", (PyCFunction)BytesCache_stats, CtsArg_METH,
+     "stats(reset=False)\n--\n\nReturn a dict of hits, misses, evictions, "
+     "expirations and insertions, reset all of them at once if ``reset`` "
+     "is true."},
+    {NULL, NULL, 0, NULL} /* Sentinel */
+};
+
+PyDoc_STRVAR(BytesCache__doc__,
+             "BytesCache(capacity=None, max_bytes=None)\n"
+             "--\n\n"
+             "A LFU cache of bytes and str, stored off the Python heap.\n"
+             "\n"
+             "Keys and values are copied into chunks of 1MB slabs, an item\n"
+             "costs its payload, a header of 30 bytes and the rounding of\n"
+             "its chunk. The cache holds no Python object, so it is not\n"
+             "tracked by the cyclic garbage collector. ``get`` returns a\n"
+             "copy, ``view`` a zero copy memoryview.\n"
+             "\n"
+             "A str key is the same key as its UTF-8 encoded bytes, keys\n"
+             "are iterated as bytes. Values are returned as the type they\n"
+             "were set with, bytes for any other buffer.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "capacity : int, optional\n"
+             "  Max size of cache, default is C ``INT32_MAX``.\n"
+             "max_bytes : int, optional\n"
+             "  Max bytes of the chunks holding items, unbounded by\n"
+             "  default.\n"
+             "\n"
+             "Examples\n"
+             "--------\n"
+             ">>> import ctools\n"
+             ">>> cache = ctools.BytesCache(1)\n"
+             ">>> cache[b'foo'] = b'bar'\n"
+             ">>> bytes(cache.view(b'foo'))\n"
+             "b'bar'\n"
+             ">>> cache['bar'] = 'foo'\n"
+             ">>> b'foo' in cache\n"
+             "False\n");
+
+static PyTypeObject BytesCache_Type = {
+    /* clang-format off */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    /* clang-format on */
+    "ctools.BytesCache",                     /* tp_name */
+    sizeof(CtsBytesCache),                   /* tp_basicsize */
+    0,                                       /* tp_itemsize */
+    (destructor)BytesCache_tp_dealloc,       /* tp_dealloc */
+    0,                                       /* tp_print */
+    0,                                       /* tp_getattr */
+    0,                                       /* tp_setattr */
+    0,                                       /* tp_compare */
+    (reprfunc)BytesCache_repr,               /* tp_repr */
+    0,                                       /* tp_as_number */
+    &BytesCache_as_sequence,                 /* tp_as_sequence */
+    &BytesCache_as_mapping,                  /* tp_as_mapping */
+    PyObject_HashNotImplemented,             /* tp_hash */
+    0,                                       /* tp_call */
+    0,                                       /* tp_str */
+    0,                                       /* tp_getattro */
+    0,                                       /* tp_setattro */
+    0,                                       /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                      /* tp_flags */
+    BytesCache__doc__,                       /* tp_doc */
+    0,                                       /* tp_traverse */
+    0,                                       /* tp_clear */
+    0,                                       /* tp_richcompare */
+    0,                                       /* tp_weaklistoffset */
+    (getiterfunc)BytesCache_tp_iter,         /* tp_iter */
+    0,                                       /* tp_iternext */
+    BytesCache_methods,                      /* tp_methods */
+    0,                                       /* tp_members */
+    BytesCache_getset,                       /* tp_getset */
+    0,                                       /* tp_base */
+    0,                                       /* tp_dict */
+    0,                                       /* tp_descr_get */
+    0,                                       /* tp_descr_set */
+    0,                                       /* tp_dictoffset */
+    0,                                       /* tp_init */
+    0,                                       /* tp_alloc */
+    (newfunc)BytesCache_tp_new,              /* tp_new */
+};
+
+EXTERN_C_START
+int ctools_init_bytescache(PyObject *module) {
+  if (PyType_Ready(&BytesCache_Type) < 0 ||
+      PyType_Ready(&BytesCacheIter_Type) < 0 ||
+      PyType_Ready(&BytesCacheValue_Type) < 0) {
+    return -1;
+  }
+  Py_INCREF(&BytesCache_Type);
+  if (PyModule_AddObject(module, "BytesCache",
+                         PyObjectCast(&BytesCache_Type))) {
+    Py_DECREF(&BytesCache_Type);
+    return -1;
+  }
+  return 0;
+}
+EXTERN_C_END
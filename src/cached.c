@@ -0,0 +1,419 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "core.h"
+#include "module.h"
+
+#include <Python.h>
+#include <stddef.h>
+#include <structmember.h>
+
+#define Cached_DEFAULT_CAPACITY 128
+
+/* How the cache is accessed, CacheMap and TTLCache skip the KeyError of a
+ * miss. */
+#define Cached_MAPPING 0
+#define Cached_CACHEMAP 1
+#define Cached_TTLCACHE 2
+
+/* clang-format off */
+typedef struct {
+  PyObject_HEAD
+  PyObject *func;
+  PyObject *cache;
+  PyObject *dict; /* filled by functools.update_wrapper */
+#ifdef CTS_HAVE_VECTORCALL
+  vectorcallfunc vectorcall;
+#endif
+  char typed;
+  char kind;
+} CtsCached;
+/* clang-format on */
+
+/* Separates positional and keyword arguments in keys. */
+static PyObject *kwd_mark = NULL;
+static PyObject *default_cache_type = NULL;
+static PyObject *update_wrapper = NULL;
+
+/* Key of a call, `kwnames` name the arguments after the `nargs` positional
+ * ones. A lone str or int argument is the key itself, as functools does. */
+static PyObject *Cached_MakeKey(CtsCached *self, PyObject *const *args,
+                                Py_ssize_t nargs, PyObject *kwnames) {
+  Py_ssize_t nkw = kwnames ? PyTuple_GET_SIZE(kwnames) : 0, n = 0, i;
+  PyObject *key, *ob;
+  if (nkw == 0 && nargs == 1 && !self->typed &&
+      (PyUnicode_CheckExact(args[0]) || PyLong_CheckExact(args[0]))) {
+    Py_INCREF(args[0]);
+    return args[0];
+  }
+  key = PyTuple_New(nargs + (nkw ? 1 + 2 * nkw : 0) +
+                    (self->typed ? nargs + nkw : 0));
+  ReturnIfNULL(key, NULL);
+  for (i = 0; i < nargs; i++) {
+    Py_INCREF(args[i]);
+    PyTuple_SET_ITEM(key, n++, args[i]);
+  }
+  if (nkw) {
+    Py_INCREF(kwd_mark);
+    PyTuple_SET_ITEM(key, n++, kwd_mark);
+    for (i = 0; i < nkw; i++) {
+      ob = PyTuple_GET_ITEM(kwnames, i);
+      Py_INCREF(ob);
+      PyTuple_SET_ITEM(key, n++, ob);
+      Py_INCREF(args[nargs + i]);
+      PyTuple_SET_ITEM(key, n++, args[nargs + i]);
+    }
+  }
+  if (self->typed) {
+    for (i = 0; i < nargs + nkw; i++) {
+      ob = (PyObject *)Py_TYPE(args[i]);
+      Py_INCREF(ob);
+      PyTuple_SET_ITEM(key, n++, ob);
+    }
+  }
+  return key;
+}
+
+/* New reference, NULL on a miss or an error. */
+static PyObject *Cached_Lookup(CtsCached *self, PyObject *key) {
+  PyObject *value;
+  switch (self->kind) {
+  case Cached_CACHEMAP:
+    return CtsCacheMap_Lookup(self->cache, key);
+  case Cached_TTLCACHE:
+    return CtsTTLCache_Lookup(self->cache, key);
+  default:
+    value = PyObject_GetItem(self->cache, key);
+    if (value == NULL && PyErr_ExceptionMatches(PyExc_KeyError)) {
+      PyErr_Clear();
+    }
+    return value;
+  }
+}
+
+static int Cached_Store(CtsCached *self, PyObject *key, PyObject *value) {
+  switch (self->kind) {
+  case Cached_CACHEMAP:
+    return CtsCacheMap_Store(self->cache, key, value);
+  case Cached_TTLCACHE:
+    return CtsTTLCache_Store(self->cache, key, value);
+  default:
+    return PyObject_SetItem(self->cache, key, value);
+  }
+}
+
+/* Store a value just computed, steals a reference of `value`. */
+static PyObject *Cached_Fill(CtsCached *self, PyObject *key,
+                             PyObject *value) {
+  if (value && Cached_Store(self, key, value)) {
+    Py_CLEAR(value);
+  }
+  Py_DECREF(key);
+  return value;
+}
+
+#ifdef CTS_HAVE_VECTORCALL
+static PyObject *Cached_vectorcall(CtsCached *self, PyObject *const *args,
+                                   size_t nargsf, PyObject *kwnames) {
+  PyObject *key, *value;
+  key = Cached_MakeKey(self, args, PyVectorcall_NARGS(nargsf), kwnames);
+  ReturnIfNULL(key, NULL);
+  value = Cached_Lookup(self, key);
+  if (value || PyErr_Occurred()) {
+    Py_DECREF(key);
+    return value;
+  }
+  return Cached_Fill(self, key,
+                     PyObject_Vectorcall(self->func, args, nargsf, kwnames));
+}
+#else
+static PyObject *Cached_tp_call(CtsCached *self, PyObject *args,
+                                PyObject *kwargs) {
+  PyObject *key, *value, *kwnames = NULL, *name;
+  PyObject **stack = &PyTuple_GET_ITEM(args, 0);
+  Py_ssize_t nargs = PyTuple_GET_SIZE(args), nkw, pos = 0, i = 0;
+  nkw = kwargs ? PyDict_Size(kwargs) : 0;
+  if (nkw) {
+    /* lay keyword values after positional ones, as vectorcall does */
+    stack = PyMem_Malloc((nargs + nkw) * sizeof(PyObject *));
+    if (stack == NULL) {
+      return PyErr_NoMemory();
+    }
+    if ((kwnames = PyTuple_New(nkw)) == NULL) {
+      PyMem_Free(stack);
+      return NULL;
+    }
+    memcpy(stack, &PyTuple_GET_ITEM(args, 0), nargs * sizeof(PyObject *));
+    while (PyDict_Next(kwargs, &pos, &name, &value)) {
+      Py_INCREF(name);
+      PyTuple_SET_ITEM(kwnames, i, name);
+      stack[nargs + i++] = value;
+    }
+  }
+  key = Cached_MakeKey(self, stack, nargs, kwnames);
+  if (nkw) {
+    PyMem_Free(stack);
+    Py_DECREF(kwnames);
+  }
+  ReturnIfNULL(key, NULL);
+  value = Cached_Lookup(self, key);
+  if (value || PyErr_Occurred()) {
+    Py_DECREF(key);
+    return value;
+  }
+  return Cached_Fill(self, key, PyObject_Call(self->func, args, kwargs));
+}
+#endif
+
+static int Cached_tp_traverse(CtsCached *self, visitproc visit, void *arg) {
+  Py_VISIT(self->func);
+  Py_VISIT(self->cache);
+  Py_VISIT(self->dict);
+  return 0;
+}
+
+static int Cached_tp_clear(CtsCached *self) {
+  Py_CLEAR(self->func);
+  Py_CLEAR(self->cache);
+  Py_CLEAR(self->dict);
+  return 0;
+}
+
+static void Cached_tp_dealloc(CtsCached *self) {
+  PyObject_GC_UnTrack(self);
+  Cached_tp_clear(self);
+  PyObject_GC_Del(self);
+}
+
+static PyObject *Cached_repr(CtsCached *self) {
+  return PyUnicode_FromFormat("<ctools.cached %R>", self->func);
+}
+
+/* Bind to an instance like a function does. */
+static PyObject *Cached_descr_get(PyObject *self, PyObject *obj,
+                                  PyObject *Py_UNUSED(type)) {
+  if (obj == NULL || obj == Py_None) {
+    Py_INCREF(self);
+    return self;
+  }
+  return PyMethod_New(self, obj);
+}
+
+static PyMemberDef Cached_members[] = {
+    {"cache", T_OBJECT, offsetof(CtsCached, cache), READONLY,
+     "The cache of results."},
+    {NULL} /* Sentinel */
+};
+
+static PyGetSetDef Cached_getset[] = {
+    {"__dict__", PyObject_GenericGetDict, PyObject_GenericSetDict, NULL,
+     NULL},
+    {NULL, NULL, NULL, NULL, NULL} /* Sentinel */
+};
+
+static PyTypeObject Cached_Type = {
+    /* clang-format off */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    /* clang-format on */
+    "ctools.CachedFunction",                 /* tp_name */
+    sizeof(CtsCached),                       /* tp_basicsize */
+    0,                                       /* tp_itemsize */
+    (destructor)Cached_tp_dealloc,           /* tp_dealloc */
+#ifdef CTS_HAVE_VECTORCALL
+    offsetof(CtsCached, vectorcall),         /* tp_vectorcall_offset */
+#else
+    0,                                       /* tp_print */
+#endif
+    0,                                       /* tp_getattr */
+    0,                                       /* tp_setattr */
+    0,                                       /* tp_compare */
+    (reprfunc)Cached_repr,                   /* tp_repr */
+    0,                                       /* tp_as_number */
+    0,                                       /* tp_as_sequence */
+    0,                                       /* tp_as_mapping */
+    0,                                       /* tp_hash */
+#ifdef CTS_HAVE_VECTORCALL
+    PyVectorcall_Call,                       /* tp_call */
+#else
+    (ternaryfunc)Cached_tp_call,             /* tp_call */
+#endif
+    0,                                       /* tp_str */
+    0,                                       /* tp_getattro */
+    0,                                       /* tp_setattro */
+    0,                                       /* tp_as_buffer */
+#ifdef CTS_HAVE_VECTORCALL
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC |
+        Py_TPFLAGS_HAVE_VECTORCALL,          /* tp_flags */
+#else
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+#endif
+    NULL,                                    /* tp_doc */
+    (traverseproc)Cached_tp_traverse,        /* tp_traverse */
+    (inquiry)Cached_tp_clear,                /* tp_clear */
+    0,                                       /* tp_richcompare */
+    0,                                       /* tp_weaklistoffset */
+    0,                                       /* tp_iter */
+    0,                                       /* tp_iternext */
+    0,                                       /* tp_methods */
+    Cached_members,                          /* tp_members */
+    Cached_getset,                           /* tp_getset */
+    0,                                       /* tp_base */
+    0,                                       /* tp_dict */
+    Cached_descr_get,                        /* tp_descr_get */
+    0,                                       /* tp_descr_set */
+    offsetof(CtsCached, dict),               /* tp_dictoffset */
+    0,                                       /* tp_init */
+    0,                                       /* tp_alloc */
+    0,                                       /* tp_new */
+};
+
+/* Wrap `func`, a new CacheMap is used if `cache` is None. */
+static PyObject *Cached_Wrap(PyObject *func, PyObject *cache, int typed) {
+  CtsCached *self;
+  PyObject *rv;
+  if (!PyCallable_Check(func)) {
+    PyErr_SetString(PyExc_TypeError, "cached() expects a callable.");
+    return NULL;
+  }
+  self = PyObject_GC_New(CtsCached, &Cached_Type);
+  ReturnIfNULL(self, NULL);
+  self->dict = NULL;
+  self->typed = (char)typed;
+#ifdef CTS_HAVE_VECTORCALL
+  self->vectorcall = (vectorcallfunc)Cached_vectorcall;
+#endif
+  Py_INCREF(func);
+  self->func = func;
+  if (cache == Py_None) {
+    self->cache = PyObject_CallFunction(default_cache_type, "n",
+                                        (Py_ssize_t)Cached_DEFAULT_CAPACITY);
+  } else {
+    Py_INCREF(cache);
+    self->cache = cache;
+  }
+  PyObject_GC_Track(self);
+  if (self->cache == NULL) {
+    Py_DECREF(self);
+    return NULL;
+  }
+  if (CtsCacheMap_Check(self->cache)) {
+    self->kind = Cached_CACHEMAP;
+  } else if (CtsTTLCache_Check(self->cache)) {
+    self->kind = Cached_TTLCACHE;
+  } else {
+    self->kind = Cached_MAPPING;
+  }
+  rv = PyObject_CallFunctionObjArgs(update_wrapper, self, func, NULL);
+  if (rv == NULL) {
+    Py_DECREF(self);
+    return NULL;
+  }
+  Py_DECREF(rv);
+  return (PyObject *)self;
+}
+
+/* `self` is the (cache, typed) given to cached(). */
+static PyObject *Cached_decorate(PyObject *self, PyObject *func) {
+  return Cached_Wrap(func, PyTuple_GET_ITEM(self, 0),
+                     PyTuple_GET_ITEM(self, 1) == Py_True);
+}
+
+static PyMethodDef Cached_decorate_def = {
+    "decorate", (PyCFunction)Cached_decorate, METH_O, NULL};
+
+PyDoc_STRVAR(
+    cached__doc__,
+    "cached(cache=None, typed=False)\n"
+    "--\n\n"
+    "Decorator caching results of a function by its arguments.\n"
+    "\n"
+    "Parameters\n"
+    "----------\n"
+    "cache : CacheMap or TTLCache or typing.MutableMapping, optional\n"
+    "  Where results are kept, a new ``CacheMap(128)`` for each decorated\n"
+    "  function by default. Hits of a CacheMap or TTLCache do not raise\n"
+    "  and catch KeyError internally.\n"
+    "typed : bool, optional\n"
+    "  Cache arguments of different types separately, e.g. ``1`` and\n"
+    "  ``1.0``.\n"
+    "\n"
+    "Examples\n"
+    "--------\n"
+    ">>> import ctools\n"
+    ">>> @ctools.cached(ctools.TTLCache(60))\n"
+    "... def square(x):\n"
+    "...     return x * x\n"
+    ">>> square(3)\n"
+    "9\n"
+    ">>> square.cache[3]\n"
+    "9\n");
+
+static PyObject *Cached_cached(PyObject *Py_UNUSED(module), PyObject *args,
+                               PyObject *kwds) {
+  PyObject *cache = Py_None, *state, *rv;
+  int typed = 0;
+  static char *kwlist[] = {"cache", "typed", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Op", kwlist, &cache,
+                                   &typed)) {
+    return NULL;
+  }
+  /* used as @cached without arguments */
+  if (PyCallable_Check(cache) && !PyType_Check(cache)) {
+    return Cached_Wrap(cache, Py_None, typed);
+  }
+  state = Py_BuildValue("(OO)", cache, typed ? Py_True : Py_False);
+  ReturnIfNULL(state, NULL);
+  rv = PyCFunction_New(&Cached_decorate_def, state);
+  Py_DECREF(state);
+  return rv;
+}
+
+static PyMethodDef Cached_functions[] = {
+    {"cached", (PyCFunction)Cached_cached, METH_VARARGS | METH_KEYWORDS,
+     cached__doc__},
+    {NULL, NULL, 0, NULL},
+};
+
+EXTERN_C_START
+int ctools_init_cached(PyObject *module) {
+  PyObject *functools;
+  if (PyType_Ready(&Cached_Type) < 0) {
+    return -1;
+  }
+  if (kwd_mark == NULL &&
+      (kwd_mark = PyObject_CallObject((PyObject *)&PyBaseObject_Type,
+                                      NULL)) == NULL) {
+    return -1;
+  }
+  if (update_wrapper == NULL) {
+    functools = PyImport_ImportModule("functools");
+    ReturnIfNULL(functools, -1);
+    update_wrapper = PyObject_GetAttrString(functools, "update_wrapper");
+    Py_DECREF(functools);
+    ReturnIfNULL(update_wrapper, -1);
+  }
+  Py_XDECREF(default_cache_type);
+  default_cache_type = PyObject_GetAttrString(module, "CacheMap");
+  ReturnIfNULL(default_cache_type, -1);
+  Py_INCREF(&Cached_Type);
+  if (PyModule_AddObject(module, "CachedFunction",
+                         PyObjectCast(&Cached_Type))) {
+    Py_DECREF(&Cached_Type);
+    return -1;
+  }
+  return PyModule_AddFunctions(module, Cached_functions);
+}
+EXTERN_C_END
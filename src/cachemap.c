@@ -14,41 +14,94 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include "args.h"
+#include "batch.h"
 #include "core.h"
+#include "disktier.h"
+#include "evict.h"
+#include "freelist.h"
+#include "pressure.h"
 #include "pydoc.h"
+#include "singleflight.h"
+#include "snapshot.h"
+#include "stats.h"
 
 #include <Python.h>
-#include <time.h>
+#include <string.h>
 
-#define CacheEntry_DEFAULT_VISITS 255U
-#define CacheEntry_DECREASE_EVERY_MINUTES 10
+/* Visits of a new entry, so it is not the next victim of LFU at once. */
+#define CacheEntry_INIT_VISITS 5U
+/* LFU halves all visit counters after this many operations per entry. */
+#define CacheMap_AGING_FACTOR 16
 
 #define CacheMap_BUCKET_NUM 8
 #define CacheMap_BUCKET_SIZE 256
 
-static inline unsigned int time_in_minutes(void) {
-  return (unsigned int)(((uint64_t)time(NULL) / 60) & UINT32_MAX);
-}
-
-typedef struct {
+/* Eviction policies, index of CacheMap_POLICY_NAMES */
+#define CacheMap_POLICY_LFU 0
+#define CacheMap_POLICY_WTINYLFU 1
+#define CacheMap_POLICY_LRU 2
+#define CacheMap_POLICY_ARC 3
+#define CacheMap_POLICY_S3FIFO 4
+#define CacheMap_POLICY_CLOCK 5
+#define CacheMap_NUM_POLICIES 6
+
+/* Where an entry is linked. Regions 1 to CacheMap_NUM_LISTS are lists of
+ * CacheMap, each policy gives them its own meaning. */
+#define CacheMap_NUM_LISTS 4
+#define CacheMap_REGION_NONE 0
+#define CacheMap_REGION_SAMPLED 5 /* LFU: in the sample array */
+/* W-TinyLFU */
+#define CacheMap_REGION_WINDOW 1
+#define CacheMap_REGION_PROBATION 2
+#define CacheMap_REGION_PROTECTED 3
+/* LRU and CLOCK */
+#define CacheMap_REGION_QUEUE 1
+/* ARC, B1 and B2 hold ghosts of keys evicted from T1 and T2 */
+#define CacheMap_REGION_T1 1
+#define CacheMap_REGION_T2 2
+#define CacheMap_REGION_B1 3
+#define CacheMap_REGION_B2 4
+/* S3-FIFO */
+#define CacheMap_REGION_SMALL 1
+#define CacheMap_REGION_MAIN 2
+#define CacheMap_REGION_GHOST 3
+
+typedef struct _cts_cachemap_entry {
   /* clang-format off */
   PyObject_HEAD
   PyObject *ma_value;
   /* clang-format on */
-  uint32_t last_visit;
   uint32_t visits;
+  PyObject *key; /* borrowed, the dict of CacheMap owns it */
+  Py_hash_t hash;
+  struct _cts_cachemap_entry *prev;
+  struct _cts_cachemap_entry *next;
+  Py_ssize_t index;  /* LFU: position in the sample array */
+  Py_ssize_t weight; /* counted against max_bytes of CacheMap */
+  char region;
 } CtsCacheMapEntry;
 
 static PyTypeObject CacheEntry_Type;
 
+/* Entries of evicted and deleted keys, reused by new ones. */
+static CtsFreeList CacheEntry_freelist = {NULL, 0, 0, 0};
+
 static CtsCacheMapEntry *CacheEntry_New(PyObject *ma_value) {
   CtsCacheMapEntry *self;
   assert(ma_value);
-  self =
-      (CtsCacheMapEntry *)PyObject_GC_New(CtsCacheMapEntry, &CacheEntry_Type);
+  self = (CtsCacheMapEntry *)CtsFreeList_Alloc(&CacheEntry_freelist,
+                                               &CacheEntry_Type);
   ReturnIfNULL(self, NULL);
   self->ma_value = ma_value;
   Py_INCREF(ma_value);
+  self->key = NULL;
+  self->hash = 0;
+  self->prev = NULL;
+  self->next = NULL;
+  self->index = -1;
+  self->weight = 0;
+  self->region = CacheMap_REGION_NONE;
   PyObject_GC_Track(self);
   return self;
 }
@@ -63,11 +116,7 @@ static PyObject *CacheEntry_new(PyTypeObject *Py_UNUSED(type), PyObject *args,
   return (PyObject *)CacheEntry_New(ma_value);
 }
 
-#define CacheEntry_Init(self)                                                  \
-  do {                                                                         \
-    (self)->last_visit = time_in_minutes();                                    \
-    (self)->visits = CacheEntry_DEFAULT_VISITS;                                \
-  } while (0)
+#define CacheEntry_Init(self) ((self)->visits = CacheEntry_INIT_VISITS)
 
 static int CacheEntry_init(CtsCacheMapEntry *self, PyObject *Py_UNUSED(unused1),
                            PyObject *Py_UNUSED(unused2)) {
@@ -89,13 +138,14 @@ static int CacheEntry_tp_clear(CtsCacheMapEntry *self) {
 static void CacheEntry_tp_dealloc(CtsCacheMapEntry *self) {
   PyObject_GC_UnTrack(self);
   CacheEntry_tp_clear(self);
-  PyObject_GC_Del(self);
+  CtsFreeList_Free(&CacheEntry_freelist, (PyObject *)self);
 }
 
 #define CacheEntry_NewVisit(self)                                              \
   do {                                                                         \
-    self->visits++;                                                            \
-    self->last_visit = time_in_minutes();                                      \
+    if ((self)->visits < UINT32_MAX) {                                         \
+      (self)->visits++;                                                        \
+    }                                                                          \
   } while (0)
 
 static PyObject *CacheEntry_get_ma_value(CtsCacheMapEntry *self) {
@@ -105,16 +155,8 @@ static PyObject *CacheEntry_get_ma_value(CtsCacheMapEntry *self) {
   return ma_value;
 }
 
-static inline unsigned int CacheEntry_GetWeight(CtsCacheMapEntry *self,
-                                                unsigned int now) {
-  register unsigned int num, counter;
-  counter = self->visits;
-  num = (now - self->last_visit) / CacheEntry_DECREASE_EVERY_MINUTES;
-  return counter > num ? counter - num : 0;
-}
-
 static PyObject *CacheEntry_get_weight(CtsCacheMapEntry *self) {
-  return Py_BuildValue("I", CacheEntry_GetWeight(self, time_in_minutes()));
+  return Py_BuildValue("I", self->visits);
 }
 
 static PyMethodDef CacheEntry_methods[] = {
@@ -171,32 +213,181 @@ static PyTypeObject CacheEntry_Type = {
 };
 /* CtsCacheMapEntry Type Define */
 
+/* Doubly linked list of entries, ordered from least to most recently used.
+ * Links are borrowed, an entry is kept alive by the dict of CacheMap. */
+typedef struct {
+  CtsCacheMapEntry *head;
+  CtsCacheMapEntry *tail;
+  Py_ssize_t size;
+} CtsCacheMapList;
+
+static void CacheList_Append(CtsCacheMapList *list, CtsCacheMapEntry *entry) {
+  entry->prev = list->tail;
+  entry->next = NULL;
+  if (list->tail) {
+    list->tail->next = entry;
+  } else {
+    list->head = entry;
+  }
+  list->tail = entry;
+  list->size++;
+}
+
+static void CacheList_Remove(CtsCacheMapList *list, CtsCacheMapEntry *entry) {
+  if (entry->prev) {
+    entry->prev->next = entry->next;
+  } else {
+    list->head = entry->next;
+  }
+  if (entry->next) {
+    entry->next->prev = entry->prev;
+  } else {
+    list->tail = entry->prev;
+  }
+  entry->prev = NULL;
+  entry->next = NULL;
+  list->size--;
+}
+
+#define CacheList_Init(list)                                                   \
+  do {                                                                         \
+    (list)->head = NULL;                                                       \
+    (list)->tail = NULL;                                                       \
+    (list)->size = 0;                                                          \
+  } while (0)
+
+/* Count-min sketch estimating how often a key was seen recently.
+ * Counters saturate at 15 and are all halved once `additions` reaches ten
+ * times the width, so the estimate favours recent popularity. */
+#define Sketch_DEPTH 4
+#define Sketch_MAX_COUNT 15
+#define Sketch_MIN_WIDTH 256
+#define Sketch_MAX_WIDTH ((size_t)1 << 24)
+
+typedef struct {
+  uint8_t *table; /* Sketch_DEPTH rows of `width` counters */
+  size_t width;   /* always a power of 2 */
+  size_t additions;
+} CtsFrequencySketch;
+
+/* Make the sketch able to count about `size` distinct keys.
+ * Counters are reset when the table grows. */
+static int Sketch_Ensure(CtsFrequencySketch *sketch, Py_ssize_t size) {
+  size_t width = Sketch_MIN_WIDTH;
+  uint8_t *table;
+  while (width < (size_t)size && width < Sketch_MAX_WIDTH) {
+    width <<= 1;
+  }
+  if (width <= sketch->width) {
+    return 0;
+  }
+  table = PyMem_Calloc(Sketch_DEPTH, width);
+  if (table == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  PyMem_Free(sketch->table);
+  sketch->table = table;
+  sketch->width = width;
+  sketch->additions = 0;
+  return 0;
+}
+
+/* Index of `hash` in row `i`, double hashing over a mixed hash. */
+static inline size_t Sketch_Index(CtsFrequencySketch *sketch, Py_hash_t hash,
+                                  int i) {
+  uint64_t h = (uint64_t)hash;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return (size_t)(i * sketch->width +
+                  (((h & UINT32_MAX) + i * ((h >> 32) | 1)) &
+                   (sketch->width - 1)));
+}
+
+static void Sketch_Increment(CtsFrequencySketch *sketch, Py_hash_t hash) {
+  size_t idx;
+  if (sketch->table == NULL) {
+    return;
+  }
+  for (int i = 0; i < Sketch_DEPTH; i++) {
+    idx = Sketch_Index(sketch, hash, i);
+    if (sketch->table[idx] < Sketch_MAX_COUNT) {
+      sketch->table[idx]++;
+    }
+  }
+  if (++sketch->additions >= 10 * sketch->width) {
+    for (size_t i = 0; i < Sketch_DEPTH * sketch->width; i++) {
+      sketch->table[i] >>= 1;
+    }
+    sketch->additions /= 2;
+  }
+}
+
+static unsigned int Sketch_Estimate(CtsFrequencySketch *sketch,
+                                    Py_hash_t hash) {
+  unsigned int min = Sketch_MAX_COUNT, count;
+  if (sketch->table == NULL) {
+    return 0;
+  }
+  for (int i = 0; i < Sketch_DEPTH; i++) {
+    count = sketch->table[Sketch_Index(sketch, hash, i)];
+    if (count < min) {
+      min = count;
+    }
+  }
+  return min;
+}
+
 typedef struct {
   /* clang-format off */
   PyObject_HEAD
   PyObject *dict;
   /* clang-format on */
-  Py_ssize_t capacity;
-  Py_ssize_t hits;
-  Py_ssize_t misses;
+  Py_ssize_t capacity;     /* lowered from max_capacity under memory pressure */
+  Py_ssize_t max_capacity; /* capacity set by the user */
+  CtsCacheStats stats;
+  Py_ssize_t max_bytes; /* PY_SSIZE_T_MAX if unbounded */
+  Py_ssize_t weight;    /* sum of weight of entries */
+  PyObject *sizeof_fn;  /* weighs values, use __sizeof__ if NULL */
+  PyObject *on_evict;
+  PyObject *evicted; /* batch of evicted entries waiting for on_evict */
+  PyObject *inflight; /* setnx(singleflight=True): key -> load in progress */
+  char policy;
+  char deferred; /* set_many: evict once after the whole batch */
+  CtsCacheMapList lists[CacheMap_NUM_LISTS]; /* indexed by region - 1 */
+  /* ARC and S3-FIFO remember recently evicted keys, key -> ghost entry */
+  PyObject *ghosts;
+  /* LFU samples victims from a dense array of its entries */
+  CtsCacheMapEntry **slots;
+  Py_ssize_t nslots;
+  Py_ssize_t slots_allocated;
+  Py_ssize_t ops; /* LFU: operations since counters were halved */
+  /* W-TinyLFU: new keys enter a small LRU window, keys leaving the window
+   * compete with the probation victim of the segmented LRU main region. */
+  Py_ssize_t window_capacity;
+  Py_ssize_t protected_capacity;
+  CtsFrequencySketch sketch;
+  Py_ssize_t arc_p;          /* ARC: adaptive target size of T1 */
+  Py_ssize_t small_capacity; /* S3-FIFO: size of the small queue */
+  CtsDiskTier disk;          /* evicted items kept on local disk */
+  CtsPressure pressure;
 } CtsCacheMap;
 
+static const char *CacheMap_POLICY_NAMES[] = {"lfu", "wtinylfu", "lru",
+                                              "arc", "s3fifo",   "clock"};
+
 #define CacheMap_Size(self) (PyDict_Size(((CtsCacheMap *)(self))->dict))
 
+#define CacheMap_List(self, region) (&(self)->lists[(region)-1])
+
 static Py_ssize_t CacheMap_size(CtsCacheMap *self) {
   return CacheMap_Size(self);
 }
 
-/* return a random number between 0 and limit inclusive. */
-static int rand_integer(int limit) {
-  int divisor = RAND_MAX / (limit + 1);
-  int rv;
-
-  do {
-    rv = rand() / divisor;
-  } while (rv > limit);
-
-  return rv;
+/* return a random number between 0 and limit exclusive. */
+static inline Py_ssize_t rand_index(Py_ssize_t limit) {
+  return (Py_ssize_t)((double)rand() / ((double)RAND_MAX + 1) * limit);
 }
 
 static int CacheMap_Contains(PyObject *self, PyObject *key) {
@@ -221,108 +412,803 @@ static PySequenceMethods CacheMap_as_sequence = {
   ((CtsCacheMapEntry *)PyDict_GetItemWithError(((CtsCacheMap *)self)->dict,    \
                                                (PyObject *)(key)))
 
-/* New Reference */
-static PyObject *CacheMap_NextEvictKey(CtsCacheMap *self) {
-  PyObject *key = NULL, *wrapper = NULL;
-  Py_ssize_t pos = 0;
-  uint32_t min = 0, weight;
-  PyObject *rv = NULL;
-  uint32_t now = time_in_minutes();
-  Py_ssize_t dict_len = CacheMap_Size(self);
+static void CacheMap_Unlink(CtsCacheMap *self, CtsCacheMapEntry *entry) {
+  CtsCacheMapEntry *last;
+  if (entry->region == CacheMap_REGION_SAMPLED) {
+    last = self->slots[--self->nslots];
+    self->slots[entry->index] = last;
+    last->index = entry->index;
+  } else if (entry->region != CacheMap_REGION_NONE) {
+    CacheList_Remove(CacheMap_List(self, entry->region), entry);
+  }
+  entry->region = CacheMap_REGION_NONE;
+}
 
-  if (dict_len == 0) {
-    PyErr_SetString(PyExc_KeyError, "CacheMap is empty.");
+/* Move an entry to the most recently used end of region `r`. */
+static void CacheMap_MoveTo(CtsCacheMap *self, CtsCacheMapEntry *entry,
+                            char r) {
+  CacheMap_Unlink(self, entry);
+  CacheList_Append(CacheMap_List(self, r), entry);
+  entry->region = r;
+}
+
+/* Make room for one more entry in the sample array of LFU. */
+static int CacheMap_ReserveSlot(CtsCacheMap *self) {
+  Py_ssize_t allocated;
+  CtsCacheMapEntry **slots;
+  if (self->nslots < self->slots_allocated) {
+    return 0;
+  }
+  allocated = self->slots_allocated ? self->slots_allocated * 2 : 16;
+  slots = PyMem_Realloc(self->slots, allocated * sizeof(CtsCacheMapEntry *));
+  if (slots == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  self->slots = slots;
+  self->slots_allocated = allocated;
+  return 0;
+}
+
+/* Unlink an entry from the policy and remove it from the dict. */
+static int CacheMap_DelEntry(CtsCacheMap *self, CtsCacheMapEntry *entry) {
+  PyObject *key = entry->key;
+  int rv;
+  CacheMap_Unlink(self, entry);
+  self->weight -= entry->weight;
+  entry->weight = 0;
+  Py_INCREF(key);
+  rv = PyDict_DelItem(self->dict, key);
+  Py_DECREF(key);
+  return rv;
+}
+
+/* Count an entry about to be evicted and queue it for on_evict. */
+static int CacheMap_Evicted(CtsCacheMap *self, CtsCacheMapEntry *entry) {
+  self->stats.evictions++;
+  if (CtsDisk_Enabled(&self->disk) &&
+      CtsDisk_Put(&self->disk, entry->key, entry->ma_value)) {
+    return -1;
+  }
+  if (self->on_evict == NULL) {
+    return 0;
+  }
+  return CtsEvict_Push(&self->evicted, entry->key, entry->ma_value,
+                       CtsEvict_EVICTED);
+}
+
+/* Write evicted items to disk, then deliver them to on_evict. */
+#define CacheMap_Flush(self)                                                   \
+  (CtsDisk_Flush(&(self)->disk) ||                                             \
+   CtsEvict_Flush(&(self)->evicted, (self)->on_evict))
+
+/* Remember an evicted key in ghost region `r`. */
+static int CacheMap_AddGhost(CtsCacheMap *self, PyObject *key, char r) {
+  CtsCacheMapEntry *ghost;
+  if (self->ghosts == NULL && (self->ghosts = PyDict_New()) == NULL) {
+    return -1;
+  }
+  ghost = CacheEntry_New(Py_None);
+  ReturnIfNULL(ghost, -1);
+  ghost->key = key;
+  if (PyDict_SetItem(self->ghosts, key, (PyObject *)ghost)) {
+    Py_DECREF(ghost);
+    return -1;
+  }
+  Py_DECREF(ghost);
+  CacheList_Append(CacheMap_List(self, r), ghost);
+  ghost->region = r;
+  return 0;
+}
+
+static int CacheMap_DelGhost(CtsCacheMap *self, CtsCacheMapEntry *ghost) {
+  PyObject *key = ghost->key;
+  int rv;
+  CacheMap_Unlink(self, ghost);
+  Py_INCREF(key);
+  rv = PyDict_DelItem(self->ghosts, key);
+  Py_DECREF(key);
+  return rv;
+}
+
+/* Borrowed reference, the ghost entry of `key` or NULL. */
+static CtsCacheMapEntry *CacheMap_FindGhost(CtsCacheMap *self, PyObject *key) {
+  if (self->ghosts == NULL) {
     return NULL;
-  } else if (dict_len < CacheMap_BUCKET_SIZE) {
-    while (PyDict_Next(self->dict, &pos, &key, &wrapper)) {
-      weight = CacheEntry_GetWeight((CtsCacheMapEntry *)wrapper, now);
-      if (min == 0 || weight < min) {
-        min = weight;
-        rv = key;
+  }
+  return (CtsCacheMapEntry *)PyDict_GetItemWithError(self->ghosts, key);
+}
+
+/* Keep the ghost lists bounded by the capacity. */
+static int CacheMap_TrimGhosts(CtsCacheMap *self) {
+  CtsCacheMapList *t1, *b1, *b2, *ghost;
+  Py_ssize_t c = self->capacity;
+  if (self->policy == CacheMap_POLICY_ARC) {
+    t1 = CacheMap_List(self, CacheMap_REGION_T1);
+    b1 = CacheMap_List(self, CacheMap_REGION_B1);
+    b2 = CacheMap_List(self, CacheMap_REGION_B2);
+    while (b1->head && t1->size + b1->size > c) {
+      if (CacheMap_DelGhost(self, b1->head)) {
+        return -1;
       }
     }
-  } else {
-    PyObject *keylist = PyDict_Keys(self->dict);
-    ReturnIfNULL(keylist, NULL);
-    Py_ssize_t b_size = dict_len / CacheMap_BUCKET_NUM;
-    for (int i = 0; i < CacheMap_BUCKET_NUM - 1; i++) {
-      pos = i * b_size + rand_integer(b_size);
-      /* fast get list item, borrowed reference */
-      key = PyList_GET_ITEM(keylist, pos);
-      wrapper = PyDict_GetItem(self->dict, key);
-      weight = CacheEntry_GetWeight((CtsCacheMapEntry *)wrapper, now);
-      if (min == 0 || weight < min) {
-        min = weight;
-        rv = key;
+    while (b2->head && CacheMap_Size(self) + b1->size + b2->size > 2 * c) {
+      if (CacheMap_DelGhost(self, b2->head)) {
+        return -1;
       }
     }
-    if ((dict_len % CacheMap_BUCKET_NUM)) {
-      pos = CacheMap_BUCKET_NUM * b_size +
-            (dict_len - CacheMap_BUCKET_NUM * b_size) / 2;
-      wrapper = PyDict_GetItem(self->dict, PyList_GET_ITEM(keylist, pos));
-      weight = CacheEntry_GetWeight((CtsCacheMapEntry *)wrapper, now);
-      if (min == 0 || weight < min) {
-        rv = key;
+  } else if (self->policy == CacheMap_POLICY_S3FIFO) {
+    ghost = CacheMap_List(self, CacheMap_REGION_GHOST);
+    while (ghost->head && ghost->size > c - self->small_capacity) {
+      if (CacheMap_DelGhost(self, ghost->head)) {
+        return -1;
       }
     }
-    Py_DECREF(keylist);
   }
-  assert(rv);
-  Py_INCREF(rv);
+  return 0;
+}
+
+/* Sampled LFU: the least weighted of a few entries picked from evenly sized
+ * buckets of the sample array, small caches are scanned in full. */
+static CtsCacheMapEntry *LFU_Victim(CtsCacheMap *self) {
+  CtsCacheMapEntry *rv = NULL, *entry;
+  uint32_t min = 0;
+  Py_ssize_t n = self->nslots, bucket, i;
+  int sampled = n > CacheMap_BUCKET_SIZE;
+
+  bucket = n / CacheMap_BUCKET_NUM;
+  for (i = 0; i < (sampled ? CacheMap_BUCKET_NUM : n); i++) {
+    entry = self->slots[sampled ? i * bucket + rand_index(bucket) : i];
+    if (rv == NULL || entry->visits < min) {
+      min = entry->visits;
+      rv = entry;
+    }
+  }
   return rv;
 }
 
-/* Always return Py_None */
-static PyObject *CacheMap_evict(CtsCacheMap *self) {
-  PyObject *k = CacheMap_NextEvictKey(self);
-  if (!k) {
-    PyErr_Clear();
-    Py_RETURN_NONE;
+/* Count an operation of LFU. Halving all counters once in a while lets old
+ * popularity fade, driven by this logical clock instead of the wall clock.
+ * The period grows with the cache, so the cost is O(1) amortized. */
+static void LFU_Tick(CtsCacheMap *self) {
+  Py_ssize_t n = self->nslots;
+  if (++self->ops < CacheMap_AGING_FACTOR *
+                        (n > CacheMap_BUCKET_NUM ? n : CacheMap_BUCKET_NUM)) {
+    return;
   }
-  if (PyDict_DelItem(self->dict, k)) {
+  for (Py_ssize_t i = 0; i < n; i++) {
+    self->slots[i]->visits >>= 1;
+  }
+  self->ops = 0;
+}
+
+/* The entry W-TinyLFU would evict next. */
+static CtsCacheMapEntry *TinyLFU_Victim(CtsCacheMap *self) {
+  for (char r = CacheMap_REGION_PROBATION; r <= CacheMap_REGION_PROTECTED;
+       r++) {
+    if (CacheMap_List(self, r)->head) {
+      return CacheMap_List(self, r)->head;
+    }
+  }
+  return CacheMap_List(self, CacheMap_REGION_WINDOW)->head;
+}
+
+/* Move keys overflowing the window into the main region, admitting each only
+ * if the sketch says it is more popular than the victim it would replace. */
+static int TinyLFU_Maintain(CtsCacheMap *self) {
+  CtsCacheMapList *window = CacheMap_List(self, CacheMap_REGION_WINDOW);
+  CtsCacheMapList *probation = CacheMap_List(self, CacheMap_REGION_PROBATION);
+  CtsCacheMapList *protected = CacheMap_List(self, CacheMap_REGION_PROTECTED);
+  CtsCacheMapEntry *candidate, *victim;
+  Py_ssize_t main_capacity = self->capacity - self->window_capacity;
+
+  while (window->size > self->window_capacity) {
+    candidate = window->head;
+    if (probation->size + protected->size < main_capacity) {
+      CacheMap_MoveTo(self, candidate, CacheMap_REGION_PROBATION);
+      continue;
+    }
+    victim = probation->head ? probation->head : protected->head;
+    if (victim && Sketch_Estimate(&self->sketch, candidate->hash) >
+                      Sketch_Estimate(&self->sketch, victim->hash)) {
+      CacheMap_MoveTo(self, candidate, CacheMap_REGION_PROBATION);
+      candidate = victim;
+    }
+    if (CacheMap_Evicted(self, candidate) ||
+        CacheMap_DelEntry(self, candidate)) {
+      return -1;
+    }
+  }
+  while (probation->size + protected->size > main_capacity) {
+    victim = probation->head ? probation->head : protected->head;
+    if (CacheMap_Evicted(self, victim) || CacheMap_DelEntry(self, victim)) {
+      return -1;
+    }
+  }
+  while (protected->size > self->protected_capacity) {
+    CacheMap_MoveTo(self, protected->head, CacheMap_REGION_PROBATION);
+  }
+  return 0;
+}
+
+/* Record a hit of an entry. */
+static void TinyLFU_Touch(CtsCacheMap *self, CtsCacheMapEntry *entry) {
+  CtsCacheMapList *protected = CacheMap_List(self, CacheMap_REGION_PROTECTED);
+  Sketch_Increment(&self->sketch, entry->hash);
+  switch (entry->region) {
+  case CacheMap_REGION_WINDOW:
+    CacheMap_MoveTo(self, entry, CacheMap_REGION_WINDOW);
+    break;
+  case CacheMap_REGION_PROBATION:
+  case CacheMap_REGION_PROTECTED:
+    CacheMap_MoveTo(self, entry, CacheMap_REGION_PROTECTED);
+    if (protected->size > self->protected_capacity) {
+      CacheMap_MoveTo(self, protected->head, CacheMap_REGION_PROBATION);
+    }
+    break;
+  }
+}
+
+/* Link a new entry, which is already in the dict. */
+static int TinyLFU_Admit(CtsCacheMap *self, CtsCacheMapEntry *entry) {
+  Py_ssize_t size = CacheMap_Size(self);
+  entry->hash = PyObject_Hash(entry->key);
+  if (Sketch_Ensure(&self->sketch,
+                    size < self->capacity ? size : self->capacity)) {
+    return -1;
+  }
+  Sketch_Increment(&self->sketch, entry->hash);
+  CacheMap_MoveTo(self, entry, CacheMap_REGION_WINDOW);
+  return TinyLFU_Maintain(self);
+}
+
+/* REPLACE of ARC, evict from T1 while it is larger than its target. */
+static CtsCacheMapEntry *ARC_Victim(CtsCacheMap *self, int in_b2) {
+  CtsCacheMapList *t1 = CacheMap_List(self, CacheMap_REGION_T1);
+  CtsCacheMapList *t2 = CacheMap_List(self, CacheMap_REGION_T2);
+  if (t1->head && (t1->size > self->arc_p ||
+                   (in_b2 && t1->size == self->arc_p) || !t2->head)) {
+    return t1->head;
+  }
+  return t2->head;
+}
+
+/* Second chance FIFO: entries hit since they entered a queue are moved on
+ * instead of being evicted. */
+static CtsCacheMapEntry *S3FIFO_Victim(CtsCacheMap *self) {
+  CtsCacheMapList *small = CacheMap_List(self, CacheMap_REGION_SMALL);
+  CtsCacheMapList *main = CacheMap_List(self, CacheMap_REGION_MAIN);
+  CtsCacheMapEntry *entry;
+  for (;;) {
+    if (small->head && (small->size >= self->small_capacity || !main->head)) {
+      entry = small->head;
+      if (!entry->visits) {
+        return entry;
+      }
+      entry->visits = 0;
+    } else if ((entry = main->head) != NULL) {
+      if (!entry->visits) {
+        return entry;
+      }
+      entry->visits--;
+    } else {
+      return NULL;
+    }
+    CacheMap_MoveTo(self, entry, CacheMap_REGION_MAIN);
+  }
+}
+
+static CtsCacheMapEntry *Clock_Victim(CtsCacheMap *self) {
+  CtsCacheMapList *queue = CacheMap_List(self, CacheMap_REGION_QUEUE);
+  CtsCacheMapEntry *entry;
+  while ((entry = queue->head) != NULL && entry->visits) {
+    entry->visits = 0;
+    CacheMap_MoveTo(self, entry, CacheMap_REGION_QUEUE);
+  }
+  return entry;
+}
+
+/* Borrowed reference, the entry to evict next, NULL if cache is empty. */
+static CtsCacheMapEntry *CacheMap_Victim(CtsCacheMap *self) {
+  switch (self->policy) {
+  case CacheMap_POLICY_WTINYLFU:
+    return TinyLFU_Victim(self);
+  case CacheMap_POLICY_LRU:
+    return CacheMap_List(self, CacheMap_REGION_QUEUE)->head;
+  case CacheMap_POLICY_ARC:
+    return ARC_Victim(self, 0);
+  case CacheMap_POLICY_S3FIFO:
+    return S3FIFO_Victim(self);
+  case CacheMap_POLICY_CLOCK:
+    return Clock_Victim(self);
+  default:
+    return LFU_Victim(self);
+  }
+}
+
+/* Evict an entry, leaving a ghost behind if the policy keeps history. */
+static int CacheMap_EvictEntry(CtsCacheMap *self, CtsCacheMapEntry *entry) {
+  char ghost = CacheMap_REGION_NONE;
+  if (self->policy == CacheMap_POLICY_ARC) {
+    ghost = entry->region == CacheMap_REGION_T1 ? CacheMap_REGION_B1
+                                                : CacheMap_REGION_B2;
+  } else if (self->policy == CacheMap_POLICY_S3FIFO &&
+             entry->region == CacheMap_REGION_SMALL) {
+    ghost = CacheMap_REGION_GHOST;
+  }
+  if (ghost != CacheMap_REGION_NONE &&
+      CacheMap_AddGhost(self, entry->key, ghost)) {
+    return -1;
+  }
+  if (CacheMap_Evicted(self, entry) || CacheMap_DelEntry(self, entry)) {
+    return -1;
+  }
+  return CacheMap_TrimGhosts(self);
+}
+
+/* The k-th smallest of n visit counts, reordering `a`. */
+static uint32_t LFU_NthVisits(uint32_t *a, Py_ssize_t n, Py_ssize_t k) {
+  Py_ssize_t lo = 0, hi = n - 1, i, j;
+  uint32_t pivot, tmp;
+  while (lo < hi) {
+    pivot = a[lo + (hi - lo) / 2];
+    i = lo;
+    j = hi;
+    while (i <= j) {
+      while (a[i] < pivot) {
+        i++;
+      }
+      while (a[j] > pivot) {
+        j--;
+      }
+      if (i <= j) {
+        tmp = a[i];
+        a[i++] = a[j];
+        a[j--] = tmp;
+      }
+    }
+    if (k <= j) {
+      hi = j;
+    } else if (k >= i) {
+      lo = i;
+    } else {
+      break;
+    }
+  }
+  return a[k];
+}
+
+/* Evict the n least visited entries of LFU, selected exactly in one pass
+ * over the slots instead of sampling once for every victim. */
+static int LFU_EvictN(CtsCacheMap *self, Py_ssize_t n) {
+  Py_ssize_t size = self->nslots, ties = 0, i;
+  CtsCacheMapEntry *entry;
+  uint32_t *visits, max;
+  if (n <= 0 || size == 0) {
+    return 0;
+  }
+  if (n < size) {
+    visits = PyMem_New(uint32_t, size);
+    if (visits == NULL) {
+      PyErr_NoMemory();
+      return -1;
+    }
+    for (i = 0; i < size; i++) {
+      visits[i] = self->slots[i]->visits;
+    }
+    max = LFU_NthVisits(visits, size, n - 1);
+    /* entries visited exactly `max` times fill what is left of n */
+    ties = n;
+    for (i = 0; i < size; i++) {
+      ties -= visits[i] < max;
+    }
+    PyMem_Free(visits);
+  } else {
+    max = UINT32_MAX;
+    ties = size;
+  }
+  /* A deleted slot is refilled from the end, which was visited already.
+   * Slots are read again on every step as deleting may run Python code. */
+  for (i = size - 1; i >= 0 && n > 0; i--) {
+    if (i >= self->nslots) {
+      continue;
+    }
+    entry = self->slots[i];
+    if (entry->visits > max || (entry->visits == max && ties == 0)) {
+      continue;
+    }
+    if (entry->visits == max) {
+      ties--;
+    }
+    n--;
+    if (CacheMap_EvictEntry(self, entry)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Evict until the cache has no more than `size` entries and fits in
+ * max_bytes. */
+static int CacheMap_EvictTo(CtsCacheMap *self, Py_ssize_t size) {
+  CtsCacheMapEntry *entry;
+  if (self->deferred) {
+    return 0;
+  }
+  if (self->policy == CacheMap_POLICY_LFU &&
+      CacheMap_Size(self) - size > 1 &&
+      LFU_EvictN(self, CacheMap_Size(self) - size)) {
+    return -1;
+  }
+  while (CacheMap_Size(self) > size || self->weight > self->max_bytes) {
+    entry = CacheMap_Victim(self);
+    if (entry == NULL) {
+      break;
+    }
+    if (CacheMap_EvictEntry(self, entry)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Case II to IV of ARC for a key not in cache.
+ * Return the region the new entry belongs to. */
+static int ARC_MakeRoom(CtsCacheMap *self, PyObject *key) {
+  CtsCacheMapList *t1 = CacheMap_List(self, CacheMap_REGION_T1);
+  CtsCacheMapList *t2 = CacheMap_List(self, CacheMap_REGION_T2);
+  CtsCacheMapList *b1 = CacheMap_List(self, CacheMap_REGION_B1);
+  CtsCacheMapList *b2 = CacheMap_List(self, CacheMap_REGION_B2);
+  CtsCacheMapEntry *ghost, *victim;
+  Py_ssize_t c = self->capacity, delta;
+  int in_b2 = 0;
+
+  ghost = CacheMap_FindGhost(self, key);
+  ReturnIfErrorSet(-1);
+  if (ghost) {
+    /* a ghost hit shows which list was evicted too early */
+    if (ghost->region == CacheMap_REGION_B1) {
+      delta = b1->size >= b2->size ? 1 : b2->size / b1->size;
+      self->arc_p = self->arc_p + delta < c ? self->arc_p + delta : c;
+    } else {
+      delta = b2->size >= b1->size ? 1 : b1->size / b2->size;
+      self->arc_p = self->arc_p > delta ? self->arc_p - delta : 0;
+      in_b2 = 1;
+    }
+    if (CacheMap_DelGhost(self, ghost)) {
+      return -1;
+    }
+  } else if (t1->size + b1->size >= c) {
+    if (b1->head) {
+      if (CacheMap_DelGhost(self, b1->head)) {
+        return -1;
+      }
+    } else if (t1->head) {
+      if (CacheMap_Evicted(self, t1->head) ||
+          CacheMap_DelEntry(self, t1->head)) {
+        return -1;
+      }
+    }
+  } else if (b2->head && t1->size + t2->size + b1->size + b2->size >= 2 * c) {
+    if (CacheMap_DelGhost(self, b2->head)) {
+      return -1;
+    }
+  }
+  while (CacheMap_Size(self) >= c && (victim = ARC_Victim(self, in_b2))) {
+    if (CacheMap_EvictEntry(self, victim)) {
+      return -1;
+    }
+  }
+  return ghost ? CacheMap_REGION_T2 : CacheMap_REGION_T1;
+}
+
+/* Evict entries for a new key, return the region the new entry belongs to. */
+static int CacheMap_MakeRoom(CtsCacheMap *self, PyObject *key) {
+  CtsCacheMapEntry *ghost;
+  switch (self->policy) {
+  case CacheMap_POLICY_WTINYLFU:
+    /* W-TinyLFU decides after the new entry is linked */
+    return CacheMap_REGION_WINDOW;
+  case CacheMap_POLICY_ARC:
+    return ARC_MakeRoom(self, key);
+  case CacheMap_POLICY_S3FIFO:
+    ghost = CacheMap_FindGhost(self, key);
+    ReturnIfErrorSet(-1);
+    if (ghost && CacheMap_DelGhost(self, ghost)) {
+      return -1;
+    }
+    if (CacheMap_EvictTo(self, self->capacity - 1)) {
+      return -1;
+    }
+    return ghost ? CacheMap_REGION_MAIN : CacheMap_REGION_SMALL;
+  case CacheMap_POLICY_LRU:
+  case CacheMap_POLICY_CLOCK:
+    if (CacheMap_EvictTo(self, self->capacity - 1)) {
+      return -1;
+    }
+    return CacheMap_REGION_QUEUE;
+  default:
+    if (CacheMap_EvictTo(self, self->capacity - 1) ||
+        CacheMap_ReserveSlot(self)) {
+      return -1;
+    }
+    return CacheMap_REGION_SAMPLED;
+  }
+}
+
+/* Link a new entry, which is already in the dict, to region `r`. */
+static int CacheMap_Link(CtsCacheMap *self, CtsCacheMapEntry *entry, char r) {
+  if (self->policy == CacheMap_POLICY_WTINYLFU) {
+    return TinyLFU_Admit(self, entry);
+  }
+  if (r == CacheMap_REGION_SAMPLED) {
+    entry->index = self->nslots;
+    self->slots[self->nslots++] = entry;
+    entry->region = r;
+    LFU_Tick(self);
+    return 0;
+  }
+  /* other policies use visits as their reference counter */
+  entry->visits = 0;
+  CacheMap_MoveTo(self, entry, r);
+  return 0;
+}
+
+/* Record a hit of an entry. */
+static void CacheMap_Touch(CtsCacheMap *self, CtsCacheMapEntry *entry) {
+  switch (self->policy) {
+  case CacheMap_POLICY_WTINYLFU:
+    TinyLFU_Touch(self, entry);
+    break;
+  case CacheMap_POLICY_LRU:
+    CacheMap_MoveTo(self, entry, CacheMap_REGION_QUEUE);
+    break;
+  case CacheMap_POLICY_ARC:
+    CacheMap_MoveTo(self, entry, CacheMap_REGION_T2);
+    break;
+  case CacheMap_POLICY_S3FIFO:
+    if (entry->visits < 3) {
+      entry->visits++;
+    }
+    break;
+  case CacheMap_POLICY_CLOCK:
+    entry->visits = 1;
+    break;
+  default:
+    CacheEntry_NewVisit(entry);
+    LFU_Tick(self);
+  }
+}
+
+/* New reference, the value of an entry being hit. */
+static PyObject *CacheMap_GetValue(CtsCacheMap *self,
+                                   CtsCacheMapEntry *entry) {
+  CacheMap_Touch(self, entry);
+  Py_INCREF(entry->ma_value);
+  return entry->ma_value;
+}
+
+/* New Reference */
+static PyObject *CacheMap_NextEvictKey(CtsCacheMap *self) {
+  CtsCacheMapEntry *entry = CacheMap_Victim(self);
+  if (entry == NULL) {
+    PyErr_SetString(PyExc_KeyError, "CacheMap is empty.");
     return NULL;
   }
-  Py_DECREF(k);
-  Py_RETURN_NONE;
+  Py_INCREF(entry->key);
+  return entry->key;
+}
+
+/* Return the number of entries evicted. */
+static PyObject *CacheMap_evict(CtsCacheMap *self, CtsArg_PARAMS) {
+  PyObject *argv[1];
+  CtsCacheMapEntry *entry;
+  Py_ssize_t n = 1, size = CacheMap_Size(self), rv;
+
+  static const char *const kwlist[] = {"n", NULL};
+  static CtsArg_Parser parser = {"evict", kwlist, 0, 1};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  if (argv[0] && (n = PyLong_AsSsize_t(argv[0])) < 0) {
+    if (!PyErr_Occurred()) {
+      PyErr_SetString(PyExc_ValueError, "n should not be negative");
+    }
+    return NULL;
+  }
+  if (self->policy == CacheMap_POLICY_LFU && n > 1) {
+    if (LFU_EvictN(self, n)) {
+      return NULL;
+    }
+  } else {
+    for (rv = 0; rv < n && (entry = CacheMap_Victim(self)) != NULL; rv++) {
+      if (CacheMap_EvictEntry(self, entry)) {
+        return NULL;
+      }
+    }
+  }
+  if (CacheMap_Flush(self)) {
+    return NULL;
+  }
+  rv = size - CacheMap_Size(self);
+  return PyLong_FromSsize_t(rv > 0 ? rv : 0);
 }
 
 static int CacheMap_DelItem(CtsCacheMap *self, PyObject *key) {
-  return PyDict_DelItem(self->dict, key);
+  PyObject *value;
+  CtsCacheMapEntry *entry = CacheMap_GetItemWithError(self, key);
+  if (!entry) {
+    ReturnIfErrorSet(-1);
+    if (CtsDisk_Enabled(&self->disk) &&
+        (value = CtsDisk_Take(&self->disk, key)) != NULL) {
+      Py_DECREF(value);
+      return 0;
+    }
+    ReturnKeyErrorIfErrorNotSet(key, -1);
+    return -1;
+  }
+  return CacheMap_DelEntry(self, entry);
 }
 
-static int CacheMap_SetItem(CtsCacheMap *self, PyObject *key, PyObject *value) {
+/* Weight of a value, by the sizeof callback or __sizeof__.
+ * Values are only weighed if the cache is bounded by bytes. */
+static Py_ssize_t CacheMap_Weigh(CtsCacheMap *self, PyObject *value) {
+  PyObject *rv;
+  Py_ssize_t weight;
+  if (self->sizeof_fn) {
+    rv = PyObject_CallFunctionObjArgs(self->sizeof_fn, value, NULL);
+  } else if (self->max_bytes != PY_SSIZE_T_MAX) {
+    rv = PyObject_CallMethod(value, "__sizeof__", NULL);
+  } else {
+    return 0;
+  }
+  ReturnIfNULL(rv, -1);
+  weight = PyLong_AsSsize_t(rv);
+  Py_DECREF(rv);
+  if (weight < 0) {
+    if (!PyErr_Occurred()) {
+      PyErr_SetString(PyExc_ValueError, "weight should not be negative.");
+    }
+    return -1;
+  }
+  return weight;
+}
+
+/* Apply a new capacity to the sizes of policy regions, as lowered by the
+ * cap of memory pressure. */
+static void CacheMap_SetCapacity(CtsCacheMap *self, Py_ssize_t capacity) {
+  self->max_capacity = capacity;
+  if (capacity > self->pressure.cap) {
+    capacity = self->pressure.cap;
+  }
+  self->capacity = capacity;
+  self->window_capacity = capacity / 100;
+  if (self->window_capacity < 1) {
+    self->window_capacity = 1;
+  }
+  self->protected_capacity = (capacity - self->window_capacity) * 4 / 5;
+  self->small_capacity = capacity / 10;
+  if (self->small_capacity < 1) {
+    self->small_capacity = 1;
+  }
+  if (self->arc_p > capacity) {
+    self->arc_p = capacity;
+  }
+}
+
+/* Evict down to a capacity that was just lowered. */
+static int CacheMap_Fit(CtsCacheMap *self) {
+  if (self->policy == CacheMap_POLICY_WTINYLFU) {
+    return TinyLFU_Maintain(self);
+  }
+  return CacheMap_EvictTo(self, self->capacity) || CacheMap_TrimGhosts(self);
+}
+
+/* Set an item of `weight`, weigh the value if `weight` is negative. */
+static int CacheMap_SetItemWeighted(CtsCacheMap *self, PyObject *key,
+                                    PyObject *value, Py_ssize_t weight) {
   PyObject *old_value;
   CtsCacheMapEntry *entry;
+  int region;
+  if (weight < 0 && (weight = CacheMap_Weigh(self, value)) < 0) {
+    return -1;
+  }
   entry = CacheMap_GetItemWithError(self, key);
   ReturnIfErrorSet(-1);
   if (entry) {
     old_value = entry->ma_value;
     Py_INCREF(value);
     entry->ma_value = value;
+    self->weight += weight - entry->weight;
+    entry->weight = weight;
     Py_DECREF(old_value);
-    return 0;
+    return CacheMap_EvictTo(self, self->capacity);
   }
-  if (CacheMap_Size(self) >= self->capacity) {
-    if (!CacheMap_evict(self)) {
-      return -1;
-    }
+  region = CacheMap_MakeRoom(self, key);
+  if (region < 0) {
+    return -1;
   }
 
   entry = CacheEntry_New(value);
   ReturnIfNULL(entry, -1);
   CacheEntry_Init(entry);
+  entry->key = key;
   if (PyDict_SetItem(self->dict, key, (PyObject *)entry) != 0) {
     Py_DECREF(entry);
     return -1;
   }
   Py_DECREF(entry);
-  return 0;
+  self->stats.insertions++;
+  entry->weight = weight;
+  self->weight += weight;
+  /* a record on disk is older than the new value */
+  if (CtsDisk_Enabled(&self->disk) && CtsDisk_Forget(&self->disk, key)) {
+    return -1;
+  }
+  if (CacheMap_Link(self, entry, (char)region)) {
+    return -1;
+  }
+  if (CtsPressure_Poll(&self->pressure, CacheMap_Size(self),
+                       self->max_capacity)) {
+    CacheMap_SetCapacity(self, self->max_capacity);
+    if (CacheMap_Fit(self)) {
+      return -1;
+    }
+  }
+  return self->weight > self->max_bytes
+             ? CacheMap_EvictTo(self, self->capacity)
+             : 0;
+}
+
+#define CacheMap_SetItem(self, key, value)                                     \
+  CacheMap_SetItemWeighted(self, key, value, -1)
+
+/* New reference to the value of a key as a hit, NULL without error on a
+ * miss. A key spilled to the disk tier is moved back to memory. */
+static PyObject *CacheMap_Find(CtsCacheMap *self, PyObject *key) {
+  PyObject *value;
+  CtsCacheMapEntry *entry = CacheMap_GetItemWithError(self, key);
+  if (entry) {
+    self->stats.hits++;
+    return CacheMap_GetValue(self, entry);
+  }
+  ReturnIfErrorSet(NULL);
+  if (CtsDisk_Enabled(&self->disk) &&
+      (value = CtsDisk_Take(&self->disk, key)) != NULL) {
+    if (CacheMap_SetItem(self, key, value) || CacheMap_Flush(self)) {
+      Py_DECREF(value);
+      return NULL;
+    }
+    self->stats.hits++;
+    return value;
+  }
+  ReturnIfErrorSet(NULL);
+  self->stats.misses++;
+  return NULL;
+}
+
+/* Forget all entries linked by the policy, the dicts are left untouched. */
+static void CacheMap_ResetPolicy(CtsCacheMap *self) {
+  for (int i = 0; i < CacheMap_NUM_LISTS; i++) {
+    CacheList_Init(&self->lists[i]);
+  }
+  self->nslots = 0;
+  self->ops = 0;
+  self->arc_p = 0;
+  self->weight = 0;
 }
 
 static void CacheMap_Clear(CtsCacheMap *self) {
+  CacheMap_ResetPolicy(self);
+  if (self->sketch.table) {
+    memset(self->sketch.table, 0, Sketch_DEPTH * self->sketch.width);
+    self->sketch.additions = 0;
+  }
+  if (self->ghosts) {
+    PyDict_Clear(self->ghosts);
+  }
   PyDict_Clear(self->dict);
-  self->misses = 0;
-  self->hits = 0;
+  CtsDisk_Clear(&self->disk);
 }
 
 static PyTypeObject CacheMap_Type;
@@ -336,9 +1222,25 @@ static CtsCacheMap *CacheMap_New(void) {
     return NULL;
   }
   PyObject_GC_Track(self);
-  self->hits = 0;
-  self->misses = 0;
+  CtsStats_Init(&self->stats);
   self->capacity = INT32_MAX;
+  self->policy = CacheMap_POLICY_LFU;
+  self->deferred = 0;
+  self->max_bytes = PY_SSIZE_T_MAX;
+  self->sizeof_fn = NULL;
+  self->on_evict = NULL;
+  self->evicted = NULL;
+  self->inflight = NULL;
+  self->ghosts = NULL;
+  self->slots = NULL;
+  self->slots_allocated = 0;
+  CacheMap_ResetPolicy(self);
+  self->sketch.table = NULL;
+  self->sketch.width = 0;
+  self->sketch.additions = 0;
+  memset(&self->disk, 0, sizeof(CtsDiskTier));
+  CtsPressure_Clear(&self->pressure);
+  CacheMap_SetCapacity(self, INT32_MAX);
   return self;
 }
 
@@ -349,162 +1251,545 @@ static PyObject *CacheMap_tp_new(PyTypeObject *Py_UNUSED(type),
 }
 
 static int CacheMap_tp_init(CtsCacheMap *self, PyObject *args,
-                            PyObject *Py_UNUSED(kwds)) {
+                            PyObject *kwds) {
   Py_ssize_t capacity = 0;
-  if (!PyArg_ParseTuple(args, "|n", &capacity)) {
+  const char *policy = NULL;
+  PyObject *max_bytes = Py_None, *sizeof_fn = Py_None, *on_evict = Py_None;
+  PyObject *l2_path = Py_None, *memory_high = Py_None;
+  PyObject *memory_limit = Py_None;
+  Py_ssize_t nbytes = PY_SSIZE_T_MAX;
+  long long l2_max_bytes = (long long)1 << 30;
+  int latency = 0;
+  char p;
+  static char *kwlist[] = {"capacity",     "policy",      "max_bytes",
+                           "sizeof",       "latency",     "on_evict",
+                           "l2_path",      "l2_max_bytes", "memory_high",
+                           "memory_limit", NULL};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds, "|nzOOpOOLOO", kwlist, &capacity, &policy, &max_bytes,
+          &sizeof_fn, &latency, &on_evict, &l2_path, &l2_max_bytes,
+          &memory_high, &memory_limit)) {
+    return -1;
+  }
+  if (l2_max_bytes <= 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "l2_max_bytes should be a positive integer");
+    return -1;
+  }
+  if (on_evict != Py_None && !PyCallable_Check(on_evict)) {
+    PyErr_SetString(PyExc_TypeError, "on_evict is not callable.");
     return -1;
   }
   if (capacity < 0) {
     PyErr_SetString(PyExc_ValueError, "Capacity should be a positive number");
     return -1;
   }
-  if (capacity > 0) {
-    self->capacity = capacity;
+  if (max_bytes != Py_None) {
+    nbytes = PyLong_AsSsize_t(max_bytes);
+    if (nbytes <= 0) {
+      if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_ValueError,
+                        "max_bytes should be a positive integer");
+      }
+      return -1;
+    }
+  }
+  if (sizeof_fn != Py_None && !PyCallable_Check(sizeof_fn)) {
+    PyErr_SetString(PyExc_TypeError, "sizeof is not callable.");
+    return -1;
+  }
+  for (p = 0; policy && p < CacheMap_NUM_POLICIES; p++) {
+    if (strcmp(policy, CacheMap_POLICY_NAMES[(int)p]) == 0) {
+      break;
+    }
+  }
+  if (policy == NULL) {
+    p = CacheMap_POLICY_LFU;
+  } else if (p == CacheMap_NUM_POLICIES) {
+    PyErr_Format(PyExc_ValueError, "unknown policy '%s'", policy);
+    return -1;
+  }
+  if (p != self->policy && CacheMap_Size(self)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "can not change policy of a non-empty cache");
+    return -1;
+  }
+  if ((nbytes != self->max_bytes || sizeof_fn != Py_None) &&
+      CacheMap_Size(self)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "can not change weighing of a non-empty cache");
+    return -1;
+  }
+  self->policy = p;
+  self->max_bytes = nbytes;
+  Py_XDECREF(self->sizeof_fn);
+  self->sizeof_fn = NULL;
+  if (sizeof_fn != Py_None) {
+    Py_INCREF(sizeof_fn);
+    self->sizeof_fn = sizeof_fn;
+  }
+  Py_XDECREF(self->on_evict);
+  self->on_evict = NULL;
+  if (on_evict != Py_None) {
+    Py_INCREF(on_evict);
+    self->on_evict = on_evict;
+  }
+  if (CtsPressure_Init(&self->pressure, memory_high, memory_limit)) {
+    return -1;
+  }
+  CacheMap_SetCapacity(self, capacity > 0 ? capacity : self->max_capacity);
+  CtsDisk_Close(&self->disk);
+  if (l2_path != Py_None &&
+      CtsDisk_Open(&self->disk, l2_path, (int64_t)l2_max_bytes)) {
+    return -1;
+  }
+  return CtsStats_SetLatency(&self->stats, latency);
+}
+
+static int CacheMap_tp_traverse(CtsCacheMap *self, visitproc visit, void *arg) {
+  Py_VISIT(self->dict);
+  Py_VISIT(self->ghosts);
+  Py_VISIT(self->sizeof_fn);
+  Py_VISIT(self->on_evict);
+  Py_VISIT(self->evicted);
+  Py_VISIT(self->inflight);
+  return 0;
+}
+
+static int CacheMap_tp_clear(CtsCacheMap *self) {
+  CacheMap_ResetPolicy(self);
+  Py_CLEAR(self->dict);
+  Py_CLEAR(self->ghosts);
+  Py_CLEAR(self->sizeof_fn);
+  Py_CLEAR(self->on_evict);
+  Py_CLEAR(self->evicted);
+  Py_CLEAR(self->inflight);
+  return 0;
+}
+
+static void CacheMap_tp_dealloc(CtsCacheMap *self) {
+  PyObject_GC_UnTrack(self);
+  CacheMap_tp_clear(self);
+  PyMem_Free(self->sketch.table);
+  PyMem_Free(self->slots);
+  CtsDisk_Free(&self->disk);
+  CtsStats_Free(&self->stats);
+  PyObject_GC_Del(self);
+}
+
+static PyObject *CacheMap_repr(CtsCacheMap *self) {
+  PyObject *s;
+  PyObject *rv;
+  s = PyObject_Repr(self->dict);
+  ReturnIfNULL(s, NULL);
+  rv = PyUnicode_FromFormat("CacheMap(%S)", s);
+  if (!rv) {
+    Py_DECREF(s);
+    return NULL;
+  }
+  Py_DECREF(s);
+  return rv;
+}
+
+/* mp_subscript: __getitem__() */
+static PyObject *CacheMap_mp_subscript(CtsCacheMap *self, PyObject *key) {
+  int64_t start = CtsStats_Start(&self->stats);
+  PyObject *rv = CacheMap_Find(self, key);
+  if (!rv) {
+    ReturnIfErrorSet(NULL);
+    CtsStats_Stop(&self->stats, CtsStats_OP_GET, start);
+    return PyErr_Format(PyExc_KeyError, "%S", key);
   }
+  CtsStats_Stop(&self->stats, CtsStats_OP_GET, start);
+  return rv;
+}
+
+/* Set an item, record the latency and deliver evicted entries. */
+static int CacheMap_TimedSetItem(CtsCacheMap *self, PyObject *key,
+                                 PyObject *value, Py_ssize_t weight) {
+  int64_t start = CtsStats_Start(&self->stats);
+  int rv = CacheMap_SetItemWeighted(self, key, value, weight);
+  CtsStats_Stop(&self->stats, CtsStats_OP_SET, start);
+  return rv ? rv : CacheMap_Flush(self);
+}
+
+/* mp_ass_subscript: __setitem__() and __delitem__() */
+static int CacheMap_mp_ass_sub(CtsCacheMap *self, PyObject *key,
+                               PyObject *value) {
+  if (value == NULL) {
+    return CacheMap_DelItem(self, key);
+  } else {
+    return CacheMap_TimedSetItem(self, key, value, -1);
+  }
+}
+
+static PyMappingMethods CacheMap_as_mapping = {
+    (lenfunc)CacheMap_size,             /*mp_length*/
+    (binaryfunc)CacheMap_mp_subscript,  /*mp_subscript*/
+    (objobjargproc)CacheMap_mp_ass_sub, /*mp_ass_subscript*/
+};
+
+static PyObject *CacheMap_hit_info(CtsCacheMap *self) {
+  return Py_BuildValue("nnn", self->capacity, self->stats.hits,
+                       self->stats.misses);
+}
+
+static PyObject *CacheMap_stats(CtsCacheMap *self, CtsArg_PARAMS) {
+  int reset = 0;
+  PyObject *rv, *l2, *memory, *argv[1];
+  static const char *const kwlist[] = {"reset", NULL};
+  static CtsArg_Parser parser = {"stats", kwlist, 0, 1};
+  if (CtsArg_UNPACK(&parser, argv) || CtsArg_Bool(argv[0], &reset)) {
+    return NULL;
+  }
+  rv = CtsStats_AsDict(&self->stats);
+  if (rv && CtsDisk_Enabled(&self->disk)) {
+    l2 = Py_BuildValue("{snsnsL}", "hits", self->disk.hits, "writes",
+                       self->disk.writes, "bytes",
+                       self->disk.end < self->disk.size ? self->disk.end
+                                                        : self->disk.size);
+    if (l2 == NULL || PyDict_SetItemString(rv, "l2", l2)) {
+      Py_XDECREF(l2);
+      Py_DECREF(rv);
+      return NULL;
+    }
+    Py_DECREF(l2);
+  }
+  if (rv && CtsPressure_Enabled(&self->pressure)) {
+    memory = CtsPressure_AsDict(&self->pressure);
+    if (memory == NULL || PyDict_SetItemString(rv, "memory", memory)) {
+      Py_XDECREF(memory);
+      Py_DECREF(rv);
+      return NULL;
+    }
+    Py_DECREF(memory);
+  }
+  if (rv && reset) {
+    CtsStats_Reset(&self->stats);
+    self->disk.hits = self->disk.writes = 0;
+    self->pressure.shrinks = 0;
+  }
+  return rv;
+}
+
+/* Views of keys, values and items read the dict of entries in place. They
+ * do not copy it, and do not count as hits of the policy. */
+#define CacheMapView_KEYS 0
+#define CacheMapView_VALUES 1
+#define CacheMapView_ITEMS 2
+
+static const char *CacheMapView_NAMES[] = {"cachemap_keys", "cachemap_values",
+                                           "cachemap_items"};
+
+/* clang-format off */
+typedef struct {
+  PyObject_HEAD
+  CtsCacheMap *cache;
+  int kind;
+} CtsCacheMapView;
+
+typedef struct {
+  PyObject_HEAD
+  CtsCacheMap *cache; /* NULL once exhausted */
+  int kind;
+  Py_ssize_t pos;  /* position of PyDict_Next */
+  Py_ssize_t size; /* size of the cache when the iteration started */
+} CtsCacheMapIter;
+/* clang-format on */
+
+static PyTypeObject CacheMapView_Type;
+static PyTypeObject CacheMapIter_Type;
+
+static PyObject *CacheMapIter_New(CtsCacheMap *cache, int kind) {
+  CtsCacheMapIter *it =
+      PyObject_GC_New(CtsCacheMapIter, &CacheMapIter_Type);
+  ReturnIfNULL(it, NULL);
+  Py_INCREF(cache);
+  it->cache = cache;
+  it->kind = kind;
+  it->pos = 0;
+  it->size = CacheMap_Size(cache);
+  PyObject_GC_Track(it);
+  return (PyObject *)it;
+}
+
+static PyObject *CacheMapIter_tp_iternext(CtsCacheMapIter *it) {
+  PyObject *key;
+  CtsCacheMapEntry *entry;
+  CtsCacheMap *cache = it->cache;
+  if (cache == NULL) {
+    return NULL;
+  }
+  if (CacheMap_Size(cache) != it->size) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "CacheMap changed size during iteration");
+    it->size = -1; /* keep raising */
+    return NULL;
+  }
+  if (!PyDict_Next(cache->dict, &it->pos, &key, (PyObject **)&entry)) {
+    it->cache = NULL;
+    Py_DECREF(cache);
+    return NULL;
+  }
+  switch (it->kind) {
+  case CacheMapView_KEYS:
+    Py_INCREF(key);
+    return key;
+  case CacheMapView_VALUES:
+    Py_INCREF(entry->ma_value);
+    return entry->ma_value;
+  default:
+    return PyTuple_Pack(2, key, entry->ma_value);
+  }
+}
+
+static PyObject *CacheMapIter_length_hint(CtsCacheMapIter *it,
+                                          PyObject *Py_UNUSED(ignore)) {
+  Py_ssize_t n = 0;
+  if (it->cache && it->size == CacheMap_Size(it->cache)) {
+    /* pos only counts slots visited, which may include deleted ones */
+    n = it->size - it->pos;
+  }
+  return PyLong_FromSsize_t(n > 0 ? n : 0);
+}
+
+static PyMethodDef CacheMapIter_methods[] = {
+    {"__length_hint__", (PyCFunction)CacheMapIter_length_hint, METH_NOARGS,
+     NULL},
+    {NULL, NULL, 0, NULL} /* Sentinel */
+};
+
+static int CacheMapIter_tp_traverse(CtsCacheMapIter *it, visitproc visit,
+                                    void *arg) {
+  Py_VISIT(it->cache);
   return 0;
 }
 
-static int CacheMap_tp_traverse(CtsCacheMap *self, visitproc visit, void *arg) {
-  Py_VISIT(self->dict);
-  return 0;
+static void CacheMapIter_tp_dealloc(CtsCacheMapIter *it) {
+  PyObject_GC_UnTrack(it);
+  Py_XDECREF(it->cache);
+  PyObject_GC_Del(it);
 }
 
-static int CacheMap_tp_clear(CtsCacheMap *self) {
-  Py_CLEAR(self->dict);
-  return 0;
+static PyTypeObject CacheMapIter_Type = {
+    /* clang-format off */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    /* clang-format on */
+    "ctools.CacheMapIterator",                /* tp_name */
+    sizeof(CtsCacheMapIter),                  /* tp_basicsize */
+    0,                                        /* tp_itemsize */
+    (destructor)CacheMapIter_tp_dealloc,      /* tp_dealloc */
+    0,                                        /* tp_print */
+    0,                                        /* tp_getattr */
+    0,                                        /* tp_setattr */
+    0,                                        /* tp_compare */
+    0,                                        /* tp_repr */
+    0,                                        /* tp_as_number */
+    0,                                        /* tp_as_sequence */
+    0,                                        /* tp_as_mapping */
+    0,                                        /* tp_hash */
+    0,                                        /* tp_call */
+    0,                                        /* tp_str */
+    0,                                        /* tp_getattro */
+    0,                                        /* tp_setattro */
+    0,                                        /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,  /* tp_flags */
+    0,                                        /* tp_doc */
+    (traverseproc)CacheMapIter_tp_traverse,   /* tp_traverse */
+    0,                                        /* tp_clear */
+    0,                                        /* tp_richcompare */
+    0,                                        /* tp_weaklistoffset */
+    PyObject_SelfIter,                        /* tp_iter */
+    (iternextfunc)CacheMapIter_tp_iternext,   /* tp_iternext */
+    CacheMapIter_methods,                     /* tp_methods */
+};
+
+static PyObject *CacheMapView_New(CtsCacheMap *cache, int kind) {
+  CtsCacheMapView *view =
+      PyObject_GC_New(CtsCacheMapView, &CacheMapView_Type);
+  ReturnIfNULL(view, NULL);
+  Py_INCREF(cache);
+  view->cache = cache;
+  view->kind = kind;
+  PyObject_GC_Track(view);
+  return (PyObject *)view;
 }
 
-static void CacheMap_tp_dealloc(CtsCacheMap *self) {
-  PyObject_GC_UnTrack(self);
-  CacheMap_tp_clear(self);
-  PyObject_GC_Del(self);
+static Py_ssize_t CacheMapView_sq_length(CtsCacheMapView *view) {
+  return CacheMap_Size(view->cache);
 }
 
-static PyObject *CacheMap_repr(CtsCacheMap *self) {
-  PyObject *s;
-  PyObject *rv;
-  s = PyObject_Repr(self->dict);
-  ReturnIfNULL(s, NULL);
-  rv = PyUnicode_FromFormat("CacheMap(%S)", s);
-  if (!rv) {
-    Py_DECREF(s);
-    return NULL;
+static int CacheMapView_sq_contains(CtsCacheMapView *view, PyObject *ob) {
+  PyObject *key, *value;
+  CtsCacheMapEntry *entry;
+  Py_ssize_t pos = 0;
+  int rv;
+  switch (view->kind) {
+  case CacheMapView_KEYS:
+    return PyDict_Contains(view->cache->dict, ob);
+  case CacheMapView_VALUES:
+    while (PyDict_Next(view->cache->dict, &pos, &key, (PyObject **)&entry)) {
+      value = entry->ma_value;
+      Py_INCREF(value);
+      rv = PyObject_RichCompareBool(value, ob, Py_EQ);
+      Py_DECREF(value);
+      if (rv != 0) {
+        return rv;
+      }
+    }
+    return 0;
+  default:
+    if (!PyTuple_Check(ob) || PyTuple_GET_SIZE(ob) != 2) {
+      return 0;
+    }
+    entry = CacheMap_GetItemWithError(view->cache, PyTuple_GET_ITEM(ob, 0));
+    if (entry == NULL) {
+      return PyErr_Occurred() ? -1 : 0;
+    }
+    value = entry->ma_value;
+    Py_INCREF(value);
+    rv = PyObject_RichCompareBool(value, PyTuple_GET_ITEM(ob, 1), Py_EQ);
+    Py_DECREF(value);
+    return rv;
   }
-  Py_DECREF(s);
-  return rv;
 }
 
-/* mp_subscript: __getitem__() */
-static PyObject *CacheMap_mp_subscript(CtsCacheMap *self, PyObject *key) {
-  CtsCacheMapEntry *wrapper = CacheMap_GetItemWithError(self, key);
-  if (!wrapper) {
-    self->misses++;
-    ReturnIfErrorSet(NULL);
-    return PyErr_Format(PyExc_KeyError, "%S", key);
-  }
-  self->hits++;
-  return CacheEntry_get_ma_value(wrapper);
+static PySequenceMethods CacheMapView_as_sequence = {
+    (lenfunc)CacheMapView_sq_length,     /* sq_length */
+    0,                                   /* sq_concat */
+    0,                                   /* sq_repeat */
+    0,                                   /* sq_item */
+    0,                                   /* sq_slice */
+    0,                                   /* sq_ass_item */
+    0,                                   /* sq_ass_slice */
+    (objobjproc)CacheMapView_sq_contains, /* sq_contains */
+    0,                                   /* sq_inplace_concat */
+    0,                                   /* sq_inplace_repeat */
+};
+
+static PyObject *CacheMapView_tp_iter(CtsCacheMapView *view) {
+  return CacheMapIter_New(view->cache, view->kind);
 }
 
-/* mp_ass_subscript: __setitem__() and __delitem__() */
-static int CacheMap_mp_ass_sub(CtsCacheMap *self, PyObject *key,
-                               PyObject *value) {
-  if (value == NULL) {
-    return CacheMap_DelItem(self, key);
-  } else {
-    return CacheMap_SetItem(self, key, value);
+static PyObject *CacheMapView_repr(CtsCacheMapView *view) {
+  PyObject *list, *rv;
+  int status = Py_ReprEnter((PyObject *)view);
+  if (status != 0) {
+    return status > 0 ? PyUnicode_FromString("...") : NULL;
+  }
+  list = PySequence_List((PyObject *)view);
+  if (list == NULL) {
+    Py_ReprLeave((PyObject *)view);
+    return NULL;
   }
+  rv = PyUnicode_FromFormat("%s(%R)", CacheMapView_NAMES[view->kind], list);
+  Py_DECREF(list);
+  Py_ReprLeave((PyObject *)view);
+  return rv;
 }
 
-static PyMappingMethods CacheMap_as_mapping = {
-    (lenfunc)CacheMap_size,             /*mp_length*/
-    (binaryfunc)CacheMap_mp_subscript,  /*mp_subscript*/
-    (objobjargproc)CacheMap_mp_ass_sub, /*mp_ass_subscript*/
-};
+static int CacheMapView_tp_traverse(CtsCacheMapView *view, visitproc visit,
+                                    void *arg) {
+  Py_VISIT(view->cache);
+  return 0;
+}
 
-static PyObject *CacheMap_hit_info(CtsCacheMap *self) {
-  return Py_BuildValue("iii", self->capacity, self->hits, self->misses);
+static void CacheMapView_tp_dealloc(CtsCacheMapView *view) {
+  PyObject_GC_UnTrack(view);
+  Py_XDECREF(view->cache);
+  PyObject_GC_Del(view);
 }
 
+static PyTypeObject CacheMapView_Type = {
+    /* clang-format off */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    /* clang-format on */
+    "ctools.CacheMapView",                    /* tp_name */
+    sizeof(CtsCacheMapView),                  /* tp_basicsize */
+    0,                                        /* tp_itemsize */
+    (destructor)CacheMapView_tp_dealloc,      /* tp_dealloc */
+    0,                                        /* tp_print */
+    0,                                        /* tp_getattr */
+    0,                                        /* tp_setattr */
+    0,                                        /* tp_compare */
+    (reprfunc)CacheMapView_repr,              /* tp_repr */
+    0,                                        /* tp_as_number */
+    &CacheMapView_as_sequence,                /* tp_as_sequence */
+    0,                                        /* tp_as_mapping */
+    PyObject_HashNotImplemented,              /* tp_hash */
+    0,                                        /* tp_call */
+    0,                                        /* tp_str */
+    0,                                        /* tp_getattro */
+    0,                                        /* tp_setattro */
+    0,                                        /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,  /* tp_flags */
+    "A live view of keys, values or items of a CacheMap.", /* tp_doc */
+    (traverseproc)CacheMapView_tp_traverse,   /* tp_traverse */
+    0,                                        /* tp_clear */
+    0,                                        /* tp_richcompare */
+    0,                                        /* tp_weaklistoffset */
+    (getiterfunc)CacheMapView_tp_iter,        /* tp_iter */
+};
+
 static PyObject *CacheMap_keys(CtsCacheMap *self) {
-  return PyDict_Keys(self->dict);
+  return CacheMapView_New(self, CacheMapView_KEYS);
 }
 
 static PyObject *CacheMap_values(CtsCacheMap *self) {
-  PyObject *values;
-  CtsCacheMapEntry *entry;
-  Py_ssize_t size;
-  values = PyDict_Values(self->dict);
-  ReturnIfNULL(values, NULL);
-
-  size = PyList_GET_SIZE(values);
-  if (size == 0) {
-    return values;
-  }
-
-  for (Py_ssize_t i = 0; i < size; i++) {
-    entry = (CtsCacheMapEntry *)PyList_GET_ITEM(values, i);
-    PyList_SET_ITEM(values, i, CacheEntry_get_ma_value(entry));
-    Py_DECREF(entry);
-  }
-  return values;
+  return CacheMapView_New(self, CacheMapView_VALUES);
 }
 
 static PyObject *CacheMap_items(CtsCacheMap *self) {
-  CtsCacheMapEntry *cacheentry;
-  PyObject *items;
-  PyObject *kv;
-  Py_ssize_t size;
-
-  items = PyDict_Items(self->dict);
-  ReturnIfNULL(items, NULL);
-  size = PyList_GET_SIZE(items);
-  if (size == 0) {
-    return items;
-  }
-
-  for (Py_ssize_t i = 0; i < size; i++) {
-    kv = PyList_GET_ITEM(items, i);
-    cacheentry = (CtsCacheMapEntry *)PyTuple_GET_ITEM(kv, 1);
-    Py_INCREF(cacheentry);
-    PyTuple_SET_ITEM(kv, 1, CacheEntry_get_ma_value(cacheentry));
-    Py_DECREF(cacheentry);
-  }
-  return items;
+  return CacheMapView_New(self, CacheMapView_ITEMS);
 }
 
-static PyObject *CacheMap_get(CtsCacheMap *self, PyObject *args, PyObject *kw) {
+static PyObject *CacheMap_get(CtsCacheMap *self, CtsArg_PARAMS) {
   PyObject *key;
-  PyObject *_default = NULL;
-  CtsCacheMapEntry *result;
+  PyObject *_default;
+  PyObject *argv[2];
+  PyObject *result;
 
-  static char *kwlist[] = {"key", "default", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kw, "O|O", kwlist, &key, &_default))
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"get", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv))
     return NULL;
-  result = CacheMap_GetItemWithError(self, key);
+  key = argv[0];
+  _default = argv[1];
+  int64_t start = CtsStats_Start(&self->stats);
+  result = CacheMap_Find(self, key);
   if (!result) {
     ReturnIfErrorSet(NULL);
+    CtsStats_Stop(&self->stats, CtsStats_OP_GET, start);
     if (!_default) {
       Py_RETURN_NONE;
     }
     Py_INCREF(_default);
     return _default;
   }
-  Py_INCREF(result->ma_value);
-  return result->ma_value;
+  CtsStats_Stop(&self->stats, CtsStats_OP_GET, start);
+  return result;
 }
 
-static PyObject *CacheMap_pop(CtsCacheMap *self, PyObject *args, PyObject *kw) {
-  PyObject *key;
-  PyObject *_default = NULL;
+static PyObject *CacheMap_pop(CtsCacheMap *self, CtsArg_PARAMS) {
+  PyObject *key, *value;
+  PyObject *_default;
+  PyObject *argv[2];
   CtsCacheMapEntry *result;
 
-  static char *kwlist[] = {"key", "default", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kw, "O|O", kwlist, &key, &_default)) {
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"pop", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
     return NULL;
   }
+  key = argv[0];
+  _default = argv[1];
   result = CacheMap_GetItemWithError(self, key);
   if (!result) {
+    ReturnIfErrorSet(NULL);
+    if (CtsDisk_Enabled(&self->disk) &&
+        (value = CtsDisk_Take(&self->disk, key)) != NULL) {
+      return value;
+    }
     ReturnIfErrorSet(NULL);
     if (!_default) {
       Py_RETURN_NONE;
@@ -512,82 +1797,48 @@ static PyObject *CacheMap_pop(CtsCacheMap *self, PyObject *args, PyObject *kw) {
     Py_INCREF(_default);
     return _default;
   }
-  Py_INCREF(result->ma_value);
-  if (!CacheMap_DelItem(self, key)) {
-    Py_XDECREF(result->ma_value);
+  value = result->ma_value;
+  Py_INCREF(value);
+  if (CacheMap_DelEntry(self, result)) {
+    Py_DECREF(value);
     return NULL;
   }
-  return result->ma_value;
+  return value;
 }
 
+/* Pop the entry the policy would evict next. */
 static PyObject *CacheMap_popitem(CtsCacheMap *self,
                                   PyObject *Py_UNUSED(args)) {
-  PyObject *keys, *key, *value, *tuple;
-  CtsCacheMapEntry *value_entry;
-  Py_ssize_t size;
-  int err;
-  keys = CacheMap_keys(self);
-  ReturnIfNULL(keys, NULL);
-  size = PyList_Size(keys);
-  if (size < 0) {
-    Py_DECREF(keys);
-    return NULL;
-  }
-  if (size == 0) {
+  PyObject *rv;
+  CtsCacheMapEntry *entry = CacheMap_Victim(self);
+  if (entry == NULL) {
     PyErr_SetString(PyExc_KeyError, "popitem(): cache map is empty");
     return NULL;
   }
-  key = PyList_GetItem(keys, 0);
-  Py_DECREF(keys);
-  /* keys is not usable start from here */
-  if (key == NULL) {
-    return NULL;
-  }
-  value_entry = CacheMap_GetItemWithError(self, key);
-  if (value_entry == NULL) {
-    if (!PyErr_Occurred()) {
-      PyErr_Format(PyExc_KeyError, "%S", key);
-    }
-    return NULL;
-  }
-  Py_INCREF(key);
-  value = CacheEntry_get_ma_value(value_entry);
-  tuple = PyTuple_New(2);
-  if (!tuple) {
-    Py_DECREF(key);
-    Py_DECREF(value);
-    return NULL;
-  }
-  err = PyTuple_SetItem(tuple, 0, key);
-  if (err) {
-    Py_DECREF(key);
-    Py_DECREF(value);
-    Py_DECREF(tuple);
+  rv = PyTuple_Pack(2, entry->key, entry->ma_value);
+  ReturnIfNULL(rv, NULL);
+  if (CacheMap_DelEntry(self, entry)) {
+    Py_DECREF(rv);
     return NULL;
   }
-  err = PyTuple_SetItem(tuple, 1, value);
-  if (err) {
-    Py_DECREF(value);
-    Py_DECREF(tuple);
-    return NULL;
-  }
-  CacheMap_DelItem(self, key);
-  PyErr_Clear(); /* Don't care del error */
-  return tuple;
+  return rv;
 }
 
-static PyObject *CacheMap_setdefault(CtsCacheMap *self, PyObject *args,
-                                     PyObject *kw) {
+static PyObject *CacheMap_setdefault(CtsCacheMap *self, CtsArg_PARAMS) {
   PyObject *key;
-  PyObject *_default = NULL;
-  CtsCacheMapEntry *result;
+  PyObject *_default;
+  PyObject *argv[2];
+  PyObject *result;
 
-  static char *kwlist[] = {"key", "default", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kw, "O|O", kwlist, &key, &_default))
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"setdefault", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv))
     return NULL;
-  result = CacheMap_GetItemWithError(self, key);
+  key = argv[0];
+  _default = argv[1];
+  result = CacheMap_Find(self, key);
   if (result != NULL) {
-    return CacheEntry_get_ma_value(result);
+    return result;
   }
   ReturnIfErrorSet(NULL);
   if (!_default) {
@@ -595,33 +1846,49 @@ static PyObject *CacheMap_setdefault(CtsCacheMap *self, PyObject *args,
   }
 
   Py_INCREF(_default);
-  if (CacheMap_SetItem(self, key, _default)) {
+  if (CacheMap_SetItem(self, key, _default) || CacheMap_Flush(self)) {
     Py_DECREF(_default);
     return NULL;
   }
   return _default;
 }
 
-static PyObject *CacheMap_setnx(CtsCacheMap *self, PyObject *args,
-                                PyObject *kw) {
+/* CtsFlight_StoreFunc of setnx. */
+static int CacheMap_Store(PyObject *self, PyObject *key, PyObject *value) {
+  return CacheMap_SetItem((CtsCacheMap *)self, key, value) ||
+         CacheMap_Flush((CtsCacheMap *)self);
+}
+
+static PyObject *CacheMap_setnx(CtsCacheMap *self, CtsArg_PARAMS) {
   PyObject *key;
   PyObject *_default;
   PyObject *callback;
-  CtsCacheMapEntry *result;
+  PyObject *argv[3];
+  PyObject *result;
 
-  static char *kwlist[] = {"key", "fn", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kw, "OO", kwlist, &key, &callback)) {
+  int singleflight = 0;
+
+  static const char *const kwlist[] = {"key", "fn", "singleflight", NULL};
+  static CtsArg_Parser parser = {"setnx", kwlist, 2, 3};
+  if (CtsArg_UNPACK(&parser, argv) || CtsArg_Bool(argv[2], &singleflight)) {
     return NULL;
   }
+  key = argv[0];
+  callback = argv[1];
 
-  result = CacheMap_GetItemWithError(self, key);
+  result = CacheMap_Find(self, key);
   if (result) {
-    return CacheEntry_get_ma_value(result);
+    return result;
+  }
+  ReturnIfErrorSet(NULL);
+  if (singleflight) {
+    return CtsFlight_Load((PyObject *)self, &self->inflight, key, callback,
+                          CacheMap_Store);
   }
 
   _default = PyObject_CallFunctionObjArgs(callback, key, NULL);
   ReturnIfNULL(_default, NULL);
-  if (CacheMap_SetItem(self, key, _default) != 0) {
+  if (CacheMap_SetItem(self, key, _default) || CacheMap_Flush(self)) {
     Py_XDECREF(_default);
     return NULL;
   }
@@ -650,6 +1917,9 @@ static PyObject *CacheMap_update(CtsCacheMap *self, PyObject *args,
       }
   }
 
+  if (CacheMap_Flush(self)) {
+    return NULL;
+  }
   Py_RETURN_NONE;
 }
 
@@ -662,20 +1932,16 @@ static PyObject *CacheMap_set_capacity(CtsCacheMap *self, PyObject *capacity) {
     }
     return NULL;
   }
-  if (cap < self->capacity && CacheMap_Size(self) > cap) {
-    int r = CacheMap_Size(self) - cap;
-    for (int i = 0; i < r; ++i) {
-      ReturnIfNULL(CacheMap_evict(self), NULL);
-    }
+  CacheMap_SetCapacity(self, (Py_ssize_t)cap);
+  if (CacheMap_Fit(self) || CacheMap_Flush(self)) {
+    return NULL;
   }
-  self->capacity = cap;
   Py_RETURN_NONE;
 }
 
 static PyObject *CacheMap__storage(CtsCacheMap *self) {
-  PyObject *dict = self->dict;
-  Py_INCREF(dict);
-  return dict;
+  /* read only, changing the dict directly would break the policy lists */
+  return PyDictProxy_New(self->dict);
 }
 
 static PyObject *CacheMap_clear(CtsCacheMap *self) {
@@ -683,10 +1949,357 @@ static PyObject *CacheMap_clear(CtsCacheMap *self) {
   Py_RETURN_NONE;
 }
 
+static PyObject *CacheMap_set(CtsCacheMap *self, CtsArg_PARAMS) {
+  PyObject *key, *value, *argv[3];
+  Py_ssize_t weight = -1;
+  static const char *const kwlist[] = {"key", "value", "weight", NULL};
+  static CtsArg_Parser parser = {"set", kwlist, 2, 3};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  key = argv[0];
+  value = argv[1];
+  if (argv[2] && argv[2] != Py_None) {
+    weight = PyLong_AsSsize_t(argv[2]);
+    if (weight < 0) {
+      if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_ValueError, "weight should not be negative.");
+      }
+      return NULL;
+    }
+  }
+  if (CacheMap_TimedSetItem(self, key, value, weight)) {
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *CacheMap_get_many(CtsCacheMap *self, CtsArg_PARAMS) {
+  PyObject *keys, *_default, *argv[2], *rv, *value;
+  Py_ssize_t n, i;
+  static const char *const kwlist[] = {"keys", "default", NULL};
+  static CtsArg_Parser parser = {"get_many", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  _default = argv[1] ? argv[1] : Py_None;
+  keys = PySequence_Fast(argv[0], "keys should be iterable.");
+  ReturnIfNULL(keys, NULL);
+  n = PySequence_Fast_GET_SIZE(keys);
+  rv = PyList_New(n);
+  if (rv == NULL) {
+    Py_DECREF(keys);
+    return NULL;
+  }
+  for (i = 0; i < n; i++) {
+    value = CacheMap_Find(self, PySequence_Fast_GET_ITEM(keys, i));
+    if (value == NULL && PyErr_Occurred()) {
+      Py_DECREF(keys);
+      Py_DECREF(rv);
+      return NULL;
+    } else if (value == NULL) {
+      Py_INCREF(_default);
+      value = _default;
+    }
+    PyList_SET_ITEM(rv, i, value);
+  }
+  Py_DECREF(keys);
+  return rv;
+}
+
+/* CtsBatch_PairFunc of set_many. */
+static int CacheMap_BatchSet(PyObject *self, PyObject *key, PyObject *value,
+                             void *Py_UNUSED(arg)) {
+  return CacheMap_SetItem((CtsCacheMap *)self, key, value);
+}
+
+static PyObject *CacheMap_set_many(CtsCacheMap *self, PyObject *items) {
+  PyObject *type, *exc, *tb;
+  int rv;
+  /* LFU, LRU, CLOCK and S3-FIFO evict once for the batch, ARC and W-TinyLFU
+   * decide on each admission */
+  self->deferred = 1;
+  rv = CtsBatch_ForEachPair((PyObject *)self, items, CacheMap_BatchSet, NULL);
+  self->deferred = 0;
+  PyErr_Fetch(&type, &exc, &tb);
+  if (CacheMap_EvictTo(self, self->capacity) || CacheMap_TrimGhosts(self)) {
+    Py_XDECREF(type);
+    Py_XDECREF(exc);
+    Py_XDECREF(tb);
+    return NULL;
+  }
+  PyErr_Restore(type, exc, tb);
+  if (CacheMap_Flush(self) || rv) {
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *CacheMap_delete_many(CtsCacheMap *self, PyObject *keys) {
+  PyObject *seq, *key, *value;
+  CtsCacheMapEntry *entry;
+  Py_ssize_t n, i, deleted = 0;
+  seq = PySequence_Fast(keys, "keys should be iterable.");
+  ReturnIfNULL(seq, NULL);
+  n = PySequence_Fast_GET_SIZE(seq);
+  for (i = 0; i < n; i++) {
+    key = PySequence_Fast_GET_ITEM(seq, i);
+    entry = CacheMap_GetItemWithError(self, key);
+    if (entry == NULL) {
+      if (!PyErr_Occurred() && CtsDisk_Enabled(&self->disk) &&
+          (value = CtsDisk_Take(&self->disk, key)) != NULL) {
+        Py_DECREF(value);
+        deleted++;
+      }
+      if (PyErr_Occurred()) {
+        Py_DECREF(seq);
+        return NULL;
+      }
+      continue;
+    }
+    if (CacheMap_DelEntry(self, entry)) {
+      Py_DECREF(seq);
+      return NULL;
+    }
+    deleted++;
+  }
+  Py_DECREF(seq);
+  return PyLong_FromSsize_t(deleted);
+}
+
+static PyObject *CacheMap_policy(CtsCacheMap *self,
+                                 void *Py_UNUSED(closure)) {
+  return PyUnicode_FromString(CacheMap_POLICY_NAMES[(int)self->policy]);
+}
+
+static PyObject *CacheMap_max_bytes(CtsCacheMap *self,
+                                    void *Py_UNUSED(closure)) {
+  if (self->max_bytes == PY_SSIZE_T_MAX) {
+    Py_RETURN_NONE;
+  }
+  return PyLong_FromSsize_t(self->max_bytes);
+}
+
+static PyObject *CacheMap_weight(CtsCacheMap *self, void *Py_UNUSED(closure)) {
+  return PyLong_FromSsize_t(self->weight);
+}
+
+static PyGetSetDef CacheMap_getset[] = {
+    {"policy", (getter)CacheMap_policy, NULL, "Eviction policy.", NULL},
+    {"max_bytes", (getter)CacheMap_max_bytes, NULL,
+     "Max total weight of entries, None if unbounded.", NULL},
+    {"weight", (getter)CacheMap_weight, NULL, "Total weight of entries.",
+     NULL},
+    {NULL, NULL, NULL, NULL, NULL} /* Sentinel */
+};
+
+/* Return 1 if region `r` holds entries of the policy, not ghosts. */
+static int CacheMap_IsLiveRegion(CtsCacheMap *self, int r) {
+  switch (self->policy) {
+  case CacheMap_POLICY_WTINYLFU:
+    return r >= CacheMap_REGION_WINDOW && r <= CacheMap_REGION_PROTECTED;
+  case CacheMap_POLICY_LRU:
+  case CacheMap_POLICY_CLOCK:
+    return r == CacheMap_REGION_QUEUE;
+  case CacheMap_POLICY_ARC:
+    return r == CacheMap_REGION_T1 || r == CacheMap_REGION_T2;
+  case CacheMap_POLICY_S3FIFO:
+    return r == CacheMap_REGION_SMALL || r == CacheMap_REGION_MAIN;
+  default:
+    return r == CacheMap_REGION_SAMPLED;
+  }
+}
+
+/* New reference, a flat list of key and entry pairs in the order of the
+ * policy, so they are linked back alike by appending. */
+static PyObject *CacheMap_Ordered(CtsCacheMap *self) {
+  PyObject *list = PyList_New(0);
+  CtsCacheMapEntry *entry;
+  ReturnIfNULL(list, NULL);
+  for (Py_ssize_t i = 0; i < self->nslots; i++) {
+    entry = self->slots[i];
+    if (PyList_Append(list, entry->key) ||
+        PyList_Append(list, (PyObject *)entry)) {
+      Py_DECREF(list);
+      return NULL;
+    }
+  }
+  for (int r = 1; r <= CacheMap_NUM_LISTS; r++) {
+    if (!CacheMap_IsLiveRegion(self, r)) {
+      continue;
+    }
+    for (entry = CacheMap_List(self, r)->head; entry; entry = entry->next) {
+      if (PyList_Append(list, entry->key) ||
+          PyList_Append(list, (PyObject *)entry)) {
+        Py_DECREF(list);
+        return NULL;
+      }
+    }
+  }
+  return list;
+}
+
+/* Snapshot record of an entry: region, visits, key and value. */
+static PyObject *CacheMap_dump(CtsCacheMap *self, CtsArg_PARAMS) {
+  PyObject *argv[2], *ordered;
+  CtsCacheMapEntry *entry;
+  CtsSnapWriter w;
+  Py_ssize_t n;
+  char meta[1 + sizeof(uint32_t)];
+  int failed;
+
+  static const char *const kwlist[] = {"path", "serializer", NULL};
+  static CtsArg_Parser parser = {"dump", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  ordered = CacheMap_Ordered(self);
+  ReturnIfNULL(ordered, NULL);
+  n = PyList_GET_SIZE(ordered) / 2;
+  if (CtsSnap_OpenWriter(&w, argv[0], argv[1] == Py_None ? NULL : argv[1])) {
+    Py_DECREF(ordered);
+    return NULL;
+  }
+  failed = CtsSnap_WriteHeader(&w, CtsSnap_KIND_CACHEMAP,
+                               (uint8_t)self->policy, n, self->arc_p);
+  /* the serializer may change the cache, the list keeps entries alive */
+  for (Py_ssize_t i = 0; i < n && !failed; i++) {
+    entry = (CtsCacheMapEntry *)PyList_GET_ITEM(ordered, 2 * i + 1);
+    meta[0] = entry->region;
+    memcpy(meta + 1, &entry->visits, sizeof(uint32_t));
+    failed = CtsSnap_Write(&w, meta, sizeof(meta)) ||
+             CtsSnap_WriteObject(&w, PyList_GET_ITEM(ordered, 2 * i)) ||
+             CtsSnap_WriteObject(&w, entry->ma_value);
+  }
+  Py_DECREF(ordered);
+  if (CtsSnap_CloseWriter(&w, failed)) {
+    return NULL;
+  }
+  return PyLong_FromSsize_t(n);
+}
+
+/* Link an entry of a snapshot written under the policy of this cache back
+ * to its region, keeping its visits. */
+static int CacheMap_Restore(CtsCacheMap *self, PyObject *key, PyObject *value,
+                            char region, uint32_t visits) {
+  CtsCacheMapEntry *entry, *old;
+  Py_ssize_t weight = CacheMap_Weigh(self, value);
+  if (weight < 0) {
+    return -1;
+  }
+  if (region == CacheMap_REGION_SAMPLED && CacheMap_ReserveSlot(self)) {
+    return -1;
+  }
+  entry = CacheEntry_New(value);
+  ReturnIfNULL(entry, -1);
+  entry->key = key;
+  entry->visits = visits;
+  /* one lookup for the common case of a new key */
+  old = (CtsCacheMapEntry *)PyDict_SetDefault(self->dict, key,
+                                              (PyObject *)entry);
+  if (old == NULL ||
+      (old != entry && (CacheMap_DelEntry(self, old) ||
+                        PyDict_SetItem(self->dict, key, (PyObject *)entry)))) {
+    Py_DECREF(entry);
+    return -1;
+  }
+  Py_DECREF(entry);
+  entry->weight = weight;
+  self->weight += weight;
+  if (CtsDisk_Enabled(&self->disk) && CtsDisk_Forget(&self->disk, key)) {
+    return -1;
+  }
+  if (self->policy == CacheMap_POLICY_WTINYLFU) {
+    entry->hash = PyObject_Hash(key);
+  }
+  if (region == CacheMap_REGION_SAMPLED) {
+    entry->index = self->nslots;
+    self->slots[self->nslots++] = entry;
+    entry->region = region;
+  } else {
+    CacheMap_MoveTo(self, entry, region);
+  }
+  return 0;
+}
+
+/* W-TinyLFU keeps no count in entries, seed the sketch with one access of
+ * each restored key and move overflowing keys out of the window. */
+static int CacheMap_RestoreSketch(CtsCacheMap *self) {
+  Py_ssize_t size = CacheMap_Size(self);
+  CtsCacheMapEntry *entry;
+  if (Sketch_Ensure(&self->sketch,
+                    size < self->capacity ? size : self->capacity)) {
+    return -1;
+  }
+  for (int r = CacheMap_REGION_WINDOW; r <= CacheMap_REGION_PROTECTED; r++) {
+    for (entry = CacheMap_List(self, r)->head; entry; entry = entry->next) {
+      Sketch_Increment(&self->sketch, entry->hash);
+    }
+  }
+  return TinyLFU_Maintain(self);
+}
+
+static PyObject *CacheMap_load(CtsCacheMap *self, CtsArg_PARAMS) {
+  PyObject *argv[2], *key = NULL, *value = NULL;
+  CtsSnapReader r;
+  CtsSnapHeader h;
+  uint64_t i;
+  uint32_t visits;
+  char meta[1 + sizeof(uint32_t)];
+  int same, failed = 0;
+
+  static const char *const kwlist[] = {"path", "serializer", NULL};
+  static CtsArg_Parser parser = {"load", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  if (CtsSnap_OpenReader(&r, argv[0], argv[1] == Py_None ? NULL : argv[1])) {
+    return NULL;
+  }
+  if (CtsSnap_ReadHeader(&r, CtsSnap_KIND_CACHEMAP, &h)) {
+    CtsSnap_CloseReader(&r);
+    return NULL;
+  }
+  /* entries of another policy are set like new ones */
+  same = h.policy == (uint8_t)self->policy;
+  for (i = 0; i < h.count && !failed; i++) {
+    if (CtsSnap_Read(&r, meta, sizeof(meta)) ||
+        (key = CtsSnap_ReadObject(&r)) == NULL ||
+        (value = CtsSnap_ReadObject(&r)) == NULL) {
+      failed = 1;
+    } else if (same && !CacheMap_IsLiveRegion(self, meta[0])) {
+      PyErr_Format(PyExc_ValueError, "snapshot %R is corrupted", argv[0]);
+      failed = 1;
+    } else if (same) {
+      memcpy(&visits, meta + 1, sizeof(uint32_t));
+      failed = CacheMap_Restore(self, key, value, meta[0], visits);
+    } else {
+      failed = CacheMap_SetItem(self, key, value);
+    }
+    Py_CLEAR(key);
+    Py_CLEAR(value);
+  }
+  CtsSnap_CloseReader(&r);
+  if (same && self->policy == CacheMap_POLICY_ARC) {
+    self->arc_p = h.extra < self->capacity ? (Py_ssize_t)h.extra
+                                           : self->capacity;
+  }
+  if (same && !failed && self->policy == CacheMap_POLICY_WTINYLFU) {
+    failed = CacheMap_RestoreSketch(self);
+  }
+  /* the snapshot may be of a larger cache */
+  if (CacheMap_EvictTo(self, self->capacity) || CacheMap_Flush(self) ||
+      failed) {
+    return NULL;
+  }
+  return PyLong_FromSsize_t((Py_ssize_t)i);
+}
+
 /* tp_methods */
 static PyMethodDef CacheMap_methods[] = {
-    {"evict", (PyCFunction)CacheMap_evict, METH_NOARGS,
-     "evict()\n--\n\nEvict a item. raise error if no item in cache."},
+    {"evict", (PyCFunction)CacheMap_evict, CtsArg_METH,
+     "evict(n=1)\n--\n\nEvict up to ``n`` items chosen by the policy, "
+     "return the number evicted."},
     {
         "set_capacity",
         (PyCFunction)CacheMap_set_capacity,
@@ -695,30 +2308,46 @@ static PyMethodDef CacheMap_methods[] = {
     },
     {"hit_info", (PyCFunction)CacheMap_hit_info, METH_NOARGS,
      "hit_info()\n--\n\nReturn capacity, hits, and misses count."},
+    {"stats", (PyCFunction)CacheMap_stats, CtsArg_METH,
+     "stats(reset=False)\n--\n\nReturn a dict of hits, misses, evictions, "
+     "expirations, insertions and latency histograms, with counters of "
+     "the disk tier under ``l2`` and memory pressure under ``memory``, "
+     "reset all of them at once if ``reset`` is true."},
     {"next_evict_key", (PyCFunction)CacheMap_NextEvictKey, METH_NOARGS,
      "next_evict_key()\n--\n\nReturn the most unused key."},
-    {"get", (PyCFunction)CacheMap_get, METH_VARARGS | METH_KEYWORDS,
+    {"get", (PyCFunction)CacheMap_get, CtsArg_METH,
      "get(key, default=None)\n--\n\nGet item from cache."},
-    {"setdefault", (PyCFunction)CacheMap_setdefault,
-     METH_VARARGS | METH_KEYWORDS,
-     "setdefault(key, default=None, /)\n--\n\nGet item in cache, if key not "
+    {"set", (PyCFunction)CacheMap_set, CtsArg_METH,
+     "set(key, value, weight=None)\n--\n\nSet item to cache, ``weight`` "
+     "overrides the weight given by ``sizeof``."},
+    {"get_many", (PyCFunction)CacheMap_get_many, CtsArg_METH,
+     CACHE_GET_MANY_METHOD_DOC},
+    {"set_many", (PyCFunction)CacheMap_set_many, METH_O,
+     CACHE_SET_MANY_METHOD_DOC},
+    {"delete_many", (PyCFunction)CacheMap_delete_many, METH_O,
+     CACHE_DELETE_MANY_METHOD_DOC},
+    {"dump", (PyCFunction)CacheMap_dump, CtsArg_METH, CACHE_DUMP_METHOD_DOC},
+    {"load", (PyCFunction)CacheMap_load, CtsArg_METH, CACHE_LOAD_METHOD_DOC},
+    {"setdefault", (PyCFunction)CacheMap_setdefault, CtsArg_METH,
+     "setdefault(key, default=None)\n--\n\nGet item in cache, if key not "
      "exists, set default to cache and return it."},
-    {"pop", (PyCFunction)CacheMap_pop, METH_VARARGS | METH_KEYWORDS,
-     "pop(key, default=None, /)\n--\n\nPop an item from cache, if key not "
+    {"pop", (PyCFunction)CacheMap_pop, CtsArg_METH,
+     "pop(key, default=None)\n--\n\nPop an item from cache, if key not "
      "exists return default."},
     {
         "popitem",
         (PyCFunction)CacheMap_popitem,
         METH_NOARGS,
-        "popitem()\n--\n\nRemove and return some (key, value) pair"
-        "as a 2-tuple; but raise KeyError if mapping is empty.",
+        "popitem()\n--\n\nRemove and return the (key, value) pair the "
+        "policy would evict next; but raise KeyError if mapping is empty.",
     },
     {"keys", (PyCFunction)CacheMap_keys, METH_NOARGS,
-     "keys()\n--\n\nIter keys."},
+     "keys()\n--\n\nA view of keys, reading it is not counted as hits."},
     {"values", (PyCFunction)CacheMap_values, METH_NOARGS,
-     "values()\n--\n\nIter values."},
+     "values()\n--\n\nA view of values, reading it is not counted as hits."},
     {"items", (PyCFunction)CacheMap_items, METH_NOARGS,
-     "items()\n--\n\nIter keys and values."},
+     "items()\n--\n\nA view of (key, value) pairs, reading it is not "
+     "counted as hits."},
     {"update", (PyCFunction)CacheMap_update, METH_VARARGS | METH_KEYWORDS,
      "update(map, /)\n--\n\nUpdate item to cache. Unlike dict.update, only "
      "accept a dict object."},
@@ -726,25 +2355,20 @@ static PyMethodDef CacheMap_methods[] = {
         "clear",
         (PyCFunction)CacheMap_clear,
         METH_NOARGS,
-        "clear()\n--\n\nClean cache.",
+        "clear()\n--\n\nClean cache, stats are kept.",
     },
     {
         "setnx",
         (PyCFunction)CacheMap_setnx,
-        METH_VARARGS | METH_KEYWORDS,
-        USUAL_SETNX_METHOD_DOC,
+        CtsArg_METH,
+        CACHE_SETNX_METHOD_DOC,
     },
     {"_storage", (PyCFunction)CacheMap__storage, METH_NOARGS, NULL},
     {NULL, NULL, 0, NULL} /* Sentinel */
 };
 
 static PyObject *CacheMap_tp_iter(CtsCacheMap *self) {
-  PyObject *keys, *it;
-  keys = CacheMap_keys(self);
-  ReturnIfNULL(keys, NULL);
-  it = PySeqIter_New(keys);
-  Py_DECREF(keys);
-  return it;
+  return CacheMapIter_New(self, CacheMapView_KEYS);
 }
 
 static PyObject *CacheMap_tp_richcompare(PyObject *self, PyObject *other,
@@ -762,13 +2386,60 @@ static PyObject *CacheMap_tp_richcompare(PyObject *self, PyObject *other,
 }
 
 PyDoc_STRVAR(CacheMap__doc__,
-             "CacheMap(capacity=None, )\n--\n\n"
+             "CacheMap(capacity=None, policy='lfu', max_bytes=None,\n"
+             "         sizeof=None, latency=False, on_evict=None,\n"
+             "         l2_path=None, l2_max_bytes=1073741824,\n"
+             "         memory_high=None, memory_limit=None)\n"
+             "--\n\n"
              "A fast LFU (least frequently used) mapping.\n"
              "\n"
              "Parameters\n"
              "----------\n"
              "capacity : int, optional\n"
              "  Max size of cache, default is  C ``INT32_MAX``.\n"
+             "policy : str, optional\n"
+             "  Eviction policy, all of them cost O(1) per operation.\n"
+             "\n"
+             "  - ``'lfu'`` evicts the least used of a few sampled keys.\n"
+             "  - ``'wtinylfu'`` only admits a new key if it is estimated to\n"
+             "    be used more often than the key it replaces, which keeps\n"
+             "    one-off scans from flushing the cache.\n"
+             "  - ``'lru'`` evicts the least recently used key.\n"
+             "  - ``'arc'`` adaptive replacement cache, balances recency and\n"
+             "    frequency by the history of evicted keys.\n"
+             "  - ``'s3fifo'`` a small FIFO queue filtering keys used once,\n"
+             "    in front of a main FIFO queue with second chance.\n"
+             "  - ``'clock'`` a cheap approximation of LRU.\n"
+             "max_bytes : int, optional\n"
+             "  Max total weight of values, unbounded by default.\n"
+             "sizeof : typing.Callable[[typing.Any], int], optional\n"
+             "  Return weight of a value, default is ``value.__sizeof__()``.\n"
+             "latency : bool, optional\n"
+             "  Record latency histograms of get and set in :meth:`stats`.\n"
+             "on_evict : typing.Callable[[list], typing.Any], optional\n"
+             "  Called with a list of ``(key, value, 'evicted')`` tuples\n"
+             "  after an operation evicted entries.\n"
+             "l2_path : str or os.PathLike, optional\n"
+             "  File of a second tier on local disk. Evicted items of bytes,\n"
+             "  str or int keys and bytes values are appended to it, a miss\n"
+             "  in memory reads the key back from the file and moves it to\n"
+             "  memory again. ``len``, ``in`` and iteration only see items\n"
+             "  in memory. The file is truncated when the cache is created.\n"
+             "l2_max_bytes : int, optional\n"
+             "  Size of the file, used as a ring, the oldest records are\n"
+             "  overwritten first. Default is 1 GiB.\n"
+             "memory_high : float, optional\n"
+             "  Shrink the cache when memory usage is above this fraction of\n"
+             "  ``memory_limit``. Usage is read every 256 insertions, under\n"
+             "  pressure the capacity is lowered to 7/8 of the size and\n"
+             "  entries are evicted by the policy, it grows back by 1/8 per\n"
+             "  reading below 0.9 of the watermark. Freed memory is not\n"
+             "  always given back to the system, so usage may stay high\n"
+             "  after a shrink. Disabled by default.\n"
+             "memory_limit : int, optional\n"
+             "  Limit of the resident set size of the process in bytes.\n"
+             "  Default is ``memory.max`` of the cgroup v2 of the process,\n"
+             "  compared with its ``memory.current``.\n"
              "\n"
              "Examples\n"
              "--------\n"
@@ -813,7 +2484,7 @@ static PyTypeObject CacheMap_Type = {
     0,                                       /* tp_iternext */
     CacheMap_methods,                        /* tp_methods */
     0,                                       /* tp_members */
-    0,                                       /* tp_getset */
+    CacheMap_getset,                         /* tp_getset */
     0,                                       /* tp_base */
     0,                                       /* tp_dict */
     0,                                       /* tp_descr_get */
@@ -825,8 +2496,28 @@ static PyTypeObject CacheMap_Type = {
 };
 
 EXTERN_C_START
+int CtsCacheMap_Check(PyObject *ob) { return Py_TYPE(ob) == &CacheMap_Type; }
+
+PyObject *CtsCacheMap_Lookup(PyObject *ob, PyObject *key) {
+  return CacheMap_Find((CtsCacheMap *)ob, key);
+}
+
+int CtsCacheMap_Store(PyObject *ob, PyObject *key, PyObject *value) {
+  return CacheMap_TimedSetItem((CtsCacheMap *)ob, key, value, -1);
+}
+
+PyObject *CtsCacheMap_FreeListStats(void) {
+  return CtsFreeList_AsDict(&CacheEntry_freelist);
+}
+
+void CtsCacheMap_FreeListClear(void) {
+  CtsFreeList_Clear(&CacheEntry_freelist, &CacheEntry_Type);
+}
+
 int ctools_init_cachemap(PyObject *module) {
-  if (PyType_Ready(&CacheMap_Type) < 0) {
+  if (PyType_Ready(&CacheMap_Type) < 0 ||
+      PyType_Ready(&CacheMapView_Type) < 0 ||
+      PyType_Ready(&CacheMapIter_Type) < 0) {
     return -1;
   }
 
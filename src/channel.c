@@ -14,256 +14,571 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include "args.h"
+#include "atomic.h"
 #include "core.h"
 
 #include <Python.h>
+#include <string.h>
 #include <time.h>
+#ifdef MS_WINDOWS
+#include <windows.h>
+#endif
+
+#define Channel_MODE_GIL 0
+#define Channel_MODE_SPSC 1
+#define Channel_MODE_MPMC 2
+
+typedef struct {
+  size_t seq;
+  PyObject *item;
+} CtsChannelCell;
+
+/* Lock-free ring used by spsc and mpmc mode.
+ * Producer and consumer indices live in their own cache line so that
+ * the two sides never write the same line.
+ * spsc: classic single producer/single consumer ring, each side keeps a
+ *       cached copy of the other's index to avoid reading the shared line.
+ * mpmc: Dmitry Vyukov's bounded queue, every cell carries a sequence number.
+ */
+typedef struct {
+  size_t tail; /* next position to send */
+  size_t cached_head;
+  char _pad0[CTS_CACHELINE - 2 * sizeof(size_t)];
+  size_t head; /* next position to receive */
+  size_t cached_tail;
+  char _pad1[CTS_CACHELINE - 2 * sizeof(size_t)];
+  size_t mask;
+  PyObject **items;      /* spsc */
+  CtsChannelCell *cells; /* mpmc */
+  void *raw_slots;
+} CtsChannelRing;
+
+/* Growable ring used by gil mode.
+ * Slots are allocated on demand, doubling up to `limit` items, and halved
+ * again when the occupancy drops to a quarter, so an unbounded channel only
+ * costs memory proportional to what it holds.
+ */
+typedef struct {
+  PyObject **items;
+  Py_ssize_t allocated;
+  Py_ssize_t head;
+  Py_ssize_t count;
+  Py_ssize_t limit;
+  size_t popped; /* items removed from the head, position of the head */
+} CtsChannelBuffer;
+
+#define ChannelBuffer_MIN_ALLOC 8
+
+/* A thread blocked in select(), woken by releasing `lock`. */
+typedef struct {
+  PyThread_type_lock lock;
+  int signaled;
+} CtsChannelWaiter;
+
+/* Link of a waiter in the wait list of one channel. */
+typedef struct _cts_channel_wait_node {
+  CtsChannelWaiter *waiter;
+  struct _cts_channel_wait_node *prev;
+  struct _cts_channel_wait_node *next;
+} CtsChannelWaitNode;
 
 typedef struct {
   /* clang-format off */
   PyObject_VAR_HEAD
-  PyObject **ob_item;
+  CtsChannelBuffer buffer;
   /* clang-format on */
-  /* cursor between [0, 2 * size), if cursor >= size, set flag to 1
-   * if flag <= 0; channel is closed
-   * when sendx == recvx; rflag == sflag -> channel is empty
-   *                      rflag != sflag -> channel is full
-   *
-   */
-  int sendx;
-  int recvx;
+  /* if flag < 0; channel is closed */
   char sflag;
   char rflag;
+  char mode;
+  CtsChannelWaitNode *waiters; /* threads blocked in select() */
+  CtsChannelRing *ring;        /* NULL in gil mode */
+  void *raw_ring;
 } CtsChannel;
 
+#define Channel_IsLockFree(ch) ((ch)->mode != Channel_MODE_GIL)
+
 static PyTypeObject Channel_Type;
 
-static CtsChannel *Channel_New(int size) {
-  CtsChannel *op;
-  int i;
-  assert(size > 0);
-  /* check for overflow. */
-  if ((Py_ssize_t)size > (Py_ssize_t)((PY_SSIZE_T_MAX - sizeof(CtsChannel)) /
-                                      sizeof(PyObject *))) {
-    PyErr_NoMemory();
-    return NULL;
+/* Wake every thread waiting on this channel. Must hold the GIL. */
+static void ChannelWaiters_Notify(CtsChannelWaitNode *node) {
+  for (; node != NULL; node = node->next) {
+    if (!node->waiter->signaled) {
+      node->waiter->signaled = 1;
+      PyThread_release_lock(node->waiter->lock);
+    }
   }
+}
 
-  op = PyObject_GC_New(CtsChannel, &Channel_Type);
-  ReturnIfNULL(op, NULL);
-
-  op->ob_item = (PyObject **)PyMem_Calloc(size, sizeof(PyObject *));
-  if (op->ob_item == NULL) {
-    Py_DECREF(op);
-    PyErr_NoMemory();
-    return NULL;
+static void ChannelWaiters_Add(CtsChannelWaitNode **head,
+                               CtsChannelWaitNode *node) {
+  node->prev = NULL;
+  node->next = *head;
+  if (*head != NULL) {
+    (*head)->prev = node;
   }
+  *head = node;
+}
 
-  for (i = 0; i < size; i++)
-    op->ob_item[i] = NULL;
-
-  op->sendx = 0;
-  op->recvx = 0;
-  if (IsPowerOf2(size)) {
-    op->sflag = 3;
-    op->rflag = 3;
+static void ChannelWaiters_Remove(CtsChannelWaitNode **head,
+                                  CtsChannelWaitNode *node) {
+  if (node->prev != NULL) {
+    node->prev->next = node->next;
   } else {
-    op->sflag = 1;
-    op->rflag = 1;
+    *head = node->next;
+  }
+  if (node->next != NULL) {
+    node->next->prev = node->prev;
   }
-
-  Py_SIZE(op) = size;
-  PyObject_GC_Track(op);
-  return op;
 }
 
-static void Channel_tp_dealloc(CtsChannel *ob) {
-  int i;
-  int len = Py_SIZE(ob);
-  PyObject_GC_UnTrack(ob);
-  /* clang-format off */
-  Py_TRASHCAN_SAFE_BEGIN(ob)
-      if (len > 0) {
-        i = len;
-        while (--i >= 0)
-          Py_XDECREF(ob->ob_item[i]);
-      }
-      PyMem_FREE(ob->ob_item);
-      PyObject_GC_Del(ob);
-  Py_TRASHCAN_SAFE_END(ob)
-  /* clang-format on */
+static void ChannelBuffer_Init(CtsChannelBuffer *buf, Py_ssize_t limit) {
+  buf->items = NULL;
+  buf->allocated = 0;
+  buf->head = 0;
+  buf->count = 0;
+  buf->limit = limit;
+  buf->popped = 0;
 }
 
-static int Channel_tp_traverse(CtsChannel *o, visitproc visit, void *arg) {
-  int i;
-  for (i = Py_SIZE(o); --i >= 0;) {
-    Py_VISIT(o->ob_item[i]);
+/* Move items to a new array of `allocated` slots, in order from index 0. */
+static int ChannelBuffer_Resize(CtsChannelBuffer *buf, Py_ssize_t allocated) {
+  PyObject **items;
+  Py_ssize_t i, idx;
+  assert(allocated >= buf->count);
+  items = PyMem_New(PyObject *, allocated);
+  if (items == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  for (i = 0; i < buf->count; i++) {
+    idx = buf->head + i;
+    if (idx >= buf->allocated) {
+      idx -= buf->allocated;
+    }
+    items[i] = buf->items[idx];
   }
+  PyMem_Free(buf->items);
+  buf->items = items;
+  buf->allocated = allocated;
+  buf->head = 0;
   return 0;
 }
 
-static int Channel_tp_clear(CtsChannel *op) {
-  int i;
-  PyObject **item = op->ob_item;
-  if (item != NULL) {
-    /* Because XDECREF can recursively invoke operations on
-       this list, we make it empty first. */
-    i = Py_SIZE(op);
-    Py_SIZE(op) = 0;
-    op->ob_item = NULL;
-    op->sendx = 0;
-    op->recvx = 0;
-    op->sflag = 0;
-    op->rflag = 0;
-    while (--i >= 0) {
-      Py_XDECREF(item[i]);
-    }
-    PyMem_FREE(item);
-  }
-  /* Never fails; the return value can be ignored.
-     Note that there is no guarantee that the list is actually empty
-     at this point, because XDECREF may have populated it again! */
-  return 0;
+#define ChannelBuffer_IsFull(buf) ((buf)->count >= (buf)->limit)
+
+/* Return 1 if obj is pushed, 0 if buffer is full, -1 on memory error. */
+static int ChannelBuffer_Push(CtsChannelBuffer *buf, PyObject *obj) {
+  Py_ssize_t idx, allocated;
+  if (ChannelBuffer_IsFull(buf)) {
+    return 0;
+  }
+  if (buf->count == buf->allocated) {
+    allocated = buf->allocated ? buf->allocated : ChannelBuffer_MIN_ALLOC / 2;
+    allocated = allocated > buf->limit / 2 ? buf->limit : allocated * 2;
+    if (ChannelBuffer_Resize(buf, allocated)) {
+      return -1;
+    }
+  }
+  idx = buf->head + buf->count;
+  if (idx >= buf->allocated) {
+    idx -= buf->allocated;
+  }
+  Py_INCREF(obj);
+  buf->items[idx] = obj;
+  buf->count++;
+  return 1;
 }
 
-static PyObject *Channel_tp_new(PyTypeObject *Py_UNUSED(type), PyObject *args,
-                                PyObject *Py_UNUSED(kwds)) {
-  int size = INT32_MAX;
-  if (!PyArg_ParseTuple(args, "|i", &size)) {
+/* Borrowed reference of the oldest item, NULL if empty. */
+#define ChannelBuffer_Peek(buf)                                                \
+  ((buf)->count ? (buf)->items[(buf)->head] : NULL)
+
+/* Return the oldest item as new reference, NULL if empty. */
+static PyObject *ChannelBuffer_Pop(CtsChannelBuffer *buf) {
+  PyObject *item;
+  if (buf->count == 0) {
     return NULL;
   }
-  if (size <= 0) {
-    PyErr_SetString(PyExc_ValueError, "size should be positive.");
-    return NULL;
+  item = buf->items[buf->head];
+  buf->items[buf->head] = NULL;
+  buf->head++;
+  if (buf->head == buf->allocated) {
+    buf->head = 0;
   }
-  return (PyObject *)Channel_New(size);
+  buf->count--;
+  buf->popped++;
+  if (buf->count == 0) {
+    buf->head = 0;
+  }
+  /* shrink is best effort, keep the old array on failure */
+  if (buf->allocated > ChannelBuffer_MIN_ALLOC &&
+      buf->count <= buf->allocated / 4) {
+    if (ChannelBuffer_Resize(buf, buf->allocated / 2)) {
+      PyErr_Clear();
+    }
+  }
+  return item;
 }
 
-static PyObject *Channel_clear(CtsChannel *self, PyObject *Py_UNUSED(u)) {
-  PyObject **buffer = self->ob_item;
-  Py_ssize_t size;
-  size = Py_SIZE(self);
-  for (Py_ssize_t i = 0; i < size; ++i) {
-    if (buffer[i] != NULL) {
-      Py_DECREF(buffer[i]);
-      buffer[i] = NULL;
+/* Release all items and the slots. */
+static void ChannelBuffer_Clear(CtsChannelBuffer *buf) {
+  PyObject **items = buf->items;
+  Py_ssize_t i, idx, count = buf->count, head = buf->head,
+                     allocated = buf->allocated;
+  /* Because DECREF can recursively invoke operations on
+     this buffer, we make it empty first. */
+  buf->items = NULL;
+  buf->allocated = 0;
+  buf->head = 0;
+  buf->count = 0;
+  buf->popped += (size_t)count;
+  for (i = 0; i < count; i++) {
+    idx = head + i;
+    if (idx >= allocated) {
+      idx -= allocated;
     }
+    Py_DECREF(items[idx]);
   }
-  Py_RETURN_NONE;
+  PyMem_Free(items);
 }
 
-static void Channel_incr_sendx(CtsChannel *self) {
-  assert(self->sflag > 0);
-  if (self->sflag == 3) {
-    self->sendx = (self->sendx + 1) & (2 * Py_SIZE(self) - 1);
-    return;
-  }
-  int sendx;
-  sendx = self->sendx + 1;
-  if (sendx >= 2 * Py_SIZE(self)) {
-    sendx %= 2 * Py_SIZE(self);
-  }
-  if (sendx >= Py_SIZE(self)) {
-    self->sflag = 2;
-  } else {
-    self->sflag = 1;
+static int ChannelBuffer_Traverse(CtsChannelBuffer *buf, visitproc visit,
+                                  void *arg) {
+  Py_ssize_t i, idx;
+  for (i = 0; i < buf->count; i++) {
+    idx = buf->head + i;
+    if (idx >= buf->allocated) {
+      idx -= buf->allocated;
+    }
+    Py_VISIT(buf->items[idx]);
   }
-  self->sendx = sendx;
+  return 0;
 }
 
-static void Channel_incr_recvx(CtsChannel *self) {
-  assert(self->rflag > 0);
-  if (self->rflag == 3) {
-    self->recvx = (self->recvx + 1) & (2 * Py_SIZE(self) - 1);
-    return;
+static int ChannelRing_Init(CtsChannel *ch, Py_ssize_t size) {
+  CtsChannelRing *ring;
+  size_t capacity = 1;
+  size_t i;
+  while ((Py_ssize_t)capacity < size) {
+    capacity <<= 1;
+  }
+  if (capacity > (size_t)PY_SSIZE_T_MAX / sizeof(CtsChannelCell)) {
+    PyErr_NoMemory();
+    return -1;
   }
-  int recvx;
-  recvx = self->recvx + 1;
-  if (recvx >= 2 * Py_SIZE(self)) {
-    recvx %= 2 * Py_SIZE(self);
+  ring = (CtsChannelRing *)Cts_AlignedCalloc(sizeof(CtsChannelRing),
+                                             &ch->raw_ring);
+  if (ring == NULL) {
+    PyErr_NoMemory();
+    return -1;
   }
-  if (recvx >= Py_SIZE(self)) {
-    self->rflag = 2;
+  ring->mask = capacity - 1;
+  if (ch->mode == Channel_MODE_SPSC) {
+    ring->items = (PyObject **)Cts_AlignedCalloc(capacity * sizeof(PyObject *),
+                                                 &ring->raw_slots);
   } else {
-    self->rflag = 1;
+    ring->cells = (CtsChannelCell *)Cts_AlignedCalloc(
+        capacity * sizeof(CtsChannelCell), &ring->raw_slots);
+    if (ring->cells != NULL) {
+      for (i = 0; i < capacity; i++) {
+        ring->cells[i].seq = i;
+      }
+    }
+  }
+  if (ring->raw_slots == NULL) {
+    PyMem_Free(ch->raw_ring);
+    ch->raw_ring = NULL;
+    PyErr_NoMemory();
+    return -1;
   }
-  self->recvx = recvx;
+  ch->ring = ring;
+  Py_SET_SIZE(ch, (Py_ssize_t)capacity);
+  return 0;
 }
 
-static int Channel_send_idx(CtsChannel *self) {
-  if (self->sflag < 0) {
-    return -2;
+/* Return 1 if obj is sent, 0 if the ring is full. Steals nothing. */
+static int ChannelRing_Send(CtsChannel *ch, PyObject *obj) {
+  CtsChannelRing *ring = ch->ring;
+  size_t pos, seq;
+  Py_ssize_t dif;
+  CtsChannelCell *cell;
+
+  if (ch->mode == Channel_MODE_SPSC) {
+    pos = Cts_AtomicLoadRelaxed(&ring->tail);
+    if (pos - ring->cached_head > ring->mask) {
+      ring->cached_head = Cts_AtomicLoadAcquire(&ring->head);
+      if (pos - ring->cached_head > ring->mask) {
+        return 0;
+      }
+    }
+    Py_INCREF(obj);
+    ring->items[pos & ring->mask] = obj;
+    Cts_AtomicStoreRelease(&ring->tail, pos + 1);
+    return 1;
   }
 
-  if (Py_SIZE(self) == 1) {
-    if (self->ob_item[0] == NULL) {
+  pos = Cts_AtomicLoadRelaxed(&ring->tail);
+  for (;;) {
+    cell = &ring->cells[pos & ring->mask];
+    seq = Cts_AtomicLoadAcquire(&cell->seq);
+    dif = (Py_ssize_t)(seq - pos);
+    if (dif == 0) {
+      if (Cts_AtomicCAS(&ring->tail, &pos, pos + 1)) {
+        break;
+      }
+    } else if (dif < 0) {
       return 0;
     } else {
-      return -1;
+      pos = Cts_AtomicLoadRelaxed(&ring->tail);
     }
+    Cts_CpuRelax();
   }
+  Py_INCREF(obj);
+  cell->item = obj;
+  Cts_AtomicStoreRelease(&cell->seq, pos + 1);
+  return 1;
+}
 
-  /* size is 2**n */
-  if (self->sflag == 3) {
-    /* Is it full? */
-    if (self->sendx == (self->recvx ^ Py_SIZE(self))) {
-      return -1;
+/* Return a new reference of the received item, NULL if the ring is empty.
+ * Error is never set. */
+static PyObject *ChannelRing_Recv(CtsChannel *ch) {
+  CtsChannelRing *ring = ch->ring;
+  size_t pos, seq;
+  Py_ssize_t dif;
+  CtsChannelCell *cell;
+  PyObject *item;
+
+  if (ch->mode == Channel_MODE_SPSC) {
+    pos = Cts_AtomicLoadRelaxed(&ring->head);
+    if (pos == ring->cached_tail) {
+      ring->cached_tail = Cts_AtomicLoadAcquire(&ring->tail);
+      if (pos == ring->cached_tail) {
+        return NULL;
+      }
     }
-    return self->sendx & (Py_SIZE(self) - 1);
+    item = ring->items[pos & ring->mask];
+    ring->items[pos & ring->mask] = NULL;
+    Cts_AtomicStoreRelease(&ring->head, pos + 1);
+    return item;
   }
 
-  if ((self->sendx % Py_SIZE(self)) != (self->recvx % Py_SIZE(self))) {
-    return self->sendx % Py_SIZE(self);
+  pos = Cts_AtomicLoadRelaxed(&ring->head);
+  for (;;) {
+    cell = &ring->cells[pos & ring->mask];
+    seq = Cts_AtomicLoadAcquire(&cell->seq);
+    dif = (Py_ssize_t)(seq - (pos + 1));
+    if (dif == 0) {
+      if (Cts_AtomicCAS(&ring->head, &pos, pos + 1)) {
+        break;
+      }
+    } else if (dif < 0) {
+      return NULL;
+    } else {
+      pos = Cts_AtomicLoadRelaxed(&ring->head);
+    }
+    Cts_CpuRelax();
   }
+  item = cell->item;
+  cell->item = NULL;
+  Cts_AtomicStoreRelease(&cell->seq, pos + ring->mask + 1);
+  return item;
+}
 
-  /* flag not equal means that channel is full */
-  if (abs(self->rflag) != self->sflag) {
-    return -1;
+/* spsc only. Borrowed reference of the next item without consuming it. */
+static PyObject *ChannelRing_Peek(CtsChannel *ch) {
+  CtsChannelRing *ring = ch->ring;
+  size_t pos;
+  assert(ch->mode == Channel_MODE_SPSC);
+  pos = Cts_AtomicLoadRelaxed(&ring->head);
+  if (pos == ring->cached_tail) {
+    ring->cached_tail = Cts_AtomicLoadAcquire(&ring->tail);
+    if (pos == ring->cached_tail) {
+      return NULL;
+    }
   }
-  return self->sendx % Py_SIZE(self);
+  return ring->items[pos & ring->mask];
 }
 
-static int Channel_recv_idx(CtsChannel *self) {
-  if (self->rflag < 0) {
-    return -2;
+static int ChannelRing_Sendable(CtsChannel *ch) {
+  CtsChannelRing *ring = ch->ring;
+  size_t pos;
+  if (ch->mode == Channel_MODE_SPSC) {
+    pos = Cts_AtomicLoadRelaxed(&ring->tail);
+    return pos - Cts_AtomicLoadAcquire(&ring->head) <= ring->mask;
   }
+  pos = Cts_AtomicLoadRelaxed(&ring->tail);
+  return Cts_AtomicLoadAcquire(&ring->cells[pos & ring->mask].seq) == pos;
+}
 
-  if (Py_SIZE(self) == 1) {
-    if (self->ob_item[0] == NULL) {
-      return -1;
+static int ChannelRing_Recvable(CtsChannel *ch) {
+  CtsChannelRing *ring = ch->ring;
+  size_t pos;
+  if (ch->mode == Channel_MODE_SPSC) {
+    pos = Cts_AtomicLoadRelaxed(&ring->head);
+    return pos != Cts_AtomicLoadAcquire(&ring->tail);
+  }
+  pos = Cts_AtomicLoadRelaxed(&ring->head);
+  return Cts_AtomicLoadAcquire(&ring->cells[pos & ring->mask].seq) == pos + 1;
+}
+
+static void ChannelRing_Drain(CtsChannel *ch) {
+  PyObject *item;
+  while ((item = ChannelRing_Recv(ch)) != NULL) {
+    Py_DECREF(item);
+  }
+}
+
+static void ChannelRing_Free(CtsChannel *ch) {
+  if (ch->ring == NULL) {
+    return;
+  }
+  ChannelRing_Drain(ch);
+  PyMem_Free(ch->ring->raw_slots);
+  PyMem_Free(ch->raw_ring);
+  ch->ring = NULL;
+  ch->raw_ring = NULL;
+}
+
+static int ChannelRing_Traverse(CtsChannel *ch, visitproc visit, void *arg) {
+  CtsChannelRing *ring = ch->ring;
+  size_t i;
+  if (ring == NULL) {
+    return 0;
+  }
+  for (i = 0; i <= ring->mask; i++) {
+    if (ch->mode == Channel_MODE_SPSC) {
+      Py_VISIT(ring->items[i]);
     } else {
-      return 0;
+      Py_VISIT(ring->cells[i].item);
     }
   }
+  return 0;
+}
 
-  /* size is 2**n */
-  if (self->rflag == 3) {
-    /* Is it empty? */
-    if (self->sendx == self->recvx) {
-      return -1;
-    }
-    return self->recvx & (Py_SIZE(self) - 1);
+static CtsChannel *Channel_NewLockFree(int size, char mode) {
+  CtsChannel *op;
+  assert(size > 0);
+  op = PyObject_GC_New(CtsChannel, &Channel_Type);
+  ReturnIfNULL(op, NULL);
+  ChannelBuffer_Init(&op->buffer, 0);
+  op->sflag = 1;
+  op->rflag = 1;
+  op->mode = mode;
+  op->ring = NULL;
+  op->raw_ring = NULL;
+  op->waiters = NULL;
+  Py_SET_SIZE(op, 0);
+  if (ChannelRing_Init(op, size)) {
+    Py_DECREF(op);
+    return NULL;
   }
+  PyObject_GC_Track(op);
+  return op;
+}
+
+static CtsChannel *Channel_New(int size) {
+  CtsChannel *op;
+  assert(size > 0);
+
+  op = PyObject_GC_New(CtsChannel, &Channel_Type);
+  ReturnIfNULL(op, NULL);
+
+  ChannelBuffer_Init(&op->buffer, size);
+  op->sflag = 1;
+  op->rflag = 1;
+  op->mode = Channel_MODE_GIL;
+  op->ring = NULL;
+  op->raw_ring = NULL;
+  op->waiters = NULL;
+
+  Py_SET_SIZE(op, size);
+  PyObject_GC_Track(op);
+  return op;
+}
 
-  if ((self->sendx % Py_SIZE(self)) != (self->recvx % Py_SIZE(self))) {
-    return self->recvx % Py_SIZE(self);
+static void Channel_tp_dealloc(CtsChannel *ob) {
+  PyObject_GC_UnTrack(ob);
+  /* clang-format off */
+  Py_TRASHCAN_SAFE_BEGIN(ob)
+      ChannelRing_Free(ob);
+      ChannelBuffer_Clear(&ob->buffer);
+      PyObject_GC_Del(ob);
+  Py_TRASHCAN_SAFE_END(ob)
+  /* clang-format on */
+}
+
+static int Channel_tp_traverse(CtsChannel *o, visitproc visit, void *arg) {
+  if (Channel_IsLockFree(o)) {
+    return ChannelRing_Traverse(o, visit, arg);
   }
+  return ChannelBuffer_Traverse(&o->buffer, visit, arg);
+}
 
-  /* flag equal means that channel is empty */
-  if (abs(self->sflag) == self->rflag) {
-    return -1;
+static int Channel_tp_clear(CtsChannel *op) {
+  if (Channel_IsLockFree(op)) {
+    ChannelRing_Drain(op);
+    return 0;
   }
-  return self->recvx % Py_SIZE(self);
+  ChannelBuffer_Clear(&op->buffer);
+  return 0;
+}
+
+static PyObject *Channel_tp_new(PyTypeObject *Py_UNUSED(type), PyObject *args,
+                                PyObject *kwds) {
+  PyObject *size_obj = NULL;
+  const char *mode = NULL;
+  long size = INT32_MAX;
+  static char *kwlist[] = {"size", "mode", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oz", kwlist, &size_obj,
+                                   &mode)) {
+    return NULL;
+  }
+  if (size_obj != NULL && size_obj != Py_None) {
+    size = PyLong_AsLong(size_obj);
+    if (size == -1 && PyErr_Occurred()) {
+      return NULL;
+    }
+  }
+  if (size > INT32_MAX) {
+    PyErr_SetString(PyExc_OverflowError, "size is greater than MAX_INT32.");
+    return NULL;
+  }
+  if (size <= 0) {
+    PyErr_SetString(PyExc_ValueError, "size should be positive.");
+    return NULL;
+  }
+  if (mode == NULL || strcmp(mode, "gil") == 0) {
+    return (PyObject *)Channel_New((int)size);
+  }
+  if (strcmp(mode, "spsc") != 0 && strcmp(mode, "mpmc") != 0) {
+    PyErr_Format(PyExc_ValueError, "unsupported channel mode: %s", mode);
+    return NULL;
+  }
+  if (size_obj == NULL || size_obj == Py_None) {
+    PyErr_SetString(PyExc_ValueError, "size is required in lock-free mode.");
+    return NULL;
+  }
+  return (PyObject *)Channel_NewLockFree(
+      (int)size, mode[0] == 's' ? Channel_MODE_SPSC : Channel_MODE_MPMC);
+}
+
+static PyObject *Channel_clear(CtsChannel *self, PyObject *Py_UNUSED(u)) {
+  if (Channel_IsLockFree(self)) {
+    ChannelRing_Drain(self);
+    Py_RETURN_NONE;
+  }
+  ChannelBuffer_Clear(&self->buffer);
+  Py_RETURN_NONE;
 }
 
 static PyObject *Channel_recv(PyObject *self, PyObject *Py_UNUSED(u)) {
   PyObject *item;
   PyObject *rv;
-  int recvx;
   CtsChannel *ch = (CtsChannel *)self;
 
-  recvx = Channel_recv_idx(ch);
-  if (recvx == -2) {
+  if (ch->rflag < 0) {
     PyErr_SetString(PyExc_IndexError, "channel is closed for receiving.");
     return NULL;
   }
@@ -272,17 +587,18 @@ static PyObject *Channel_recv(PyObject *self, PyObject *Py_UNUSED(u)) {
     return NULL;
   }
 
-  if (recvx == -1) {
+  if (Channel_IsLockFree(ch)) {
+    item = ChannelRing_Recv(ch);
+  } else {
+    item = ChannelBuffer_Pop(&ch->buffer);
+  }
+  if (item == NULL) {
     Py_INCREF(Py_None);
     Py_INCREF(Py_False);
     PyTuple_SET_ITEM(rv, 0, Py_None);
     PyTuple_SET_ITEM(rv, 1, Py_False);
     return rv;
   }
-  item = ch->ob_item[recvx];
-  assert(item);
-  ch->ob_item[recvx] = NULL;
-  Channel_incr_recvx(ch);
 
   Py_INCREF(Py_True);
   PyTuple_SET_ITEM(rv, 0, item);
@@ -292,31 +608,37 @@ static PyObject *Channel_recv(PyObject *self, PyObject *Py_UNUSED(u)) {
 
 static PyObject *Channel_send(PyObject *self, PyObject *obj) {
   CtsChannel *ch = (CtsChannel *)self;
-  int sendx;
+  int ok;
 
-  sendx = Channel_send_idx(ch);
-  if (sendx == -2) {
+  if (ch->sflag < 0) {
     PyErr_SetString(PyExc_IndexError, "channel is closed for sending.");
     return NULL;
   }
 
-  if (sendx == -1) {
-    Py_RETURN_FALSE;
+  if (Channel_IsLockFree(ch)) {
+    ok = ChannelRing_Send(ch, obj);
+  } else {
+    ok = ChannelBuffer_Push(&ch->buffer, obj);
   }
-  assert(ch->ob_item[sendx] == NULL);
-  Py_INCREF(obj);
-  ch->ob_item[sendx] = obj;
-  Channel_incr_sendx(ch);
-  Py_RETURN_TRUE;
+  if (ok < 0) {
+    return NULL;
+  }
+  if (ok && ch->waiters) {
+    ChannelWaiters_Notify(ch->waiters);
+  }
+  return PyBool_FromLong(ok);
 }
 
-static PyObject *Channel_close(PyObject *self, PyObject *args, PyObject *kwds) {
+static PyObject *Channel_close(PyObject *self, CtsArg_PARAMS) {
   CtsChannel *ch;
+  PyObject *argv[2];
   int write, read;
   write = 1;
   read = 1;
-  static char *kwlist[] = {"send", "recv", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|pp", kwlist, &write, &read)) {
+  static const char *const kwlist[] = {"send", "recv", NULL};
+  static CtsArg_Parser parser = {"close", kwlist, 0, 2};
+  if (CtsArg_UNPACK(&parser, argv) || CtsArg_Bool(argv[0], &write) ||
+      CtsArg_Bool(argv[1], &read)) {
     return NULL;
   }
 
@@ -327,6 +649,7 @@ static PyObject *Channel_close(PyObject *self, PyObject *args, PyObject *kwds) {
   if (read) {
     ch->rflag *= -1;
   }
+  ChannelWaiters_Notify(ch->waiters);
   Py_RETURN_NONE;
 }
 
@@ -334,70 +657,119 @@ static PyObject *Channel_safe_consume(PyObject *self, PyObject *callback) {
   PyObject *item;
   PyObject *callback_rv;
   CtsChannel *ch = (CtsChannel *)self;
-  int recvx;
+  size_t pos;
 
   if (!(PyCallable_Check(callback))) {
     PyErr_SetString(PyExc_TypeError, "object is not callable");
     return NULL;
   }
 
-  recvx = Channel_recv_idx(ch);
+  if (ch->mode == Channel_MODE_MPMC) {
+    PyErr_SetString(PyExc_TypeError,
+                    "safe_consume is not supported in mpmc mode.");
+    return NULL;
+  }
 
-  if (recvx == -2) {
+  if (ch->mode == Channel_MODE_SPSC) {
+    if (ch->rflag < 0) {
+      PyErr_SetString(PyExc_RuntimeError, "channel is closed for receiving.");
+      return NULL;
+    }
+    item = ChannelRing_Peek(ch);
+    if (item == NULL) {
+      Py_RETURN_FALSE;
+    }
+    pos = Cts_AtomicLoadRelaxed(&ch->ring->head);
+    Py_INCREF(item);
+    callback_rv = PyObject_CallFunctionObjArgs(callback, item, NULL);
+    Py_DECREF(item);
+    if (callback_rv == NULL || callback_rv == Py_False) {
+      return callback_rv;
+    }
+    /* single consumer: only the callback may have moved the head */
+    if (Cts_AtomicLoadRelaxed(&ch->ring->head) == pos) {
+      Py_XDECREF(ChannelRing_Recv(ch));
+    }
+    return callback_rv;
+  }
+
+  if (ch->rflag < 0) {
     PyErr_SetString(PyExc_RuntimeError, "channel is closed for receiving.");
     return NULL;
   }
 
-  if (recvx == -1) {
+  item = ChannelBuffer_Peek(&ch->buffer);
+  if (item == NULL) {
     Py_RETURN_FALSE;
   }
 
-  item = ch->ob_item[recvx];
-  assert(item);
+  pos = ch->buffer.popped;
   Py_INCREF(item);
   callback_rv = PyObject_CallFunctionObjArgs(callback, item, NULL);
-  if (callback_rv == NULL) {
-    Py_DECREF(item);
-    return NULL;
-  }
-  if (callback_rv == Py_False) {
-    Py_DECREF(item);
+  Py_DECREF(item);
+  if (callback_rv == NULL || callback_rv == Py_False) {
     return callback_rv;
   }
 
-  Py_DECREF(item);
-  Py_DECREF(item);
-  ch->ob_item[recvx] = NULL;
-  Channel_incr_recvx(ch);
+  /* callback may have consumed the channel itself, the same object may
+   * have been sent again since */
+  if (ch->buffer.popped == pos && ch->buffer.count) {
+    Py_DECREF(ChannelBuffer_Pop(&ch->buffer));
+  }
   return callback_rv;
 }
 
 static PyObject *Channel_sendable(PyObject *self, PyObject *Py_UNUSED(unused)) {
   CtsChannel *ch = (CtsChannel *)self;
-  int sendx;
-  sendx = Channel_send_idx(ch);
-
-  if (sendx == -2 || sendx == -1) {
-    Py_RETURN_FALSE;
+  if (Channel_IsLockFree(ch)) {
+    return PyBool_FromLong(ch->sflag > 0 && ChannelRing_Sendable(ch));
   }
-  Py_RETURN_TRUE;
+  return PyBool_FromLong(ch->sflag > 0 && !ChannelBuffer_IsFull(&ch->buffer));
 }
 
 static PyObject *Channel_recvable(PyObject *self, PyObject *Py_UNUSED(unused)) {
   CtsChannel *ch = (CtsChannel *)self;
-  int recvx;
-  recvx = Channel_recv_idx(ch);
-
-  if (recvx == -2 || recvx == -1) {
-    Py_RETURN_FALSE;
+  if (Channel_IsLockFree(ch)) {
+    return PyBool_FromLong(ch->rflag > 0 && ChannelRing_Recvable(ch));
   }
-  Py_RETURN_TRUE;
+  return PyBool_FromLong(ch->rflag > 0 && ch->buffer.count > 0);
 }
 
 static PyObject *Channel_size(PyObject *self, PyObject *Py_UNUSED(unused)) {
   return PyLong_FromLong(Py_SIZE(self));
 }
 
+static PyObject *Channel_sizeof(CtsChannel *self,
+                                PyObject *Py_UNUSED(unused)) {
+  Py_ssize_t res = Py_TYPE(self)->tp_basicsize;
+  if (self->ring != NULL) {
+    res += sizeof(CtsChannelRing);
+    if (self->mode == Channel_MODE_SPSC) {
+      res += (self->ring->mask + 1) * sizeof(PyObject *);
+    } else {
+      res += (self->ring->mask + 1) * sizeof(CtsChannelCell);
+    }
+  }
+  res += self->buffer.allocated * sizeof(PyObject *);
+  return PyLong_FromSsize_t(res);
+}
+
+static PyObject *Channel_mode(CtsChannel *self, void *Py_UNUSED(closure)) {
+  switch (self->mode) {
+  case Channel_MODE_SPSC:
+    return PyUnicode_FromString("spsc");
+  case Channel_MODE_MPMC:
+    return PyUnicode_FromString("mpmc");
+  default:
+    return PyUnicode_FromString("gil");
+  }
+}
+
+static PyGetSetDef Channel_getset[] = {
+    {"mode", (getter)Channel_mode, NULL, "Channel mode.", NULL},
+    {NULL, NULL, NULL, NULL, NULL} /* Sentinel */
+};
+
 PyDoc_STRVAR(Channel_send__doc__, "send(obj, /)\n--\n\n"
                                   "Send an object to channel.\n"
                                   "\n"
@@ -451,7 +823,7 @@ static PyMethodDef Channel_methods[] = {
         METH_NOARGS,
         "clear()\n--\n\nClear channel.",
     },
-    {"close", (PyCFunction)Channel_close, METH_VARARGS | METH_KEYWORDS,
+    {"close", (PyCFunction)Channel_close, CtsArg_METH,
      "close(send=True, recv=True)\n--\n\nClose channel."},
     {
         "safe_consume",
@@ -465,17 +837,29 @@ static PyMethodDef Channel_methods[] = {
      "recvable()\n--\n\nReturn channel is available to receive."},
     {"size", (PyCFunction)Channel_size, METH_NOARGS,
      "size()\n--\n\nReturn the size of channel."},
+    {"__sizeof__", (PyCFunction)Channel_sizeof, METH_NOARGS,
+     "__sizeof__()\n--\n\nReturn memory used by channel in bytes."},
     {NULL, NULL, 0, NULL} /* Sentinel */
 };
 
 PyDoc_STRVAR(Channel_Doc,
-             "Channel(size=None, /)\n--\n\n"
+             "Channel(size=None, mode=None)\n--\n\n"
              "A channel support sending and safe consuming.\n"
              "\n"
              "Parameters\n"
              "----------\n"
              "size : int, optional\n"
-             "  The max size of channel, default to C ``MAX_INT32``.\n"
+             "  The max size of channel, default to C ``MAX_INT32``. In gil\n"
+             "  mode slots are allocated on demand.\n"
+             "mode : {'gil', 'spsc', 'mpmc'}, optional\n"
+             "  ``gil`` (default) relies on the GIL for thread safety.\n"
+             "  ``spsc`` is a lock-free single producer/single consumer\n"
+             "  ring and ``mpmc`` a lock-free bounded multi producer/multi\n"
+             "  consumer ring. Methods still run with the GIL held, the rings\n"
+             "  trade on demand growth for a fixed array and separate cache\n"
+             "  lines for producers and consumers. Lock-free modes require\n"
+             "  ``size``, which is rounded up to a power of 2.\n"
+             "  ``mpmc`` does not support :meth:`safe_consume`.\n"
              "\n"
              "Examples\n"
              "--------\n"
@@ -522,7 +906,7 @@ static PyTypeObject Channel_Type = {
     0,                                       /* tp_iternext */
     Channel_methods,                         /* tp_methods */
     0,                                       /* tp_members */
-    0,                                       /* tp_getset */
+    Channel_getset,                          /* tp_getset */
     0,                                       /* tp_base */
     0,                                       /* tp_dict */
     0,                                       /* tp_descr_get */
@@ -534,6 +918,619 @@ static PyTypeObject Channel_Type = {
     PyObject_GC_Del                          /* tp_free */
 };
 
+#define PriorityChannel_MAX_LANES 32
+#define PriorityChannel_DEFAULT_LANES 4
+
+/* Index of the highest set bit, x must not be 0. */
+static inline int highest_bit(uint32_t x) {
+  assert(x);
+#if defined(__GNUC__) || defined(__clang__)
+  return 31 - __builtin_clz(x);
+#elif defined(_MSC_VER)
+  unsigned long idx;
+  _BitScanReverse(&idx, x);
+  return (int)idx;
+#else
+  int idx = 0;
+  while (x >>= 1) {
+    idx++;
+  }
+  return idx;
+#endif
+}
+
+typedef struct {
+  /* clang-format off */
+  PyObject_HEAD
+  CtsChannelBuffer *lanes;
+  /* clang-format on */
+  int nlanes;
+  /* bit i is set when lane i is not empty */
+  uint32_t bitmap;
+  Py_ssize_t size;
+  Py_ssize_t count;
+  char sflag;
+  char rflag;
+  CtsChannelWaitNode *waiters; /* threads blocked in select() */
+} CtsPriorityChannel;
+
+static PyTypeObject PriorityChannel_Type;
+
+static PyObject *PriorityChannel_tp_new(PyTypeObject *Py_UNUSED(type),
+                                        PyObject *args, PyObject *kwds) {
+  CtsPriorityChannel *op;
+  PyObject *size_obj = Py_None;
+  Py_ssize_t size = INT32_MAX;
+  int nlanes = PriorityChannel_DEFAULT_LANES;
+  int i;
+  static char *kwlist[] = {"size", "lanes", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oi", kwlist, &size_obj,
+                                   &nlanes)) {
+    return NULL;
+  }
+  if (size_obj != Py_None) {
+    size = PyLong_AsSsize_t(size_obj);
+    if (size == -1 && PyErr_Occurred()) {
+      return NULL;
+    }
+  }
+  if (size <= 0) {
+    PyErr_SetString(PyExc_ValueError, "size should be positive.");
+    return NULL;
+  }
+  if (nlanes <= 0 || nlanes > PriorityChannel_MAX_LANES) {
+    PyErr_Format(PyExc_ValueError, "lanes should between 1 and %d.",
+                 PriorityChannel_MAX_LANES);
+    return NULL;
+  }
+
+  op = PyObject_GC_New(CtsPriorityChannel, &PriorityChannel_Type);
+  ReturnIfNULL(op, NULL);
+  op->lanes = PyMem_New(CtsChannelBuffer, nlanes);
+  if (op->lanes == NULL) {
+    op->nlanes = 0;
+    Py_DECREF(op);
+    return PyErr_NoMemory();
+  }
+  for (i = 0; i < nlanes; i++) {
+    ChannelBuffer_Init(&op->lanes[i], size);
+  }
+  op->nlanes = nlanes;
+  op->bitmap = 0;
+  op->size = size;
+  op->count = 0;
+  op->sflag = 1;
+  op->rflag = 1;
+  op->waiters = NULL;
+  PyObject_GC_Track(op);
+  return (PyObject *)op;
+}
+
+static int PriorityChannel_tp_traverse(CtsPriorityChannel *self,
+                                       visitproc visit, void *arg) {
+  int i;
+  for (i = 0; i < self->nlanes; i++) {
+    if (ChannelBuffer_Traverse(&self->lanes[i], visit, arg)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int PriorityChannel_tp_clear(CtsPriorityChannel *self) {
+  int i;
+  self->bitmap = 0;
+  self->count = 0;
+  for (i = 0; i < self->nlanes; i++) {
+    ChannelBuffer_Clear(&self->lanes[i]);
+  }
+  return 0;
+}
+
+static void PriorityChannel_tp_dealloc(CtsPriorityChannel *self) {
+  PyObject_GC_UnTrack(self);
+  PriorityChannel_tp_clear(self);
+  PyMem_Free(self->lanes);
+  PyObject_GC_Del(self);
+}
+
+/* New reference of the oldest item of a non-empty lane. */
+static PyObject *PriorityChannel_PopLane(CtsPriorityChannel *self, int lane) {
+  PyObject *item;
+  item = ChannelBuffer_Pop(&self->lanes[lane]);
+  assert(item);
+  if (self->lanes[lane].count == 0) {
+    self->bitmap &= ~((uint32_t)1 << lane);
+  }
+  self->count--;
+  return item;
+}
+
+/* New reference of the item with highest priority, NULL if empty. */
+static PyObject *PriorityChannel_Pop(CtsPriorityChannel *self) {
+  if (self->bitmap == 0) {
+    return NULL;
+  }
+  return PriorityChannel_PopLane(self, highest_bit(self->bitmap));
+}
+
+static PyObject *PriorityChannel_send(CtsPriorityChannel *self,
+                                      CtsArg_PARAMS) {
+  PyObject *obj, *argv[2];
+  long priority = 0;
+  int ok;
+  static const char *const kwlist[] = {"obj", "priority", NULL};
+  static CtsArg_Parser parser = {"send", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  obj = argv[0];
+  if (argv[1]) {
+    priority = PyLong_AsLong(argv[1]);
+    if (priority == -1 && PyErr_Occurred()) {
+      return NULL;
+    }
+  }
+  if (priority < 0 || priority >= self->nlanes) {
+    PyErr_Format(PyExc_ValueError, "priority should between 0 and %d.",
+                 self->nlanes - 1);
+    return NULL;
+  }
+  if (self->sflag < 0) {
+    PyErr_SetString(PyExc_IndexError, "channel is closed for sending.");
+    return NULL;
+  }
+  if (self->count >= self->size) {
+    Py_RETURN_FALSE;
+  }
+  ok = ChannelBuffer_Push(&self->lanes[priority], obj);
+  if (ok < 0) {
+    return NULL;
+  }
+  assert(ok);
+  self->bitmap |= (uint32_t)1 << priority;
+  self->count++;
+  if (self->waiters) {
+    ChannelWaiters_Notify(self->waiters);
+  }
+  Py_RETURN_TRUE;
+}
+
+static PyObject *PriorityChannel_recv(CtsPriorityChannel *self,
+                                      PyObject *Py_UNUSED(unused)) {
+  PyObject *item;
+  if (self->rflag < 0) {
+    PyErr_SetString(PyExc_IndexError, "channel is closed for receiving.");
+    return NULL;
+  }
+  item = PriorityChannel_Pop(self);
+  if (item == NULL) {
+    return Py_BuildValue("(OO)", Py_None, Py_False);
+  }
+  return Py_BuildValue("(NO)", item, Py_True);
+}
+
+static PyObject *PriorityChannel_safe_consume(CtsPriorityChannel *self,
+                                              PyObject *callback) {
+  CtsChannelBuffer *buf;
+  PyObject *item;
+  PyObject *callback_rv;
+  size_t pos;
+  int lane;
+
+  if (!(PyCallable_Check(callback))) {
+    PyErr_SetString(PyExc_TypeError, "object is not callable");
+    return NULL;
+  }
+  if (self->rflag < 0) {
+    PyErr_SetString(PyExc_RuntimeError, "channel is closed for receiving.");
+    return NULL;
+  }
+  if (self->bitmap == 0) {
+    Py_RETURN_FALSE;
+  }
+  lane = highest_bit(self->bitmap);
+  buf = &self->lanes[lane];
+  pos = buf->popped;
+  item = ChannelBuffer_Peek(buf);
+  Py_INCREF(item);
+  callback_rv = PyObject_CallFunctionObjArgs(callback, item, NULL);
+  Py_DECREF(item);
+  if (callback_rv == NULL || callback_rv == Py_False) {
+    return callback_rv;
+  }
+  /* pop from the lane of the item, the callback may have consumed it or
+   * sent items of higher priority */
+  if (buf->popped == pos && buf->count) {
+    Py_DECREF(PriorityChannel_PopLane(self, lane));
+  }
+  return callback_rv;
+}
+
+static PyObject *PriorityChannel_close(CtsPriorityChannel *self,
+                                       CtsArg_PARAMS) {
+  int write = 1, read = 1;
+  PyObject *argv[2];
+  static const char *const kwlist[] = {"send", "recv", NULL};
+  static CtsArg_Parser parser = {"close", kwlist, 0, 2};
+  if (CtsArg_UNPACK(&parser, argv) || CtsArg_Bool(argv[0], &write) ||
+      CtsArg_Bool(argv[1], &read)) {
+    return NULL;
+  }
+  if (write) {
+    self->sflag = -1;
+  }
+  if (read) {
+    self->rflag = -1;
+  }
+  ChannelWaiters_Notify(self->waiters);
+  Py_RETURN_NONE;
+}
+
+static PyObject *PriorityChannel_clear(CtsPriorityChannel *self,
+                                       PyObject *Py_UNUSED(unused)) {
+  PriorityChannel_tp_clear(self);
+  Py_RETURN_NONE;
+}
+
+static PyObject *PriorityChannel_sendable(CtsPriorityChannel *self,
+                                          PyObject *Py_UNUSED(unused)) {
+  return PyBool_FromLong(self->sflag > 0 && self->count < self->size);
+}
+
+static PyObject *PriorityChannel_recvable(CtsPriorityChannel *self,
+                                          PyObject *Py_UNUSED(unused)) {
+  return PyBool_FromLong(self->rflag > 0 && self->bitmap != 0);
+}
+
+static PyObject *PriorityChannel_size(CtsPriorityChannel *self,
+                                      PyObject *Py_UNUSED(unused)) {
+  return PyLong_FromSsize_t(self->size);
+}
+
+static PyObject *PriorityChannel_lanes(CtsPriorityChannel *self,
+                                       void *Py_UNUSED(closure)) {
+  return PyLong_FromLong(self->nlanes);
+}
+
+static Py_ssize_t PriorityChannel_length(CtsPriorityChannel *self) {
+  return self->count;
+}
+
+static PySequenceMethods PriorityChannel_as_sequence = {
+    (lenfunc)PriorityChannel_length, /* sq_length */
+};
+
+static PyGetSetDef PriorityChannel_getset[] = {
+    {"lanes", (getter)PriorityChannel_lanes, NULL, "Number of priorities.",
+     NULL},
+    {NULL, NULL, NULL, NULL, NULL} /* Sentinel */
+};
+
+PyDoc_STRVAR(PriorityChannel_send__doc__,
+             "send(obj, priority=0)\n--\n\n"
+             "Send an object to channel.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "obj : object\n"
+             "  The object to send.\n"
+             "priority : int, optional\n"
+             "  Between 0 and ``lanes - 1``, higher is received first.\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "bool\n"
+             "  Return True if send success else False\n"
+             "\n"
+             "Raises\n"
+             "------\n"
+             "IndexError\n"
+             "  If the channel is closing for sending.\n");
+
+static PyMethodDef PriorityChannel_methods[] = {
+    {"send", (PyCFunction)PriorityChannel_send, CtsArg_METH,
+     PriorityChannel_send__doc__},
+    {"recv", (PyCFunction)PriorityChannel_recv, METH_NOARGS,
+     Channel_recv__doc__},
+    {"clear", (PyCFunction)PriorityChannel_clear, METH_NOARGS,
+     "clear()\n--\n\nClear channel."},
+    {"close", (PyCFunction)PriorityChannel_close, CtsArg_METH,
+     "close(send=True, recv=True)\n--\n\nClose channel."},
+    {"safe_consume", (PyCFunction)PriorityChannel_safe_consume, METH_O,
+     Channel_safe_consume__doc__},
+    {"sendable", (PyCFunction)PriorityChannel_sendable, METH_NOARGS,
+     "sendable()\n--\n\nReturn channel is available to send."},
+    {"recvable", (PyCFunction)PriorityChannel_recvable, METH_NOARGS,
+     "recvable()\n--\n\nReturn channel is available to receive."},
+    {"size", (PyCFunction)PriorityChannel_size, METH_NOARGS,
+     "size()\n--\n\nReturn the size of channel."},
+    {NULL, NULL, 0, NULL} /* Sentinel */
+};
+
+PyDoc_STRVAR(PriorityChannel_Doc,
+             "PriorityChannel(size=None, lanes=4)\n--\n\n"
+             "A channel that items with higher priority are received first.\n"
+             "\n"
+             "Items with the same priority are received in sending order.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "size : int, optional\n"
+             "  The max size of channel in total, default to C ``MAX_INT32``."
+             "\n"
+             "lanes : int, optional\n"
+             "  Number of priorities, at most 32.\n"
+             "\n"
+             "Examples\n"
+             "--------\n"
+             ">>> import ctools\n"
+             ">>> ch = ctools.PriorityChannel(2)\n"
+             ">>> ch.send('foo')\n"
+             "True\n"
+             ">>> ch.send('bar', priority=3)\n"
+             "True\n"
+             ">>> ch.recv()\n"
+             "('bar', True)\n");
+
+static PyTypeObject PriorityChannel_Type = {
+    /* clang-format off */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    /* clang-format on */
+    "ctools.PriorityChannel",                  /* tp_name */
+    sizeof(CtsPriorityChannel),                /* tp_basicsize */
+    0,                                         /* tp_itemsize */
+    (destructor)PriorityChannel_tp_dealloc,    /* tp_dealloc */
+    0,                                         /* tp_print */
+    0,                                         /* tp_getattr */
+    0,                                         /* tp_setattr */
+    0,                                         /* tp_compare */
+    0,                                         /* tp_repr */
+    0,                                         /* tp_as_number */
+    &PriorityChannel_as_sequence,              /* tp_as_sequence */
+    0,                                         /* tp_as_mapping */
+    PyObject_HashNotImplemented,               /* tp_hash */
+    0,                                         /* tp_call */
+    0,                                         /* tp_str */
+    0,                                         /* tp_getattro */
+    0,                                         /* tp_setattro */
+    0,                                         /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,   /* tp_flags */
+    PriorityChannel_Doc,                       /* tp_doc */
+    (traverseproc)PriorityChannel_tp_traverse, /* tp_traverse */
+    (inquiry)PriorityChannel_tp_clear,         /* tp_clear */
+    0,                                         /* tp_richcompare */
+    0,                                         /* tp_weaklistoffset */
+    0,                                         /* tp_iter */
+    0,                                         /* tp_iternext */
+    PriorityChannel_methods,                   /* tp_methods */
+    0,                                         /* tp_members */
+    PriorityChannel_getset,                    /* tp_getset */
+    0,                                         /* tp_base */
+    0,                                         /* tp_dict */
+    0,                                         /* tp_descr_get */
+    0,                                         /* tp_descr_set */
+    0,                                         /* tp_dictoffset */
+    0,                                         /* tp_init */
+    0,                                         /* tp_alloc */
+    (newfunc)PriorityChannel_tp_new,           /* tp_new */
+    PyObject_GC_Del                            /* tp_free */
+};
+
+/* Try to receive from a Channel or PriorityChannel.
+ * Return 1 and set `*item` to a new reference on success, 0 if empty and
+ * -1 if the channel is closed for receiving, or empty and closed for
+ * sending so it will never deliver again. */
+static int Channel_TryRecv(PyObject *ob, PyObject **item) {
+  CtsChannel *ch;
+  CtsPriorityChannel *pch;
+  if (Py_TYPE(ob) == &PriorityChannel_Type) {
+    pch = (CtsPriorityChannel *)ob;
+    if (pch->rflag < 0) {
+      return -1;
+    }
+    *item = PriorityChannel_Pop(pch);
+    if (*item == NULL && pch->sflag < 0) {
+      return -1;
+    }
+  } else {
+    ch = (CtsChannel *)ob;
+    if (ch->rflag < 0) {
+      return -1;
+    }
+    if (Channel_IsLockFree(ch)) {
+      *item = ChannelRing_Recv(ch);
+    } else {
+      *item = ChannelBuffer_Pop(&ch->buffer);
+    }
+    if (*item == NULL && ch->sflag < 0) {
+      return -1;
+    }
+  }
+  return *item != NULL;
+}
+
+#define Channel_WaitList(ob)                                                   \
+  (Py_TYPE(ob) == &PriorityChannel_Type                                        \
+       ? &((CtsPriorityChannel *)(ob))->waiters                                \
+       : &((CtsChannel *)(ob))->waiters)
+
+/* Monotonic clock in microseconds. */
+static int64_t Channel_MonotonicUS(void) {
+#ifdef MS_WINDOWS
+  return (int64_t)GetTickCount64() * 1000;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+#ifdef _MSC_VER
+#define Channel_THREAD_LOCAL __declspec(thread)
+#else
+#define Channel_THREAD_LOCAL __thread
+#endif
+
+/* Counter to rotate the first channel examined, so an always ready channel
+ * cannot starve the others. Each thread rotates its own calls. */
+static Channel_THREAD_LOCAL Py_ssize_t select_round = 0;
+
+static PyObject *Channel_select(PyObject *Py_UNUSED(module),
+                                CtsArg_PARAMS) {
+  PyObject *channels, *timeout_obj, *argv[2];
+  PyObject *seq = NULL, *ob, *item = NULL, *rv = NULL;
+  CtsChannelWaiter waiter = {NULL, 0};
+  CtsChannelWaitNode *nodes = NULL;
+  Py_ssize_t n, i, k, start;
+  double timeout = -1;
+  int64_t deadline = -1, now, wait_us;
+  int r, open_count;
+  PyLockStatus st;
+  static const char *const kwlist[] = {"channels", "timeout", NULL};
+  static CtsArg_Parser parser = {"select", kwlist, 1, 2};
+
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  channels = argv[0];
+  timeout_obj = argv[1];
+  if (timeout_obj && timeout_obj != Py_None) {
+    timeout = PyFloat_AsDouble(timeout_obj);
+    if (timeout == -1 && PyErr_Occurred()) {
+      return NULL;
+    }
+    if (timeout < 0) {
+      PyErr_SetString(PyExc_ValueError, "timeout should not be negative.");
+      return NULL;
+    }
+  }
+  /* A private tuple, so channels stay alive while we wait without GIL. */
+  seq = PySequence_Tuple(channels);
+  ReturnIfNULL(seq, NULL);
+  n = PyTuple_GET_SIZE(seq);
+  if (n == 0) {
+    PyErr_SetString(PyExc_ValueError, "channels should not be empty.");
+    goto done;
+  }
+  for (i = 0; i < n; i++) {
+    ob = PyTuple_GET_ITEM(seq, i);
+    if (Py_TYPE(ob) != &Channel_Type && Py_TYPE(ob) != &PriorityChannel_Type) {
+      PyErr_Format(PyExc_TypeError, "expect Channel or PriorityChannel, got %s",
+                   Py_TYPE(ob)->tp_name);
+      goto done;
+    }
+  }
+  if (timeout > 0) {
+    deadline = Channel_MonotonicUS() + (int64_t)(timeout * 1e6);
+  }
+
+  for (;;) {
+    open_count = 0;
+    start = select_round++ % n;
+    for (k = 0; k < n; k++) {
+      ob = PyTuple_GET_ITEM(seq, (start + k) % n);
+      r = Channel_TryRecv(ob, &item);
+      if (r > 0) {
+        rv = Py_BuildValue("(ON)", ob, item);
+        goto done;
+      }
+      if (r == 0) {
+        open_count++;
+      }
+    }
+    if (open_count == 0) {
+      PyErr_SetString(PyExc_IndexError, "all channels are closed.");
+      goto done;
+    }
+    if (timeout == 0) {
+      break;
+    }
+    wait_us = -1;
+    if (deadline >= 0) {
+      now = Channel_MonotonicUS();
+      if (now >= deadline) {
+        break;
+      }
+      wait_us = deadline - now;
+    }
+
+    if (waiter.lock == NULL) {
+      waiter.lock = PyThread_allocate_lock();
+      nodes = PyMem_New(CtsChannelWaitNode, n);
+      if (waiter.lock == NULL || nodes == NULL) {
+        PyErr_NoMemory();
+        goto done;
+      }
+    }
+    /* the lock is held while not signaled, waiting means acquiring again */
+    PyThread_acquire_lock(waiter.lock, WAIT_LOCK);
+    waiter.signaled = 0;
+    for (i = 0; i < n; i++) {
+      nodes[i].waiter = &waiter;
+      ChannelWaiters_Add(Channel_WaitList(PyTuple_GET_ITEM(seq, i)),
+                         &nodes[i]);
+    }
+    Py_BEGIN_ALLOW_THREADS;
+    st = PyThread_acquire_lock_timed(waiter.lock, wait_us, 1);
+    Py_END_ALLOW_THREADS;
+    for (i = 0; i < n; i++) {
+      ChannelWaiters_Remove(Channel_WaitList(PyTuple_GET_ITEM(seq, i)),
+                            &nodes[i]);
+    }
+    /* Leave the lock released. If we timed out after being signaled, the
+     * notifier has released it already. */
+    if (st == PY_LOCK_ACQUIRED || !waiter.signaled) {
+      PyThread_release_lock(waiter.lock);
+    }
+    if (st == PY_LOCK_INTR && PyErr_CheckSignals()) {
+      goto done;
+    }
+  }
+  rv = Py_BuildValue("(OO)", Py_None, Py_None);
+
+done:
+  if (waiter.lock != NULL) {
+    PyThread_free_lock(waiter.lock);
+  }
+  PyMem_Free(nodes);
+  Py_DECREF(seq);
+  return rv;
+}
+
+PyDoc_STRVAR(
+    Channel_select__doc__,
+    "select(channels, timeout=None)\n--\n\n"
+    "Receive an item from the first ready channel.\n"
+    "\n"
+    "Parameters\n"
+    "----------\n"
+    "channels : typing.Iterable[Channel | PriorityChannel]\n"
+    "  Channels to wait on.\n"
+    "timeout : float, optional\n"
+    "  Seconds to wait. ``None`` waits forever and ``0`` never blocks.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+    "channel\n"
+    "  The channel that item is received from, None if timeout.\n"
+    "item\n"
+    "  Received item, None if timeout.\n"
+    "\n"
+    "Raises\n"
+    "------\n"
+    "IndexError\n"
+    "  If all channels are closing for receive, or empty and closing for\n"
+    "  send.\n"
+    "ValueError\n"
+    "  If ``channels`` is empty.\n");
+
+static PyMethodDef Channel_functions[] = {
+    {"select", (PyCFunction)Channel_select, CtsArg_METH,
+     Channel_select__doc__},
+    {NULL, NULL, 0, NULL} /* Sentinel */
+};
+
 EXTERN_C_START
 int ctools_init_channel(PyObject *module) {
   if (PyType_Ready(&Channel_Type) < 0) {
@@ -546,6 +1543,21 @@ int ctools_init_channel(PyObject *module) {
     return -1;
   }
 
+  if (PyType_Ready(&PriorityChannel_Type) < 0) {
+    return -1;
+  }
+
+  Py_INCREF(&PriorityChannel_Type);
+  if (PyModule_AddObject(module, "PriorityChannel",
+                         (PyObject *)&PriorityChannel_Type)) {
+    Py_DECREF(&PriorityChannel_Type);
+    return -1;
+  }
+
+  if (PyModule_AddFunctions(module, Channel_functions)) {
+    return -1;
+  }
+
   return 0;
 }
 EXTERN_C_END
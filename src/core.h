@@ -67,6 +67,19 @@ limitations under the License.
 
 #define PyObjectCast(x) ((PyObject *)(x))
 
+#ifndef Py_SET_SIZE
+#define Py_SET_SIZE(ob, size) (Py_SIZE(ob) = (size))
+#endif
+
+/* Vectorcall is provisional in 3.8, with underscore prefixed names. */
+#if PY_VERSION_HEX >= 0x03080000
+#define CTS_HAVE_VECTORCALL
+#if PY_VERSION_HEX < 0x03090000
+#define PyObject_Vectorcall _PyObject_Vectorcall
+#define Py_TPFLAGS_HAVE_VECTORCALL _Py_TPFLAGS_HAVE_VECTORCALL
+#endif
+#endif
+
 #ifdef __clusplus
 #define EXTERN_C_START extern "C" {
 #define EXTERN_C_END }
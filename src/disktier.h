@@ -0,0 +1,537 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _CTOOLS_DISKTIER_H_
+#define _CTOOLS_DISKTIER_H_
+
+#include "core.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* A second tier of a cache on local disk, holding items evicted from memory.
+ *
+ * Records are appended to a file of `size` bytes used as a ring, and an
+ * index maps the hash of a key to the position of its latest record.
+ * Positions grow forever, the record at `pos` is intact while
+ * `pos >= end - size`, older ones were overwritten by the ring and are
+ * dropped from the index when met. A record is a CtsDiskRecord, the key
+ * as a tag byte and its payload, then the value. Only keys of exact bytes,
+ * str and int of 64 bits with bytes values are written. Slots also keep a
+ * fingerprint of the encoded key, bytes and str of the same text have the
+ * same hash.
+ *
+ * The file is read and written without the GIL. Evicted items are queued
+ * by CtsDisk_Put and written by CtsDisk_Flush, where the cache is in a
+ * consistent state for other threads. The lock allows one file operation
+ * at a time. `fp`, `end` and `epoch` are changed only with both the GIL
+ * and the lock held. The index is only used with the GIL held. A read or
+ * write is discarded if `epoch` changed meanwhile, as the tier was cleared
+ * or closed. */
+
+#define CtsDisk_MIN_SLOTS 64
+
+#define CtsDisk_TAG_BYTES 0
+#define CtsDisk_TAG_STR 1
+#define CtsDisk_TAG_INT 2
+
+#ifdef MS_WINDOWS
+#define CtsDisk_Seek(fp, offset) _fseeki64(fp, offset, SEEK_SET)
+#else
+#define CtsDisk_Seek(fp, offset) fseeko(fp, (off_t)(offset), SEEK_SET)
+#endif
+
+typedef struct {
+  uint32_t klen; /* tag byte included */
+  uint32_t vlen;
+} CtsDiskRecord;
+
+typedef struct {
+  Py_hash_t hash;
+  int64_t pos; /* -1 if the slot is empty */
+  uint32_t fp;
+} CtsDiskSlot;
+
+typedef struct {
+  FILE *fp; /* NULL if the tier is off */
+  PyObject *path;
+  PyObject *pending;       /* key -> value evicted but not written yet */
+  PyThread_type_lock lock; /* kept until CtsDisk_Free */
+  uint64_t epoch;          /* bumped when the tier is cleared or closed */
+  int64_t size;
+  int64_t end; /* position of the next record */
+  CtsDiskSlot *slots;
+  Py_ssize_t mask;
+  Py_ssize_t used;
+  Py_ssize_t hits;
+  Py_ssize_t writes;
+} CtsDiskTier;
+
+#define CtsDisk_Enabled(tier) ((tier)->fp != NULL)
+
+static inline int CtsDisk_OSError(CtsDiskTier *tier) {
+  PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, tier->path);
+  return -1;
+}
+
+static inline void CtsDisk_ResetSlots(CtsDiskTier *tier) {
+  for (Py_ssize_t i = 0; i <= tier->mask; i++) {
+    tier->slots[i].pos = -1;
+  }
+  tier->used = 0;
+}
+
+/* Close the file, the tier is off afterwards. The lock is kept for the
+ * threads that may still wait on it. A lock holder never waits for the GIL,
+ * so it is taken with the GIL held. */
+static inline void CtsDisk_Close(CtsDiskTier *tier) {
+  PyThread_type_lock lock = tier->lock;
+  uint64_t epoch = tier->epoch + 1;
+  if (lock) {
+    PyThread_acquire_lock(lock, WAIT_LOCK);
+  }
+  if (tier->fp) {
+    fclose(tier->fp);
+  }
+  Py_CLEAR(tier->path);
+  Py_CLEAR(tier->pending);
+  PyMem_Free(tier->slots);
+  memset(tier, 0, sizeof(CtsDiskTier));
+  tier->lock = lock;
+  tier->epoch = epoch;
+  if (lock) {
+    PyThread_release_lock(lock);
+  }
+}
+
+/* Close the tier of a cache being deallocated. */
+static inline void CtsDisk_Free(CtsDiskTier *tier) {
+  CtsDisk_Close(tier);
+  if (tier->lock) {
+    PyThread_free_lock(tier->lock);
+    tier->lock = NULL;
+  }
+}
+
+/* Create or truncate the file at `path` for a ring of `size` bytes. */
+static inline int CtsDisk_Open(CtsDiskTier *tier, PyObject *path,
+                               int64_t size) {
+  PyObject *bytes = NULL;
+  CtsDisk_Close(tier);
+  if (tier->lock == NULL && (tier->lock = PyThread_allocate_lock()) == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  if (!PyUnicode_FSConverter(path, &bytes)) {
+    return -1;
+  }
+  tier->slots = PyMem_New(CtsDiskSlot, CtsDisk_MIN_SLOTS);
+  if (tier->slots == NULL) {
+    Py_DECREF(bytes);
+    PyErr_NoMemory();
+    return -1;
+  }
+  tier->mask = CtsDisk_MIN_SLOTS - 1;
+  CtsDisk_ResetSlots(tier);
+  Py_INCREF(path);
+  tier->path = path;
+  tier->size = size;
+  tier->fp = fopen(PyBytes_AS_STRING(bytes), "w+b");
+  Py_DECREF(bytes);
+  if (tier->fp == NULL) {
+    CtsDisk_OSError(tier);
+    CtsDisk_Close(tier);
+    return -1;
+  }
+  return 0;
+}
+
+/* Forget all records, the file is overwritten from the start. */
+static inline void CtsDisk_Clear(CtsDiskTier *tier) {
+  if (CtsDisk_Enabled(tier)) {
+    PyThread_acquire_lock(tier->lock, WAIT_LOCK);
+    CtsDisk_ResetSlots(tier);
+    Py_CLEAR(tier->pending);
+    tier->end = 0;
+    tier->epoch++;
+    PyThread_release_lock(tier->lock);
+  }
+}
+
+#define CtsDisk_Live(tier, slot)                                               \
+  ((slot)->pos >= 0 && (slot)->pos >= (tier)->end - (tier)->size)
+
+/* Index of the slot of a key, -1 if there is none. */
+static inline Py_ssize_t CtsDisk_Find(CtsDiskTier *tier, Py_hash_t hash,
+                                      uint32_t fp) {
+  Py_ssize_t i = (Py_ssize_t)((size_t)hash & (size_t)tier->mask);
+  for (; tier->slots[i].pos >= 0; i = (i + 1) & tier->mask) {
+    if (tier->slots[i].hash == hash && tier->slots[i].fp == fp) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* Empty slot `i`, shifting back the slots probed past it. */
+static inline void CtsDisk_DelSlot(CtsDiskTier *tier, Py_ssize_t i) {
+  Py_ssize_t j = i, home;
+  for (;;) {
+    tier->slots[i].pos = -1;
+    for (;;) {
+      j = (j + 1) & tier->mask;
+      if (tier->slots[j].pos < 0) {
+        tier->used--;
+        return;
+      }
+      home = (Py_ssize_t)((size_t)tier->slots[j].hash & (size_t)tier->mask);
+      /* stop at an entry which may move to `i` */
+      if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+        break;
+      }
+    }
+    tier->slots[i] = tier->slots[j];
+    i = j;
+  }
+}
+
+static inline void CtsDisk_Insert(CtsDiskTier *tier, Py_hash_t hash,
+                                  uint32_t fp, int64_t pos) {
+  Py_ssize_t i = (Py_ssize_t)((size_t)hash & (size_t)tier->mask);
+  while (tier->slots[i].pos >= 0) {
+    i = (i + 1) & tier->mask;
+  }
+  tier->slots[i].hash = hash;
+  tier->slots[i].fp = fp;
+  tier->slots[i].pos = pos;
+  tier->used++;
+}
+
+/* Rebuild the index with room for twice the live records, dropping the
+ * records overwritten by the ring. */
+static inline int CtsDisk_Resize(CtsDiskTier *tier) {
+  CtsDiskSlot *old = tier->slots;
+  Py_ssize_t n = tier->mask + 1, live = 0, size = CtsDisk_MIN_SLOTS;
+  for (Py_ssize_t i = 0; i < n; i++) {
+    live += CtsDisk_Live(tier, &old[i]);
+  }
+  while (size < live * 4) {
+    size *= 2;
+  }
+  tier->slots = PyMem_New(CtsDiskSlot, size);
+  if (tier->slots == NULL) {
+    tier->slots = old;
+    PyErr_NoMemory();
+    return -1;
+  }
+  tier->mask = size - 1;
+  CtsDisk_ResetSlots(tier);
+  for (Py_ssize_t i = 0; i < n; i++) {
+    if (CtsDisk_Live(tier, &old[i])) {
+      CtsDisk_Insert(tier, old[i].hash, old[i].fp, old[i].pos);
+    }
+  }
+  PyMem_Free(old);
+  return 0;
+}
+
+typedef struct {
+  Py_hash_t hash;
+  uint32_t fp; /* FNV-1a of the tag and the payload */
+  uint8_t tag;
+  const char *p;
+  Py_ssize_t n;
+  long long i; /* payload of an int */
+} CtsDiskKey;
+
+/* Encode a key, return 0 if it can not be written or -1 on error. */
+static inline int CtsDisk_EncodeKey(PyObject *key, CtsDiskKey *k) {
+  int overflow;
+  if (PyBytes_CheckExact(key)) {
+    k->tag = CtsDisk_TAG_BYTES;
+    k->p = PyBytes_AS_STRING(key);
+    k->n = PyBytes_GET_SIZE(key);
+  } else if (PyUnicode_CheckExact(key)) {
+    k->tag = CtsDisk_TAG_STR;
+    if ((k->p = PyUnicode_AsUTF8AndSize(key, &k->n)) == NULL) {
+      /* lone surrogates */
+      PyErr_Clear();
+      return 0;
+    }
+  } else if (PyLong_CheckExact(key)) {
+    k->tag = CtsDisk_TAG_INT;
+    k->i = PyLong_AsLongLongAndOverflow(key, &overflow);
+    if (overflow || (k->i == -1 && PyErr_Occurred())) {
+      PyErr_Clear();
+      return 0;
+    }
+    k->p = (const char *)&k->i;
+    k->n = sizeof(k->i);
+  } else {
+    return 0;
+  }
+  if ((k->hash = PyObject_Hash(key)) == -1) {
+    return -1;
+  }
+  k->fp = (2166136261U ^ k->tag) * 16777619U;
+  for (Py_ssize_t j = 0; j < k->n; j++) {
+    k->fp = (k->fp ^ (uint8_t)k->p[j]) * 16777619U;
+  }
+  return 1;
+}
+
+/* New reference to the value queued for `key`, dequeued, NULL without
+ * error if there is none. */
+static inline PyObject *CtsDisk_Dequeue(CtsDiskTier *tier, PyObject *key) {
+  PyObject *value;
+  if (tier->pending == NULL) {
+    return NULL;
+  }
+  value = PyDict_GetItemWithError(tier->pending, key);
+  ReturnIfNULL(value, NULL);
+  Py_INCREF(value);
+  if (PyDict_DelItem(tier->pending, key)) {
+    Py_DECREF(value);
+    return NULL;
+  }
+  return value;
+}
+
+/* Queue an evicted item for CtsDisk_Flush, items of other types are
+ * ignored. */
+static inline int CtsDisk_Put(CtsDiskTier *tier, PyObject *key,
+                              PyObject *value) {
+  CtsDiskKey k;
+  int rv;
+
+  if (!PyBytes_CheckExact(value)) {
+    return 0;
+  }
+  if ((rv = CtsDisk_EncodeKey(key, &k)) <= 0) {
+    return rv;
+  }
+  if (tier->pending == NULL && (tier->pending = PyDict_New()) == NULL) {
+    return -1;
+  }
+  return PyDict_SetItem(tier->pending, key, value);
+}
+
+/* Append a record at the end of the ring, called with the lock held and
+ * without the GIL. Return its position, or -1 with errno set. */
+static inline int64_t CtsDisk_Append(CtsDiskTier *tier, CtsDiskRecord *rec,
+                                     CtsDiskKey *k, const char *value) {
+  int64_t pos = tier->end, len = (int64_t)sizeof(*rec) + rec->klen + rec->vlen;
+  /* a record does not wrap around the end of the ring */
+  if (pos % tier->size + len > tier->size) {
+    pos += tier->size - pos % tier->size;
+  }
+  if (CtsDisk_Seek(tier->fp, pos % tier->size) ||
+      fwrite(rec, sizeof(*rec), 1, tier->fp) != 1 ||
+      fwrite(&k->tag, 1, 1, tier->fp) != 1 ||
+      (k->n && fwrite(k->p, (size_t)k->n, 1, tier->fp) != 1) ||
+      (rec->vlen && fwrite(value, rec->vlen, 1, tier->fp) != 1)) {
+    return -1;
+  }
+  tier->end = pos + len;
+  return pos;
+}
+
+/* Write a queued item, then index it unless the key was set, taken or
+ * forgotten while the GIL was released. */
+static inline int CtsDisk_Write(CtsDiskTier *tier, PyObject *key,
+                                PyObject *value) {
+  CtsDiskRecord rec;
+  CtsDiskKey k;
+  uint64_t epoch = tier->epoch;
+  int64_t pos = -1;
+  Py_ssize_t i;
+  int rv, failed = 0;
+
+  if ((rv = CtsDisk_EncodeKey(key, &k)) <= 0) {
+    return rv;
+  }
+  if ((int64_t)sizeof(rec) + 1 + k.n + PyBytes_GET_SIZE(value) > tier->size ||
+      (uint64_t)k.n >= UINT32_MAX ||
+      (uint64_t)PyBytes_GET_SIZE(value) > UINT32_MAX) {
+    rv = 0;
+  } else {
+    rec.klen = (uint32_t)k.n + 1;
+    rec.vlen = (uint32_t)PyBytes_GET_SIZE(value);
+    /* key and value are immutable and kept alive by the caller */
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(tier->lock, WAIT_LOCK);
+    if (tier->epoch == epoch) {
+      pos = CtsDisk_Append(tier, &rec, &k, PyBytes_AS_STRING(value));
+      failed = pos < 0;
+    }
+    PyThread_release_lock(tier->lock);
+    Py_END_ALLOW_THREADS
+    if (failed) {
+      return CtsDisk_OSError(tier);
+    }
+  }
+  if (tier->epoch != epoch ||
+      PyDict_GetItemWithError(tier->pending, key) != value) {
+    return PyErr_Occurred() ? -1 : 0;
+  }
+  if (PyDict_DelItem(tier->pending, key) || pos < 0) {
+    return PyErr_Occurred() ? -1 : 0;
+  }
+  if ((i = CtsDisk_Find(tier, k.hash, k.fp)) >= 0) {
+    if (tier->slots[i].pos < pos) {
+      tier->slots[i].pos = pos;
+    }
+  } else {
+    CtsDisk_Insert(tier, k.hash, k.fp, pos);
+  }
+  tier->writes++;
+  if (tier->used * 2 > tier->mask) {
+    return CtsDisk_Resize(tier);
+  }
+  return 0;
+}
+
+/* Write the queued items. The GIL is released around each write, so it is
+ * called once the cache is consistent. */
+static inline int CtsDisk_Flush(CtsDiskTier *tier) {
+  PyObject *items, *item;
+  int rv = 0;
+  if (tier->pending == NULL || PyDict_GET_SIZE(tier->pending) == 0) {
+    return 0;
+  }
+  items = PyDict_Items(tier->pending);
+  ReturnIfNULL(items, -1);
+  for (Py_ssize_t i = 0; i < PyList_GET_SIZE(items) && rv == 0; i++) {
+    item = PyList_GET_ITEM(items, i);
+    if (CtsDisk_Enabled(tier)) {
+      rv = CtsDisk_Write(tier, PyTuple_GET_ITEM(item, 0),
+                         PyTuple_GET_ITEM(item, 1));
+    }
+  }
+  Py_DECREF(items);
+  return rv;
+}
+
+/* Drop the record of a key set in memory, without reading it. */
+static inline int CtsDisk_Forget(CtsDiskTier *tier, PyObject *key) {
+  CtsDiskKey k;
+  PyObject *value;
+  Py_ssize_t i;
+  int rv = CtsDisk_EncodeKey(key, &k);
+  if (rv <= 0) {
+    return rv;
+  }
+  value = CtsDisk_Dequeue(tier, key);
+  if (value == NULL && PyErr_Occurred()) {
+    return -1;
+  }
+  Py_XDECREF(value);
+  if ((i = CtsDisk_Find(tier, k.hash, k.fp)) >= 0) {
+    CtsDisk_DelSlot(tier, i);
+  }
+  return 0;
+}
+
+/* Read the record of `k` at `pos`, called with the lock held and without
+ * the GIL. Return 1 and the key and value in `*data` to free with
+ * PyMem_RawFree, 0 if another key is there, -1 with errno set or -2 if out
+ * of memory. */
+static inline int CtsDisk_ReadAt(CtsDiskTier *tier, int64_t pos,
+                                 CtsDiskKey *k, CtsDiskRecord *rec,
+                                 char **data) {
+  size_t n;
+  if (CtsDisk_Seek(tier->fp, pos % tier->size) ||
+      fread(rec, sizeof(*rec), 1, tier->fp) != 1) {
+    return -1;
+  }
+  /* another key of the same hash and fingerprint */
+  if (rec->klen != (uint32_t)k->n + 1) {
+    return 0;
+  }
+  n = (size_t)rec->klen + rec->vlen;
+  if ((*data = PyMem_RawMalloc(n)) == NULL) {
+    return -2;
+  }
+  if (fread(*data, n, 1, tier->fp) != 1) {
+    PyMem_RawFree(*data);
+    return -1;
+  }
+  if ((uint8_t)(*data)[0] != k->tag ||
+      memcmp(*data + 1, k->p, (size_t)k->n) != 0) {
+    PyMem_RawFree(*data);
+    return 0;
+  }
+  return 1;
+}
+
+/* New reference to the value of `key` removed from the tier, NULL without
+ * error if it is not there. */
+static inline PyObject *CtsDisk_Take(CtsDiskTier *tier, PyObject *key) {
+  CtsDiskRecord rec;
+  CtsDiskKey k;
+  PyObject *value = NULL;
+  uint64_t epoch = tier->epoch;
+  int64_t pos;
+  Py_ssize_t i;
+  char *data = NULL;
+  int found = 0;
+
+  if (CtsDisk_EncodeKey(key, &k) <= 0) {
+    return NULL;
+  }
+  /* evicted but not written yet */
+  if ((value = CtsDisk_Dequeue(tier, key)) != NULL) {
+    tier->hits++;
+    return value;
+  }
+  if (PyErr_Occurred() || (i = CtsDisk_Find(tier, k.hash, k.fp)) < 0) {
+    return NULL;
+  }
+  if (!CtsDisk_Live(tier, &tier->slots[i])) {
+    CtsDisk_DelSlot(tier, i);
+    return NULL;
+  }
+  pos = tier->slots[i].pos;
+  /* the key is kept alive by the caller */
+  Py_BEGIN_ALLOW_THREADS
+  PyThread_acquire_lock(tier->lock, WAIT_LOCK);
+  if (tier->epoch == epoch && pos >= tier->end - tier->size) {
+    found = CtsDisk_ReadAt(tier, pos, &k, &rec, &data);
+  }
+  PyThread_release_lock(tier->lock);
+  Py_END_ALLOW_THREADS
+  if (found == -1) {
+    CtsDisk_OSError(tier);
+    return NULL;
+  }
+  if (found == -2) {
+    return PyErr_NoMemory();
+  }
+  if (found == 0) {
+    return NULL;
+  }
+  /* the record is stale if the key was written or forgotten meanwhile */
+  if (tier->epoch == epoch && (i = CtsDisk_Find(tier, k.hash, k.fp)) >= 0 &&
+      tier->slots[i].pos == pos &&
+      (value = PyBytes_FromStringAndSize(data + rec.klen, rec.vlen))) {
+    CtsDisk_DelSlot(tier, i);
+    tier->hits++;
+  }
+  PyMem_RawFree(data);
+  return value;
+}
+
+#endif /* _CTOOLS_DISKTIER_H_ */
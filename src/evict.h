@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _CTOOLS_EVICT_H_
+#define _CTOOLS_EVICT_H_
+
+#include "core.h"
+
+/* Entries dropped by a cache are queued as (key, value, reason) tuples while
+ * an operation runs, and handed to the callback as one list once the cache
+ * is consistent again. */
+#define CtsEvict_EVICTED 0
+#define CtsEvict_EXPIRED 1
+
+static PyObject *CtsEvict_reasons[2] = {NULL, NULL};
+
+static inline int CtsEvict_Push(PyObject **pending, PyObject *key,
+                                PyObject *value, int reason) {
+  PyObject *item;
+  int rv;
+  if (CtsEvict_reasons[reason] == NULL) {
+    CtsEvict_reasons[reason] = PyUnicode_InternFromString(
+        reason == CtsEvict_EXPIRED ? "expired" : "evicted");
+    ReturnIfNULL(CtsEvict_reasons[reason], -1);
+  }
+  if (*pending == NULL && (*pending = PyList_New(0)) == NULL) {
+    return -1;
+  }
+  item = PyTuple_Pack(3, key, value, CtsEvict_reasons[reason]);
+  ReturnIfNULL(item, -1);
+  rv = PyList_Append(*pending, item);
+  Py_DECREF(item);
+  return rv;
+}
+
+/* Deliver the pending batch. The batch is detached first, so the callback
+ * may use the cache again. */
+static inline int CtsEvict_Flush(PyObject **pending, PyObject *callback) {
+  PyObject *batch = *pending, *rv;
+  if (batch == NULL) {
+    return 0;
+  }
+  *pending = NULL;
+  if (callback == NULL) {
+    Py_DECREF(batch);
+    return 0;
+  }
+  rv = PyObject_CallFunctionObjArgs(callback, batch, NULL);
+  Py_DECREF(batch);
+  ReturnIfNULL(rv, -1);
+  Py_DECREF(rv);
+  return 0;
+}
+
+#endif /* _CTOOLS_EVICT_H_ */
@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _CTOOLS_FREELIST_H_
+#define _CTOOLS_FREELIST_H_
+
+#include "core.h"
+
+/* A bounded list of deallocated objects of one GC type, reused by the next
+ * allocations instead of going through the allocator. Free objects are
+ * untracked and linked through their type pointer, like the free list of
+ * float in CPython. */
+
+#define CtsFreeList_MAX 1024
+
+typedef struct {
+  PyObject *head;
+  Py_ssize_t size;      /* objects in the list */
+  Py_ssize_t allocated; /* objects created by the allocator */
+  Py_ssize_t reused;    /* objects taken from the list */
+} CtsFreeList;
+
+/* New untracked object of `type`, the fields past the header are left as
+ * they were. */
+static inline PyObject *CtsFreeList_Alloc(CtsFreeList *list,
+                                          PyTypeObject *type) {
+  PyObject *op = list->head;
+  if (op) {
+    list->head = (PyObject *)op->ob_type;
+    list->size--;
+    list->reused++;
+    return PyObject_Init(op, type);
+  }
+  op = PyObject_GC_New(PyObject, type);
+  ReturnIfNULL(op, NULL);
+  list->allocated++;
+  return op;
+}
+
+/* Keep an untracked object whose references are cleared, or free it if the
+ * list is full. */
+static inline void CtsFreeList_Free(CtsFreeList *list, PyObject *op) {
+  if (list->size >= CtsFreeList_MAX) {
+    PyObject_GC_Del(op);
+    return;
+  }
+  op->ob_type = (PyTypeObject *)list->head;
+  list->head = op;
+  list->size++;
+}
+
+/* Free every object of the list, when the module is freed. The type is
+ * restored first, the allocator finds the GC header by it. */
+static inline void CtsFreeList_Clear(CtsFreeList *list, PyTypeObject *type) {
+  PyObject *op;
+  while ((op = list->head) != NULL) {
+    list->head = (PyObject *)op->ob_type;
+    op->ob_type = type;
+    PyObject_GC_Del(op);
+  }
+  list->size = 0;
+}
+
+static inline PyObject *CtsFreeList_AsDict(CtsFreeList *list) {
+  return Py_BuildValue("{snsnsn}", "allocated", list->allocated, "reused",
+                       list->reused, "size", list->size);
+}
+
+#endif /* _CTOOLS_FREELIST_H_ */
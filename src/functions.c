@@ -14,7 +14,9 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include "args.h"
 #include "core.h"
+#include "module.h"
 
 #include <Python.h>
 #include <datetime.h>
@@ -36,12 +38,31 @@ PyDoc_STRVAR(jump_consistent_hash__doc__,
              "  hash number.\n");
 
 static PyObject *Ctools__jump_hash(PyObject *Py_UNUSED(module),
-                                   PyObject *args) {
+                                   CtsArg_PARAMS) {
   uint64_t key;
-  int32_t num_buckets;
+  long num_buckets;
+  PyObject *argv[2], *index;
 
-  if (!PyArg_ParseTuple(args, "Ki", &key, &num_buckets))
+  static const char *const kwlist[] = {"", "", NULL};
+  static CtsArg_Parser parser = {"jump_consistent_hash", kwlist, 2, 2};
+  if (CtsArg_UNPACK(&parser, argv))
     return NULL;
+  /* like "K", any int or object with __index__, truncated to 64 bits */
+  index = PyNumber_Index(argv[0]);
+  if (index == NULL)
+    return NULL;
+  key = PyLong_AsUnsignedLongLongMask(index);
+  Py_DECREF(index);
+  if (key == (uint64_t)-1 && PyErr_Occurred())
+    return NULL;
+  num_buckets = PyLong_AsLong(argv[1]);
+  if (num_buckets == -1 && PyErr_Occurred())
+    return NULL;
+  if (num_buckets > INT32_MAX || num_buckets < INT32_MIN) {
+    PyErr_SetString(PyExc_OverflowError,
+                    "num_buckets is out of range of a signed 32 bit integer.");
+    return NULL;
+  }
 
   int64_t b = -1, j = 0;
   while (j < num_buckets) {
@@ -166,8 +187,8 @@ PyDoc_STRVAR(strhash__doc__,
              "\n"
              "Parameters\n"
              "----------\n"
-             "s : str\n"
-             "  The string to hash.\n"
+             "s : str or bytes-like object\n"
+             "  The string to hash, str is hashed as UTF-8.\n"
              "method : {'fnv1a', 'fnv1', 'djb2', 'murmur'}, optional\n"
              "  Choice in method, default first when optional.\n"
              "\n"
@@ -181,28 +202,58 @@ PyDoc_STRVAR(strhash__doc__,
              "ValueError"
              "  If method not supported.\n");
 
-static PyObject *Ctools__strhash(PyObject *Py_UNUSED(module), PyObject *args) {
-  const char *s, *method = NULL;
-  Py_ssize_t len = 0, m_len = 0;
-  if (!PyArg_ParseTuple(args, "s#|s#", &s, &len, &method, &m_len))
+/* Like "s#" of PyArg_Parse, str as UTF-8 or any bytes-like object.
+ * Release `view` once its bytes are no longer used. */
+static int Ctools__AsString(PyObject *ob, Py_buffer *view) {
+  const char *s;
+  Py_ssize_t len;
+  if (PyUnicode_Check(ob)) {
+    s = PyUnicode_AsUTF8AndSize(ob, &len);
+    ReturnIfNULL(s, -1);
+    return PyBuffer_FillInfo(view, NULL, (void *)s, len, 1, PyBUF_SIMPLE);
+  }
+  return PyObject_GetBuffer(ob, view, PyBUF_SIMPLE);
+}
+
+static PyObject *Ctools__strhash(PyObject *Py_UNUSED(module), CtsArg_PARAMS) {
+  const char *s, *method = "fnv1a";
+  Py_ssize_t len, m_len = 5;
+  unsigned int h = 0;
+  Py_buffer view, m_view;
+  PyObject *argv[2];
+  static const char *const kwlist[] = {"", "", NULL};
+  static CtsArg_Parser parser = {"strhash", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv) || Ctools__AsString(argv[0], &view))
     return NULL;
-  if (method == NULL)
-    return Py_BuildValue("I", fnv1a(s, len));
-  switch (method[0]) {
-  case 'f':
-    if (m_len == 5) {
-      return Py_BuildValue("I", fnv1a(s, len));
-    } else {
-      return Py_BuildValue("I", fnv1(s, len));
+  if (argv[1]) {
+    if (Ctools__AsString(argv[1], &m_view)) {
+      PyBuffer_Release(&view);
+      return NULL;
     }
+    method = m_view.buf;
+    m_len = m_view.len;
+  }
+  s = view.buf;
+  len = view.len;
+  switch (m_len ? method[0] : 0) {
+  case 'f':
+    h = m_len == 5 ? fnv1a(s, len) : fnv1(s, len);
+    break;
   case 'd':
-    return Py_BuildValue("I", djb2(s, len));
+    h = djb2(s, len);
+    break;
   case 'm':
-    return Py_BuildValue("I", murmur_hash2(s, len));
+    h = murmur_hash2(s, len);
+    break;
   default:
     PyErr_SetString(PyExc_ValueError, "invalid method");
-    return NULL;
   }
+  PyBuffer_Release(&view);
+  if (argv[1]) {
+    PyBuffer_Release(&m_view);
+  }
+  ReturnIfErrorSet(NULL);
+  return Py_BuildValue("I", h);
 }
 
 static PyObject *build_with_debug(PyObject *Py_UNUSED(self),
@@ -214,14 +265,35 @@ static PyObject *build_with_debug(PyObject *Py_UNUSED(self),
 #endif
 }
 
+PyDoc_STRVAR(freelist_stats__doc__,
+             "freelist_stats()\n"
+             "--\n\n"
+             "Return counters of the free lists of cache entries.\n\n"
+             "Entries of evicted, expired and deleted keys of\n"
+             ":class:`CacheMap` and :class:`TTLCache` are kept in a bounded\n"
+             "free list per type and reused by new keys.\n\n"
+             "Returns\n"
+             "-------\n"
+             "dict\n"
+             "  ``allocated``, ``reused`` and ``size`` of the list, keyed by\n"
+             "  ``'CacheMapEntry'`` and ``'TTLCacheEntry'``.\n");
+
+static PyObject *Ctools__freelist_stats(PyObject *Py_UNUSED(module),
+                                        PyObject *Py_UNUSED(unused)) {
+  return Py_BuildValue("{sNsN}", "CacheMapEntry", CtsCacheMap_FreeListStats(),
+                       "TTLCacheEntry", CtsTTLCache_FreeListStats());
+}
+
 static PyMethodDef methods[] = {
-    {"jump_consistent_hash", Ctools__jump_hash, METH_VARARGS,
+    {"jump_consistent_hash", (PyCFunction)Ctools__jump_hash, CtsArg_METH,
      jump_consistent_hash__doc__},
-    {"strhash", Ctools__strhash, METH_VARARGS, strhash__doc__},
+    {"strhash", (PyCFunction)Ctools__strhash, CtsArg_METH, strhash__doc__},
     {"int8_to_datetime", Ctools__int8_to_datetime, METH_O,
      int8_to_datetime__doc__},
     {"build_with_debug", (PyCFunction)build_with_debug, METH_NOARGS,
      "build_with_debug()\n--\n\nReturn if build in debug."},
+    {"freelist_stats", (PyCFunction)Ctools__freelist_stats, METH_NOARGS,
+     freelist_stats__doc__},
     {NULL, NULL, 0, NULL},
 };
 
@@ -0,0 +1,48 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _CTOOLS_HASH_H_
+#define _CTOOLS_HASH_H_
+
+#include "core.h"
+
+#include <string.h>
+
+/* Fibonacci hashing, key * 2**64 / phi. Sequential ids spread over the top
+ * bits. */
+static inline uint64_t CtsHash_Int(int64_t key) {
+  return (uint64_t)key * 0x9E3779B97F4A7C15ULL;
+}
+
+/* Mixes 8 bytes at a time, finished like MurmurHash3. */
+static inline uint64_t CtsHash_Bytes(uint64_t seed, const char *p,
+                                     Py_ssize_t n) {
+  uint64_t h = seed ^ (uint64_t)n, w;
+  for (; n >= 8; p += 8, n -= 8) {
+    memcpy(&w, p, 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+  }
+  w = 0;
+  memcpy(&w, p, (size_t)n);
+  h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  return h ^ (h >> 33);
+}
+
+#endif /* _CTOOLS_HASH_H_ */
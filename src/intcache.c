@@ -0,0 +1,1126 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "args.h"
+#include "batch.h"
+#include "core.h"
+#include "hash.h"
+#include "lfu.h"
+#include "pydoc.h"
+#include "stats.h"
+#include "table.h"
+
+#include <Python.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define IntCache_DEFAULT_TTL 60
+#define IntCache_EMPTY CtsTable_EMPTY
+
+#define NOW() ((int64_t)time(NULL))
+
+/* Keys are stored inline in a dense array of entries, which is found
+ * through an open addressing index of positions. Only values are Python
+ * objects, there is no key object, dict slot or entry object per item. */
+typedef struct {
+  int64_t key;
+  PyObject *value;
+  int64_t expire;  /* IntTTLCache */
+  int32_t prev;    /* IntTTLCache, neighbours in the order of writes */
+  int32_t next;
+  uint32_t visits; /* IntCacheMap */
+} CtsIntEntry;
+
+/* clang-format off */
+typedef struct {
+  PyObject_HEAD
+  CtsIntEntry *entries;
+  Py_ssize_t size;
+  Py_ssize_t allocated;
+  CtsTable table;      /* positions of entries */
+  Py_ssize_t capacity; /* IntCacheMap */
+  int64_t ttl;         /* IntTTLCache, 0 for IntCacheMap */
+  int32_t head;        /* IntTTLCache, the least recently written entry */
+  int32_t tail;
+  Py_ssize_t ops;      /* IntCacheMap, clock of LFU aging */
+  CtsCacheStats stats;
+} CtsIntCache;
+/* clang-format on */
+
+static PyTypeObject IntCacheMap_Type;
+static PyTypeObject IntTTLCache_Type;
+
+#define IntCache_Expired(entry, now) ((entry)->expire < (now))
+
+static uint64_t IntCache_HashOf(void *owner, int32_t e) {
+  return CtsHash_Int(((CtsIntCache *)owner)->entries[e].key);
+}
+
+static int IntCache_Match(void *owner, int32_t e, const void *key) {
+  return ((CtsIntCache *)owner)->entries[e].key == *(const int64_t *)key;
+}
+
+static uint32_t *IntCache_VisitsOf(void *owner, Py_ssize_t pos) {
+  return &((CtsIntCache *)owner)->entries[pos].visits;
+}
+
+/* The index slot holding `key`, or the empty slot ending its probe. */
+static Py_ssize_t IntCache_Probe(CtsIntCache *self, int64_t key) {
+  return CtsTable_Probe(&self->table, CtsHash_Int(key), IntCache_Match, &key);
+}
+
+/* Make room for one more entry. */
+static int IntCache_Reserve(CtsIntCache *self) {
+  CtsIntEntry *entries = (CtsIntEntry *)CtsTable_Grow(
+      self->entries, &self->allocated, self->size, sizeof(CtsIntEntry));
+  ReturnIfNULL(entries, -1);
+  self->entries = entries;
+  return CtsTable_Reserve(&self->table, self->size);
+}
+
+static void IntCache_Append(CtsIntCache *self, int32_t e) {
+  CtsIntEntry *entry = &self->entries[e];
+  entry->prev = self->tail;
+  entry->next = IntCache_EMPTY;
+  if (self->tail == IntCache_EMPTY) {
+    self->head = e;
+  } else {
+    self->entries[self->tail].next = e;
+  }
+  self->tail = e;
+}
+
+static void IntCache_Unlink(CtsIntCache *self, int32_t e) {
+  CtsIntEntry *entry = &self->entries[e];
+  if (entry->prev == IntCache_EMPTY) {
+    self->head = entry->next;
+  } else {
+    self->entries[entry->prev].next = entry->next;
+  }
+  if (entry->next == IntCache_EMPTY) {
+    self->tail = entry->prev;
+  } else {
+    self->entries[entry->next].prev = entry->prev;
+  }
+}
+
+/* Remove the entry at index slot `i`. Return its value, which the caller
+ * releases once it is done with the table, as that may run Python code. */
+static PyObject *IntCache_Remove(CtsIntCache *self, Py_ssize_t i) {
+  int32_t e = self->table.index[i], last = (int32_t)self->size - 1;
+  PyObject *value = self->entries[e].value;
+  CtsIntEntry *moved;
+  CtsTable_Remove(&self->table, i, self->size);
+  if (self->ttl) {
+    IntCache_Unlink(self, e);
+  }
+  self->size--;
+  if (e != last) {
+    /* the last entry fills the hole */
+    self->entries[e] = self->entries[last];
+    moved = &self->entries[e];
+    if (self->ttl) {
+      if (moved->prev == IntCache_EMPTY) {
+        self->head = e;
+      } else {
+        self->entries[moved->prev].next = e;
+      }
+      if (moved->next == IntCache_EMPTY) {
+        self->tail = e;
+      } else {
+        self->entries[moved->next].prev = e;
+      }
+    }
+  }
+  return value;
+}
+
+/* Drop all entries, values are released after the table is empty. */
+static void IntCache_Clear(CtsIntCache *self) {
+  CtsIntEntry *entries = self->entries;
+  Py_ssize_t size = self->size, i;
+  self->entries = NULL;
+  self->size = 0;
+  self->allocated = 0;
+  self->head = self->tail = IntCache_EMPTY;
+  self->ops = 0;
+  CtsTable_Clear(&self->table);
+  for (i = 0; i < size; i++) {
+    Py_DECREF(entries[i].value);
+  }
+  PyMem_Free(entries);
+}
+
+static int IntCache_EvictTo(CtsIntCache *self, Py_ssize_t size) {
+  Py_ssize_t pos;
+  PyObject *value;
+  while (self->size > size &&
+         (pos = CtsLFU_Victim(self->size, IntCache_VisitsOf, self)) >= 0) {
+    value = IntCache_Remove(self, CtsTable_SlotOf(&self->table, (int32_t)pos));
+    self->stats.evictions++;
+    Py_DECREF(value);
+  }
+  return 0;
+}
+
+/* Drop expired entries from the least recently written one. */
+static void IntCache_Sweep(CtsIntCache *self, int64_t now) {
+  PyObject *value;
+  while (self->head != IntCache_EMPTY &&
+         IntCache_Expired(&self->entries[self->head], now)) {
+    value = IntCache_Remove(
+        self, IntCache_Probe(self, self->entries[self->head].key));
+    self->stats.expirations++;
+    Py_DECREF(value);
+  }
+}
+
+/* Borrowed entry of `key`, NULL if it is missing or expired. An expired
+ * entry is dropped. The entry is valid until the table changes. */
+static CtsIntEntry *IntCache_Lookup(CtsIntCache *self, int64_t key,
+                                    int64_t now) {
+  Py_ssize_t i = IntCache_Probe(self, key);
+  CtsIntEntry *entry;
+  PyObject *value;
+  if (self->table.index[i] == IntCache_EMPTY) {
+    return NULL;
+  }
+  entry = &self->entries[self->table.index[i]];
+  if (self->ttl && IntCache_Expired(entry, now)) {
+    value = IntCache_Remove(self, i);
+    self->stats.expirations++;
+    Py_DECREF(value);
+    return NULL;
+  }
+  return entry;
+}
+
+/* New reference of the value of `key` counted as a hit, NULL on a miss. */
+static PyObject *IntCache_Get(CtsIntCache *self, int64_t key, int64_t now) {
+  CtsIntEntry *entry = IntCache_Lookup(self, key, now);
+  if (entry == NULL) {
+    self->stats.misses++;
+    return NULL;
+  }
+  self->stats.hits++;
+  if (!self->ttl) {
+    CtsLFU_Visit(&entry->visits);
+    CtsLFU_Tick(&self->ops, self->size, IntCache_VisitsOf, self);
+  }
+  Py_INCREF(entry->value);
+  return entry->value;
+}
+
+/* Write a value without evicting anything. */
+static int IntCache_Put(CtsIntCache *self, int64_t key, PyObject *value,
+                        int64_t now) {
+  Py_ssize_t i = IntCache_Probe(self, key);
+  CtsIntEntry *entry;
+  PyObject *old;
+  int32_t e = self->table.index[i];
+  int bits = self->table.bits;
+  Py_INCREF(value);
+  if (e != IntCache_EMPTY) {
+    entry = &self->entries[e];
+    old = entry->value;
+    entry->value = value;
+    if (self->ttl) {
+      entry->expire = now + self->ttl;
+      IntCache_Unlink(self, e);
+      IntCache_Append(self, e);
+    }
+    Py_DECREF(old);
+    return 0;
+  }
+  if (IntCache_Reserve(self)) {
+    Py_DECREF(value);
+    return -1;
+  }
+  if (self->table.bits != bits) {
+    i = IntCache_Probe(self, key);
+  }
+  e = (int32_t)self->size++;
+  entry = &self->entries[e];
+  entry->key = key;
+  entry->value = value;
+  entry->visits = CtsLFU_INIT_VISITS;
+  entry->expire = now + self->ttl;
+  self->table.index[i] = e;
+  if (self->ttl) {
+    IntCache_Append(self, e);
+  }
+  self->stats.insertions++;
+  return 0;
+}
+
+/* Set an item, making room for a new key first so that it is not its own
+ * victim. */
+static int IntCache_Set(CtsIntCache *self, int64_t key, PyObject *value,
+                        int64_t now) {
+  if (self->ttl) {
+    IntCache_Sweep(self, now);
+  } else if (self->size >= self->capacity &&
+             self->table.index[IntCache_Probe(self, key)] == IntCache_EMPTY &&
+             IntCache_EvictTo(self, self->capacity - 1)) {
+    return -1;
+  }
+  return IntCache_Put(self, key, value, now);
+}
+
+/* Remove `key`, return 1 if it was in cache. */
+static int IntCache_Delete(CtsIntCache *self, int64_t key, int64_t now) {
+  Py_ssize_t i = IntCache_Probe(self, key);
+  int32_t e = self->table.index[i];
+  PyObject *value;
+  int rv;
+  if (e == IntCache_EMPTY) {
+    return 0;
+  }
+  rv = !(self->ttl && IntCache_Expired(&self->entries[e], now));
+  value = IntCache_Remove(self, i);
+  Py_DECREF(value);
+  return rv;
+}
+
+#define IntCache_Now(self) ((self)->ttl ? NOW() : 0)
+
+static int IntCache_AsKey(PyObject *ob, int64_t *key) {
+  long long v;
+  if (!PyLong_Check(ob)) {
+    PyErr_Format(PyExc_TypeError, "keys should be int, not %.100s",
+                 Py_TYPE(ob)->tp_name);
+    return -1;
+  }
+  v = PyLong_AsLongLong(ob);
+  if (v == -1 && PyErr_Occurred()) {
+    return -1;
+  }
+  *key = (int64_t)v;
+  return 0;
+}
+
+/* Called for each key of a batch. */
+typedef int (*IntCache_KeyFunc)(CtsIntCache *self, int64_t key, void *arg);
+
+/* Read a native integer of struct format `fmt`. */
+static int IntCache_ReadId(const char *p, char fmt, int64_t *key) {
+  unsigned long long u;
+  switch (fmt) {
+#define IntCache_READ(c, type)                                                 \
+  case c: {                                                                    \
+    type v;                                                                    \
+    memcpy(&v, p, sizeof(type));                                               \
+    *key = (int64_t)v;                                                         \
+    return 0;                                                                  \
+  }
+    IntCache_READ('b', signed char)
+    IntCache_READ('B', unsigned char)
+    IntCache_READ('h', short)
+    IntCache_READ('H', unsigned short)
+    IntCache_READ('i', int)
+    IntCache_READ('I', unsigned int)
+    IntCache_READ('l', long)
+    IntCache_READ('q', long long)
+    IntCache_READ('n', Py_ssize_t)
+#undef IntCache_READ
+  case 'L':
+  case 'Q':
+  case 'N':
+    if (fmt == 'L') {
+      unsigned long v;
+      memcpy(&v, p, sizeof(v));
+      u = v;
+    } else if (fmt == 'Q') {
+      memcpy(&u, p, sizeof(u));
+    } else {
+      size_t v;
+      memcpy(&v, p, sizeof(v));
+      u = v;
+    }
+    if (u > (unsigned long long)INT64_MAX) {
+      PyErr_SetString(PyExc_OverflowError, "key is greater than int64 max");
+      return -1;
+    }
+    *key = (int64_t)u;
+    return 0;
+  default:
+    PyErr_Format(PyExc_TypeError, "keys of format '%c' are not integers",
+                 fmt);
+    return -1;
+  }
+}
+
+/* Call `fn` for each key of a one dimensional buffer of native integers,
+ * such as array.array('q') or a numpy array of int64, or of an iterable of
+ * ints. */
+static int IntCache_ForEachKey(CtsIntCache *self, PyObject *keys,
+                               IntCache_KeyFunc fn, void *arg) {
+  Py_buffer view;
+  PyObject *it, *item;
+  const char *fmt, *p;
+  Py_ssize_t n, i;
+  int64_t key;
+  int rv = 0;
+  if (PyObject_CheckBuffer(keys)) {
+    if (PyObject_GetBuffer(keys, &view, PyBUF_RECORDS_RO)) {
+      return -1;
+    }
+    fmt = view.format ? view.format : "B";
+    if (*fmt == '@') {
+      fmt++;
+    }
+    if (view.ndim > 1 || fmt[0] == '\0' || fmt[1] != '\0') {
+      PyErr_SetString(PyExc_TypeError,
+                      "keys should be a one dimensional buffer of integers");
+      PyBuffer_Release(&view);
+      return -1;
+    }
+    n = view.ndim ? view.shape[0] : 1;
+    p = (const char *)view.buf;
+    for (i = 0; i < n; i++) {
+      if (IntCache_ReadId(p, fmt[0], &key) || fn(self, key, arg)) {
+        rv = -1;
+        break;
+      }
+      p += view.ndim ? view.strides[0] : 0;
+    }
+    PyBuffer_Release(&view);
+    return rv;
+  }
+  it = PyObject_GetIter(keys);
+  ReturnIfNULL(it, -1);
+  while ((item = PyIter_Next(it)) != NULL) {
+    rv = IntCache_AsKey(item, &key);
+    Py_DECREF(item);
+    if (rv || (rv = fn(self, key, arg))) {
+      break;
+    }
+  }
+  Py_DECREF(it);
+  if (rv == 0 && PyErr_Occurred()) {
+    rv = -1;
+  }
+  return rv;
+}
+
+static Py_ssize_t IntCache_mp_length(CtsIntCache *self) { return self->size; }
+
+static PyObject *IntCache_mp_subscript(CtsIntCache *self, PyObject *key) {
+  int64_t k;
+  PyObject *value;
+  if (IntCache_AsKey(key, &k)) {
+    return NULL;
+  }
+  value = IntCache_Get(self, k, IntCache_Now(self));
+  if (value == NULL) {
+    PyErr_SetObject(PyExc_KeyError, key);
+  }
+  return value;
+}
+
+static int IntCache_mp_ass_sub(CtsIntCache *self, PyObject *key,
+                               PyObject *value) {
+  int64_t k;
+  if (IntCache_AsKey(key, &k)) {
+    return -1;
+  }
+  if (value) {
+    return IntCache_Set(self, k, value, IntCache_Now(self));
+  }
+  if (!IntCache_Delete(self, k, IntCache_Now(self))) {
+    PyErr_SetObject(PyExc_KeyError, key);
+    return -1;
+  }
+  return 0;
+}
+
+static PyMappingMethods IntCache_as_mapping = {
+    (lenfunc)IntCache_mp_length,        /* mp_length */
+    (binaryfunc)IntCache_mp_subscript,  /* mp_subscript */
+    (objobjargproc)IntCache_mp_ass_sub, /* mp_ass_subscript */
+};
+
+/* Not counted as a hit. */
+static int IntCache_sq_contains(CtsIntCache *self, PyObject *key) {
+  int64_t k;
+  int32_t e;
+  if (!PyLong_Check(key)) {
+    return 0;
+  }
+  if (IntCache_AsKey(key, &k)) {
+    if (PyErr_ExceptionMatches(PyExc_OverflowError)) {
+      PyErr_Clear();
+      return 0;
+    }
+    return -1;
+  }
+  e = self->table.index[IntCache_Probe(self, k)];
+  return e != IntCache_EMPTY &&
+         !(self->ttl && IntCache_Expired(&self->entries[e], NOW()));
+}
+
+static PySequenceMethods IntCache_as_sequence = {
+    0,                                   /* sq_length */
+    0,                                   /* sq_concat */
+    0,                                   /* sq_repeat */
+    0,                                   /* sq_item */
+    0,                                   /* sq_slice */
+    0,                                   /* sq_ass_item */
+    0,                                   /* sq_ass_slice */
+    (objobjproc)IntCache_sq_contains,    /* sq_contains */
+    0,                                   /* sq_inplace_concat */
+    0,                                   /* sq_inplace_repeat */
+};
+
+static PyObject *IntCache_get(CtsIntCache *self, CtsArg_PARAMS) {
+  PyObject *argv[2], *value;
+  int64_t key;
+
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"get", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv) || IntCache_AsKey(argv[0], &key)) {
+    return NULL;
+  }
+  value = IntCache_Get(self, key, IntCache_Now(self));
+  if (value == NULL) {
+    value = argv[1] ? argv[1] : Py_None;
+    Py_INCREF(value);
+  }
+  return value;
+}
+
+static PyObject *IntCache_set(CtsIntCache *self, CtsArg_PARAMS) {
+  PyObject *argv[2];
+  int64_t key;
+
+  static const char *const kwlist[] = {"key", "value", NULL};
+  static CtsArg_Parser parser = {"set", kwlist, 2, 2};
+  if (CtsArg_UNPACK(&parser, argv) || IntCache_AsKey(argv[0], &key) ||
+      IntCache_Set(self, key, argv[1], IntCache_Now(self))) {
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *IntCache_setdefault(CtsIntCache *self, CtsArg_PARAMS) {
+  PyObject *argv[2], *value;
+  int64_t key, now = IntCache_Now(self);
+
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"setdefault", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv) || IntCache_AsKey(argv[0], &key)) {
+    return NULL;
+  }
+  value = IntCache_Get(self, key, now);
+  if (value) {
+    return value;
+  }
+  value = argv[1] ? argv[1] : Py_None;
+  if (IntCache_Set(self, key, value, now)) {
+    return NULL;
+  }
+  Py_INCREF(value);
+  return value;
+}
+
+static PyObject *IntCache_pop(CtsIntCache *self, CtsArg_PARAMS) {
+  PyObject *argv[2], *value;
+  CtsIntEntry *entry;
+  int64_t key;
+
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"pop", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv) || IntCache_AsKey(argv[0], &key)) {
+    return NULL;
+  }
+  entry = IntCache_Lookup(self, key, IntCache_Now(self));
+  if (entry == NULL) {
+    value = argv[1] ? argv[1] : Py_None;
+    Py_INCREF(value);
+    return value;
+  }
+  /* the reference of the table is handed to the caller */
+  return IntCache_Remove(self, IntCache_Probe(self, key));
+}
+
+typedef struct {
+  PyObject *list;
+  PyObject *_default;
+  int64_t now;
+} IntCache_GetManyState;
+
+static int IntCache_GetOne(CtsIntCache *self, int64_t key, void *arg) {
+  IntCache_GetManyState *state = (IntCache_GetManyState *)arg;
+  PyObject *value = IntCache_Get(self, key, state->now);
+  int rv;
+  if (value == NULL) {
+    return PyList_Append(state->list, state->_default);
+  }
+  rv = PyList_Append(state->list, value);
+  Py_DECREF(value);
+  return rv;
+}
+
+static PyObject *IntCache_get_many(CtsIntCache *self, CtsArg_PARAMS) {
+  PyObject *argv[2];
+  IntCache_GetManyState state;
+
+  static const char *const kwlist[] = {"keys", "default", NULL};
+  static CtsArg_Parser parser = {"get_many", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  state.list = PyList_New(0);
+  ReturnIfNULL(state.list, NULL);
+  state._default = argv[1] ? argv[1] : Py_None;
+  state.now = IntCache_Now(self);
+  if (IntCache_ForEachKey(self, argv[0], IntCache_GetOne, &state)) {
+    Py_DECREF(state.list);
+    return NULL;
+  }
+  return state.list;
+}
+
+static int IntCache_PutPair(PyObject *self, PyObject *key, PyObject *value,
+                            void *arg) {
+  int64_t k;
+  if (IntCache_AsKey(key, &k)) {
+    return -1;
+  }
+  return IntCache_Put((CtsIntCache *)self, k, value, *(int64_t *)arg);
+}
+
+/* Write the whole batch, then evict or sweep once. */
+static PyObject *IntCache_set_many(CtsIntCache *self, PyObject *items) {
+  PyObject *type, *value, *tb;
+  int64_t now = IntCache_Now(self);
+  int rv;
+  if (self->ttl) {
+    IntCache_Sweep(self, now);
+  }
+  rv = CtsBatch_ForEachPair((PyObject *)self, items, IntCache_PutPair, &now);
+  PyErr_Fetch(&type, &value, &tb);
+  if (!self->ttl) {
+    IntCache_EvictTo(self, self->capacity);
+  }
+  PyErr_Restore(type, value, tb);
+  if (rv) {
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+typedef struct {
+  Py_ssize_t deleted;
+  int64_t now;
+} IntCache_DeleteManyState;
+
+static int IntCache_DeleteOne(CtsIntCache *self, int64_t key, void *arg) {
+  IntCache_DeleteManyState *state = (IntCache_DeleteManyState *)arg;
+  state->deleted += IntCache_Delete(self, key, state->now);
+  return 0;
+}
+
+static PyObject *IntCache_delete_many(CtsIntCache *self, PyObject *keys) {
+  IntCache_DeleteManyState state = {0, IntCache_Now(self)};
+  if (IntCache_ForEachKey(self, keys, IntCache_DeleteOne, &state)) {
+    return NULL;
+  }
+  return PyLong_FromSsize_t(state.deleted);
+}
+
+/* Return the number of entries evicted. */
+static PyObject *IntCache_evict(CtsIntCache *self, CtsArg_PARAMS) {
+  PyObject *argv[1];
+  Py_ssize_t n = 1, size = self->size;
+
+  static const char *const kwlist[] = {"n", NULL};
+  static CtsArg_Parser parser = {"evict", kwlist, 0, 1};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  if (argv[0] && (n = PyLong_AsSsize_t(argv[0])) < 0) {
+    if (!PyErr_Occurred()) {
+      PyErr_SetString(PyExc_ValueError, "n should not be negative");
+    }
+    return NULL;
+  }
+  IntCache_EvictTo(self, n < size ? size - n : 0);
+  return PyLong_FromSsize_t(size > self->size ? size - self->size : 0);
+}
+
+static PyObject *IntCache_clear(CtsIntCache *self,
+                                PyObject *Py_UNUSED(ignore)) {
+  IntCache_Clear(self);
+  Py_RETURN_NONE;
+}
+
+static PyObject *IntCache_stats(CtsIntCache *self, CtsArg_PARAMS) {
+  PyObject *argv[1], *rv;
+  int reset = 0;
+
+  static const char *const kwlist[] = {"reset", NULL};
+  static CtsArg_Parser parser = {"stats", kwlist, 0, 1};
+  if (CtsArg_UNPACK(&parser, argv) || CtsArg_Bool(argv[0], &reset)) {
+    return NULL;
+  }
+  rv = CtsStats_AsDict(&self->stats);
+  if (rv && reset) {
+    CtsStats_Reset(&self->stats);
+  }
+  return rv;
+}
+
+#define IntCacheIter_KEYS 0
+#define IntCacheIter_VALUES 1
+#define IntCacheIter_ITEMS 2
+
+/* clang-format off */
+typedef struct {
+  PyObject_HEAD
+  CtsIntCache *cache; /* NULL once exhausted */
+  int kind;
+  Py_ssize_t pos;
+  Py_ssize_t size; /* size of the cache when the iteration started */
+  int64_t now;     /* entries expired before this are skipped */
+} CtsIntCacheIter;
+/* clang-format on */
+
+static PyTypeObject IntCacheIter_Type;
+
+/* Iterate keys, values or items without counting hits. */
+static PyObject *IntCacheIter_New(CtsIntCache *cache, int kind) {
+  CtsIntCacheIter *it = PyObject_GC_New(CtsIntCacheIter, &IntCacheIter_Type);
+  ReturnIfNULL(it, NULL);
+  Py_INCREF(cache);
+  it->cache = cache;
+  it->kind = kind;
+  it->pos = 0;
+  it->size = cache->size;
+  it->now = IntCache_Now(cache);
+  PyObject_GC_Track(it);
+  return (PyObject *)it;
+}
+
+static PyObject *IntCacheIter_tp_iternext(CtsIntCacheIter *it) {
+  CtsIntCache *cache = it->cache;
+  CtsIntEntry *entry;
+  PyObject *key, *rv;
+  if (cache == NULL) {
+    return NULL;
+  }
+  if (cache->size != it->size) {
+    PyErr_Format(PyExc_RuntimeError, "%s changed size during iteration",
+                 cache->ttl ? "IntTTLCache" : "IntCacheMap");
+    it->size = -1; /* keep raising */
+    return NULL;
+  }
+  for (; it->pos < cache->size; it->pos++) {
+    entry = &cache->entries[it->pos];
+    if (cache->ttl && IntCache_Expired(entry, it->now)) {
+      continue;
+    }
+    it->pos++;
+    if (it->kind == IntCacheIter_VALUES) {
+      Py_INCREF(entry->value);
+      return entry->value;
+    }
+    key = PyLong_FromLongLong(entry->key);
+    if (key == NULL || it->kind == IntCacheIter_KEYS) {
+      return key;
+    }
+    rv = PyTuple_Pack(2, key, entry->value);
+    Py_DECREF(key);
+    return rv;
+  }
+  it->cache = NULL;
+  Py_DECREF(cache);
+  return NULL;
+}
+
+static int IntCacheIter_tp_traverse(CtsIntCacheIter *it, visitproc visit,
+                                    void *arg) {
+  Py_VISIT(it->cache);
+  return 0;
+}
+
+static void IntCacheIter_tp_dealloc(CtsIntCacheIter *it) {
+  PyObject_GC_UnTrack(it);
+  Py_XDECREF(it->cache);
+  PyObject_GC_Del(it);
+}
+
+static PyTypeObject IntCacheIter_Type = {
+    /* clang-format off */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    /* clang-format on */
+    "ctools.IntCacheIterator",                /* tp_name */
+    sizeof(CtsIntCacheIter),                  /* tp_basicsize */
+    0,                                        /* tp_itemsize */
+    (destructor)IntCacheIter_tp_dealloc,      /* tp_dealloc */
+    0,                                        /* tp_print */
+    0,                                        /* tp_getattr */
+    0,                                        /* tp_setattr */
+    0,                                        /* tp_compare */
+    0,                                        /* tp_repr */
+    0,                                        /* tp_as_number */
+    0,                                        /* tp_as_sequence */
+    0,                                        /* tp_as_mapping */
+    0,                                        /* tp_hash */
+    0,                                        /* tp_call */
+    0,                                        /* tp_str */
+    0,                                        /* tp_getattro */
+    0,                                        /* tp_setattro */
+    0,                                        /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,  /* tp_flags */
+    0,                                        /* tp_doc */
+    (traverseproc)IntCacheIter_tp_traverse,   /* tp_traverse */
+    0,                                        /* tp_clear */
+    0,                                        /* tp_richcompare */
+    0,                                        /* tp_weaklistoffset */
+    PyObject_SelfIter,                        /* tp_iter */
+    (iternextfunc)IntCacheIter_tp_iternext,   /* tp_iternext */
+};
+
+static PyObject *IntCache_tp_iter(CtsIntCache *self) {
+  return IntCacheIter_New(self, IntCacheIter_KEYS);
+}
+
+static PyObject *IntCache_keys(CtsIntCache *self,
+                               PyObject *Py_UNUSED(ignore)) {
+  return IntCacheIter_New(self, IntCacheIter_KEYS);
+}
+
+static PyObject *IntCache_values(CtsIntCache *self,
+                                 PyObject *Py_UNUSED(ignore)) {
+  return IntCacheIter_New(self, IntCacheIter_VALUES);
+}
+
+static PyObject *IntCache_items(CtsIntCache *self,
+                                PyObject *Py_UNUSED(ignore)) {
+  return IntCacheIter_New(self, IntCacheIter_ITEMS);
+}
+
+static PyObject *IntCache_repr(CtsIntCache *self) {
+  PyObject *dict, *items, *rv = NULL;
+  int status = Py_ReprEnter((PyObject *)self);
+  if (status != 0) {
+    return status > 0 ? PyUnicode_FromString("...") : NULL;
+  }
+  dict = PyDict_New();
+  items = IntCache_items(self, NULL);
+  if (dict && items && PyDict_MergeFromSeq2(dict, items, 1) == 0) {
+    rv = PyUnicode_FromFormat("%s(%R)",
+                              self->ttl ? "IntTTLCache" : "IntCacheMap", dict);
+  }
+  Py_XDECREF(dict);
+  Py_XDECREF(items);
+  Py_ReprLeave((PyObject *)self);
+  return rv;
+}
+
+static int IntCache_tp_traverse(CtsIntCache *self, visitproc visit,
+                                void *arg) {
+  for (Py_ssize_t i = 0; i < self->size; i++) {
+    Py_VISIT(self->entries[i].value);
+  }
+  return 0;
+}
+
+static int IntCache_tp_clear(CtsIntCache *self) {
+  IntCache_Clear(self);
+  return 0;
+}
+
+static void IntCache_tp_dealloc(CtsIntCache *self) {
+  PyObject_GC_UnTrack(self);
+  IntCache_Clear(self);
+  CtsTable_Free(&self->table);
+  CtsStats_Free(&self->stats);
+  PyObject_GC_Del(self);
+}
+
+static CtsIntCache *IntCache_New(PyTypeObject *type) {
+  CtsIntCache *self = PyObject_GC_New(CtsIntCache, type);
+  ReturnIfNULL(self, NULL);
+  self->entries = NULL;
+  self->size = 0;
+  self->allocated = 0;
+  self->capacity = INT32_MAX;
+  self->ttl = 0;
+  self->head = self->tail = IntCache_EMPTY;
+  self->ops = 0;
+  CtsStats_Init(&self->stats);
+  if (CtsTable_Init(&self->table, IntCache_HashOf, self)) {
+    Py_DECREF(self);
+    return NULL;
+  }
+  PyObject_GC_Track(self);
+  return self;
+}
+
+static PyObject *IntCacheMap_tp_new(PyTypeObject *Py_UNUSED(type),
+                                    PyObject *args, PyObject *kwds) {
+  Py_ssize_t capacity = INT32_MAX;
+  CtsIntCache *self;
+  static char *kwlist[] = {"capacity", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|n", kwlist, &capacity)) {
+    return NULL;
+  }
+  if (capacity <= 0 || capacity > INT32_MAX) {
+    PyErr_SetString(PyExc_ValueError,
+                    "capacity should be a positive int32 integer");
+    return NULL;
+  }
+  self = IntCache_New(&IntCacheMap_Type);
+  ReturnIfNULL(self, NULL);
+  self->capacity = capacity;
+  return (PyObject *)self;
+}
+
+static PyObject *IntTTLCache_tp_new(PyTypeObject *Py_UNUSED(type),
+                                    PyObject *args, PyObject *kwds) {
+  int64_t ttl = IntCache_DEFAULT_TTL;
+  CtsIntCache *self;
+  static char *kwlist[] = {"ttl", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|L", kwlist, &ttl)) {
+    return NULL;
+  }
+  if (ttl <= 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "ttl should be a positive integer in seconds.");
+    return NULL;
+  }
+  self = IntCache_New(&IntTTLCache_Type);
+  ReturnIfNULL(self, NULL);
+  self->ttl = ttl;
+  return (PyObject *)self;
+}
+
+static PyObject *IntCache_get_capacity(CtsIntCache *self,
+                                       void *Py_UNUSED(closure)) {
+  return PyLong_FromSsize_t(self->capacity);
+}
+
+static PyObject *IntCache_get_ttl(CtsIntCache *self,
+                                  void *Py_UNUSED(closure)) {
+  return PyLong_FromLongLong(self->ttl);
+}
+
+static PyGetSetDef IntCacheMap_getset[] = {
+    {"capacity", (getter)IntCache_get_capacity, NULL, "Max size of cache.",
+     NULL},
+    {NULL, NULL, NULL, NULL, NULL} /* Sentinel */
+};
+
+static PyGetSetDef IntTTLCache_getset[] = {
+    {"ttl", (getter)IntCache_get_ttl, NULL, "Seconds before keys expire.",
+     NULL},
+    {NULL, NULL, NULL, NULL, NULL} /* Sentinel */
+};
+
+/* Methods shared by IntCacheMap and IntTTLCache. */
+#define IntCache_METHODS                                                       \
+  {"get", (PyCFunction)IntCache_get, CtsArg_METH,                              \
+   "get(key, default=None)\n--\n\nGet item from cache."},                      \
+  {"set", (PyCFunction)IntCache_set, CtsArg_METH,                              \
+   "set(key, value)\n--\n\nSet item to cache."},                               \
+  {"setdefault", (PyCFunction)IntCache_setdefault, CtsArg_METH,                \
+   "setdefault(key, default=None)\n--\n\nGet item in cache, if key not "       \
+   "exists, set default to cache and return it."},                             \
+  {"pop", (PyCFunction)IntCache_pop, CtsArg_METH,                              \
+   "pop(key, default=None)\n--\n\nPop an item from cache, if key not "         \
+   "exists return default."},                                                  \
+  {"get_many", (PyCFunction)IntCache_get_many, CtsArg_METH,                    \
+   INT_CACHE_GET_MANY_METHOD_DOC},                                             \
+  {"set_many", (PyCFunction)IntCache_set_many, METH_O,                         \
+   CACHE_SET_MANY_METHOD_DOC},                                                 \
+  {"delete_many", (PyCFunction)IntCache_delete_many, METH_O,                   \
+   INT_CACHE_DELETE_MANY_METHOD_DOC},                                          \
+  {"keys", (PyCFunction)IntCache_keys, METH_NOARGS,                            \
+   "keys()\n--\n\nIterate keys, not counted as hits."},                        \
+  {"values", (PyCFunction)IntCache_values, METH_NOARGS,                        \
+   "values()\n--\n\nIterate values, not counted as hits."},                    \
+  {"items", (PyCFunction)IntCache_items, METH_NOARGS,                          \
+   "items()\n--\n\nIterate (key, value) pairs, not counted as hits."},         \
+  {"clear", (PyCFunction)IntCache_clear, METH_NOARGS,                          \
+   "clear()\n--\n\nRemove all items, stats are kept."},                        \
+  {"stats", (PyCFunction)IntCache_stats, CtsArg_METH,                          \
+   "stats(reset=False)\n--\n\nReturn a dict of hits, misses, evictions, "      \
+   "expirations and insertions, reset all of them at once if ``reset`` is "    \
+   "true."}
+
+/* clang-format off */
+static PyMethodDef IntCacheMap_methods[] = {
+    IntCache_METHODS,
+    {"evict", (PyCFunction)IntCache_evict, CtsArg_METH,
+     "evict(n=1)\n--\n\nEvict up to ``n`` of the least used items, return "
+     "the number evicted."},
+    {NULL, NULL, 0, NULL} /* Sentinel */
+};
+
+static PyMethodDef IntTTLCache_methods[] = {
+    IntCache_METHODS,
+    {NULL, NULL, 0, NULL} /* Sentinel */
+};
+/* clang-format on */
+
+PyDoc_STRVAR(IntCacheMap__doc__,
+             "IntCacheMap(capacity=None)\n"
+             "--\n\n"
+             "A :class:`CacheMap` of int64 keys with the ``'lfu'`` policy.\n"
+             "\n"
+             "Keys are stored unboxed in a flat table instead of a dict of\n"
+             "entry objects, an item costs well under half the memory of a\n"
+             "``CacheMap`` item. ``get_many`` and ``delete_many`` also take\n"
+             "buffers of integers, such as ``array.array('q')``.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "capacity : int, optional\n"
+             "  Max size of cache, default is C ``INT32_MAX``.\n"
+             "\n"
+             "Examples\n"
+             "--------\n"
+             ">>> import ctools\n"
+             ">>> cache = ctools.IntCacheMap(1)\n"
+             ">>> cache[1] = 'foo'\n"
+             ">>> cache[1]\n"
+             "'foo'\n"
+             ">>> cache[2] = 'bar'\n"
+             ">>> 1 in cache\n"
+             "False\n");
+
+PyDoc_STRVAR(IntTTLCache__doc__,
+             "IntTTLCache(ttl=None)\n"
+             "--\n\n"
+             "A :class:`TTLCache` of int64 keys, stored unboxed like\n"
+             ":class:`IntCacheMap`.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "ttl : int, optional\n"
+             "  Key will expire after this many seconds, default is 60.\n");
+
+static PyTypeObject IntCacheMap_Type = {
+    /* clang-format off */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    /* clang-format on */
+    "ctools.IntCacheMap",                    /* tp_name */
+    sizeof(CtsIntCache),                     /* tp_basicsize */
+    0,                                       /* tp_itemsize */
+    (destructor)IntCache_tp_dealloc,         /* tp_dealloc */
+    0,                                       /* tp_print */
+    0,                                       /* tp_getattr */
+    0,                                       /* tp_setattr */
+    0,                                       /* tp_compare */
+    (reprfunc)IntCache_repr,                 /* tp_repr */
+    0,                                       /* tp_as_number */
+    &IntCache_as_sequence,                   /* tp_as_sequence */
+    &IntCache_as_mapping,                    /* tp_as_mapping */
+    PyObject_HashNotImplemented,             /* tp_hash */
+    0,                                       /* tp_call */
+    0,                                       /* tp_str */
+    0,                                       /* tp_getattro */
+    0,                                       /* tp_setattro */
+    0,                                       /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    IntCacheMap__doc__,                      /* tp_doc */
+    (traverseproc)IntCache_tp_traverse,      /* tp_traverse */
+    (inquiry)IntCache_tp_clear,              /* tp_clear */
+    0,                                       /* tp_richcompare */
+    0,                                       /* tp_weaklistoffset */
+    (getiterfunc)IntCache_tp_iter,           /* tp_iter */
+    0,                                       /* tp_iternext */
+    IntCacheMap_methods,                     /* tp_methods */
+    0,                                       /* tp_members */
+    IntCacheMap_getset,                      /* tp_getset */
+    0,                                       /* tp_base */
+    0,                                       /* tp_dict */
+    0,                                       /* tp_descr_get */
+    0,                                       /* tp_descr_set */
+    0,                                       /* tp_dictoffset */
+    0,                                       /* tp_init */
+    0,                                       /* tp_alloc */
+    (newfunc)IntCacheMap_tp_new,             /* tp_new */
+};
+
+static PyTypeObject IntTTLCache_Type = {
+    /* clang-format off */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    /* clang-format on */
+    "ctools.IntTTLCache",                    /* tp_name */
+    sizeof(CtsIntCache),                     /* tp_basicsize */
+    0,                                       /* tp_itemsize */
+    (destructor)IntCache_tp_dealloc,         /* tp_dealloc */
+    0,                                       /* tp_print */
+    0,                                       /* tp_getattr */
+    0,                                       /* tp_setattr */
+    0,                                       /* tp_compare */
+    (reprfunc)IntCache_repr,                 /* tp_repr */
+    0,                                       /* tp_as_number */
+    &IntCache_as_sequence,                   /* tp_as_sequence */
+    &IntCache_as_mapping,                    /* tp_as_mapping */
+    PyObject_HashNotImplemented,             /* tp_hash */
+    0,                                       /* tp_call */
+    0,                                       /* tp_str */
+    0,                                       /* tp_getattro */
+    0,                                       /* tp_setattro */
+    0,                                       /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    IntTTLCache__doc__,                      /* tp_doc */
+    (traverseproc)IntCache_tp_traverse,      /* tp_traverse */
+    (inquiry)IntCache_tp_clear,              /* tp_clear */
+    0,                                       /* tp_richcompare */
+    0,                                       /* tp_weaklistoffset */
+    (getiterfunc)IntCache_tp_iter,           /* tp_iter */
+    0,                                       /* tp_iternext */
+    IntTTLCache_methods,                     /* tp_methods */
+    0,                                       /* tp_members */
+    IntTTLCache_getset,                      /* tp_getset */
+    0,                                       /* tp_base */
+    0,                                       /* tp_dict */
+    0,                                       /* tp_descr_get */
+    0,                                       /* tp_descr_set */
+    0,                                       /* tp_dictoffset */
+    0,                                       /* tp_init */
+    0,                                       /* tp_alloc */
+    (newfunc)IntTTLCache_tp_new,             /* tp_new */
+};
+
+EXTERN_C_START
+int ctools_init_intcache(PyObject *module) {
+  if (PyType_Ready(&IntCacheMap_Type) < 0 ||
+      PyType_Ready(&IntTTLCache_Type) < 0 ||
+      PyType_Ready(&IntCacheIter_Type) < 0) {
+    return -1;
+  }
+  Py_INCREF(&IntCacheMap_Type);
+  if (PyModule_AddObject(module, "IntCacheMap",
+                         PyObjectCast(&IntCacheMap_Type))) {
+    Py_DECREF(&IntCacheMap_Type);
+    return -1;
+  }
+  Py_INCREF(&IntTTLCache_Type);
+  if (PyModule_AddObject(module, "IntTTLCache",
+                         PyObjectCast(&IntTTLCache_Type))) {
+    Py_DECREF(&IntTTLCache_Type);
+    return -1;
+  }
+  return 0;
+}
+EXTERN_C_END
@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _CTOOLS_LFU_H_
+#define _CTOOLS_LFU_H_
+
+#include "core.h"
+
+#include <stdlib.h>
+
+/* Sampled LFU of the caches keeping a dense array of entries, the policy of
+ * CacheMap: the least visited of a few sampled entries is evicted, and
+ * visit counters are halved once in a while so old hits fade. */
+#define CtsLFU_BUCKET_NUM 8
+#define CtsLFU_BUCKET_SIZE 256
+#define CtsLFU_AGING_FACTOR 16
+/* as CacheEntry_INIT_VISITS, a new entry outlives a few colder ones */
+#define CtsLFU_INIT_VISITS 5U
+
+/* The visit counter of the entry at `pos`, NULL if no entry is there. */
+typedef uint32_t *(*CtsLFU_VisitsOf)(void *owner, Py_ssize_t pos);
+
+static inline Py_ssize_t CtsLFU_RandIndex(Py_ssize_t limit) {
+  return (Py_ssize_t)((double)rand() / ((double)RAND_MAX + 1) * limit);
+}
+
+/* Position of the least visited of a few sampled entries out of `n`, -1 if
+ * there is none. */
+static inline Py_ssize_t CtsLFU_Victim(Py_ssize_t n, CtsLFU_VisitsOf visits_of,
+                                       void *owner) {
+  Py_ssize_t bucket = n / CtsLFU_BUCKET_NUM, i, pos, rv = -1;
+  uint32_t min = 0, *visits;
+  int sampled = n > CtsLFU_BUCKET_SIZE;
+  for (i = 0; i < (sampled ? CtsLFU_BUCKET_NUM : n); i++) {
+    pos = sampled ? i * bucket + CtsLFU_RandIndex(bucket) : i;
+    visits = visits_of(owner, pos);
+    if (visits && (rv < 0 || *visits < min)) {
+      min = *visits;
+      rv = pos;
+    }
+  }
+  return rv;
+}
+
+static inline void CtsLFU_Visit(uint32_t *visits) {
+  if (*visits < UINT32_MAX) {
+    (*visits)++;
+  }
+}
+
+/* Count an operation on `n` entries, halving every counter after
+ * CtsLFU_AGING_FACTOR operations per entry. */
+static inline void CtsLFU_Tick(Py_ssize_t *ops, Py_ssize_t n,
+                               CtsLFU_VisitsOf visits_of, void *owner) {
+  if (++*ops < CtsLFU_AGING_FACTOR *
+                   (n > CtsLFU_BUCKET_NUM ? n : CtsLFU_BUCKET_NUM)) {
+    return;
+  }
+  uint32_t *visits;
+  for (Py_ssize_t i = 0; i < n; i++) {
+    if ((visits = visits_of(owner, i)) != NULL) {
+      *visits >>= 1;
+    }
+  }
+  *ops = 0;
+}
+
+#endif /* _CTOOLS_LFU_H_ */
@@ -18,6 +18,12 @@ limitations under the License.
 
 #include "Python.h"
 
+/* m_free, the free lists of entries would outlive the module otherwise. */
+static void ctools_free(void *Py_UNUSED(module)) {
+  CtsCacheMap_FreeListClear();
+  CtsTTLCache_FreeListClear();
+}
+
 static struct PyModuleDef _ctools = {
     PyModuleDef_HEAD_INIT,
     "ctools._ctools",                /* m_name */
@@ -27,7 +33,7 @@ static struct PyModuleDef _ctools = {
     NULL,                            /* m_reload */
     NULL,                            /* m_traverse */
     NULL,                            /* m_clear */
-    NULL,                            /* m_free */
+    ctools_free,                     /* m_free */
 };
 
 #define CtoolsModuleInitOne(name)                                              \
@@ -46,7 +52,12 @@ PyMODINIT_FUNC PyInit__ctools(void) {
   CtoolsModuleInitOne(ctools_init_cachemap);
   CtoolsModuleInitOne(ctools_init_funcs);
   CtoolsModuleInitOne(ctools_init_channel);
+  CtoolsModuleInitOne(ctools_init_sharedchannel);
+  CtoolsModuleInitOne(ctools_init_sharedcache);
   CtoolsModuleInitOne(ctools_init_ttlcache);
   CtoolsModuleInitOne(ctools_init_rbtree);
+  CtoolsModuleInitOne(ctools_init_cached);
+  CtoolsModuleInitOne(ctools_init_intcache);
+  CtoolsModuleInitOne(ctools_init_bytescache);
   return module;
 }
\ No newline at end of file
@@ -27,12 +27,47 @@ int ctools_init_cachemap(PyObject *module);
 
 int ctools_init_channel(PyObject *module);
 
+int ctools_init_sharedchannel(PyObject *module);
+
+int ctools_init_sharedcache(PyObject *module);
+
 int ctools_init_funcs(PyObject *module);
 
 int ctools_init_ttlcache(PyObject *module);
 
 int ctools_init_rbtree(PyObject *module);
 
+int ctools_init_cached(PyObject *module);
+
+int ctools_init_intcache(PyObject *module);
+
+int ctools_init_bytescache(PyObject *module);
+
+/* Used by ctools.cached. Lookup returns a new reference, or NULL on a miss,
+ * an error is set only if the lookup failed. */
+int CtsCacheMap_Check(PyObject *ob);
+
+PyObject *CtsCacheMap_Lookup(PyObject *ob, PyObject *key);
+
+int CtsCacheMap_Store(PyObject *ob, PyObject *key, PyObject *value);
+
+int CtsTTLCache_Check(PyObject *ob);
+
+PyObject *CtsTTLCache_Lookup(PyObject *ob, PyObject *key);
+
+int CtsTTLCache_Store(PyObject *ob, PyObject *key, PyObject *value);
+
+/* Used by ctools.freelist_stats, new references to dicts of counters of the
+ * free lists of entries. */
+PyObject *CtsCacheMap_FreeListStats(void);
+
+PyObject *CtsTTLCache_FreeListStats(void);
+
+/* Used by m_free of the module, free the entries kept by the free lists. */
+void CtsCacheMap_FreeListClear(void);
+
+void CtsTTLCache_FreeListClear(void);
+
 EXTERN_C_END
 
 #endif // _CTOOLS_MODULE_H_
\ No newline at end of file
@@ -0,0 +1,254 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _CTOOLS_PRESSURE_H_
+#define _CTOOLS_PRESSURE_H_
+
+#include "core.h"
+
+#include <stdio.h>
+#include <string.h>
+#ifdef MS_WINDOWS
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+
+/* Memory pressure of a cache, the resident set size of the process against
+ * a limit in bytes, or memory.current against memory.max of the cgroup v2
+ * of the process. Usage is read every CtsPressure_INTERVAL insertions.
+ * Above `high` of the limit the number of entries is capped at 7/8 of what
+ * the cache holds, and the cap is raised by 1/8 per reading once usage
+ * falls below CtsPressure_LOW of the high watermark. */
+
+#define CtsPressure_INTERVAL 256
+#define CtsPressure_LOW 0.9
+
+typedef struct {
+  double high;         /* fraction of the limit, 0 if disabled */
+  int64_t limit;       /* bytes */
+  int64_t usage;       /* bytes at the last reading, -1 if unknown */
+  Py_ssize_t cap;      /* PY_SSIZE_T_MAX if not under pressure */
+  Py_ssize_t ops;      /* insertions since the last reading */
+  Py_ssize_t shrinks;  /* times the cap was lowered */
+  char cgroup[256];    /* memory.current of the cgroup, empty for RSS */
+} CtsPressure;
+
+#define CtsPressure_Enabled(p) ((p)->high > 0)
+
+static inline void CtsPressure_Clear(CtsPressure *p) {
+  p->high = 0;
+  p->limit = 0;
+  p->usage = -1;
+  p->cap = PY_SSIZE_T_MAX;
+  p->ops = 0;
+  p->shrinks = 0;
+  p->cgroup[0] = '\0';
+}
+
+/* Resident set size of the process in bytes, -1 if unknown. */
+static inline int64_t CtsPressure_RSS(void) {
+#ifdef MS_WINDOWS
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+    return -1;
+  }
+  return (int64_t)pmc.WorkingSetSize;
+#elif defined(__APPLE__)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info,
+                &count) != KERN_SUCCESS) {
+    return -1;
+  }
+  return (int64_t)info.resident_size;
+#else
+  long long size, resident;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  int n;
+  if (fp == NULL) {
+    return -1;
+  }
+  n = fscanf(fp, "%lld %lld", &size, &resident);
+  fclose(fp);
+  return n == 2 ? (int64_t)resident * sysconf(_SC_PAGESIZE) : -1;
+#endif
+}
+
+/* Number in a file of the cgroup filesystem, 0 for "max", -1 if it can
+ * not be read. */
+static inline int64_t CtsPressure_ReadFile(const char *path) {
+  char buf[32];
+  long long value;
+  FILE *fp = fopen(path, "r");
+  int n;
+  if (fp == NULL) {
+    return -1;
+  }
+  n = fscanf(fp, "%31s", buf);
+  fclose(fp);
+  if (n != 1) {
+    return -1;
+  }
+  if (strcmp(buf, "max") == 0) {
+    return 0;
+  }
+  return sscanf(buf, "%lld", &value) == 1 ? (int64_t)value : -1;
+}
+
+/* Path of `name` in the cgroup v2 of the process, from the "0::" line of
+ * /proc/self/cgroup. Return -1 if there is no such cgroup. */
+static inline int CtsPressure_CgroupPath(char *path, size_t size,
+                                         const char *name) {
+  char line[256];
+  size_t n;
+  FILE *fp = fopen("/proc/self/cgroup", "r");
+  if (fp == NULL) {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    if (strncmp(line, "0::", 3) != 0) {
+      continue;
+    }
+    fclose(fp);
+    n = strcspn(line + 3, "\n");
+    line[3 + n] = '\0';
+    /* the root is "/", keep a single slash */
+    if (n == 1) {
+      line[3] = '\0';
+    }
+    return (size_t)snprintf(path, size, "/sys/fs/cgroup%s/%s", line + 3,
+                            name) < size
+               ? 0
+               : -1;
+  }
+  fclose(fp);
+  return -1;
+}
+
+static inline int64_t CtsPressure_Usage(CtsPressure *p) {
+  return p->cgroup[0] ? CtsPressure_ReadFile(p->cgroup) : CtsPressure_RSS();
+}
+
+/* Enable the mode if `high` is not None, against `limit` bytes of RSS, or
+ * the cgroup limit if `limit` is None. A cap already in place is kept, so
+ * changing the watermark does not undo a shrink. */
+static inline int CtsPressure_Init(CtsPressure *p, PyObject *high,
+                                   PyObject *limit) {
+  char path[sizeof(p->cgroup)];
+  double h;
+  int64_t n;
+  if (high == Py_None) {
+    CtsPressure_Clear(p);
+    return 0;
+  }
+  h = PyFloat_AsDouble(high);
+  if (!(h > 0 && h <= 1)) {
+    if (!PyErr_Occurred()) {
+      PyErr_SetString(PyExc_ValueError,
+                      "memory_high should be a number in (0, 1]");
+    }
+    return -1;
+  }
+  path[0] = '\0';
+  if (limit != Py_None) {
+    n = PyLong_AsLongLong(limit);
+    if (n <= 0) {
+      if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_ValueError,
+                        "memory_limit should be a positive integer");
+      }
+      return -1;
+    }
+    if (CtsPressure_RSS() < 0) {
+      PyErr_SetString(PyExc_ValueError,
+                      "memory usage of the process is not available");
+      return -1;
+    }
+  } else {
+    if (CtsPressure_CgroupPath(path, sizeof(path), "memory.max") ||
+        (n = CtsPressure_ReadFile(path)) < 0) {
+      PyErr_SetString(PyExc_ValueError,
+                      "memory_limit is required without a cgroup v2");
+      return -1;
+    }
+    if (n == 0) {
+      PyErr_SetString(PyExc_ValueError,
+                      "memory_limit is required, the cgroup has no limit");
+      return -1;
+    }
+    CtsPressure_CgroupPath(path, sizeof(path), "memory.current");
+  }
+  if (!CtsPressure_Enabled(p)) {
+    CtsPressure_Clear(p);
+  }
+  p->high = h;
+  p->limit = n;
+  p->ops = 0;
+  memcpy(p->cgroup, path, sizeof(path));
+  p->usage = CtsPressure_Usage(p);
+  return 0;
+}
+
+/* Count an insertion into a cache of `size` entries and `max` capacity,
+ * read the usage if it is time to. Return 1 if the cap changed. */
+static inline int CtsPressure_Poll(CtsPressure *p, Py_ssize_t size,
+                                   Py_ssize_t max) {
+  Py_ssize_t cap;
+  if (!CtsPressure_Enabled(p) || ++p->ops < CtsPressure_INTERVAL) {
+    return 0;
+  }
+  p->ops = 0;
+  if ((p->usage = CtsPressure_Usage(p)) < 0) {
+    return 0;
+  }
+  if ((double)p->usage > p->high * (double)p->limit) {
+    cap = size < p->cap ? size : p->cap;
+    cap -= cap / 8 + 1;
+    if (cap < 1) {
+      cap = 1;
+    }
+    if (cap == p->cap) {
+      return 0;
+    }
+    p->shrinks++;
+  } else if (p->cap < PY_SSIZE_T_MAX &&
+             (double)p->usage <
+                 p->high * CtsPressure_LOW * (double)p->limit) {
+    cap = p->cap / 8 + 1 < max - p->cap ? p->cap + p->cap / 8 + 1
+                                        : PY_SSIZE_T_MAX;
+  } else {
+    return 0;
+  }
+  p->cap = cap;
+  return 1;
+}
+
+static inline PyObject *CtsPressure_AsDict(CtsPressure *p) {
+  if (p->cap == PY_SSIZE_T_MAX) {
+    return Py_BuildValue("{sLsLsdsnsO}", "usage", (long long)p->usage,
+                         "limit", (long long)p->limit, "high", p->high,
+                         "shrinks", p->shrinks, "cap", Py_None);
+  }
+  return Py_BuildValue("{sLsLsdsnsn}", "usage", (long long)p->usage, "limit",
+                       (long long)p->limit, "high", p->high, "shrinks",
+                       p->shrinks, "cap", p->cap);
+}
+
+#endif /* _CTOOLS_PRESSURE_H_ */
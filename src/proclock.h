@@ -0,0 +1,115 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _CTOOLS_PROCLOCK_H_
+#define _CTOOLS_PROCLOCK_H_
+
+#include "atomic.h"
+#include "core.h"
+
+#ifdef MS_WINDOWS
+#include <windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+/* Spin locks living in memory shared by processes. A lock word holds the
+ * pid of its owner, 0 if unlocked. Locks are taken with the GIL held, so
+ * no other thread of the process can own one. A lock left by a process
+ * that died is taken over, the caller is told so to repair what the lock
+ * guards. A lock is spun on CtsProcLock_SPINS times before yielding the
+ * CPU, the owner is checked to be alive once every CtsProcLock_CHECK_EVERY
+ * tries. */
+#define CtsProcLock_SPINS 128
+#define CtsProcLock_CHECK_EVERY 1024
+
+/* Pid of this process, the value a lock is taken with. Reading it is a
+ * system call, so it is cached and refreshed in a forked child. Each
+ * module including this header keeps its own copy, see CtsProcLock_Setup. */
+static size_t CtsProcLock_pid;
+
+static void CtsProcLock_ReadPid(void) {
+#ifdef MS_WINDOWS
+  CtsProcLock_pid = (size_t)GetCurrentProcessId();
+#else
+  CtsProcLock_pid = (size_t)getpid();
+#endif
+}
+
+/* Called once at module init. */
+static inline int CtsProcLock_Setup(void) {
+  CtsProcLock_ReadPid();
+#ifndef MS_WINDOWS
+  if (pthread_atfork(NULL, NULL, CtsProcLock_ReadPid)) {
+    PyErr_SetString(PyExc_RuntimeError, "pthread_atfork failed");
+    return -1;
+  }
+#endif
+  return 0;
+}
+
+/* Return 1 if the process holding a lock is gone. */
+static inline int CtsProcLock_OwnerDead(size_t pid) {
+#ifdef MS_WINDOWS
+  (void)pid;
+  return 0;
+#else
+  return kill((pid_t)pid, 0) == -1 && errno == ESRCH;
+#endif
+}
+
+static inline void CtsProcLock_Yield(void) {
+#ifdef MS_WINDOWS
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+/* Take a lock, return 1 if it was taken over from a dead process. */
+static inline int CtsProcLock_Acquire(size_t *lock) {
+  size_t pid = CtsProcLock_pid, owner;
+  int rv = 0;
+  for (unsigned int spins = 0;; spins++) {
+    owner = 0;
+    if (Cts_AtomicCAS(lock, &owner, pid)) {
+      break;
+    }
+    if (spins < CtsProcLock_SPINS) {
+      Cts_CpuRelax();
+      continue;
+    }
+    if (spins % CtsProcLock_CHECK_EVERY == 0 && owner != 0 &&
+        CtsProcLock_OwnerDead(owner) && Cts_AtomicCAS(lock, &owner, pid)) {
+      rv = 1;
+      break;
+    }
+    CtsProcLock_Yield();
+  }
+  Cts_AtomicFenceAcquire();
+  return rv;
+}
+
+static inline void CtsProcLock_Release(size_t *lock) {
+  Cts_AtomicStoreRelease(lock, 0);
+}
+
+#endif /* _CTOOLS_PROCLOCK_H_ */
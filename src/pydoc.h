@@ -17,4 +17,109 @@
   "object\n"                                                                   \
   "  The found value or what ``setnx`` return.\n"
 
+#define CACHE_SETNX_METHOD_DOC                                                 \
+  "setnx(key, fn=None, singleflight=False)\n--\n\n"                            \
+  "Like setdefault but accept a callable.\n"                                   \
+  "\n"                                                                         \
+  "Parameters\n"                                                               \
+  "----------\n"                                                               \
+  "key : object\n"                                                             \
+  "  Hash key.\n"                                                              \
+  "fn : typing.Callable[[typing.Any], typing.Any], optional\n"                 \
+  "  It's a callable that accept key as only one argument, called when key "   \
+  "not exists.\n"                                                              \
+  "singleflight : bool, optional\n"                                            \
+  "  If true, threads missing a key that another thread is loading wait for\n" \
+  "  that load and return its value or raise its error, instead of calling\n"  \
+  "  ``fn`` again. The GIL is released while waiting.\n"                       \
+  "\n"                                                                         \
+  "Returns\n"                                                                  \
+  "-------\n"                                                                  \
+  "object\n"                                                                   \
+  "  The found value or what ``setnx`` return.\n"
+
+#define CACHE_GET_MANY_METHOD_DOC                                              \
+  "get_many(keys, default=None)\n--\n\n"                                       \
+  "Get items of many keys in one call.\n"                                      \
+  "\n"                                                                         \
+  "Parameters\n"                                                               \
+  "----------\n"                                                               \
+  "keys : typing.Iterable\n"                                                   \
+  "  Hash keys.\n"                                                             \
+  "default : object, optional\n"                                               \
+  "  Value of keys not in cache.\n"                                            \
+  "\n"                                                                         \
+  "Returns\n"                                                                  \
+  "-------\n"                                                                  \
+  "list\n"                                                                     \
+  "  Values in the order of keys.\n"
+
+#define CACHE_SET_MANY_METHOD_DOC                                              \
+  "set_many(items, /)\n--\n\n"                                                 \
+  "Set items of a dict or an iterable of (key, value) pairs. Entries are\n"    \
+  "evicted once after the whole batch if the policy allows.\n"
+
+#define CACHE_DELETE_MANY_METHOD_DOC                                           \
+  "delete_many(keys, /)\n--\n\n"                                               \
+  "Delete items of keys, keys not in cache are ignored. Return the number\n"   \
+  "of deleted items.\n"
+
+#define CACHE_DUMP_METHOD_DOC                                                  \
+  "dump(path, serializer=None)\n--\n\n"                                        \
+  "Write all items and their eviction state to a snapshot file.\n"             \
+  "\n"                                                                         \
+  "Parameters\n"                                                               \
+  "----------\n"                                                               \
+  "path : str or os.PathLike\n"                                                \
+  "  File to create or overwrite.\n"                                           \
+  "serializer : object, optional\n"                                            \
+  "  Module or object with ``dumps``, such as ``pickle`` or ``marshal``.\n"    \
+  "  Keys and values of exact type bytes, str, int, float and None are\n"      \
+  "  stored without it. Default is ``pickle``.\n"                              \
+  "\n"                                                                         \
+  "Returns\n"                                                                  \
+  "-------\n"                                                                  \
+  "int\n"                                                                      \
+  "  The number of items written.\n"
+
+#define CACHE_LOAD_METHOD_DOC                                                  \
+  "load(path, serializer=None)\n--\n\n"                                        \
+  "Add the items of a snapshot file written by ``dump``, replacing items\n"    \
+  "of the same keys. The file is mapped into memory and read in one pass.\n"   \
+  "\n"                                                                         \
+  "Parameters\n"                                                               \
+  "----------\n"                                                               \
+  "path : str or os.PathLike\n"                                                \
+  "  Snapshot file.\n"                                                         \
+  "serializer : object, optional\n"                                            \
+  "  Module or object with ``loads``, matching the one given to ``dump``.\n"   \
+  "\n"                                                                         \
+  "Returns\n"                                                                  \
+  "-------\n"                                                                  \
+  "int\n"                                                                      \
+  "  The number of items restored, items expired since the dump are\n"         \
+  "  skipped.\n"
+
+#define INT_CACHE_GET_MANY_METHOD_DOC                                          \
+  "get_many(keys, default=None)\n--\n\n"                                       \
+  "Get items of many keys in one call.\n"                                      \
+  "\n"                                                                         \
+  "Parameters\n"                                                               \
+  "----------\n"                                                               \
+  "keys : typing.Iterable[int]\n"                                              \
+  "  Keys, or a one dimensional buffer of integers such as\n"                  \
+  "  ``array.array('q')``, read without creating int objects.\n"               \
+  "default : object, optional\n"                                               \
+  "  Value of keys not in cache.\n"                                            \
+  "\n"                                                                         \
+  "Returns\n"                                                                  \
+  "-------\n"                                                                  \
+  "list\n"                                                                     \
+  "  Values in the order of keys.\n"
+
+#define INT_CACHE_DELETE_MANY_METHOD_DOC                                       \
+  "delete_many(keys, /)\n--\n\n"                                               \
+  "Delete items of keys, an iterable of int or a buffer of integers. Keys\n"   \
+  "not in cache are ignored. Return the number of deleted items.\n"
+
 #endif /* _CTOOLS_PYDOC_H_ */
@@ -14,6 +14,7 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include "args.h"
 #include "core.h"
 #include "pydoc.h"
 
@@ -825,17 +826,20 @@ static PyObject *RBTree_items(CtsRBTree *tree, PyObject *Py_UNUSED(ignore)) {
   return RBtree_iter(tree, RBTreeItems);
 }
 
-static PyObject *RBTree_get(CtsRBTree *tree, PyObject *args, PyObject *kwds) {
-  PyObject *key = NULL;
-  PyObject *_default = NULL;
+static PyObject *RBTree_get(CtsRBTree *tree, CtsArg_PARAMS) {
+  PyObject *key;
+  PyObject *_default;
   PyObject *value = NULL;
+  PyObject *argv[2];
   int find;
 
-  static char *kwlist[] = {"key", "default", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &key,
-                                   &_default)) {
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"get", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
     return NULL;
   }
+  key = argv[0];
+  _default = argv[1];
   find = RBTree_Get(tree, key, &value);
   if (find < 0) {
     return NULL;
@@ -850,18 +854,20 @@ static PyObject *RBTree_get(CtsRBTree *tree, PyObject *args, PyObject *kwds) {
   return value;
 }
 
-static PyObject *RBTree_setdefault(CtsRBTree *tree, PyObject *args,
-                                   PyObject *kwds) {
-  PyObject *key = NULL;
-  PyObject *_default = NULL;
+static PyObject *RBTree_setdefault(CtsRBTree *tree, CtsArg_PARAMS) {
+  PyObject *key;
+  PyObject *_default;
   PyObject *value = NULL;
+  PyObject *argv[2];
   int find;
 
-  static char *kwlist[] = {"key", "default", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &key,
-                                   &_default)) {
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"setdefault", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
     return NULL;
   }
+  key = argv[0];
+  _default = argv[1];
   find = RBTree_Get(tree, key, &value);
   if (find < 0) {
     return NULL;
@@ -880,17 +886,20 @@ static PyObject *RBTree_setdefault(CtsRBTree *tree, PyObject *args,
   return value;
 }
 
-static PyObject *RBTree_setnx(CtsRBTree *tree, PyObject *args, PyObject *kwds) {
-  PyObject *key = NULL;
-  PyObject *_default = NULL;
+static PyObject *RBTree_setnx(CtsRBTree *tree, CtsArg_PARAMS) {
+  PyObject *key;
+  PyObject *_default;
   PyObject *value = NULL;
+  PyObject *argv[2];
   int find;
 
-  static char *kwlist[] = {"key", "fn", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &key,
-                                   &_default)) {
+  static const char *const kwlist[] = {"key", "fn", NULL};
+  static CtsArg_Parser parser = {"setnx", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
     return NULL;
   }
+  key = argv[0];
+  _default = argv[1];
   find = RBTree_Get(tree, key, &value);
   if (find < 0) {
     return NULL;
@@ -950,15 +959,18 @@ static PyObject *RBTree_clear(CtsRBTree *tree, PyObject *Py_UNUSED(ignore)) {
   Py_RETURN_NONE;
 }
 
-static PyObject *RBTree_pop(CtsRBTree *tree, PyObject *args, PyObject *kwds) {
+static PyObject *RBTree_pop(CtsRBTree *tree, CtsArg_PARAMS) {
   PyObject *key, *value;
-  PyObject *default_ = NULL;
+  PyObject *default_;
+  PyObject *argv[2];
 
-  static char *kwlist[] = {"key", "default", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &key,
-                                   &default_)) {
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"pop", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
     return NULL;
   }
+  key = argv[0];
+  default_ = argv[1];
   if (RBTree_Remove(tree, key, &value)) {
     return NULL;
   }
@@ -1135,20 +1147,20 @@ PyMethodDef RBTree_methods[] = {
     {
         "get",
         (PyCFunction)RBTree_get,
-        METH_VARARGS | METH_KEYWORDS,
+        CtsArg_METH,
         "get(key, default=None)\n--\n\nReturn value if find else default.",
     },
     {
         "setdefault",
         (PyCFunction)RBTree_setdefault,
-        METH_VARARGS | METH_KEYWORDS,
+        CtsArg_METH,
         "setdefault(key, default=None)\n--\n\nReturn value if find else "
         "default and put default to mapping.",
     },
     {
         "setnx",
         (PyCFunction)RBTree_setnx,
-        METH_VARARGS | METH_KEYWORDS,
+        CtsArg_METH,
         USUAL_SETNX_METHOD_DOC,
     },
     {
@@ -1166,7 +1178,7 @@ PyMethodDef RBTree_methods[] = {
     {
         "pop",
         (PyCFunction)RBTree_pop,
-        METH_VARARGS | METH_KEYWORDS,
+        CtsArg_METH,
         "pop(key, default=None)\n--\n\nPop an item, if key not exists, return "
         "default.",
     },
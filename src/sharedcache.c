@@ -0,0 +1,875 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "args.h"
+#include "atomic.h"
+#include "core.h"
+#include "hash.h"
+#include "lfu.h"
+#include "proclock.h"
+#include "stats.h"
+
+#include <Python.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SharedCache_MAGIC 0x43545348U /* "CTSH" */
+#define SharedCache_ALIGN 8
+#define SharedCache_EMPTY (-1)
+#define SharedCache_FREE UINT32_MAX /* vlen of a slot not in use */
+#define SharedCache_ITEM_SIZE 1000
+#define SharedCache_STRIPES 64
+
+/* Header at the start of the shared segment. It is followed by the stripes,
+ * the buckets of all stripes and the slots of all stripes. Every link is an
+ * index, so processes may map the segment at different addresses. */
+typedef struct {
+  uint32_t magic;
+  uint32_t nstripes;
+  uint32_t per_stripe; /* slots of a stripe */
+  uint32_t item_size;  /* max bytes of a key and its value */
+  uint64_t seed;
+  char _pad[CTS_CACHELINE - 4 * sizeof(uint32_t) - sizeof(uint64_t)];
+} CtsSharedCacheHeader;
+
+/* A stripe owns a share of the buckets and slots, all guarded by its lock,
+ * so an operation takes exactly one lock. One cache line per stripe. */
+typedef struct {
+  size_t lock;   /* pid of the owner, 0 if unlocked */
+  int32_t free;  /* first freed slot */
+  int32_t carve; /* slots never used start here */
+  int32_t size;
+  uint32_t _pad;
+  uint64_t ops; /* clock of LFU aging */
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t insertions;
+} CtsSharedCacheStripe;
+
+/* A slot is a header followed by the key and the value. */
+typedef struct {
+  uint64_t hash;
+  int32_t next; /* in the bucket, or in the free list */
+  uint32_t klen;
+  uint32_t vlen;
+  uint32_t visits;
+  char data[1];
+} CtsSharedCacheSlot;
+
+#define SharedSlot_HEADER offsetof(CtsSharedCacheSlot, data)
+#define SharedSlot_Key(slot) ((slot)->data)
+#define SharedSlot_Value(slot) ((slot)->data + (slot)->klen)
+
+/* clang-format off */
+typedef struct {
+  PyObject_HEAD
+  Py_buffer view;
+  CtsSharedCacheHeader *header;
+  CtsSharedCacheStripe *stripes;
+  int32_t *buckets;
+  char *slots;
+  Py_ssize_t stride;  /* bytes of a slot */
+} CtsSharedCache;
+/* clang-format on */
+
+static PyTypeObject SharedCache_Type;
+
+#define SharedCache_Align(n)                                                   \
+  (((n) + SharedCache_ALIGN - 1) & ~(size_t)(SharedCache_ALIGN - 1))
+#define SharedCache_Stride(item_size)                                          \
+  ((Py_ssize_t)SharedCache_Align(SharedSlot_HEADER + (size_t)(item_size)))
+#define SharedCache_Slot(self, i)                                              \
+  ((CtsSharedCacheSlot *)((self)->slots + (Py_ssize_t)(i) * (self)->stride))
+/* Slots and buckets of a stripe are numbered from its index times
+ * per_stripe. */
+#define SharedCache_Base(self, s)                                              \
+  ((int32_t)((s) - (self)->stripes) * (int32_t)(self)->header->per_stripe)
+
+/* Bytes of the segment, buckets are padded to the alignment of slots. */
+static Py_ssize_t SharedCache_Layout(Py_ssize_t nstripes, Py_ssize_t per_stripe,
+                                     Py_ssize_t item_size) {
+  return (Py_ssize_t)sizeof(CtsSharedCacheHeader) +
+         nstripes * (Py_ssize_t)sizeof(CtsSharedCacheStripe) +
+         (Py_ssize_t)SharedCache_Align(
+             (size_t)(nstripes * per_stripe) * sizeof(int32_t)) +
+         nstripes * per_stripe * SharedCache_Stride(item_size);
+}
+
+/* The seed is kept in the segment, every process hashes a key alike. */
+static uint64_t SharedCache_Hash(CtsSharedCache *self, const char *p,
+                                 Py_ssize_t n) {
+  return CtsHash_Bytes(self->header->seed, p, n);
+}
+
+/* The low half of the hash picks the stripe, the high half the bucket. */
+static CtsSharedCacheStripe *SharedCache_StripeOf(CtsSharedCache *self,
+                                                  uint64_t hash) {
+  return self->stripes +
+         (((hash & 0xFFFFFFFFU) * self->header->nstripes) >> 32);
+}
+
+static int32_t *SharedCache_BucketOf(CtsSharedCache *self,
+                                     CtsSharedCacheStripe *s, uint64_t hash) {
+  return self->buckets + SharedCache_Base(self, s) +
+         (((hash >> 32) * self->header->per_stripe) >> 32);
+}
+
+/* Forget all items of a stripe. */
+static void SharedCache_ResetStripe(CtsSharedCache *self,
+                                    CtsSharedCacheStripe *s) {
+  memset(self->buckets + SharedCache_Base(self, s), 0xFF,
+         sizeof(int32_t) * self->header->per_stripe);
+  s->free = SharedCache_EMPTY;
+  s->carve = 0;
+  s->size = 0;
+  s->ops = 0;
+}
+
+/* Take the lock of a stripe. A lock left by a process that died in the
+ * middle of an operation is taken over, the stripe is emptied as it may be
+ * torn. */
+static void SharedCache_Lock(CtsSharedCache *self, CtsSharedCacheStripe *s) {
+  if (CtsProcLock_Acquire(&s->lock)) {
+    SharedCache_ResetStripe(self, s);
+  }
+}
+
+static void SharedCache_Unlock(CtsSharedCacheStripe *s) {
+  CtsProcLock_Release(&s->lock);
+}
+
+/* Bytes of a key, a str is read as UTF-8. */
+static int SharedCache_KeyBytes(PyObject *ob, const char **p, Py_ssize_t *n) {
+  if (PyBytes_Check(ob)) {
+    *p = PyBytes_AS_STRING(ob);
+    *n = PyBytes_GET_SIZE(ob);
+    return 0;
+  }
+  if (PyUnicode_Check(ob)) {
+    *p = PyUnicode_AsUTF8AndSize(ob, n);
+    return *p == NULL ? -1 : 0;
+  }
+  PyErr_Format(PyExc_TypeError, "expect bytes or str, not %.100s",
+               Py_TYPE(ob)->tp_name);
+  return -1;
+}
+
+/* The slot of a key in a locked stripe, `*link` receives the index that
+ * points to it. */
+static int32_t SharedCache_Find(CtsSharedCache *self, int32_t *bucket,
+                                const char *key, Py_ssize_t klen,
+                                uint64_t hash, int32_t **link) {
+  CtsSharedCacheSlot *slot;
+  int32_t i;
+  while ((i = *bucket) != SharedCache_EMPTY) {
+    slot = SharedCache_Slot(self, i);
+    if (slot->hash == hash && slot->klen == (uint32_t)klen &&
+        memcmp(SharedSlot_Key(slot), key, (size_t)klen) == 0) {
+      break;
+    }
+    bucket = &slot->next;
+  }
+  if (link) {
+    *link = bucket;
+  }
+  return i;
+}
+
+/* Unlink a slot from its bucket and free it. */
+static void SharedCache_Remove(CtsSharedCache *self, CtsSharedCacheStripe *s,
+                               int32_t i, int32_t *link) {
+  CtsSharedCacheSlot *slot = SharedCache_Slot(self, i);
+  *link = slot->next;
+  slot->vlen = SharedCache_FREE;
+  slot->next = s->free;
+  s->free = i;
+  s->size--;
+}
+
+/* The owner of CtsLFU_VisitsOf, the slots of a stripe. */
+typedef struct {
+  CtsSharedCache *self;
+  int32_t base;
+} SharedCache_StripeSlots;
+
+/* CtsLFU_VisitsOf of the slots of a stripe, NULL for a freed slot. */
+static uint32_t *SharedCache_VisitsOf(void *owner, Py_ssize_t pos) {
+  SharedCache_StripeSlots *slots = (SharedCache_StripeSlots *)owner;
+  CtsSharedCacheSlot *slot =
+      SharedCache_Slot(slots->self, slots->base + (int32_t)pos);
+  return slot->vlen == SharedCache_FREE ? NULL : &slot->visits;
+}
+
+/* Sampled LFU over the used slots of a stripe, like CacheMap. */
+static int32_t SharedCache_Victim(CtsSharedCache *self,
+                                  CtsSharedCacheStripe *s) {
+  SharedCache_StripeSlots slots = {self, SharedCache_Base(self, s)};
+  Py_ssize_t k;
+
+  if (s->size == 0) {
+    return SharedCache_EMPTY;
+  }
+  k = CtsLFU_Victim(s->carve, SharedCache_VisitsOf, &slots);
+  /* all samples hit freed slots */
+  for (Py_ssize_t i = 0; k < 0 && i < s->carve; i++) {
+    if (SharedCache_VisitsOf(&slots, i)) {
+      k = i;
+    }
+  }
+  return slots.base + (int32_t)k;
+}
+
+/* Evict the victim of a locked stripe, return 0 if it is empty. */
+static int SharedCache_EvictOne(CtsSharedCache *self,
+                                CtsSharedCacheStripe *s) {
+  CtsSharedCacheSlot *slot;
+  int32_t i = SharedCache_Victim(self, s), *link;
+  if (i == SharedCache_EMPTY) {
+    return 0;
+  }
+  slot = SharedCache_Slot(self, i);
+  SharedCache_Find(self, SharedCache_BucketOf(self, s, slot->hash),
+                   SharedSlot_Key(slot), slot->klen, slot->hash, &link);
+  SharedCache_Remove(self, s, i, link);
+  s->evictions++;
+  return 1;
+}
+
+/* Halve the visits of a stripe once in a while, see CacheMap. */
+static void SharedCache_Tick(CtsSharedCache *self, CtsSharedCacheStripe *s) {
+  SharedCache_StripeSlots slots = {self, SharedCache_Base(self, s)};
+  Py_ssize_t ops = (Py_ssize_t)s->ops;
+  CtsLFU_Tick(&ops, s->carve, SharedCache_VisitsOf, &slots);
+  s->ops = (uint64_t)ops;
+}
+
+/* A slot for a new item in a locked stripe. */
+static int32_t SharedCache_Alloc(CtsSharedCache *self,
+                                 CtsSharedCacheStripe *s) {
+  int32_t i = s->free;
+  if (i != SharedCache_EMPTY) {
+    s->free = SharedCache_Slot(self, i)->next;
+    return i;
+  }
+  if (s->carve < (int32_t)self->header->per_stripe) {
+    return SharedCache_Base(self, s) + s->carve++;
+  }
+  SharedCache_EvictOne(self, s);
+  i = s->free;
+  s->free = SharedCache_Slot(self, i)->next;
+  return i;
+}
+
+/* New reference to a copy of the value of key, NULL without error set if
+ * not found. */
+static PyObject *SharedCache_Get(CtsSharedCache *self, PyObject *key) {
+  CtsSharedCacheStripe *s;
+  CtsSharedCacheSlot *slot;
+  PyObject *rv = NULL;
+  const char *k;
+  Py_ssize_t klen;
+  uint64_t hash;
+  int32_t i;
+
+  if (SharedCache_KeyBytes(key, &k, &klen)) {
+    return NULL;
+  }
+  hash = SharedCache_Hash(self, k, klen);
+  s = SharedCache_StripeOf(self, hash);
+  SharedCache_Lock(self, s);
+  i = SharedCache_Find(self, SharedCache_BucketOf(self, s, hash), k, klen,
+                       hash, NULL);
+  if (i == SharedCache_EMPTY) {
+    s->misses++;
+  } else {
+    slot = SharedCache_Slot(self, i);
+    CtsLFU_Visit(&slot->visits);
+    s->hits++;
+    /* a bytes object is not tracked by GC, no Python code runs here */
+    rv = PyBytes_FromStringAndSize(SharedSlot_Value(slot), slot->vlen);
+  }
+  SharedCache_Tick(self, s);
+  SharedCache_Unlock(s);
+  return rv;
+}
+
+static int SharedCache_SetItem(CtsSharedCache *self, PyObject *key,
+                               PyObject *value) {
+  CtsSharedCacheStripe *s;
+  CtsSharedCacheSlot *slot;
+  Py_buffer buf;
+  const char *k;
+  Py_ssize_t klen;
+  uint64_t hash;
+  int32_t *bucket, i;
+
+  if (SharedCache_KeyBytes(key, &k, &klen)) {
+    return -1;
+  }
+  if (PyUnicode_Check(value)) {
+    PyErr_SetString(PyExc_TypeError, "expect bytes-like value, not str");
+    return -1;
+  }
+  /* may run Python code, done before taking the lock */
+  if (PyObject_GetBuffer(value, &buf, PyBUF_SIMPLE)) {
+    return -1;
+  }
+  if ((size_t)klen + (size_t)buf.len > self->header->item_size) {
+    PyBuffer_Release(&buf);
+    PyErr_Format(PyExc_ValueError,
+                 "key and value are longer than item_size %u",
+                 self->header->item_size);
+    return -1;
+  }
+  hash = SharedCache_Hash(self, k, klen);
+  s = SharedCache_StripeOf(self, hash);
+  bucket = SharedCache_BucketOf(self, s, hash);
+  SharedCache_Lock(self, s);
+  i = SharedCache_Find(self, bucket, k, klen, hash, NULL);
+  if (i == SharedCache_EMPTY) {
+    i = SharedCache_Alloc(self, s);
+    slot = SharedCache_Slot(self, i);
+    slot->hash = hash;
+    slot->klen = (uint32_t)klen;
+    slot->visits = CtsLFU_INIT_VISITS;
+    memcpy(SharedSlot_Key(slot), k, (size_t)klen);
+    slot->next = *bucket;
+    *bucket = i;
+    s->size++;
+    s->insertions++;
+  } else {
+    slot = SharedCache_Slot(self, i);
+  }
+  slot->vlen = (uint32_t)buf.len;
+  memcpy(SharedSlot_Value(slot), buf.buf, (size_t)buf.len);
+  SharedCache_Tick(self, s);
+  SharedCache_Unlock(s);
+  PyBuffer_Release(&buf);
+  return 0;
+}
+
+/* Remove key, return 1 if found. `*value` receives a copy of its value if
+ * not NULL. */
+static int SharedCache_DelItem(CtsSharedCache *self, PyObject *key,
+                               PyObject **value) {
+  CtsSharedCacheStripe *s;
+  CtsSharedCacheSlot *slot;
+  const char *k;
+  Py_ssize_t klen;
+  uint64_t hash;
+  int32_t *link, i;
+  int rv = 0;
+
+  if (SharedCache_KeyBytes(key, &k, &klen)) {
+    return -1;
+  }
+  hash = SharedCache_Hash(self, k, klen);
+  s = SharedCache_StripeOf(self, hash);
+  SharedCache_Lock(self, s);
+  i = SharedCache_Find(self, SharedCache_BucketOf(self, s, hash), k, klen,
+                       hash, &link);
+  if (i != SharedCache_EMPTY) {
+    slot = SharedCache_Slot(self, i);
+    if (value) {
+      *value = PyBytes_FromStringAndSize(SharedSlot_Value(slot), slot->vlen);
+    }
+    if (value == NULL || *value != NULL) {
+      SharedCache_Remove(self, s, i, link);
+      rv = 1;
+    } else {
+      rv = -1;
+    }
+  }
+  SharedCache_Unlock(s);
+  return rv;
+}
+
+static Py_ssize_t SharedCache_mp_length(CtsSharedCache *self) {
+  CtsSharedCacheStripe *s = self->stripes;
+  Py_ssize_t size = 0;
+  for (uint32_t i = 0; i < self->header->nstripes; i++, s++) {
+    SharedCache_Lock(self, s);
+    size += s->size;
+    SharedCache_Unlock(s);
+  }
+  return size;
+}
+
+static PyObject *SharedCache_mp_subscript(CtsSharedCache *self,
+                                          PyObject *key) {
+  PyObject *value = SharedCache_Get(self, key);
+  if (value == NULL && !PyErr_Occurred()) {
+    PyErr_SetObject(PyExc_KeyError, key);
+  }
+  return value;
+}
+
+static int SharedCache_mp_ass_sub(CtsSharedCache *self, PyObject *key,
+                                  PyObject *value) {
+  int rv;
+  if (value) {
+    return SharedCache_SetItem(self, key, value);
+  }
+  rv = SharedCache_DelItem(self, key, NULL);
+  if (rv == 0) {
+    PyErr_SetObject(PyExc_KeyError, key);
+  }
+  return rv == 1 ? 0 : -1;
+}
+
+static PyMappingMethods SharedCache_as_mapping = {
+    (lenfunc)SharedCache_mp_length,        /* mp_length */
+    (binaryfunc)SharedCache_mp_subscript,  /* mp_subscript */
+    (objobjargproc)SharedCache_mp_ass_sub, /* mp_ass_subscript */
+};
+
+/* Not counted as a hit. */
+static int SharedCache_sq_contains(CtsSharedCache *self, PyObject *key) {
+  CtsSharedCacheStripe *s;
+  const char *k;
+  Py_ssize_t klen;
+  uint64_t hash;
+  int32_t i;
+
+  if (SharedCache_KeyBytes(key, &k, &klen)) {
+    PyErr_Clear();
+    return 0;
+  }
+  hash = SharedCache_Hash(self, k, klen);
+  s = SharedCache_StripeOf(self, hash);
+  SharedCache_Lock(self, s);
+  i = SharedCache_Find(self, SharedCache_BucketOf(self, s, hash), k, klen,
+                       hash, NULL);
+  SharedCache_Unlock(s);
+  return i != SharedCache_EMPTY;
+}
+
+static PySequenceMethods SharedCache_as_sequence = {
+    0,                                   /* sq_length */
+    0,                                   /* sq_concat */
+    0,                                   /* sq_repeat */
+    0,                                   /* sq_item */
+    0,                                   /* sq_slice */
+    0,                                   /* sq_ass_item */
+    0,                                   /* sq_ass_slice */
+    (objobjproc)SharedCache_sq_contains, /* sq_contains */
+    0,                                   /* sq_inplace_concat */
+    0,                                   /* sq_inplace_repeat */
+};
+
+static PyObject *SharedCache_get(CtsSharedCache *self, CtsArg_PARAMS) {
+  PyObject *argv[2], *value;
+
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"get", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  value = SharedCache_Get(self, argv[0]);
+  if (value == NULL && !PyErr_Occurred()) {
+    value = argv[1] ? argv[1] : Py_None;
+    Py_INCREF(value);
+  }
+  return value;
+}
+
+static PyObject *SharedCache_set(CtsSharedCache *self, CtsArg_PARAMS) {
+  PyObject *argv[2];
+
+  static const char *const kwlist[] = {"key", "value", NULL};
+  static CtsArg_Parser parser = {"set", kwlist, 2, 2};
+  if (CtsArg_UNPACK(&parser, argv) ||
+      SharedCache_SetItem(self, argv[0], argv[1])) {
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *SharedCache_pop(CtsSharedCache *self, CtsArg_PARAMS) {
+  PyObject *argv[2], *value = NULL;
+  int rv;
+
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"pop", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  rv = SharedCache_DelItem(self, argv[0], &value);
+  if (rv == 0) {
+    value = argv[1] ? argv[1] : Py_None;
+    Py_INCREF(value);
+  }
+  return rv < 0 ? NULL : value;
+}
+
+/* Evict round robin over the stripes, each keeps its own LFU order. */
+static PyObject *SharedCache_evict(CtsSharedCache *self, CtsArg_PARAMS) {
+  PyObject *argv[1];
+  CtsSharedCacheStripe *s;
+  Py_ssize_t n = 1, evicted = 0;
+  uint32_t i, nstripes = self->header->nstripes, empty = 0;
+
+  static const char *const kwlist[] = {"n", NULL};
+  static CtsArg_Parser parser = {"evict", kwlist, 0, 1};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  if (argv[0] && (n = PyLong_AsSsize_t(argv[0])) < 0) {
+    if (!PyErr_Occurred()) {
+      PyErr_SetString(PyExc_ValueError, "n should not be negative");
+    }
+    return NULL;
+  }
+  for (i = 0; evicted < n && empty < nstripes; i = (i + 1) % nstripes) {
+    s = self->stripes + i;
+    SharedCache_Lock(self, s);
+    if (SharedCache_EvictOne(self, s)) {
+      evicted++;
+      empty = 0;
+    } else {
+      empty++;
+    }
+    SharedCache_Unlock(s);
+  }
+  return PyLong_FromSsize_t(evicted);
+}
+
+static PyObject *SharedCache_clear(CtsSharedCache *self,
+                                   PyObject *Py_UNUSED(unused)) {
+  CtsSharedCacheStripe *s = self->stripes;
+  for (uint32_t i = 0; i < self->header->nstripes; i++, s++) {
+    SharedCache_Lock(self, s);
+    SharedCache_ResetStripe(self, s);
+    SharedCache_Unlock(s);
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *SharedCache_stats(CtsSharedCache *self, CtsArg_PARAMS) {
+  PyObject *argv[1];
+  CtsSharedCacheStripe *s = self->stripes;
+  CtsCacheStats stats;
+  int reset = 0;
+
+  static const char *const kwlist[] = {"reset", NULL};
+  static CtsArg_Parser parser = {"stats", kwlist, 0, 1};
+  if (CtsArg_UNPACK(&parser, argv) || CtsArg_Bool(argv[0], &reset)) {
+    return NULL;
+  }
+  CtsStats_Init(&stats);
+  for (uint32_t i = 0; i < self->header->nstripes; i++, s++) {
+    SharedCache_Lock(self, s);
+    stats.hits += (Py_ssize_t)s->hits;
+    stats.misses += (Py_ssize_t)s->misses;
+    stats.evictions += (Py_ssize_t)s->evictions;
+    stats.insertions += (Py_ssize_t)s->insertions;
+    if (reset) {
+      s->hits = s->misses = s->evictions = s->insertions = 0;
+    }
+    SharedCache_Unlock(s);
+  }
+  return CtsStats_AsDict(&stats);
+}
+
+/* Parse item_size and stripes, shared by nbytes and the constructor. */
+static int SharedCache_ParseLayout(Py_ssize_t item_size, Py_ssize_t stripes) {
+  if (item_size <= 0 || item_size > INT32_MAX) {
+    PyErr_SetString(PyExc_ValueError,
+                    "item_size should be a positive int32 integer");
+    return -1;
+  }
+  if (stripes <= 0 || stripes > UINT16_MAX) {
+    PyErr_SetString(PyExc_ValueError,
+                    "stripes should be in range [1, 65535]");
+    return -1;
+  }
+  return 0;
+}
+
+static PyObject *SharedCache_nbytes(PyObject *Py_UNUSED(cls), PyObject *args,
+                                    PyObject *kwds) {
+  Py_ssize_t capacity, item_size = SharedCache_ITEM_SIZE,
+                       stripes = SharedCache_STRIPES;
+  static char *kwlist[] = {"capacity", "item_size", "stripes", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "n|nn", kwlist, &capacity,
+                                   &item_size, &stripes)) {
+    return NULL;
+  }
+  if (capacity <= 0 || capacity > INT32_MAX) {
+    PyErr_SetString(PyExc_ValueError,
+                    "capacity should be a positive int32 integer");
+    return NULL;
+  }
+  if (SharedCache_ParseLayout(item_size, stripes)) {
+    return NULL;
+  }
+  return PyLong_FromSsize_t(SharedCache_Layout(
+      stripes, (capacity + stripes - 1) / stripes, item_size));
+}
+
+/* Lay out a new segment in the whole buffer. */
+static int SharedCache_Create(CtsSharedCache *self, Py_ssize_t item_size,
+                              Py_ssize_t stripes) {
+  CtsSharedCacheHeader *h = self->header;
+  Py_ssize_t fixed = SharedCache_Layout(stripes, 0, item_size), n;
+  /* a slot and its bucket */
+  Py_ssize_t cost = SharedCache_Stride(item_size) + (Py_ssize_t)sizeof(int32_t);
+
+  n = (self->view.len - fixed) / (stripes * cost);
+  /* buckets may be padded */
+  if (n > 0 && SharedCache_Layout(stripes, n, item_size) > self->view.len) {
+    n--;
+  }
+  if (n * stripes > INT32_MAX) {
+    n = INT32_MAX / stripes;
+  }
+  if (n <= 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "buffer is too small for a slot in each stripe.");
+    return -1;
+  }
+  memset(h, 0, (size_t)fixed);
+  h->nstripes = (uint32_t)stripes;
+  h->per_stripe = (uint32_t)n;
+  h->item_size = (uint32_t)item_size;
+  /* keys of one segment do not collide alike in another */
+  h->seed = (uint64_t)(uintptr_t)h * 0x9E3779B97F4A7C15ULL ^
+            (uint64_t)time(NULL) ^ (uint64_t)CtsProcLock_pid << 32;
+  return 0;
+}
+
+static PyObject *SharedCache_tp_new(PyTypeObject *type, PyObject *args,
+                                    PyObject *kwds) {
+  CtsSharedCache *self;
+  CtsSharedCacheHeader *h;
+  PyObject *buffer;
+  Py_ssize_t item_size = SharedCache_ITEM_SIZE, stripes = SharedCache_STRIPES;
+  int create = 0;
+  static char *kwlist[] = {"buffer", "create", "item_size", "stripes", NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|pnn", kwlist, &buffer,
+                                   &create, &item_size, &stripes)) {
+    return NULL;
+  }
+  if (SharedCache_ParseLayout(item_size, stripes)) {
+    return NULL;
+  }
+  self = (CtsSharedCache *)type->tp_alloc(type, 0);
+  ReturnIfNULL(self, NULL);
+  if (PyObject_GetBuffer(buffer, &self->view,
+                         PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS)) {
+    self->view.obj = NULL;
+    Py_DECREF(self);
+    return NULL;
+  }
+  if (self->view.len < (Py_ssize_t)sizeof(CtsSharedCacheHeader) ||
+      ((uintptr_t)self->view.buf & (CTS_CACHELINE - 1))) {
+    PyErr_SetString(PyExc_ValueError,
+                    "buffer is too small or not aligned to 64 bytes.");
+    Py_DECREF(self);
+    return NULL;
+  }
+  h = (CtsSharedCacheHeader *)self->view.buf;
+  self->header = h;
+  if (create) {
+    if (SharedCache_Create(self, item_size, stripes)) {
+      Py_DECREF(self);
+      return NULL;
+    }
+  } else if (h->magic != SharedCache_MAGIC ||
+             SharedCache_Layout(h->nstripes, h->per_stripe, h->item_size) >
+                 self->view.len) {
+    PyErr_SetString(PyExc_ValueError,
+                    "buffer is not an initialized SharedCache.");
+    Py_DECREF(self);
+    return NULL;
+  }
+  self->stripes = (CtsSharedCacheStripe *)((char *)h + sizeof(*h));
+  self->buckets = (int32_t *)(self->stripes + h->nstripes);
+  self->slots = (char *)self->buckets +
+                SharedCache_Align((size_t)h->nstripes * h->per_stripe *
+                                  sizeof(int32_t));
+  self->stride = SharedCache_Stride(h->item_size);
+  if (create) {
+    for (uint32_t i = 0; i < h->nstripes; i++) {
+      SharedCache_ResetStripe(self, self->stripes + i);
+    }
+    h->magic = SharedCache_MAGIC;
+  }
+  return (PyObject *)self;
+}
+
+static void SharedCache_tp_dealloc(CtsSharedCache *self) {
+  if (self->view.obj != NULL) {
+    PyBuffer_Release(&self->view);
+  }
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *SharedCache_get_capacity(CtsSharedCache *self,
+                                          void *Py_UNUSED(closure)) {
+  return PyLong_FromSsize_t((Py_ssize_t)self->header->nstripes *
+                            self->header->per_stripe);
+}
+
+static PyObject *SharedCache_get_item_size(CtsSharedCache *self,
+                                           void *Py_UNUSED(closure)) {
+  return PyLong_FromUnsignedLong(self->header->item_size);
+}
+
+static PyObject *SharedCache_get_stripes(CtsSharedCache *self,
+                                         void *Py_UNUSED(closure)) {
+  return PyLong_FromUnsignedLong(self->header->nstripes);
+}
+
+static PyGetSetDef SharedCache_getset[] = {
+    {"capacity", (getter)SharedCache_get_capacity, NULL,
+     "Max size of cache, each stripe holds an equal share.", NULL},
+    {"item_size", (getter)SharedCache_get_item_size, NULL,
+     "Max bytes of a key and its value.", NULL},
+    {"stripes", (getter)SharedCache_get_stripes, NULL,
+     "Number of independently locked parts.", NULL},
+    {NULL, NULL, NULL, NULL, NULL} /* Sentinel */
+};
+
+static PyMethodDef SharedCache_methods[] = {
+    {"get", (PyCFunction)SharedCache_get, CtsArg_METH,
+     "get(key, default=None)\n--\n\nGet a copy of the value of key."},
+    {"set", (PyCFunction)SharedCache_set, CtsArg_METH,
+     "set(key, value)\n--\n\nCopy key and value into cache."},
+    {"pop", (PyCFunction)SharedCache_pop, CtsArg_METH,
+     "pop(key, default=None)\n--\n\nPop an item from cache, if key not "
+     "exists return default."},
+    {"evict", (PyCFunction)SharedCache_evict, CtsArg_METH,
+     "evict(n=1)\n--\n\nEvict up to ``n`` of the least used items, return "
+     "the number evicted."},
+    {"clear", (PyCFunction)SharedCache_clear, METH_NOARGS,
+     "clear()\n--\n\nRemove all items in all processes."},
+    {"stats", (PyCFunction)SharedCache_stats, CtsArg_METH,
+     "stats(reset=False)\n--\n\nReturn a dict of hits, misses, evictions, "
+     "expirations and insertions of all processes, reset all of them if "
+     "``reset`` is true."},
+    {"nbytes", (PyCFunction)SharedCache_nbytes,
+     METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+     "nbytes(capacity, item_size=1000, stripes=64)\n--\n\nReturn the "
+     "buffer length needed for ``capacity`` items."},
+    {NULL, NULL, 0, NULL} /* Sentinel */
+};
+
+PyDoc_STRVAR(
+    SharedCache__doc__,
+    "SharedCache(buffer, create=False, item_size=1000, stripes=64)\n--\n\n"
+    "A LFU cache of bytes living in shared memory, usable by many\n"
+    "processes at once.\n"
+    "\n"
+    "The buffer is split into stripes, each with its own lock, buckets and\n"
+    "slots. A key is hashed to one stripe, so an operation takes a single\n"
+    "spin lock and processes rarely wait for each other. Each slot holds a\n"
+    "key and its value of up to ``item_size`` bytes, a full stripe evicts\n"
+    "its least used item.\n"
+    "\n"
+    "A str key is the same key as its UTF-8 encoded bytes, values are\n"
+    "bytes-like and returned as bytes. If a process dies holding a lock,\n"
+    "the next process to take it empties that stripe. All processes should\n"
+    "share a pid namespace for this to be detected.\n"
+    "\n"
+    "Parameters\n"
+    "----------\n"
+    "buffer : writable bytes-like\n"
+    "  Shared memory aligned to 64 bytes, e.g. a ``mmap.mmap`` of a file,\n"
+    "  of ``os.memfd_create`` or a\n"
+    "  ``multiprocessing.shared_memory.SharedMemory.buf``. It must outlive\n"
+    "  the cache.\n"
+    "create : bool, optional\n"
+    "  Lay out a new cache in the whole buffer, exactly one process should\n"
+    "  pass True before others attach.\n"
+    "item_size : int, optional\n"
+    "  Max bytes of a key and its value, only used with ``create``.\n"
+    "stripes : int, optional\n"
+    "  Number of locks, only used with ``create``.\n"
+    "\n"
+    "Examples\n"
+    "--------\n"
+    ">>> import ctools, mmap\n"
+    ">>> buf = mmap.mmap(-1, ctools.SharedCache.nbytes(1000))\n"
+    ">>> cache = ctools.SharedCache(buf, create=True)\n"
+    ">>> cache[b'foo'] = b'bar'\n"
+    ">>> ctools.SharedCache(buf)['foo']\n"
+    "b'bar'\n");
+
+static PyTypeObject SharedCache_Type = {
+    /* clang-format off */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    /* clang-format on */
+    "ctools.SharedCache",                  /* tp_name */
+    sizeof(CtsSharedCache),                /* tp_basicsize */
+    0,                                     /* tp_itemsize */
+    (destructor)SharedCache_tp_dealloc,    /* tp_dealloc */
+    0,                                     /* tp_print */
+    0,                                     /* tp_getattr */
+    0,                                     /* tp_setattr */
+    0,                                     /* tp_compare */
+    0,                                     /* tp_repr */
+    0,                                     /* tp_as_number */
+    &SharedCache_as_sequence,              /* tp_as_sequence */
+    &SharedCache_as_mapping,               /* tp_as_mapping */
+    PyObject_HashNotImplemented,           /* tp_hash */
+    0,                                     /* tp_call */
+    0,                                     /* tp_str */
+    0,                                     /* tp_getattro */
+    0,                                     /* tp_setattro */
+    0,                                     /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                    /* tp_flags */
+    SharedCache__doc__,                    /* tp_doc */
+    0,                                     /* tp_traverse */
+    0,                                     /* tp_clear */
+    0,                                     /* tp_richcompare */
+    0,                                     /* tp_weaklistoffset */
+    0,                                     /* tp_iter */
+    0,                                     /* tp_iternext */
+    SharedCache_methods,                   /* tp_methods */
+    0,                                     /* tp_members */
+    SharedCache_getset,                    /* tp_getset */
+    0,                                     /* tp_base */
+    0,                                     /* tp_dict */
+    0,                                     /* tp_descr_get */
+    0,                                     /* tp_descr_set */
+    0,                                     /* tp_dictoffset */
+    0,                                     /* tp_init */
+    0,                                     /* tp_alloc */
+    (newfunc)SharedCache_tp_new,           /* tp_new */
+};
+
+EXTERN_C_START
+int ctools_init_sharedcache(PyObject *module) {
+  if (PyType_Ready(&SharedCache_Type) < 0) {
+    return -1;
+  }
+  if (CtsProcLock_Setup()) {
+    return -1;
+  }
+  Py_INCREF(&SharedCache_Type);
+  if (PyModule_AddObject(module, "SharedCache",
+                         PyObjectCast(&SharedCache_Type))) {
+    Py_DECREF(&SharedCache_Type);
+    return -1;
+  }
+  return 0;
+}
+EXTERN_C_END
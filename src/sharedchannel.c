@@ -0,0 +1,667 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "args.h"
+#include "atomic.h"
+#include "core.h"
+#include "proclock.h"
+
+#include <Python.h>
+#include <string.h>
+
+#ifdef MS_WINDOWS
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#define SharedChannel_HAVE_FUTEX 1
+#endif
+
+#define SharedChannel_MAGIC 0x43545343U /* "CTSC" */
+#define SharedChannel_WRAP 0xFFFFFFFFU
+#define SharedChannel_ALIGN 8
+#define SharedChannel_CLOSE_SEND 1U
+#define SharedChannel_CLOSE_RECV 2U
+/* Polling interval in microseconds when futex is not available. */
+#define SharedChannel_POLL_US 100
+
+/* Header at the start of the shared segment, followed by the data ring.
+ * Records are a uint32 length followed by the payload, padded to 8 bytes.
+ * A length of SharedChannel_WRAP tells the reader to restart at offset 0.
+ * head and tail are monotonic byte offsets, the producer only writes its own
+ * cache line and the consumer only writes the other one. Any number of
+ * processes may send and receive: senders take send_lock and receivers
+ * recv_lock, so the ring only ever sees one producer and one consumer.
+ */
+typedef struct {
+  uint32_t magic;
+  uint32_t closed;
+  size_t capacity;
+  char _pad0[CTS_CACHELINE - 2 * sizeof(uint32_t) - sizeof(size_t)];
+  /* producer line */
+  size_t tail;
+  size_t send_lock; /* see proclock.h */
+  uint32_t data_seq;
+  uint32_t space_waiters;
+  char _pad1[CTS_CACHELINE - 2 * sizeof(size_t) - 2 * sizeof(uint32_t)];
+  /* consumer line */
+  size_t head;
+  size_t recv_lock;
+  uint32_t space_seq;
+  uint32_t data_waiters;
+  char _pad2[CTS_CACHELINE - 2 * sizeof(size_t) - 2 * sizeof(uint32_t)];
+} CtsSharedChannelHeader;
+
+#define SharedChannel_HEADER_SIZE ((Py_ssize_t)sizeof(CtsSharedChannelHeader))
+
+typedef struct {
+  /* clang-format off */
+  PyObject_HEAD
+  Py_buffer view;
+  /* clang-format on */
+  CtsSharedChannelHeader *header;
+  char *data;
+  size_t capacity; /* read once at attach, the header is not trusted */
+} CtsSharedChannel;
+
+static PyTypeObject SharedChannel_Type;
+
+#define SharedChannel_Align(n)                                                 \
+  (((n) + SharedChannel_ALIGN - 1) & ~(size_t)(SharedChannel_ALIGN - 1))
+
+/* Flags of close(), set by any process at any time. */
+#if defined(__GNUC__) || defined(__clang__)
+#define SharedChannel_Closed(h) __atomic_load_n(&(h)->closed, __ATOMIC_ACQUIRE)
+#define SharedChannel_SetClosed(h, flags)                                      \
+  __atomic_or_fetch(&(h)->closed, (flags), __ATOMIC_SEQ_CST)
+#elif defined(_MSC_VER)
+#define SharedChannel_Closed(h) (*(volatile uint32_t *)&(h)->closed)
+#define SharedChannel_SetClosed(h, flags)                                      \
+  _InterlockedOr((volatile long *)&(h)->closed, (long)(flags))
+#else
+#define SharedChannel_Closed(h) (*(volatile uint32_t *)&(h)->closed)
+#define SharedChannel_SetClosed(h, flags) ((h)->closed |= (flags))
+#endif
+
+#ifdef SharedChannel_HAVE_FUTEX
+
+#define SharedChannel_Load32(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define SharedChannel_Add32(p, v) __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define SharedChannel_Fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/* Sleep while *addr == val. timeout < 0 means forever. */
+static void SharedChannel_FutexWait(uint32_t *addr, uint32_t val,
+                                    double timeout) {
+  struct timespec ts, *pts = NULL;
+  if (timeout >= 0) {
+    ts.tv_sec = (time_t)timeout;
+    ts.tv_nsec = (long)((timeout - (double)ts.tv_sec) * 1e9);
+    pts = &ts;
+  }
+  syscall(SYS_futex, addr, FUTEX_WAIT, val, pts, NULL, 0);
+}
+
+static void SharedChannel_FutexWake(uint32_t *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+/* Bump seq and wake sleepers, skip the syscall when nobody waits. */
+static void SharedChannel_Notify(uint32_t *seq, uint32_t *waiters) {
+  SharedChannel_Fence();
+  if (SharedChannel_Load32(waiters) > 0) {
+    SharedChannel_Add32(seq, 1);
+    SharedChannel_FutexWake(seq);
+  }
+}
+
+#endif
+
+/* Monotonic clock in seconds. */
+static double SharedChannel_Now(void) {
+#ifdef MS_WINDOWS
+  return (double)GetTickCount64() / 1e3;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+/* Copy a message into the ring.
+ * Return 1 on success, 0 if there is no room yet, `*head_seen` receives
+ * the consumer offset the decision was based on. A sender that died with
+ * the lock never published its record, the lock is just taken over. */
+static int SharedChannel_TrySend(CtsSharedChannel *self, const char *buf,
+                                 Py_ssize_t len, size_t *head_seen) {
+  CtsSharedChannelHeader *h = self->header;
+  size_t cap = self->capacity;
+  size_t need = SharedChannel_Align(sizeof(uint32_t) + (size_t)len);
+  size_t tail, head, pos, skip = 0;
+  uint32_t n = (uint32_t)len, wrap = SharedChannel_WRAP;
+
+  CtsProcLock_Acquire(&h->send_lock);
+  tail = Cts_AtomicLoadRelaxed(&h->tail);
+  head = Cts_AtomicLoadAcquire(&h->head);
+  pos = tail % cap;
+  *head_seen = head;
+  if (cap - pos < need) {
+    skip = cap - pos;
+  }
+  if (cap - (tail - head) < skip + need) {
+    CtsProcLock_Release(&h->send_lock);
+    return 0;
+  }
+  if (skip) {
+    memcpy(self->data + pos, &wrap, sizeof(uint32_t));
+    pos = 0;
+  }
+  memcpy(self->data + pos, &n, sizeof(uint32_t));
+  memcpy(self->data + pos + sizeof(uint32_t), buf, (size_t)len);
+  Cts_AtomicStoreRelease(&h->tail, tail + skip + need);
+  CtsProcLock_Release(&h->send_lock);
+#ifdef SharedChannel_HAVE_FUTEX
+  SharedChannel_Notify(&h->data_seq, &h->data_waiters);
+#endif
+  return 1;
+}
+
+/* Return new bytes object, NULL without error set if empty.
+ * `*tail_seen` receives the producer offset the decision was based on.
+ * Record lengths come from another process and are checked against the
+ * ring before copying. A bytes object is not tracked by the collector, so
+ * allocating it under the lock runs no Python code. */
+static PyObject *SharedChannel_TryRecv(CtsSharedChannel *self,
+                                       size_t *tail_seen) {
+  CtsSharedChannelHeader *h = self->header;
+  size_t cap = self->capacity;
+  size_t head, tail, pos;
+  uint32_t n;
+  PyObject *rv;
+
+  CtsProcLock_Acquire(&h->recv_lock);
+  head = Cts_AtomicLoadRelaxed(&h->head);
+  tail = Cts_AtomicLoadAcquire(&h->tail);
+  *tail_seen = tail;
+  if (head == tail) {
+    CtsProcLock_Release(&h->recv_lock);
+    return NULL;
+  }
+  pos = head % cap;
+  memcpy(&n, self->data + pos, sizeof(uint32_t));
+  if (n == SharedChannel_WRAP) {
+    head += cap - pos;
+    pos = 0;
+    memcpy(&n, self->data, sizeof(uint32_t));
+  }
+  if (n > cap - pos - sizeof(uint32_t) ||
+      head + SharedChannel_Align(sizeof(uint32_t) + n) > tail) {
+    CtsProcLock_Release(&h->recv_lock);
+    PyErr_SetString(PyExc_ValueError, "channel is corrupted.");
+    return NULL;
+  }
+  rv = PyBytes_FromStringAndSize(self->data + pos + sizeof(uint32_t), n);
+  if (rv == NULL) {
+    CtsProcLock_Release(&h->recv_lock);
+    return NULL;
+  }
+  Cts_AtomicStoreRelease(&h->head,
+                         head + SharedChannel_Align(sizeof(uint32_t) + n));
+  CtsProcLock_Release(&h->recv_lock);
+#ifdef SharedChannel_HAVE_FUTEX
+  SharedChannel_Notify(&h->space_seq, &h->space_waiters);
+#endif
+  return rv;
+}
+
+/* Block while `*watch` equals `seen` until notified or deadline passes.
+ * Return -1 with error set if interrupted by a signal handler. */
+static int SharedChannel_Wait(uint32_t *seq, uint32_t *waiters, size_t *watch,
+                              size_t seen, double deadline) {
+  double timeout = -1;
+  if (deadline >= 0) {
+    timeout = deadline - SharedChannel_Now();
+    if (timeout <= 0) {
+      return 0;
+    }
+  }
+#ifdef SharedChannel_HAVE_FUTEX
+  {
+    uint32_t val = SharedChannel_Load32(seq);
+    SharedChannel_Add32(waiters, 1);
+    SharedChannel_Fence();
+    /* The peer publishes its offset, fences, then reads waiters. So either
+     * it sees us registered and bumps seq, or we see the new offset here. */
+    if (Cts_AtomicLoadAcquire(watch) == seen) {
+      Py_BEGIN_ALLOW_THREADS;
+      SharedChannel_FutexWait(seq, val, timeout);
+      Py_END_ALLOW_THREADS;
+    }
+    SharedChannel_Add32(waiters, (uint32_t)-1);
+  }
+#else
+  (void)seq;
+  (void)waiters;
+  (void)watch;
+  (void)seen;
+  (void)timeout;
+  Py_BEGIN_ALLOW_THREADS;
+#ifdef MS_WINDOWS
+  Sleep(1);
+#else
+  usleep(SharedChannel_POLL_US);
+#endif
+  Py_END_ALLOW_THREADS;
+#endif
+  return PyErr_CheckSignals();
+}
+
+static int SharedChannel_ParseTimeout(PyObject *obj, double *deadline) {
+  double timeout;
+  if (obj == NULL) {
+    *deadline = 0;
+    return 0;
+  }
+  if (obj == Py_None) {
+    *deadline = -1;
+    return 0;
+  }
+  timeout = PyFloat_AsDouble(obj);
+  if (timeout == -1 && PyErr_Occurred()) {
+    return -1;
+  }
+  if (timeout < 0) {
+    PyErr_SetString(PyExc_ValueError, "timeout should not be negative.");
+    return -1;
+  }
+  *deadline = timeout == 0 ? 0 : SharedChannel_Now() + timeout;
+  return 0;
+}
+
+static PyObject *SharedChannel_send(CtsSharedChannel *self, CtsArg_PARAMS) {
+  PyObject *argv[2];
+  Py_buffer msg;
+  double deadline;
+  size_t seen;
+  uint32_t closed;
+  int ok;
+
+  static const char *const kwlist[] = {"data", "timeout", NULL};
+  static CtsArg_Parser parser = {"send", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  if (PyObject_GetBuffer(argv[0], &msg, PyBUF_SIMPLE)) {
+    return NULL;
+  }
+  if (SharedChannel_ParseTimeout(argv[1], &deadline)) {
+    PyBuffer_Release(&msg);
+    return NULL;
+  }
+  if (msg.len >= (Py_ssize_t)SharedChannel_WRAP ||
+      SharedChannel_Align(sizeof(uint32_t) + (size_t)msg.len) >
+          self->capacity) {
+    PyBuffer_Release(&msg);
+    PyErr_SetString(PyExc_ValueError, "message is larger than the channel.");
+    return NULL;
+  }
+  for (;;) {
+    closed = SharedChannel_Closed(self->header);
+    if (closed & SharedChannel_CLOSE_SEND) {
+      PyBuffer_Release(&msg);
+      PyErr_SetString(PyExc_IndexError, "channel is closed for sending.");
+      return NULL;
+    }
+    /* nobody will take the message, or wake a sender waiting for space */
+    if (closed & SharedChannel_CLOSE_RECV) {
+      ok = 0;
+      break;
+    }
+    ok = SharedChannel_TrySend(self, (const char *)msg.buf, msg.len, &seen);
+    if (ok || deadline == 0 ||
+        (deadline > 0 && SharedChannel_Now() >= deadline)) {
+      break;
+    }
+    if (SharedChannel_Wait(&self->header->space_seq,
+                           &self->header->space_waiters, &self->header->head,
+                           seen, deadline)) {
+      PyBuffer_Release(&msg);
+      return NULL;
+    }
+  }
+  PyBuffer_Release(&msg);
+  return PyBool_FromLong(ok);
+}
+
+static PyObject *SharedChannel_recv(CtsSharedChannel *self, CtsArg_PARAMS) {
+  PyObject *argv[1], *item;
+  double deadline;
+  size_t seen;
+
+  static const char *const kwlist[] = {"timeout", NULL};
+  static CtsArg_Parser parser = {"recv", kwlist, 0, 1};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  if (SharedChannel_ParseTimeout(argv[0], &deadline)) {
+    return NULL;
+  }
+  for (;;) {
+    if (SharedChannel_Closed(self->header) & SharedChannel_CLOSE_RECV) {
+      PyErr_SetString(PyExc_IndexError, "channel is closed for receiving.");
+      return NULL;
+    }
+    item = SharedChannel_TryRecv(self, &seen);
+    if (item) {
+      return Py_BuildValue("(NO)", item, Py_True);
+    }
+    ReturnIfErrorSet(NULL);
+    if (deadline == 0 || (deadline > 0 && SharedChannel_Now() >= deadline) ||
+        (SharedChannel_Closed(self->header) & SharedChannel_CLOSE_SEND)) {
+      break;
+    }
+    if (SharedChannel_Wait(&self->header->data_seq,
+                           &self->header->data_waiters, &self->header->tail,
+                           seen, deadline)) {
+      return NULL;
+    }
+  }
+  return Py_BuildValue("(OO)", Py_None, Py_False);
+}
+
+static PyObject *SharedChannel_close(CtsSharedChannel *self, CtsArg_PARAMS) {
+  PyObject *argv[2];
+  uint32_t flags = 0;
+  int write = 1, read = 1;
+
+  static const char *const kwlist[] = {"send", "recv", NULL};
+  static CtsArg_Parser parser = {"close", kwlist, 0, 2};
+  if (CtsArg_UNPACK(&parser, argv) || CtsArg_Bool(argv[0], &write) ||
+      CtsArg_Bool(argv[1], &read)) {
+    return NULL;
+  }
+  if (write) {
+    flags |= SharedChannel_CLOSE_SEND;
+  }
+  if (read) {
+    flags |= SharedChannel_CLOSE_RECV;
+  }
+  SharedChannel_SetClosed(self->header, flags);
+#ifdef SharedChannel_HAVE_FUTEX
+  SharedChannel_Add32(&self->header->data_seq, 1);
+  SharedChannel_FutexWake(&self->header->data_seq);
+  SharedChannel_Add32(&self->header->space_seq, 1);
+  SharedChannel_FutexWake(&self->header->space_seq);
+#endif
+  Py_RETURN_NONE;
+}
+
+static PyObject *SharedChannel_sendable(CtsSharedChannel *self,
+                                        PyObject *Py_UNUSED(unused)) {
+  CtsSharedChannelHeader *h = self->header;
+  size_t used;
+  if (SharedChannel_Closed(h) & SharedChannel_CLOSE_SEND) {
+    Py_RETURN_FALSE;
+  }
+  used = Cts_AtomicLoadRelaxed(&h->tail) - Cts_AtomicLoadAcquire(&h->head);
+  return PyBool_FromLong(used + SharedChannel_Align(sizeof(uint32_t) + 1) <=
+                         self->capacity);
+}
+
+static PyObject *SharedChannel_recvable(CtsSharedChannel *self,
+                                        PyObject *Py_UNUSED(unused)) {
+  CtsSharedChannelHeader *h = self->header;
+  if (SharedChannel_Closed(h) & SharedChannel_CLOSE_RECV) {
+    Py_RETURN_FALSE;
+  }
+  return PyBool_FromLong(Cts_AtomicLoadAcquire(&h->tail) !=
+                         Cts_AtomicLoadRelaxed(&h->head));
+}
+
+static PyObject *SharedChannel_size(CtsSharedChannel *self,
+                                    PyObject *Py_UNUSED(unused)) {
+  return PyLong_FromSize_t(self->capacity);
+}
+
+static PyObject *SharedChannel_nbytes(PyObject *Py_UNUSED(cls),
+                                      PyObject *size) {
+  Py_ssize_t n = PyLong_AsSsize_t(size);
+  if (n == -1 && PyErr_Occurred()) {
+    return NULL;
+  }
+  if (n <= 0) {
+    PyErr_SetString(PyExc_ValueError, "size should be positive.");
+    return NULL;
+  }
+  return PyLong_FromSsize_t(SharedChannel_HEADER_SIZE +
+                            (Py_ssize_t)SharedChannel_Align((size_t)n));
+}
+
+static PyObject *SharedChannel_tp_new(PyTypeObject *type, PyObject *args,
+                                      PyObject *kwds) {
+  CtsSharedChannel *self;
+  PyObject *buffer;
+  int create = 0;
+  CtsSharedChannelHeader *h;
+  static char *kwlist[] = {"buffer", "create", NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|p", kwlist, &buffer,
+                                   &create)) {
+    return NULL;
+  }
+  self = (CtsSharedChannel *)type->tp_alloc(type, 0);
+  ReturnIfNULL(self, NULL);
+  if (PyObject_GetBuffer(buffer, &self->view,
+                         PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS)) {
+    self->view.obj = NULL;
+    Py_DECREF(self);
+    return NULL;
+  }
+  if (self->view.len < SharedChannel_HEADER_SIZE + SharedChannel_ALIGN * 2 ||
+      ((uintptr_t)self->view.buf & (SharedChannel_ALIGN - 1))) {
+    PyErr_SetString(PyExc_ValueError,
+                    "buffer is too small or not aligned to 8 bytes.");
+    Py_DECREF(self);
+    return NULL;
+  }
+  h = (CtsSharedChannelHeader *)self->view.buf;
+  self->header = h;
+  self->data = (char *)self->view.buf + SharedChannel_HEADER_SIZE;
+  if (create) {
+    memset(h, 0, sizeof(CtsSharedChannelHeader));
+    h->capacity = (size_t)(self->view.len - SharedChannel_HEADER_SIZE) &
+                  ~(size_t)(SharedChannel_ALIGN - 1);
+    Cts_AtomicStoreRelease(&h->tail, 0);
+    h->magic = SharedChannel_MAGIC;
+  } else if (h->magic != SharedChannel_MAGIC ||
+             h->capacity < SharedChannel_ALIGN * 2 ||
+             (h->capacity & (SharedChannel_ALIGN - 1)) ||
+             h->capacity >
+                 (size_t)(self->view.len - SharedChannel_HEADER_SIZE)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "buffer is not an initialized SharedChannel.");
+    Py_DECREF(self);
+    return NULL;
+  }
+  self->capacity = h->capacity;
+  return (PyObject *)self;
+}
+
+static void SharedChannel_tp_dealloc(CtsSharedChannel *self) {
+  if (self->view.obj != NULL) {
+    PyBuffer_Release(&self->view);
+  }
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+PyDoc_STRVAR(SharedChannel_send__doc__,
+             "send(data, timeout=0)\n--\n\n"
+             "Copy a bytes-like object into the channel.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "data : bytes-like\n"
+             "  The message.\n"
+             "timeout : float, optional\n"
+             "  Seconds to wait for free space, ``None`` waits forever.\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "bool\n"
+             "  Return True if send success else False, also False if the\n"
+             "  channel is closed for receiving.\n"
+             "\n"
+             "Raises\n"
+             "------\n"
+             "IndexError\n"
+             "  If the channel is closing for sending.\n"
+             "ValueError\n"
+             "  If the message can never fit into the channel.\n");
+
+PyDoc_STRVAR(SharedChannel_recv__doc__,
+             "recv(timeout=0)\n--\n\n"
+             "Receive a message from channel.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "timeout : float, optional\n"
+             "  Seconds to wait for a message, ``None`` waits forever.\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "o : bytes\n"
+             "  Message received. Return None if no message in channel.\n"
+             "ok : bool\n"
+             "  Return False if no message in channel else True.\n"
+             "\n"
+             "Raises\n"
+             "------\n"
+             "IndexError\n"
+             "  If the channel is closing for receive.\n");
+
+static PyMethodDef SharedChannel_methods[] = {
+    {"send", (PyCFunction)SharedChannel_send, CtsArg_METH,
+     SharedChannel_send__doc__},
+    {"recv", (PyCFunction)SharedChannel_recv, CtsArg_METH,
+     SharedChannel_recv__doc__},
+    {"close", (PyCFunction)SharedChannel_close, CtsArg_METH,
+     "close(send=True, recv=True)\n--\n\nClose channel in all processes."},
+    {"sendable", (PyCFunction)SharedChannel_sendable, METH_NOARGS,
+     "sendable()\n--\n\nReturn channel is available to send."},
+    {"recvable", (PyCFunction)SharedChannel_recvable, METH_NOARGS,
+     "recvable()\n--\n\nReturn channel is available to receive."},
+    {"size", (PyCFunction)SharedChannel_size, METH_NOARGS,
+     "size()\n--\n\nReturn the size of ring buffer in bytes."},
+    {"nbytes", (PyCFunction)SharedChannel_nbytes, METH_O | METH_CLASS,
+     "nbytes(size, /)\n--\n\nReturn the buffer length needed for a ring of "
+     "``size`` bytes."},
+    {NULL, NULL, 0, NULL} /* Sentinel */
+};
+
+PyDoc_STRVAR(
+    SharedChannel_Doc,
+    "SharedChannel(buffer, create=False)\n--\n\n"
+    "A bytes channel living in shared memory, usable across processes.\n"
+    "\n"
+    "Messages are length prefixed and copied once into the ring buffer, "
+    "waiting receivers are woken with futex on Linux.\n"
+    "Any number of processes may send and receive, senders and receivers\n"
+    "each take a lock in the segment for the time of a copy. The lock of\n"
+    "a process that died is taken over.\n"
+    "\n"
+    "Parameters\n"
+    "----------\n"
+    "buffer : writable bytes-like\n"
+    "  Shared memory, e.g. ``multiprocessing.shared_memory.SharedMemory.buf``"
+    "\n  or a ``mmap.mmap``. It must outlive the channel.\n"
+    "create : bool, optional\n"
+    "  Initialize the buffer, exactly one side should pass True.\n"
+    "\n"
+    "Examples\n"
+    "--------\n"
+    ">>> import ctools\n"
+    ">>> from multiprocessing.shared_memory import SharedMemory\n"
+    ">>> size = ctools.SharedChannel.nbytes(64)\n"
+    ">>> shm = SharedMemory(create=True, size=size)\n"
+    ">>> ch = ctools.SharedChannel(shm.buf, create=True)\n"
+    ">>> ch.send(b'foo')\n"
+    "True\n"
+    ">>> ctools.SharedChannel(shm.buf).recv()\n"
+    "(b'foo', True)\n");
+
+static PyTypeObject SharedChannel_Type = {
+    /* clang-format off */
+    PyVarObject_HEAD_INIT(NULL, 0)
+    /* clang-format on */
+    "ctools.SharedChannel",                /* tp_name */
+    sizeof(CtsSharedChannel),              /* tp_basicsize */
+    0,                                     /* tp_itemsize */
+    (destructor)SharedChannel_tp_dealloc,  /* tp_dealloc */
+    0,                                     /* tp_print */
+    0,                                     /* tp_getattr */
+    0,                                     /* tp_setattr */
+    0,                                     /* tp_compare */
+    0,                                     /* tp_repr */
+    0,                                     /* tp_as_number */
+    0,                                     /* tp_as_sequence */
+    0,                                     /* tp_as_mapping */
+    PyObject_HashNotImplemented,           /* tp_hash */
+    0,                                     /* tp_call */
+    0,                                     /* tp_str */
+    0,                                     /* tp_getattro */
+    0,                                     /* tp_setattro */
+    0,                                     /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                    /* tp_flags */
+    SharedChannel_Doc,                     /* tp_doc */
+    0,                                     /* tp_traverse */
+    0,                                     /* tp_clear */
+    0,                                     /* tp_richcompare */
+    0,                                     /* tp_weaklistoffset */
+    0,                                     /* tp_iter */
+    0,                                     /* tp_iternext */
+    SharedChannel_methods,                 /* tp_methods */
+    0,                                     /* tp_members */
+    0,                                     /* tp_getset */
+    0,                                     /* tp_base */
+    0,                                     /* tp_dict */
+    0,                                     /* tp_descr_get */
+    0,                                     /* tp_descr_set */
+    0,                                     /* tp_dictoffset */
+    0,                                     /* tp_init */
+    0,                                     /* tp_alloc */
+    (newfunc)SharedChannel_tp_new,         /* tp_new */
+};
+
+EXTERN_C_START
+int ctools_init_sharedchannel(PyObject *module) {
+  if (PyType_Ready(&SharedChannel_Type) < 0 || CtsProcLock_Setup()) {
+    return -1;
+  }
+
+  Py_INCREF(&SharedChannel_Type);
+  if (PyModule_AddObject(module, "SharedChannel",
+                         (PyObject *)&SharedChannel_Type)) {
+    Py_DECREF(&SharedChannel_Type);
+    return -1;
+  }
+
+  return 0;
+}
+EXTERN_C_END
@@ -0,0 +1,145 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _CTOOLS_SINGLEFLIGHT_H_
+#define _CTOOLS_SINGLEFLIGHT_H_
+
+#include "core.h"
+
+#include "pythread.h"
+
+/* A load of one key in progress. Threads missing the same key wait on the
+ * lock, which the loader holds until the value is stored. */
+typedef struct {
+  PyThread_type_lock lock;
+  unsigned long owner; /* thread of the loader */
+  PyObject *value;     /* NULL if the load failed */
+  PyObject *exc_type;
+  PyObject *exc_value;
+  PyObject *exc_tb;
+} CtsFlight;
+
+/* Stores a loaded value into the cache. */
+typedef int (*CtsFlight_StoreFunc)(PyObject *cache, PyObject *key,
+                                   PyObject *value);
+
+static void CtsFlight_Destroy(PyObject *capsule) {
+  CtsFlight *flight = (CtsFlight *)PyCapsule_GetPointer(capsule, NULL);
+  PyThread_free_lock(flight->lock);
+  Py_XDECREF(flight->value);
+  Py_XDECREF(flight->exc_type);
+  Py_XDECREF(flight->exc_value);
+  Py_XDECREF(flight->exc_tb);
+  PyMem_Free(flight);
+}
+
+/* Wait for the loader of another thread and share its result. */
+static PyObject *CtsFlight_Wait(PyObject *capsule) {
+  CtsFlight *flight = (CtsFlight *)PyCapsule_GetPointer(capsule, NULL);
+  PyObject *rv = NULL;
+  if (flight->owner == PyThread_get_thread_ident()) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "setnx() of a key being loaded by the same thread.");
+    return NULL;
+  }
+  Py_INCREF(capsule);
+  Py_BEGIN_ALLOW_THREADS;
+  PyThread_acquire_lock(flight->lock, WAIT_LOCK);
+  PyThread_release_lock(flight->lock);
+  Py_END_ALLOW_THREADS;
+  if (flight->value) {
+    Py_INCREF(flight->value);
+    rv = flight->value;
+  } else {
+    Py_XINCREF(flight->exc_type);
+    Py_XINCREF(flight->exc_value);
+    Py_XINCREF(flight->exc_tb);
+    PyErr_Restore(flight->exc_type, flight->exc_value, flight->exc_tb);
+  }
+  Py_DECREF(capsule);
+  return rv;
+}
+
+/* Load `key` by calling `fn(key)` and `store` the value, unless another
+ * thread is loading it already, then wait for that result instead.
+ * `*inflight` maps keys being loaded to flights, created on demand. */
+static PyObject *CtsFlight_Load(PyObject *cache, PyObject **inflight,
+                                PyObject *key, PyObject *fn,
+                                CtsFlight_StoreFunc store) {
+  CtsFlight *flight;
+  PyObject *capsule, *value, *type, *exc, *tb;
+  if (*inflight == NULL && (*inflight = PyDict_New()) == NULL) {
+    return NULL;
+  }
+  capsule = PyDict_GetItemWithError(*inflight, key);
+  if (capsule) {
+    return CtsFlight_Wait(capsule);
+  }
+  ReturnIfErrorSet(NULL);
+
+  flight = (CtsFlight *)PyMem_Calloc(1, sizeof(CtsFlight));
+  if (flight == NULL) {
+    return PyErr_NoMemory();
+  }
+  if ((flight->lock = PyThread_allocate_lock()) == NULL) {
+    PyMem_Free(flight);
+    PyErr_SetString(PyExc_MemoryError, "can not allocate lock.");
+    return NULL;
+  }
+  PyThread_acquire_lock(flight->lock, NOWAIT_LOCK);
+  flight->owner = PyThread_get_thread_ident();
+  capsule = PyCapsule_New(flight, NULL, CtsFlight_Destroy);
+  if (capsule == NULL) {
+    PyThread_release_lock(flight->lock);
+    PyThread_free_lock(flight->lock);
+    PyMem_Free(flight);
+    return NULL;
+  }
+  if (PyDict_SetItem(*inflight, key, capsule)) {
+    PyThread_release_lock(flight->lock);
+    Py_DECREF(capsule);
+    return NULL;
+  }
+
+  value = PyObject_CallFunctionObjArgs(fn, key, NULL);
+  if (value && store(cache, key, value)) {
+    Py_CLEAR(value);
+  }
+  if (value) {
+    Py_INCREF(value);
+    flight->value = value;
+  } else {
+    PyErr_Fetch(&type, &exc, &tb);
+    PyErr_NormalizeException(&type, &exc, &tb);
+    Py_XINCREF(type);
+    Py_XINCREF(exc);
+    Py_XINCREF(tb);
+    flight->exc_type = type;
+    flight->exc_value = exc;
+    flight->exc_tb = tb;
+  }
+  if (PyDict_DelItem(*inflight, key)) {
+    PyErr_Clear();
+  }
+  PyThread_release_lock(flight->lock);
+  Py_DECREF(capsule);
+  if (value == NULL) {
+    PyErr_Restore(type, exc, tb);
+  }
+  return value;
+}
+
+#endif /* _CTOOLS_SINGLEFLIGHT_H_ */
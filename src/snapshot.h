@@ -0,0 +1,441 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _CTOOLS_SNAPSHOT_H_
+#define _CTOOLS_SNAPSHOT_H_
+
+#include "core.h"
+
+#include <stdio.h>
+#include <string.h>
+#ifndef MS_WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#include <windows.h>
+#endif
+
+/* Snapshot files written by dump and read by load of the caches.
+ *
+ * A file is a CtsSnapHeader followed by `count` records. A record is the
+ * metadata of an entry, defined by its cache, then the key and the value.
+ * An object is a tag byte, a uint32 length and the payload. Exact bytes,
+ * str, int of 64 bits, float and None are written as is, any other object
+ * by `dumps` of the serializer. Numbers are in the byte order of the host,
+ * a snapshot is meant for a restart on the same machine. */
+
+#define CtsSnap_MAGIC 0x534E5443U /* "CTNS" */
+#define CtsSnap_VERSION 1
+#define CtsSnap_BUFFER_SIZE (1 << 20)
+
+#define CtsSnap_KIND_CACHEMAP 1
+#define CtsSnap_KIND_TTLCACHE 2
+
+#define CtsSnap_TAG_BYTES 0
+#define CtsSnap_TAG_STR 1
+#define CtsSnap_TAG_INT 2
+#define CtsSnap_TAG_FLOAT 3
+#define CtsSnap_TAG_NONE 4
+#define CtsSnap_TAG_SERIALIZED 5
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t kind;
+  uint8_t policy; /* CacheMap: eviction policy of the entries */
+  uint64_t count;
+  int64_t extra; /* CacheMap: target size of T1 of ARC */
+} CtsSnapHeader;
+
+typedef struct {
+  FILE *fp;
+  PyObject *path;
+  PyObject *name;       /* bytes of path */
+  PyObject *tmp;        /* bytes of the path written, renamed to name */
+  PyObject *serializer; /* NULL to use pickle */
+  PyObject *dumps;      /* looked up on first use */
+} CtsSnapWriter;
+
+typedef struct {
+  const char *base;
+  const char *p;
+  const char *end;
+  PyObject *path;
+  PyObject *serializer;
+  PyObject *loads;
+} CtsSnapReader;
+
+/* New reference to `name` of the serializer, pickle by default. */
+static inline PyObject *CtsSnap_Serializer(PyObject *serializer,
+                                           const char *name) {
+  PyObject *module, *rv;
+  if (serializer) {
+    return PyObject_GetAttrString(serializer, name);
+  }
+  module = PyImport_ImportModule("pickle");
+  ReturnIfNULL(module, NULL);
+  rv = PyObject_GetAttrString(module, name);
+  Py_DECREF(module);
+  return rv;
+}
+
+static inline int CtsSnap_OSError(PyObject *path) {
+  PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+  return -1;
+}
+
+static inline int CtsSnap_Sync(FILE *fp) {
+  if (fflush(fp)) {
+    return -1;
+  }
+#ifndef MS_WINDOWS
+  return fsync(fileno(fp));
+#else
+  return _commit(_fileno(fp));
+#endif
+}
+
+/* Move the written file over the target, replacing it at once. */
+static inline int CtsSnap_Replace(CtsSnapWriter *w) {
+  const char *tmp = PyBytes_AS_STRING(w->tmp);
+  const char *name = PyBytes_AS_STRING(w->name);
+#ifndef MS_WINDOWS
+  if (rename(tmp, name)) {
+    return CtsSnap_OSError(w->path);
+  }
+#else
+  if (!MoveFileExA(tmp, name, MOVEFILE_REPLACE_EXISTING)) {
+    PyErr_SetExcFromWindowsErrWithFilenameObject(PyExc_OSError, 0, w->path);
+    return -1;
+  }
+#endif
+  return 0;
+}
+
+/* Close the file and move it over the target. If it failed or `failed`,
+ * the file is removed instead and -1 is returned with error set, the
+ * target is left as it was. */
+static inline int CtsSnap_CloseWriter(CtsSnapWriter *w, int failed) {
+  if (w->fp) {
+    if (!failed && CtsSnap_Sync(w->fp)) {
+      failed = CtsSnap_OSError(w->path);
+    }
+    if (fclose(w->fp) && !failed) {
+      failed = CtsSnap_OSError(w->path);
+    }
+    w->fp = NULL;
+    if (!failed) {
+      failed = CtsSnap_Replace(w);
+    }
+    if (failed) {
+      remove(PyBytes_AS_STRING(w->tmp));
+    }
+  }
+  Py_CLEAR(w->path);
+  Py_CLEAR(w->name);
+  Py_CLEAR(w->tmp);
+  Py_CLEAR(w->serializer);
+  Py_CLEAR(w->dumps);
+  return failed ? -1 : 0;
+}
+
+/* Create `path` + ".tmp", which replaces `path` once the writer is closed,
+ * so a failed or interrupted dump keeps the previous snapshot. */
+static inline int CtsSnap_OpenWriter(CtsSnapWriter *w, PyObject *path,
+                                     PyObject *serializer) {
+  memset(w, 0, sizeof(CtsSnapWriter));
+  Py_INCREF(path);
+  w->path = path;
+  Py_XINCREF(serializer);
+  w->serializer = serializer;
+  if (!PyUnicode_FSConverter(path, &w->name)) {
+    return CtsSnap_CloseWriter(w, -1);
+  }
+  w->tmp = PyBytes_FromFormat("%s.tmp", PyBytes_AS_STRING(w->name));
+  if (w->tmp == NULL) {
+    return CtsSnap_CloseWriter(w, -1);
+  }
+  w->fp = fopen(PyBytes_AS_STRING(w->tmp), "wb");
+  if (w->fp == NULL) {
+    return CtsSnap_CloseWriter(w, CtsSnap_OSError(path));
+  }
+  setvbuf(w->fp, NULL, _IOFBF, CtsSnap_BUFFER_SIZE);
+  return 0;
+}
+
+static inline int CtsSnap_Write(CtsSnapWriter *w, const void *p, size_t n) {
+  if (n && fwrite(p, 1, n, w->fp) != n) {
+    return CtsSnap_OSError(w->path);
+  }
+  return 0;
+}
+
+static inline int CtsSnap_WriteHeader(CtsSnapWriter *w, uint8_t kind,
+                                      uint8_t policy, Py_ssize_t count,
+                                      int64_t extra) {
+  CtsSnapHeader h;
+  memset(&h, 0, sizeof(h));
+  h.magic = CtsSnap_MAGIC;
+  h.version = CtsSnap_VERSION;
+  h.kind = kind;
+  h.policy = policy;
+  h.count = (uint64_t)count;
+  h.extra = extra;
+  return CtsSnap_Write(w, &h, sizeof(h));
+}
+
+static inline int CtsSnap_WriteTagged(CtsSnapWriter *w, uint8_t tag,
+                                      const void *p, Py_ssize_t n) {
+  uint32_t len = (uint32_t)n;
+  if ((uint64_t)n > UINT32_MAX) {
+    PyErr_SetString(PyExc_OverflowError, "object is larger than 4GB");
+    return -1;
+  }
+  if (CtsSnap_Write(w, &tag, 1) || CtsSnap_Write(w, &len, sizeof(len))) {
+    return -1;
+  }
+  return CtsSnap_Write(w, p, (size_t)n);
+}
+
+static inline int CtsSnap_WriteObject(CtsSnapWriter *w, PyObject *ob) {
+  PyObject *data;
+  const char *p;
+  Py_ssize_t n;
+  long long i;
+  double d;
+  int overflow, rv;
+
+  if (PyBytes_CheckExact(ob)) {
+    return CtsSnap_WriteTagged(w, CtsSnap_TAG_BYTES, PyBytes_AS_STRING(ob),
+                               PyBytes_GET_SIZE(ob));
+  }
+  if (PyUnicode_CheckExact(ob)) {
+    if ((p = PyUnicode_AsUTF8AndSize(ob, &n)) != NULL) {
+      return CtsSnap_WriteTagged(w, CtsSnap_TAG_STR, p, n);
+    }
+    /* lone surrogates, leave it to the serializer */
+    PyErr_Clear();
+  } else if (PyLong_CheckExact(ob)) {
+    i = PyLong_AsLongLongAndOverflow(ob, &overflow);
+    if (i == -1 && PyErr_Occurred()) {
+      return -1;
+    }
+    if (!overflow) {
+      return CtsSnap_WriteTagged(w, CtsSnap_TAG_INT, &i, sizeof(i));
+    }
+  } else if (PyFloat_CheckExact(ob)) {
+    d = PyFloat_AS_DOUBLE(ob);
+    return CtsSnap_WriteTagged(w, CtsSnap_TAG_FLOAT, &d, sizeof(d));
+  } else if (ob == Py_None) {
+    return CtsSnap_WriteTagged(w, CtsSnap_TAG_NONE, NULL, 0);
+  }
+  if (w->dumps == NULL &&
+      (w->dumps = CtsSnap_Serializer(w->serializer, "dumps")) == NULL) {
+    return -1;
+  }
+  data = PyObject_CallFunctionObjArgs(w->dumps, ob, NULL);
+  ReturnIfNULL(data, -1);
+  if (!PyBytes_Check(data)) {
+    PyErr_Format(PyExc_TypeError, "dumps should return bytes, not %.100s",
+                 Py_TYPE(data)->tp_name);
+    Py_DECREF(data);
+    return -1;
+  }
+  rv = CtsSnap_WriteTagged(w, CtsSnap_TAG_SERIALIZED, PyBytes_AS_STRING(data),
+                           PyBytes_GET_SIZE(data));
+  Py_DECREF(data);
+  return rv;
+}
+
+static inline void CtsSnap_CloseReader(CtsSnapReader *r) {
+  if (r->base) {
+#ifndef MS_WINDOWS
+    munmap((void *)r->base, (size_t)(r->end - r->base));
+#else
+    PyMem_Free((void *)r->base);
+#endif
+  }
+  r->base = r->p = r->end = NULL;
+  Py_CLEAR(r->path);
+  Py_CLEAR(r->serializer);
+  Py_CLEAR(r->loads);
+}
+
+/* Map the whole file at `path` for reading. */
+static inline int CtsSnap_OpenReader(CtsSnapReader *r, PyObject *path,
+                                     PyObject *serializer) {
+  PyObject *bytes = NULL;
+  const char *name;
+  Py_ssize_t len;
+  void *base = NULL;
+#ifndef MS_WINDOWS
+  struct stat st;
+  int fd;
+#else
+  FILE *fp;
+  long size;
+#endif
+
+  memset(r, 0, sizeof(CtsSnapReader));
+  if (!PyUnicode_FSConverter(path, &bytes)) {
+    return -1;
+  }
+  name = PyBytes_AS_STRING(bytes);
+#ifndef MS_WINDOWS
+  fd = open(name, O_RDONLY);
+  Py_DECREF(bytes);
+  if (fd < 0) {
+    return CtsSnap_OSError(path);
+  }
+  if (fstat(fd, &st)) {
+    close(fd);
+    return CtsSnap_OSError(path);
+  }
+  len = (Py_ssize_t)st.st_size;
+  if (len > 0) {
+    base = mmap(NULL, (size_t)len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+      close(fd);
+      return CtsSnap_OSError(path);
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(base, (size_t)len, MADV_SEQUENTIAL);
+#endif
+  }
+  close(fd);
+#else
+  /* no mapping on Windows, read the file at once */
+  fp = fopen(name, "rb");
+  Py_DECREF(bytes);
+  if (fp == NULL) {
+    return CtsSnap_OSError(path);
+  }
+  if (fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0 ||
+      fseek(fp, 0, SEEK_SET)) {
+    fclose(fp);
+    return CtsSnap_OSError(path);
+  }
+  len = (Py_ssize_t)size;
+  if (len > 0) {
+    base = PyMem_Malloc((size_t)len);
+    if (base == NULL) {
+      fclose(fp);
+      PyErr_NoMemory();
+      return -1;
+    }
+    if (fread(base, 1, (size_t)len, fp) != (size_t)len) {
+      PyMem_Free(base);
+      fclose(fp);
+      return CtsSnap_OSError(path);
+    }
+  }
+  fclose(fp);
+#endif
+  r->base = r->p = (const char *)base;
+  r->end = r->base + len;
+  Py_INCREF(path);
+  r->path = path;
+  Py_XINCREF(serializer);
+  r->serializer = serializer;
+  return 0;
+}
+
+/* Copy the next `n` bytes to `dst`. */
+static inline int CtsSnap_Read(CtsSnapReader *r, void *dst, size_t n) {
+  if ((size_t)(r->end - r->p) < n) {
+    PyErr_Format(PyExc_ValueError, "snapshot %R is truncated", r->path);
+    return -1;
+  }
+  memcpy(dst, r->p, n);
+  r->p += n;
+  return 0;
+}
+
+/* Check the header against the kind of the loading cache. */
+static inline int CtsSnap_ReadHeader(CtsSnapReader *r, uint8_t kind,
+                                     CtsSnapHeader *h) {
+  if (CtsSnap_Read(r, h, sizeof(CtsSnapHeader))) {
+    return -1;
+  }
+  if (h->magic != CtsSnap_MAGIC || h->version != CtsSnap_VERSION) {
+    PyErr_Format(PyExc_ValueError, "%R is not a snapshot of this version",
+                 r->path);
+    return -1;
+  }
+  if (h->kind != kind) {
+    PyErr_Format(PyExc_ValueError, "snapshot %R is of another cache type",
+                 r->path);
+    return -1;
+  }
+  return 0;
+}
+
+/* New reference to the next object. */
+static inline PyObject *CtsSnap_ReadObject(CtsSnapReader *r) {
+  PyObject *data, *rv;
+  const char *p;
+  long long i;
+  double d;
+  uint32_t len;
+  uint8_t tag;
+
+  if (CtsSnap_Read(r, &tag, 1) || CtsSnap_Read(r, &len, sizeof(len))) {
+    return NULL;
+  }
+  if ((size_t)(r->end - r->p) < len) {
+    PyErr_Format(PyExc_ValueError, "snapshot %R is truncated", r->path);
+    return NULL;
+  }
+  p = r->p;
+  r->p += len;
+  switch (tag) {
+  case CtsSnap_TAG_BYTES:
+    return PyBytes_FromStringAndSize(p, len);
+  case CtsSnap_TAG_STR:
+    return PyUnicode_DecodeUTF8(p, len, NULL);
+  case CtsSnap_TAG_INT:
+    if (len == sizeof(i)) {
+      memcpy(&i, p, sizeof(i));
+      return PyLong_FromLongLong(i);
+    }
+    break;
+  case CtsSnap_TAG_FLOAT:
+    if (len == sizeof(d)) {
+      memcpy(&d, p, sizeof(d));
+      return PyFloat_FromDouble(d);
+    }
+    break;
+  case CtsSnap_TAG_NONE:
+    Py_RETURN_NONE;
+  case CtsSnap_TAG_SERIALIZED:
+    if (r->loads == NULL &&
+        (r->loads = CtsSnap_Serializer(r->serializer, "loads")) == NULL) {
+      return NULL;
+    }
+    data = PyBytes_FromStringAndSize(p, len);
+    ReturnIfNULL(data, NULL);
+    rv = PyObject_CallFunctionObjArgs(r->loads, data, NULL);
+    Py_DECREF(data);
+    return rv;
+  }
+  PyErr_Format(PyExc_ValueError, "snapshot %R is corrupted", r->path);
+  return NULL;
+}
+
+#endif /* _CTOOLS_SNAPSHOT_H_ */
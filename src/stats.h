@@ -0,0 +1,158 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _CTOOLS_STATS_H_
+#define _CTOOLS_STATS_H_
+
+#include "core.h"
+
+#include <string.h>
+#include <time.h>
+#ifdef MS_WINDOWS
+#include <windows.h>
+#endif
+
+/* Bucket i of a latency histogram counts operations that took
+ * [2**i, 2**(i+1)) nanoseconds, the last bucket counts all slower ones. */
+#define CtsStats_NUM_BUCKETS 32
+
+#define CtsStats_OP_GET 0
+#define CtsStats_OP_SET 1
+#define CtsStats_NUM_OPS 2
+
+/* Counters shared by the caches, only touched while holding the GIL. */
+typedef struct {
+  Py_ssize_t hits;
+  Py_ssize_t misses;
+  Py_ssize_t evictions;
+  Py_ssize_t expirations;
+  Py_ssize_t insertions;
+  /* CtsStats_NUM_OPS histograms, NULL if latency is not recorded */
+  Py_ssize_t *latency;
+} CtsCacheStats;
+
+static inline void CtsStats_Init(CtsCacheStats *stats) {
+  memset(stats, 0, sizeof(CtsCacheStats));
+}
+
+static inline void CtsStats_Reset(CtsCacheStats *stats) {
+  Py_ssize_t *latency = stats->latency;
+  memset(stats, 0, sizeof(CtsCacheStats));
+  if (latency) {
+    memset(latency, 0,
+           sizeof(Py_ssize_t) * CtsStats_NUM_OPS * CtsStats_NUM_BUCKETS);
+  }
+  stats->latency = latency;
+}
+
+static inline void CtsStats_Free(CtsCacheStats *stats) {
+  PyMem_Free(stats->latency);
+  stats->latency = NULL;
+}
+
+/* Start or stop recording latency histograms. */
+static inline int CtsStats_SetLatency(CtsCacheStats *stats, int enable) {
+  if (!enable) {
+    CtsStats_Free(stats);
+    return 0;
+  }
+  if (stats->latency) {
+    return 0;
+  }
+  stats->latency = (Py_ssize_t *)PyMem_Calloc(
+      CtsStats_NUM_OPS * CtsStats_NUM_BUCKETS, sizeof(Py_ssize_t));
+  if (stats->latency == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  return 0;
+}
+
+static inline int64_t CtsStats_NowNS(void) {
+#ifdef MS_WINDOWS
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (int64_t)((double)counter.QuadPart * 1e9 / frequency.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline void CtsStats_Record(CtsCacheStats *stats, int op,
+                                   int64_t start) {
+  uint64_t elapsed = (uint64_t)(CtsStats_NowNS() - start);
+  int bucket = 0;
+  while (elapsed > 1 && bucket < CtsStats_NUM_BUCKETS - 1) {
+    elapsed >>= 1;
+    bucket++;
+  }
+  stats->latency[op * CtsStats_NUM_BUCKETS + bucket]++;
+}
+
+/* The clock is only read if latency is recorded. */
+#define CtsStats_Start(stats) ((stats)->latency ? CtsStats_NowNS() : 0)
+
+#define CtsStats_Stop(stats, op, start)                                        \
+  do {                                                                         \
+    if ((stats)->latency) {                                                    \
+      CtsStats_Record((stats), (op), (start));                                 \
+    }                                                                          \
+  } while (0)
+
+static inline PyObject *CtsStats_Histogram(CtsCacheStats *stats, int op) {
+  PyObject *list, *count;
+  list = PyList_New(CtsStats_NUM_BUCKETS);
+  ReturnIfNULL(list, NULL);
+  for (int i = 0; i < CtsStats_NUM_BUCKETS; i++) {
+    count =
+        PyLong_FromSsize_t(stats->latency[op * CtsStats_NUM_BUCKETS + i]);
+    if (count == NULL) {
+      Py_DECREF(list);
+      return NULL;
+    }
+    PyList_SET_ITEM(list, i, count);
+  }
+  return list;
+}
+
+/* New reference, a dict of all counters. */
+static inline PyObject *CtsStats_AsDict(CtsCacheStats *stats) {
+  PyObject *get = NULL, *set = NULL, *rv;
+  if (stats->latency) {
+    get = CtsStats_Histogram(stats, CtsStats_OP_GET);
+    ReturnIfNULL(get, NULL);
+    set = CtsStats_Histogram(stats, CtsStats_OP_SET);
+    if (set == NULL) {
+      Py_DECREF(get);
+      return NULL;
+    }
+    rv = Py_BuildValue("{snsnsnsnsns{sNsN}}", "hits", stats->hits, "misses",
+                       stats->misses, "evictions", stats->evictions,
+                       "expirations", stats->expirations, "insertions",
+                       stats->insertions, "latency", "get", get, "set", set);
+  } else {
+    rv = Py_BuildValue("{snsnsnsnsnsO}", "hits", stats->hits, "misses",
+                       stats->misses, "evictions", stats->evictions,
+                       "expirations", stats->expirations, "insertions",
+                       stats->insertions, "latency", Py_None);
+  }
+  return rv;
+}
+
+#endif /* _CTOOLS_STATS_H_ */
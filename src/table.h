@@ -0,0 +1,164 @@
+/*
+Copyright (c) 2019 ko han
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef _CTOOLS_TABLE_H_
+#define _CTOOLS_TABLE_H_
+
+#include "core.h"
+
+#include <string.h>
+
+/* An open addressing index over a dense array of entries kept by a cache.
+ * Slots hold positions in the array and are probed linearly from the top
+ * bits of the hash of an entry, which the cache reports by `hash_of`. The
+ * index is kept at most half full, deletion shifts slots back so probes
+ * never meet a tombstone. */
+#define CtsTable_EMPTY (-1)
+#define CtsTable_MIN_BITS 3
+
+typedef uint64_t (*CtsTable_HashOf)(void *owner, int32_t e);
+/* Whether the entry at `e` holds `key`. */
+typedef int (*CtsTable_Match)(void *owner, int32_t e, const void *key);
+
+typedef struct {
+  int32_t *index; /* 1 << bits positions of entries */
+  int bits;
+  CtsTable_HashOf hash_of;
+  void *owner;
+} CtsTable;
+
+#define CtsTable_MASK(t) (((Py_ssize_t)1 << (t)->bits) - 1)
+#define CtsTable_Home(t, hash) ((Py_ssize_t)((hash) >> (64 - (t)->bits)))
+
+/* Index the first `size` entries in 1 << bits slots. */
+static inline int CtsTable_Rehash(CtsTable *t, int bits, Py_ssize_t size) {
+  Py_ssize_t mask = ((Py_ssize_t)1 << bits) - 1, i, j;
+  int32_t *index = PyMem_New(int32_t, (size_t)mask + 1);
+  if (index == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  memset(index, 0xff, sizeof(int32_t) * ((size_t)mask + 1)); /* EMPTY */
+  PyMem_Free(t->index);
+  t->index = index;
+  t->bits = bits;
+  for (i = 0; i < size; i++) {
+    j = CtsTable_Home(t, t->hash_of(t->owner, (int32_t)i));
+    while (index[j] != CtsTable_EMPTY) {
+      j = (j + 1) & mask;
+    }
+    index[j] = (int32_t)i;
+  }
+  return 0;
+}
+
+static inline int CtsTable_Init(CtsTable *t, CtsTable_HashOf hash_of,
+                                void *owner) {
+  t->index = NULL;
+  t->bits = 0;
+  t->hash_of = hash_of;
+  t->owner = owner;
+  return CtsTable_Rehash(t, CtsTable_MIN_BITS, 0);
+}
+
+static inline void CtsTable_Free(CtsTable *t) {
+  PyMem_Free(t->index);
+  t->index = NULL;
+}
+
+/* Forget every entry, the slots are kept. */
+static inline void CtsTable_Clear(CtsTable *t) {
+  if (t->index) {
+    memset(t->index, 0xff, sizeof(int32_t) << t->bits);
+  }
+}
+
+/* The array of `*allocated` entries of `itemsize` bytes, grown if needed
+ * for one more than `size` entries. NULL on errors, the array is kept. */
+static inline void *CtsTable_Grow(void *entries, Py_ssize_t *allocated,
+                                  Py_ssize_t size, size_t itemsize) {
+  Py_ssize_t n = size + 1;
+  if (n > INT32_MAX) {
+    return PyErr_NoMemory();
+  }
+  if (n > *allocated) {
+    n = *allocated + (*allocated >> 1) + 8;
+    entries = PyMem_Realloc(entries, (size_t)n * itemsize);
+    if (entries == NULL) {
+      return PyErr_NoMemory();
+    }
+    *allocated = n;
+  }
+  return entries;
+}
+
+/* Make room in the index for one more than `size` entries. */
+static inline int CtsTable_Reserve(CtsTable *t, Py_ssize_t size) {
+  if ((size + 1) * 2 > ((Py_ssize_t)1 << t->bits)) {
+    return CtsTable_Rehash(t, t->bits + 1, size);
+  }
+  return 0;
+}
+
+/* The slot holding `key`, or the empty slot ending its probe. */
+static inline Py_ssize_t CtsTable_Probe(CtsTable *t, uint64_t hash,
+                                        CtsTable_Match match,
+                                        const void *key) {
+  Py_ssize_t mask = CtsTable_MASK(t), i = CtsTable_Home(t, hash);
+  int32_t e;
+  while ((e = t->index[i]) != CtsTable_EMPTY && !match(t->owner, e, key)) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+/* The slot of the entry at `e`. */
+static inline Py_ssize_t CtsTable_SlotOf(CtsTable *t, int32_t e) {
+  Py_ssize_t mask = CtsTable_MASK(t),
+             i = CtsTable_Home(t, t->hash_of(t->owner, e));
+  while (t->index[i] != e) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+/* Drop the slot `i` of one of `size` entries. The hole in the array is to
+ * be filled by the last entry, whose slot already points at it. Return the
+ * position of the hole, the caller moves the entry. */
+static inline int32_t CtsTable_Remove(CtsTable *t, Py_ssize_t i,
+                                      Py_ssize_t size) {
+  Py_ssize_t mask = CtsTable_MASK(t), j = i, home;
+  int32_t e = t->index[i], last = (int32_t)size - 1;
+  for (;;) {
+    j = (j + 1) & mask;
+    if (t->index[j] == CtsTable_EMPTY) {
+      break;
+    }
+    home = CtsTable_Home(t, t->hash_of(t->owner, t->index[j]));
+    if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+      t->index[i] = t->index[j];
+      i = j;
+    }
+  }
+  t->index[i] = CtsTable_EMPTY;
+  if (e != last) {
+    t->index[CtsTable_SlotOf(t, last)] = e;
+  }
+  return e;
+}
+
+#endif /* _CTOOLS_TABLE_H_ */
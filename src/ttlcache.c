@@ -14,10 +14,20 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include "args.h"
+#include "batch.h"
 #include "core.h"
+#include "evict.h"
+#include "freelist.h"
+#include "pressure.h"
 #include "pydoc.h"
+#include "singleflight.h"
+#include "snapshot.h"
+#include "stats.h"
 
 #include <Python.h>
+#include <math.h>
+#include <stdlib.h>
 #include <time.h>
 
 #define DEFAULT_TTL 60
@@ -25,25 +35,45 @@ limitations under the License.
 #define NOW() ((int64_t)time(NULL))
 
 /* clang-format off */
-typedef struct {
+typedef struct _cts_ttlcache_entry {
   PyObject_HEAD
   PyObject *ma_value;
   int64_t expire;
+  int64_t soft_expire; /* stale but still readable after this */
+  double delta;        /* seconds the last refresh took, used by XFetch */
+  int64_t refresh_start;
+  int refreshing; /* refresh is called, waiting for the value written back */
+  PyObject *key;  /* borrowed, the dict of TTLCache owns it */
+  struct _cts_ttlcache_entry *prev;
+  struct _cts_ttlcache_entry *next;
+  Py_ssize_t weight; /* counted against max_bytes of TTLCache */
 } CtsTTLCacheEntry;
 /* clang-format on */
 
 static PyTypeObject TTLCacheEntry_Type;
 
-static CtsTTLCacheEntry *TTLCacheEntry_New(PyObject *ma_value, int64_t ttl) {
+/* Entries of expired, evicted and deleted keys, reused by new ones. */
+static CtsFreeList TTLCacheEntry_freelist = {NULL, 0, 0, 0};
+
+/* An entry expiring at `expire`. */
+static CtsTTLCacheEntry *TTLCacheEntry_New(PyObject *ma_value,
+                                           int64_t expire) {
   CtsTTLCacheEntry *self;
   assert(ma_value);
-  assert(ttl > 0);
-  self = (CtsTTLCacheEntry *)PyObject_GC_New(CtsTTLCacheEntry,
-                                             &TTLCacheEntry_Type);
+  self = (CtsTTLCacheEntry *)CtsFreeList_Alloc(&TTLCacheEntry_freelist,
+                                               &TTLCacheEntry_Type);
   ReturnIfNULL(self, NULL);
   self->ma_value = ma_value;
-  self->expire = NOW() + ttl;
+  self->expire = expire;
+  self->soft_expire = INT64_MAX;
+  self->delta = 0;
+  self->refresh_start = 0;
+  self->refreshing = 0;
   Py_INCREF(ma_value);
+  self->key = NULL;
+  self->prev = NULL;
+  self->next = NULL;
+  self->weight = 0;
   PyObject_GC_Track(self);
   return self;
 }
@@ -58,7 +88,7 @@ static PyObject *TTLCacheEntry_tp_new(PyTypeObject *type, PyObject *args,
   if (ttl < 0) {
     ttl = DEFAULT_TTL;
   }
-  return (PyObject *)TTLCacheEntry_New(ma_value, ttl);
+  return (PyObject *)TTLCacheEntry_New(ma_value, NOW() + ttl);
 }
 
 static int TTLCacheEntry_tp_traverse(CtsTTLCacheEntry *self, visitproc visit,
@@ -75,7 +105,7 @@ static int TTLCacheEntry_tp_clear(CtsTTLCacheEntry *self) {
 static void TTLCacheEntry_tp_dealloc(CtsTTLCacheEntry *self) {
   PyObject_GC_UnTrack(self);
   TTLCacheEntry_tp_clear(self);
-  PyObject_GC_Del(self);
+  CtsFreeList_Free(&TTLCacheEntry_freelist, (PyObject *)self);
 }
 
 static PyObject *TTLCacheEntry_get_ma_value(CtsTTLCacheEntry *self) {
@@ -142,6 +172,28 @@ typedef struct {
   PyObject_HEAD
   PyObject *dict;
   int64_t default_ttl;
+  /* entries from the least to the most recently written */
+  CtsTTLCacheEntry *head;
+  CtsTTLCacheEntry *tail;
+  Py_ssize_t max_bytes; /* PY_SSIZE_T_MAX if unbounded */
+  Py_ssize_t weight;    /* sum of weight of entries */
+  PyObject *sizeof_fn;  /* weighs values, use __sizeof__ if NULL */
+  CtsCacheStats stats;
+  PyObject *on_evict;
+  PyObject *on_expire;
+  /* batches of dropped entries waiting for on_evict and on_expire */
+  PyObject *evicted;
+  PyObject *expired;
+  PyObject *inflight; /* setnx(singleflight=True): key -> load in progress */
+  int64_t soft_ttl;   /* 0 if values are not stale before expired */
+  PyObject *refresh;
+  double xfetch; /* beta of XFetch early refresh, 0 if disabled */
+  uint64_t seed; /* splitmix64 state of the XFetch jitter */
+  PyObject *executor; /* runs refresh in the background, inline if NULL */
+  PyObject *timer;    /* the clock in seconds, time() if NULL */
+  int ordered;        /* entries expire in the order of the list */
+  int64_t swept;      /* time of the last full sweep if not ordered */
+  CtsPressure pressure;
 } CtsTTLCache;
 /* clang-format on */
 
@@ -152,25 +204,202 @@ typedef struct {
   ((CtsTTLCacheEntry *)PyDict_GetItemWithError(((CtsTTLCache *)(self))->dict,  \
                                                (PyObject *)(key)))
 
+/* Seconds now by the timer of the cache, -1 with an error set if failed. */
+static int64_t TTLCache_Now(CtsTTLCache *self) {
+  PyObject *rv;
+  double now;
+  if (self->timer == NULL) {
+    return NOW();
+  }
+  rv = PyObject_CallFunctionObjArgs(self->timer, NULL);
+  ReturnIfNULL(rv, -1);
+  now = PyFloat_AsDouble(rv);
+  Py_DECREF(rv);
+  if (now == -1 && PyErr_Occurred()) {
+    return -1;
+  }
+  if (!(now >= 0 && now < 9e18)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "timer should return a non-negative number.");
+    return -1;
+  }
+  return (int64_t)now;
+}
+
+/* Entries written later expire later, unless the ttl is shortened, a
+ * snapshot is loaded or the timer goes back. */
+static void TTLCache_Append(CtsTTLCache *self, CtsTTLCacheEntry *entry) {
+  if (self->tail && entry->expire < self->tail->expire) {
+    self->ordered = 0;
+  }
+  entry->prev = self->tail;
+  entry->next = NULL;
+  if (self->tail) {
+    self->tail->next = entry;
+  } else {
+    self->head = entry;
+  }
+  self->tail = entry;
+}
+
+static void TTLCache_Unlink(CtsTTLCache *self, CtsTTLCacheEntry *entry) {
+  if (entry->prev) {
+    entry->prev->next = entry->next;
+  } else {
+    self->head = entry->next;
+  }
+  if (entry->next) {
+    entry->next->prev = entry->prev;
+  } else {
+    self->tail = entry->prev;
+  }
+  entry->prev = NULL;
+  entry->next = NULL;
+}
+
+/* Unlink an entry and remove it from the dict. */
+static int TTLCache_DelEntry(CtsTTLCache *self, CtsTTLCacheEntry *entry) {
+  PyObject *key = entry->key;
+  int rv;
+  TTLCache_Unlink(self, entry);
+  self->weight -= entry->weight;
+  entry->weight = 0;
+  Py_INCREF(key);
+  rv = PyDict_DelItem(self->dict, key);
+  Py_DECREF(key);
+  return rv;
+}
+
 /* KeyError would be set if key not in cache */
 static int TTLCache_DelItem(CtsTTLCache *self, PyObject *key) {
-  return PyDict_DelItem(self->dict, key);
+  CtsTTLCacheEntry *entry = TTLCache_GetItemWithError(self, key);
+  if (!entry) {
+    ReturnKeyErrorIfErrorNotSet(key, -1);
+    return -1;
+  }
+  return TTLCache_DelEntry(self, entry);
 }
 
-/* borrowed reference.*/
-static CtsTTLCacheEntry *TTLCache_GetTTLItemWithError(CtsTTLCache *self,
-                                                      PyObject *key) {
+/* Count an entry about to be dropped and queue it for its callback. */
+static int TTLCache_Dropped(CtsTTLCache *self, CtsTTLCacheEntry *entry,
+                            int reason) {
+  if (reason == CtsEvict_EXPIRED) {
+    self->stats.expirations++;
+    return self->on_expire ? CtsEvict_Push(&self->expired, entry->key,
+                                           entry->ma_value, reason)
+                           : 0;
+  }
+  self->stats.evictions++;
+  return self->on_evict ? CtsEvict_Push(&self->evicted, entry->key,
+                                        entry->ma_value, reason)
+                        : 0;
+}
+
+/* Deliver the batches of dropped entries. */
+static int TTLCache_Flush(CtsTTLCache *self) {
+  if (CtsEvict_Flush(&self->evicted, self->on_evict)) {
+    return -1;
+  }
+  return CtsEvict_Flush(&self->expired, self->on_expire);
+}
+
+/* Drop the least recently written entries until the cache fits in
+ * max_bytes and the cap of memory pressure. */
+static int TTLCache_Shrink(CtsTTLCache *self) {
+  while (self->head && (self->weight > self->max_bytes ||
+                        TTLCache_Size(self) > self->pressure.cap)) {
+    if (TTLCache_Dropped(self, self->head, CtsEvict_EVICTED) ||
+        TTLCache_DelEntry(self, self->head)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Drop expired entries from the least recently written one, so keys that
+ * are never read again do not linger. If entries are out of order, the
+ * whole list is scanned, once a second at most. */
+static int TTLCache_Sweep(CtsTTLCache *self, int64_t now) {
+  CtsTTLCacheEntry *entry, *next;
+  int64_t last = INT64_MIN;
+  int ordered = 1;
+  while (self->head && self->head->expire < now) {
+    if (TTLCache_Dropped(self, self->head, CtsEvict_EXPIRED) ||
+        TTLCache_DelEntry(self, self->head)) {
+      return -1;
+    }
+  }
+  if (self->ordered || self->swept == now) {
+    return 0;
+  }
+  self->swept = now;
+  entry = self->head;
+  while (entry) {
+    next = entry->next;
+    if (entry->expire >= now) {
+      ordered &= entry->expire >= last;
+      last = entry->expire;
+      entry = next;
+      continue;
+    }
+    /* deleting a key may run code that drops the next entry too */
+    Py_XINCREF(next);
+    if (TTLCache_Dropped(self, entry, CtsEvict_EXPIRED) ||
+        TTLCache_DelEntry(self, entry)) {
+      Py_XDECREF(next);
+      return -1;
+    }
+    entry = next;
+    if (next && next->prev == NULL && next != self->head) {
+      entry = self->head;
+      last = INT64_MIN;
+      ordered = 1;
+    }
+    Py_XDECREF(next);
+  }
+  self->ordered = ordered;
+  return 0;
+}
+
+/* Weight of a value, by the sizeof callback or __sizeof__.
+ * Values are only weighed if the cache is bounded by bytes. */
+static Py_ssize_t TTLCache_Weigh(CtsTTLCache *self, PyObject *value) {
+  PyObject *rv;
+  Py_ssize_t weight;
+  if (self->sizeof_fn) {
+    rv = PyObject_CallFunctionObjArgs(self->sizeof_fn, value, NULL);
+  } else if (self->max_bytes != PY_SSIZE_T_MAX) {
+    rv = PyObject_CallMethod(value, "__sizeof__", NULL);
+  } else {
+    return 0;
+  }
+  ReturnIfNULL(rv, -1);
+  weight = PyLong_AsSsize_t(rv);
+  Py_DECREF(rv);
+  if (weight < 0) {
+    if (!PyErr_Occurred()) {
+      PyErr_SetString(PyExc_ValueError, "weight should not be negative.");
+    }
+    return -1;
+  }
+  return weight;
+}
+
+/* borrowed reference, the entry of key if not expired at `now`.*/
+static CtsTTLCacheEntry *TTLCache_GetTTLItemAt(CtsTTLCache *self,
+                                               PyObject *key, int64_t now) {
   assert(key);
   CtsTTLCacheEntry *entry;
   int i;
-  int64_t t;
   entry = TTLCache_GetItemWithError(self, key);
   ReturnIfNULL(entry, NULL);
 
-  t = NOW();
-  if (entry->expire < t) {
+  if (entry->expire < now) {
+    if (TTLCache_Dropped(self, entry, CtsEvict_EXPIRED)) {
+      return NULL;
+    }
     /* key is already in cache, error would not raised */
-    i = TTLCache_DelItem(self, key);
+    i = TTLCache_DelEntry(self, entry);
     assert(i == 0);
     if (i != 0) {
       abort();
@@ -180,31 +409,172 @@ static CtsTTLCacheEntry *TTLCache_GetTTLItemWithError(CtsTTLCache *self,
   return entry;
 }
 
-static int TTLCache_SetItem(CtsTTLCache *self, PyObject *key, PyObject *value) {
+/* borrowed reference, the entry of key if not expired now. */
+static CtsTTLCacheEntry *TTLCache_GetTTLItemWithError(CtsTTLCache *self,
+                                                      PyObject *key) {
+  int64_t now = TTLCache_Now(self);
+  if (now < 0) {
+    return NULL;
+  }
+  return TTLCache_GetTTLItemAt(self, key, now);
+}
+
+/* An entry is written, restart its soft ttl and end its refresh. */
+static void TTLCache_Revalidated(CtsTTLCache *self, CtsTTLCacheEntry *entry,
+                                 int64_t now) {
+  entry->soft_expire =
+      now + (self->soft_ttl ? self->soft_ttl : self->default_ttl);
+  if (entry->refreshing) {
+    entry->delta = (double)(CtsStats_NowNS() - entry->refresh_start) / 1e9;
+    entry->refreshing = 0;
+  }
+}
+
+/* Uniform random number in (0, 1), from the per cache splitmix64. */
+static double TTLCache_Random(CtsTTLCache *self) {
+  uint64_t z = (self->seed += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  return ((double)(z >> 11) + 0.5) / 9007199254740992.0; /* 2^53 */
+}
+
+/* Call refresh for an entry read after its soft ttl, or early by XFetch:
+ * refresh with probability growing as the soft expiry approaches, scaled
+ * by how long the last refresh took. Called once until written back, or
+ * again a soft ttl later if it never is. With an executor, refresh is
+ * submitted to it and the stale value returned at once. */
+static int TTLCache_Revalidate(CtsTTLCache *self, CtsTTLCacheEntry *entry,
+                               int64_t now) {
+  PyObject *key, *rv;
+  int64_t soft_expire = entry->soft_expire;
+  double gap = 0;
+  if (self->refresh == NULL) {
+    return 0;
+  }
+  if (self->xfetch > 0 && entry->delta > 0 && !entry->refreshing) {
+    gap = -entry->delta * self->xfetch *
+          log(TTLCache_Random(self));
+  }
+  if ((double)now + gap < (double)soft_expire) {
+    return 0;
+  }
+  entry->refreshing = 1;
+  entry->refresh_start = CtsStats_NowNS();
+  entry->soft_expire =
+      now + (self->soft_ttl ? self->soft_ttl : self->default_ttl);
+  key = entry->key;
+  /* refresh may drop the entry from the cache */
+  Py_INCREF(entry);
+  Py_INCREF(key);
+  if (self->executor) {
+    rv = PyObject_CallMethod(self->executor, "submit", "OO", self->refresh,
+                             key);
+  } else {
+    rv = PyObject_CallFunctionObjArgs(self->refresh, key, NULL);
+  }
+  Py_DECREF(key);
+  if (rv == NULL) {
+    /* a failed refresh is retried by the next read */
+    if (entry->refreshing) {
+      entry->refreshing = 0;
+      entry->soft_expire = soft_expire;
+    }
+    Py_DECREF(entry);
+    return -1;
+  }
+  Py_DECREF(entry);
+  Py_DECREF(rv);
+  return 0;
+}
+
+/* New reference, the value of an entry being hit at `now`. */
+static PyObject *TTLCache_HitValueAt(CtsTTLCache *self,
+                                     CtsTTLCacheEntry *entry, int64_t now) {
+  PyObject *value = entry->ma_value;
+  Py_INCREF(value);
+  if (TTLCache_Revalidate(self, entry, now)) {
+    Py_DECREF(value);
+    return NULL;
+  }
+  return value;
+}
+
+/* New reference, the value of an entry being hit now. The clock is only
+ * read if entries may be refreshed. */
+static PyObject *TTLCache_HitValue(CtsTTLCache *self,
+                                   CtsTTLCacheEntry *entry) {
+  int64_t now = 0;
+  if (self->refresh && (now = TTLCache_Now(self)) < 0) {
+    return NULL;
+  }
+  return TTLCache_HitValueAt(self, entry, now);
+}
+
+/* Write an item of `weight` at `now`, without dropping any entry. */
+static int TTLCache_Insert(CtsTTLCache *self, PyObject *key, PyObject *value,
+                           Py_ssize_t weight, int64_t now) {
   CtsTTLCacheEntry *entry;
+  PyObject *old_value;
   entry = TTLCache_GetItemWithError(self, key);
   if (entry) {
-    Py_DECREF(entry->ma_value);
+    old_value = entry->ma_value;
     Py_INCREF(value);
     entry->ma_value = value;
-    entry->expire = NOW() + self->default_ttl;
+    entry->expire = now + self->default_ttl;
+    TTLCache_Revalidated(self, entry, now);
+    self->weight += weight - entry->weight;
+    entry->weight = weight;
+    TTLCache_Unlink(self, entry);
+    TTLCache_Append(self, entry);
+    Py_DECREF(old_value);
     return 0;
   }
 
   ReturnIfErrorSet(-1);
-  entry = TTLCacheEntry_New(value, self->default_ttl);
+  entry = TTLCacheEntry_New(value, now + self->default_ttl);
   if (!entry) {
     return -1;
   }
+  entry->key = key;
   if (PyDict_SetItem(self->dict, key, (PyObject *)entry)) {
     Py_DECREF(entry);
     return -1;
   }
   Py_DECREF(entry);
+  self->stats.insertions++;
+  TTLCache_Revalidated(self, entry, now);
+  entry->weight = weight;
+  self->weight += weight;
+  TTLCache_Append(self, entry);
+  CtsPressure_Poll(&self->pressure, TTLCache_Size(self), PY_SSIZE_T_MAX);
   return 0;
 }
 
-static void TTLCache_Clear(CtsTTLCache *self) { PyDict_Clear(self->dict); }
+/* Set an item of `weight`, weigh the value if `weight` is negative. */
+static int TTLCache_SetItemWeighted(CtsTTLCache *self, PyObject *key,
+                                    PyObject *value, Py_ssize_t weight) {
+  int64_t now;
+  if (weight < 0 && (weight = TTLCache_Weigh(self, value)) < 0) {
+    return -1;
+  }
+  now = TTLCache_Now(self);
+  if (now < 0 || TTLCache_Sweep(self, now) ||
+      TTLCache_Insert(self, key, value, weight, now)) {
+    return -1;
+  }
+  return TTLCache_Shrink(self);
+}
+
+#define TTLCache_SetItem(self, key, value)                                     \
+  TTLCache_SetItemWeighted(self, key, value, -1)
+
+static void TTLCache_Clear(CtsTTLCache *self) {
+  self->head = NULL;
+  self->tail = NULL;
+  self->weight = 0;
+  PyDict_Clear(self->dict);
+}
 
 static Py_ssize_t TTLCache_get_size(CtsTTLCache *self) {
   return TTLCache_Size(self);
@@ -223,36 +593,177 @@ static CtsTTLCache *TTLCache_New(int64_t ttl) {
     return NULL;
   }
   self->default_ttl = ttl;
+  self->head = NULL;
+  self->tail = NULL;
+  self->max_bytes = PY_SSIZE_T_MAX;
+  self->weight = 0;
+  self->sizeof_fn = NULL;
+  self->on_evict = NULL;
+  self->on_expire = NULL;
+  self->evicted = NULL;
+  self->expired = NULL;
+  self->inflight = NULL;
+  self->soft_ttl = 0;
+  self->refresh = NULL;
+  self->executor = NULL;
+  self->timer = NULL;
+  self->ordered = 1;
+  self->swept = -1;
+  self->xfetch = 0;
+  self->seed = (uint64_t)CtsStats_NowNS() ^ (uint64_t)(uintptr_t)self;
+  CtsPressure_Clear(&self->pressure);
+  CtsStats_Init(&self->stats);
   PyObject_GC_Track(self);
   return self;
 }
 
 static PyObject *TTLCache_tp_new(PyTypeObject *Py_UNUSED(type), PyObject *args,
-                                 PyObject *Py_UNUSED(kwds)) {
+                                 PyObject *kwds) {
   int64_t ttl = DEFAULT_TTL;
-  if (!PyArg_ParseTuple(args, "|L", &ttl))
+  PyObject *max_bytes = Py_None, *sizeof_fn = Py_None;
+  PyObject *on_evict = Py_None, *on_expire = Py_None, *refresh = Py_None;
+  PyObject *soft_ttl_obj = Py_None, *memory_high = Py_None;
+  PyObject *memory_limit = Py_None, *executor = Py_None, *timer = Py_None;
+  Py_ssize_t nbytes = PY_SSIZE_T_MAX;
+  int latency = 0;
+  int64_t soft_ttl = 0;
+  double xfetch = 0;
+  CtsTTLCache *self;
+  static char *kwlist[] = {"ttl",         "max_bytes",    "sizeof",
+                           "latency",     "on_evict",     "on_expire",
+                           "soft_ttl",    "refresh",      "xfetch",
+                           "memory_high", "memory_limit", "executor",
+                           "timer",       NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|LOOpOOOOdOOOO", kwlist,
+                                   &ttl, &max_bytes, &sizeof_fn, &latency,
+                                   &on_evict, &on_expire, &soft_ttl_obj,
+                                   &refresh, &xfetch, &memory_high,
+                                   &memory_limit, &executor, &timer))
     return NULL;
   if (ttl <= 0) {
     PyErr_SetString(PyExc_ValueError,
                     "ttl should be a positive integer in seconds.");
     return NULL;
   }
-  return (PyObject *)TTLCache_New(ttl);
+  if (max_bytes != Py_None) {
+    nbytes = PyLong_AsSsize_t(max_bytes);
+    if (nbytes <= 0) {
+      if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_ValueError,
+                        "max_bytes should be a positive integer");
+      }
+      return NULL;
+    }
+  }
+  if (sizeof_fn != Py_None && !PyCallable_Check(sizeof_fn)) {
+    PyErr_SetString(PyExc_TypeError, "sizeof is not callable.");
+    return NULL;
+  }
+  if (on_evict != Py_None && !PyCallable_Check(on_evict)) {
+    PyErr_SetString(PyExc_TypeError, "on_evict is not callable.");
+    return NULL;
+  }
+  if (on_expire != Py_None && !PyCallable_Check(on_expire)) {
+    PyErr_SetString(PyExc_TypeError, "on_expire is not callable.");
+    return NULL;
+  }
+  if (refresh != Py_None && !PyCallable_Check(refresh)) {
+    PyErr_SetString(PyExc_TypeError, "refresh is not callable.");
+    return NULL;
+  }
+  if (executor != Py_None && refresh == Py_None) {
+    PyErr_SetString(PyExc_ValueError, "executor is only used by refresh.");
+    return NULL;
+  }
+  if (timer != Py_None && !PyCallable_Check(timer)) {
+    PyErr_SetString(PyExc_TypeError, "timer is not callable.");
+    return NULL;
+  }
+  if (soft_ttl_obj != Py_None) {
+    soft_ttl = PyLong_AsLongLong(soft_ttl_obj);
+    if (soft_ttl <= 0 || soft_ttl >= ttl) {
+      if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_ValueError,
+                        "soft_ttl should be a positive integer less than ttl.");
+      }
+      return NULL;
+    }
+  }
+  if (xfetch < 0) {
+    PyErr_SetString(PyExc_ValueError, "xfetch should not be negative.");
+    return NULL;
+  }
+  self = TTLCache_New(ttl);
+  ReturnIfNULL(self, NULL);
+  self->max_bytes = nbytes;
+  if (sizeof_fn != Py_None) {
+    Py_INCREF(sizeof_fn);
+    self->sizeof_fn = sizeof_fn;
+  }
+  if (on_evict != Py_None) {
+    Py_INCREF(on_evict);
+    self->on_evict = on_evict;
+  }
+  if (on_expire != Py_None) {
+    Py_INCREF(on_expire);
+    self->on_expire = on_expire;
+  }
+  if (refresh != Py_None) {
+    Py_INCREF(refresh);
+    self->refresh = refresh;
+  }
+  if (executor != Py_None) {
+    Py_INCREF(executor);
+    self->executor = executor;
+  }
+  if (timer != Py_None) {
+    Py_INCREF(timer);
+    self->timer = timer;
+  }
+  self->soft_ttl = soft_ttl;
+  self->xfetch = xfetch;
+  if (CtsPressure_Init(&self->pressure, memory_high, memory_limit) ||
+      CtsStats_SetLatency(&self->stats, latency)) {
+    Py_DECREF(self);
+    return NULL;
+  }
+  return (PyObject *)self;
 }
 
 static int TTLCache_tp_traverse(CtsTTLCache *self, visitproc visit, void *arg) {
   Py_VISIT(self->dict);
+  Py_VISIT(self->sizeof_fn);
+  Py_VISIT(self->on_evict);
+  Py_VISIT(self->on_expire);
+  Py_VISIT(self->evicted);
+  Py_VISIT(self->expired);
+  Py_VISIT(self->inflight);
+  Py_VISIT(self->refresh);
+  Py_VISIT(self->executor);
+  Py_VISIT(self->timer);
   return 0;
 }
 
 static int TTLCache_tp_clear(CtsTTLCache *self) {
+  self->head = NULL;
+  self->tail = NULL;
   Py_CLEAR(self->dict);
+  Py_CLEAR(self->sizeof_fn);
+  Py_CLEAR(self->on_evict);
+  Py_CLEAR(self->on_expire);
+  Py_CLEAR(self->evicted);
+  Py_CLEAR(self->expired);
+  Py_CLEAR(self->inflight);
+  Py_CLEAR(self->refresh);
+  Py_CLEAR(self->executor);
+  Py_CLEAR(self->timer);
   return 0;
 }
 
 static void TTLCache_tp_dealloc(CtsTTLCache *self) {
   PyObject_GC_UnTrack(self);
   TTLCache_tp_clear(self);
+  CtsStats_Free(&self->stats);
   PyObject_GC_Del(self);
 }
 
@@ -273,12 +784,29 @@ static PyObject *TTLCache_repr(CtsTTLCache *self) {
 
 /* mp_subscript: __getitem__() */
 static PyObject *TTLCache_mp_subscript(CtsTTLCache *self, PyObject *key) {
+  int64_t start = CtsStats_Start(&self->stats);
   CtsTTLCacheEntry *wrapper = TTLCache_GetTTLItemWithError(self, key);
   if (!wrapper) {
-    ReturnKeyErrorIfErrorNotSet(key, NULL);
-    return NULL;
+    ReturnIfErrorSet(NULL);
+    self->stats.misses++;
+    CtsStats_Stop(&self->stats, CtsStats_OP_GET, start);
+    if (TTLCache_Flush(self)) {
+      return NULL;
+    }
+    return PyErr_Format(PyExc_KeyError, "%S", key);
   }
-  return TTLCacheEntry_get_ma_value(wrapper);
+  self->stats.hits++;
+  CtsStats_Stop(&self->stats, CtsStats_OP_GET, start);
+  return TTLCache_HitValue(self, wrapper);
+}
+
+/* Set an item, record the latency and deliver dropped entries. */
+static int TTLCache_TimedSetItem(CtsTTLCache *self, PyObject *key,
+                                 PyObject *value, Py_ssize_t weight) {
+  int64_t start = CtsStats_Start(&self->stats);
+  int rv = TTLCache_SetItemWeighted(self, key, value, weight);
+  CtsStats_Stop(&self->stats, CtsStats_OP_SET, start);
+  return rv ? rv : TTLCache_Flush(self);
 }
 
 /* mp_ass_subscript: __setitem__() and __delitem__() */
@@ -287,7 +815,7 @@ static int TTLCache_mp_ass_sub(CtsTTLCache *self, PyObject *key,
   if (value == NULL) {
     return TTLCache_DelItem(self, key);
   } else {
-    return TTLCache_SetItem(self, key, value);
+    return TTLCache_TimedSetItem(self, key, value, -1);
   }
 }
 
@@ -303,7 +831,7 @@ static int TTLCache_Contains(PyObject *self, PyObject *key) {
   entry = TTLCache_GetTTLItemWithError((CtsTTLCache *)self, key);
   if (!entry) {
     ReturnIfErrorSet(-1);
-    return 0;
+    return TTLCache_Flush((CtsTTLCache *)self);
   }
   return 1;
 }
@@ -359,57 +887,75 @@ static PyObject *TTLCache_items(CtsTTLCache *self) {
   for (Py_ssize_t i = 0; i < size; i++) {
     kv = PyList_GET_ITEM(items, i);
     entry = (CtsTTLCacheEntry *)PyTuple_GET_ITEM(kv, 1);
-    Py_INCREF(entry);
     PyTuple_SET_ITEM(kv, 1, TTLCacheEntry_get_ma_value(entry));
     Py_DECREF(entry);
   }
   return items;
 }
 
-static PyObject *TTLCache_get(CtsTTLCache *self, PyObject *args, PyObject *kw) {
+static PyObject *TTLCache_get(CtsTTLCache *self, CtsArg_PARAMS) {
   PyObject *key;
-  PyObject *_default = NULL;
+  PyObject *_default;
+  PyObject *argv[2];
   CtsTTLCacheEntry *result;
 
-  static char *kwlist[] = {"key", "default", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kw, "O|O", kwlist, &key, &_default))
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"get", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv))
     return NULL;
+  key = argv[0];
+  _default = argv[1];
+  int64_t start = CtsStats_Start(&self->stats);
   result = TTLCache_GetTTLItemWithError((CtsTTLCache *)self, key);
   if (!result) {
     ReturnIfErrorSet(NULL);
+    self->stats.misses++;
+    CtsStats_Stop(&self->stats, CtsStats_OP_GET, start);
+    if (TTLCache_Flush(self)) {
+      return NULL;
+    }
     if (!_default) {
       Py_RETURN_NONE;
     }
     Py_INCREF(_default);
     return _default;
   }
-  Py_INCREF(result->ma_value);
-  return result->ma_value;
+  self->stats.hits++;
+  CtsStats_Stop(&self->stats, CtsStats_OP_GET, start);
+  return TTLCache_HitValue(self, result);
 }
 
-static PyObject *TTLCache_pop(CtsTTLCache *self, PyObject *args, PyObject *kw) {
-  PyObject *key;
-  PyObject *_default = NULL;
+static PyObject *TTLCache_pop(CtsTTLCache *self, CtsArg_PARAMS) {
+  PyObject *key, *value;
+  PyObject *_default;
+  PyObject *argv[2];
   CtsTTLCacheEntry *result;
 
-  static char *kwlist[] = {"key", "default", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kw, "O|O", kwlist, &key, &_default))
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"pop", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv))
     return NULL;
+  key = argv[0];
+  _default = argv[1];
   result = TTLCache_GetTTLItemWithError((CtsTTLCache *)self, key);
   if (!result) {
     ReturnIfErrorSet(NULL);
+    if (TTLCache_Flush(self)) {
+      return NULL;
+    }
     if (!_default) {
       Py_RETURN_NONE;
     }
     Py_INCREF(_default);
     return _default;
   }
-  Py_INCREF(result->ma_value);
-  if (!TTLCache_DelItem(self, key)) {
-    Py_XDECREF(result->ma_value);
+  value = result->ma_value;
+  Py_INCREF(value);
+  if (TTLCache_DelEntry(self, result)) {
+    Py_DECREF(value);
     return NULL;
   }
-  return result->ma_value;
+  return value;
 }
 
 static PyObject *TTLCache_popitem(CtsTTLCache *self,
@@ -463,45 +1009,62 @@ static PyObject *TTLCache_popitem(CtsTTLCache *self,
     Py_DECREF(tuple);
     return NULL;
   }
-  TTLCache_DelItem(self, key);
+  TTLCache_DelEntry(self, value_entry);
   PyErr_Clear(); /* Don't care del error */
   return tuple;
 }
 
-static PyObject *TTLCache_setdefault(CtsTTLCache *self, PyObject *args,
-                                     PyObject *kw) {
+static PyObject *TTLCache_setdefault(CtsTTLCache *self, CtsArg_PARAMS) {
   PyObject *key;
-  PyObject *_default = NULL;
+  PyObject *_default;
+  PyObject *argv[2];
   CtsTTLCacheEntry *result;
 
-  static char *kwlist[] = {"key", "default", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kw, "O|O", kwlist, &key, &_default))
+  static const char *const kwlist[] = {"key", "default", NULL};
+  static CtsArg_Parser parser = {"setdefault", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv))
     return NULL;
+  key = argv[0];
+  _default = argv[1];
   result = TTLCache_GetTTLItemWithError((CtsTTLCache *)self, key);
   if (result) {
-    return TTLCacheEntry_get_ma_value(result);
+    self->stats.hits++;
+    return TTLCache_HitValue(self, result);
   }
   ReturnIfErrorSet(NULL);
+  self->stats.misses++;
   if (!_default) {
     _default = Py_None;
   }
   Py_INCREF(_default);
-  if (TTLCache_SetItem(self, key, _default)) {
+  if (TTLCache_SetItem(self, key, _default) || TTLCache_Flush(self)) {
     Py_DECREF(_default);
     return NULL;
   }
   return _default;
 }
 
-static PyObject *TTLCache_setnx(CtsTTLCache *self, PyObject *args,
-                                PyObject *kw) {
+/* CtsFlight_StoreFunc of setnx. */
+static int TTLCache_Store(PyObject *self, PyObject *key, PyObject *value) {
+  return TTLCache_SetItem((CtsTTLCache *)self, key, value) ||
+         TTLCache_Flush((CtsTTLCache *)self);
+}
+
+static PyObject *TTLCache_setnx(CtsTTLCache *self, CtsArg_PARAMS) {
   PyObject *key;
-  PyObject *_default = NULL, *callback = NULL;
+  PyObject *_default = NULL, *callback;
+  PyObject *argv[3];
   CtsTTLCacheEntry *result;
+  int64_t start;
+
+  int singleflight = 0;
 
-  static char *kwlist[] = {"key", "fn", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kw, "OO", kwlist, &key, &callback))
+  static const char *const kwlist[] = {"key", "fn", "singleflight", NULL};
+  static CtsArg_Parser parser = {"setnx", kwlist, 2, 3};
+  if (CtsArg_UNPACK(&parser, argv) || CtsArg_Bool(argv[2], &singleflight))
     return NULL;
+  key = argv[0];
+  callback = argv[1];
 
   if (callback == NULL || !PyCallable_Check(callback)) {
     PyErr_SetString(PyExc_TypeError, "callback is not callable.");
@@ -510,15 +1073,30 @@ static PyObject *TTLCache_setnx(CtsTTLCache *self, PyObject *args,
 
   result = TTLCache_GetTTLItemWithError((CtsTTLCache *)self, key);
   if (result) {
-    return TTLCacheEntry_get_ma_value(result);
+    self->stats.hits++;
+    return TTLCache_HitValue(self, result);
   }
   ReturnIfErrorSet(NULL);
+  self->stats.misses++;
+  if (TTLCache_Flush(self)) {
+    return NULL;
+  }
+  if (singleflight) {
+    return CtsFlight_Load((PyObject *)self, &self->inflight, key, callback,
+                          TTLCache_Store);
+  }
+  start = self->xfetch > 0 ? CtsStats_NowNS() : 0;
   _default = PyObject_CallFunctionObjArgs(callback, key, NULL);
   ReturnIfNULL(_default, NULL);
-  if (TTLCache_SetItem(self, key, _default)) {
+  if (TTLCache_SetItem(self, key, _default) || TTLCache_Flush(self)) {
     Py_XDECREF(_default);
     return NULL;
   }
+  if (self->xfetch > 0 && (result = TTLCache_GetItemWithError(self, key))) {
+    /* XFetch needs to know how long a load takes */
+    result->delta = (double)(CtsStats_NowNS() - start) / 1e9;
+  }
+  PyErr_Clear();
   return _default;
 }
 
@@ -544,6 +1122,9 @@ static PyObject *TTLCache_update(CtsTTLCache *self, PyObject *args,
       }
   }
 
+  if (TTLCache_Flush(self)) {
+    return NULL;
+  }
   Py_RETURN_NONE;
 }
 
@@ -566,9 +1147,193 @@ static PyObject *TTLCache_get_default_ttl(CtsTTLCache *self) {
 }
 
 static PyObject *TTLCache__storage(CtsTTLCache *self) {
-  PyObject *dict = self->dict;
-  Py_INCREF(dict);
-  return dict;
+  /* read only, changing the dict directly would break the entry list */
+  return PyDictProxy_New(self->dict);
+}
+
+static PyObject *TTLCache_set(CtsTTLCache *self, CtsArg_PARAMS) {
+  PyObject *key, *value, *argv[3];
+  Py_ssize_t weight = -1;
+  static const char *const kwlist[] = {"key", "value", "weight", NULL};
+  static CtsArg_Parser parser = {"set", kwlist, 2, 3};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  key = argv[0];
+  value = argv[1];
+  if (argv[2] && argv[2] != Py_None) {
+    weight = PyLong_AsSsize_t(argv[2]);
+    if (weight < 0) {
+      if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_ValueError, "weight should not be negative.");
+      }
+      return NULL;
+    }
+  }
+  if (TTLCache_TimedSetItem(self, key, value, weight)) {
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *TTLCache_get_many(CtsTTLCache *self, CtsArg_PARAMS) {
+  PyObject *keys, *_default, *argv[2], *rv, *value;
+  CtsTTLCacheEntry *entry;
+  Py_ssize_t n, i;
+  int64_t now;
+  static const char *const kwlist[] = {"keys", "default", NULL};
+  static CtsArg_Parser parser = {"get_many", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv)) {
+    return NULL;
+  }
+  _default = argv[1] ? argv[1] : Py_None;
+  if ((now = TTLCache_Now(self)) < 0) {
+    return NULL;
+  }
+  keys = PySequence_Fast(argv[0], "keys should be iterable.");
+  ReturnIfNULL(keys, NULL);
+  n = PySequence_Fast_GET_SIZE(keys);
+  rv = PyList_New(n);
+  if (rv == NULL) {
+    Py_DECREF(keys);
+    return NULL;
+  }
+  for (i = 0; i < n; i++) {
+    entry = TTLCache_GetTTLItemAt(self, PySequence_Fast_GET_ITEM(keys, i),
+                                  now);
+    if (entry) {
+      self->stats.hits++;
+      value = TTLCache_HitValueAt(self, entry, now);
+    } else if (PyErr_Occurred()) {
+      value = NULL;
+    } else {
+      self->stats.misses++;
+      Py_INCREF(_default);
+      value = _default;
+    }
+    if (value == NULL) {
+      Py_CLEAR(rv);
+      break;
+    }
+    PyList_SET_ITEM(rv, i, value);
+  }
+  Py_DECREF(keys);
+  if (TTLCache_Flush(self)) {
+    Py_XDECREF(rv);
+    return NULL;
+  }
+  return rv;
+}
+
+/* CtsBatch_PairFunc of set_many, `arg` points to the time of the batch. */
+static int TTLCache_BatchSet(PyObject *self, PyObject *key, PyObject *value,
+                             void *arg) {
+  Py_ssize_t weight = TTLCache_Weigh((CtsTTLCache *)self, value);
+  if (weight < 0) {
+    return -1;
+  }
+  return TTLCache_Insert((CtsTTLCache *)self, key, value, weight,
+                         *(int64_t *)arg);
+}
+
+static PyObject *TTLCache_set_many(CtsTTLCache *self, PyObject *items) {
+  PyObject *type, *exc, *tb;
+  int64_t now = TTLCache_Now(self);
+  int rv;
+  if (now < 0 || TTLCache_Sweep(self, now)) {
+    return NULL;
+  }
+  rv = CtsBatch_ForEachPair((PyObject *)self, items, TTLCache_BatchSet, &now);
+  PyErr_Fetch(&type, &exc, &tb);
+  if (TTLCache_Shrink(self)) {
+    Py_XDECREF(type);
+    Py_XDECREF(exc);
+    Py_XDECREF(tb);
+    return NULL;
+  }
+  PyErr_Restore(type, exc, tb);
+  if (TTLCache_Flush(self) || rv) {
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *TTLCache_delete_many(CtsTTLCache *self, PyObject *keys) {
+  PyObject *seq;
+  CtsTTLCacheEntry *entry;
+  Py_ssize_t n, i, deleted = 0;
+  int64_t now = TTLCache_Now(self);
+  if (now < 0) {
+    return NULL;
+  }
+  seq = PySequence_Fast(keys, "keys should be iterable.");
+  ReturnIfNULL(seq, NULL);
+  n = PySequence_Fast_GET_SIZE(seq);
+  for (i = 0; i < n; i++) {
+    entry = TTLCache_GetItemWithError(self, PySequence_Fast_GET_ITEM(seq, i));
+    if (entry == NULL) {
+      if (PyErr_Occurred()) {
+        Py_DECREF(seq);
+        return NULL;
+      }
+      continue;
+    }
+    /* expired entries are gone already, only live ones count */
+    if (entry->expire >= now) {
+      deleted++;
+    }
+    if (TTLCache_DelEntry(self, entry)) {
+      Py_DECREF(seq);
+      return NULL;
+    }
+  }
+  Py_DECREF(seq);
+  return PyLong_FromSsize_t(deleted);
+}
+
+static PyObject *TTLCache_max_bytes(CtsTTLCache *self,
+                                    void *Py_UNUSED(closure)) {
+  if (self->max_bytes == PY_SSIZE_T_MAX) {
+    Py_RETURN_NONE;
+  }
+  return PyLong_FromSsize_t(self->max_bytes);
+}
+
+static PyObject *TTLCache_weight(CtsTTLCache *self, void *Py_UNUSED(closure)) {
+  return PyLong_FromSsize_t(self->weight);
+}
+
+static PyGetSetDef TTLCache_getset[] = {
+    {"max_bytes", (getter)TTLCache_max_bytes, NULL,
+     "Max total weight of entries, None if unbounded.", NULL},
+    {"weight", (getter)TTLCache_weight, NULL, "Total weight of entries.",
+     NULL},
+    {NULL, NULL, NULL, NULL, NULL} /* Sentinel */
+};
+
+static PyObject *TTLCache_stats(CtsTTLCache *self, CtsArg_PARAMS) {
+  int reset = 0;
+  PyObject *rv, *memory, *argv[1];
+  static const char *const kwlist[] = {"reset", NULL};
+  static CtsArg_Parser parser = {"stats", kwlist, 0, 1};
+  if (CtsArg_UNPACK(&parser, argv) || CtsArg_Bool(argv[0], &reset)) {
+    return NULL;
+  }
+  rv = CtsStats_AsDict(&self->stats);
+  if (rv && CtsPressure_Enabled(&self->pressure)) {
+    memory = CtsPressure_AsDict(&self->pressure);
+    if (memory == NULL || PyDict_SetItemString(rv, "memory", memory)) {
+      Py_XDECREF(memory);
+      Py_DECREF(rv);
+      return NULL;
+    }
+    Py_DECREF(memory);
+  }
+  if (rv && reset) {
+    CtsStats_Reset(&self->stats);
+    self->pressure.shrinks = 0;
+  }
+  return rv;
 }
 
 static PyObject *TTLCache_clear(CtsTTLCache *self) {
@@ -576,6 +1341,122 @@ static PyObject *TTLCache_clear(CtsTTLCache *self) {
   Py_RETURN_NONE;
 }
 
+/* Snapshot record of an entry: expire, soft expire, key and value. Entries
+ * are written from the least recently written one, expired ones are
+ * skipped. */
+static PyObject *TTLCache_dump(CtsTTLCache *self, CtsArg_PARAMS) {
+  PyObject *argv[2], *ordered;
+  CtsTTLCacheEntry *entry;
+  CtsSnapWriter w;
+  Py_ssize_t n;
+  int64_t now, meta[2];
+  int failed;
+
+  static const char *const kwlist[] = {"path", "serializer", NULL};
+  static CtsArg_Parser parser = {"dump", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv) || (now = TTLCache_Now(self)) < 0) {
+    return NULL;
+  }
+  /* the serializer may change the cache, the list keeps entries alive */
+  ordered = PyList_New(0);
+  ReturnIfNULL(ordered, NULL);
+  for (entry = self->head; entry; entry = entry->next) {
+    if (entry->expire >= now && (PyList_Append(ordered, entry->key) ||
+                                 PyList_Append(ordered, (PyObject *)entry))) {
+      Py_DECREF(ordered);
+      return NULL;
+    }
+  }
+  n = PyList_GET_SIZE(ordered) / 2;
+  if (CtsSnap_OpenWriter(&w, argv[0], argv[1] == Py_None ? NULL : argv[1])) {
+    Py_DECREF(ordered);
+    return NULL;
+  }
+  failed = CtsSnap_WriteHeader(&w, CtsSnap_KIND_TTLCACHE, 0, n, 0);
+  for (Py_ssize_t i = 0; i < n && !failed; i++) {
+    entry = (CtsTTLCacheEntry *)PyList_GET_ITEM(ordered, 2 * i + 1);
+    meta[0] = entry->expire;
+    meta[1] = entry->soft_expire;
+    failed = CtsSnap_Write(&w, meta, sizeof(meta)) ||
+             CtsSnap_WriteObject(&w, PyList_GET_ITEM(ordered, 2 * i)) ||
+             CtsSnap_WriteObject(&w, entry->ma_value);
+  }
+  Py_DECREF(ordered);
+  if (CtsSnap_CloseWriter(&w, failed)) {
+    return NULL;
+  }
+  return PyLong_FromSsize_t(n);
+}
+
+/* Write an entry of a snapshot with the expiry it had. */
+static int TTLCache_Restore(CtsTTLCache *self, PyObject *key, PyObject *value,
+                            int64_t expire, int64_t soft_expire) {
+  CtsTTLCacheEntry *entry, *old;
+  Py_ssize_t weight = TTLCache_Weigh(self, value);
+  if (weight < 0) {
+    return -1;
+  }
+  entry = TTLCacheEntry_New(value, expire);
+  ReturnIfNULL(entry, -1);
+  entry->key = key;
+  entry->soft_expire = soft_expire;
+  /* one lookup for the common case of a new key */
+  old = (CtsTTLCacheEntry *)PyDict_SetDefault(self->dict, key,
+                                              (PyObject *)entry);
+  if (old == NULL ||
+      (old != entry && (TTLCache_DelEntry(self, old) ||
+                        PyDict_SetItem(self->dict, key, (PyObject *)entry)))) {
+    Py_DECREF(entry);
+    return -1;
+  }
+  Py_DECREF(entry);
+  entry->weight = weight;
+  self->weight += weight;
+  TTLCache_Append(self, entry);
+  return 0;
+}
+
+static PyObject *TTLCache_load(CtsTTLCache *self, CtsArg_PARAMS) {
+  PyObject *argv[2], *key = NULL, *value = NULL;
+  CtsSnapReader r;
+  CtsSnapHeader h;
+  uint64_t i;
+  int64_t now, meta[2];
+  Py_ssize_t restored = 0;
+  int failed = 0;
+
+  static const char *const kwlist[] = {"path", "serializer", NULL};
+  static CtsArg_Parser parser = {"load", kwlist, 1, 2};
+  if (CtsArg_UNPACK(&parser, argv) || (now = TTLCache_Now(self)) < 0) {
+    return NULL;
+  }
+  if (CtsSnap_OpenReader(&r, argv[0], argv[1] == Py_None ? NULL : argv[1])) {
+    return NULL;
+  }
+  if (CtsSnap_ReadHeader(&r, CtsSnap_KIND_TTLCACHE, &h)) {
+    CtsSnap_CloseReader(&r);
+    return NULL;
+  }
+  for (i = 0; i < h.count && !failed; i++) {
+    if (CtsSnap_Read(&r, meta, sizeof(meta)) ||
+        (key = CtsSnap_ReadObject(&r)) == NULL ||
+        (value = CtsSnap_ReadObject(&r)) == NULL) {
+      failed = 1;
+    } else if (meta[0] >= now) {
+      /* entries expired while the cache was down are dropped */
+      failed = TTLCache_Restore(self, key, value, meta[0], meta[1]);
+      restored += !failed;
+    }
+    Py_CLEAR(key);
+    Py_CLEAR(value);
+  }
+  CtsSnap_CloseReader(&r);
+  if (TTLCache_Shrink(self) || TTLCache_Flush(self) || failed) {
+    return NULL;
+  }
+  return PyLong_FromSsize_t(restored);
+}
+
 /* tp_methods */
 static PyMethodDef TTLCache_methods[] = {
     {
@@ -601,21 +1482,59 @@ static PyMethodDef TTLCache_methods[] = {
     {
         "get",
         (PyCFunction)TTLCache_get,
-        METH_VARARGS | METH_KEYWORDS,
-        "get(key, default=None, /)\n--\n\nGet item from cache.",
+        CtsArg_METH,
+        "get(key, default=None)\n--\n\nGet item from cache.",
+    },
+    {
+        "set",
+        (PyCFunction)TTLCache_set,
+        CtsArg_METH,
+        "set(key, value, weight=None)\n--\n\n"
+        "Set item to cache, ``weight`` overrides the weight given by "
+        "``sizeof``.",
+    },
+    {
+        "get_many",
+        (PyCFunction)TTLCache_get_many,
+        CtsArg_METH,
+        CACHE_GET_MANY_METHOD_DOC,
+    },
+    {
+        "set_many",
+        (PyCFunction)TTLCache_set_many,
+        METH_O,
+        CACHE_SET_MANY_METHOD_DOC,
+    },
+    {
+        "delete_many",
+        (PyCFunction)TTLCache_delete_many,
+        METH_O,
+        CACHE_DELETE_MANY_METHOD_DOC,
+    },
+    {
+        "dump",
+        (PyCFunction)TTLCache_dump,
+        CtsArg_METH,
+        CACHE_DUMP_METHOD_DOC,
+    },
+    {
+        "load",
+        (PyCFunction)TTLCache_load,
+        CtsArg_METH,
+        CACHE_LOAD_METHOD_DOC,
     },
     {
         "setdefault",
         (PyCFunction)TTLCache_setdefault,
-        METH_VARARGS | METH_KEYWORDS,
-        "setdefault(key, default=None, /)\n--\n\n"
+        CtsArg_METH,
+        "setdefault(key, default=None)\n--\n\n"
         "Get item in cache, if key not "
         "exists, set default to cache and return it.",
     },
     {
         "pop",
         (PyCFunction)TTLCache_pop,
-        METH_VARARGS | METH_KEYWORDS,
+        CtsArg_METH,
         "pop(key, default=None)\n--\n\nPop item from cache.",
     },
     {
@@ -651,12 +1570,21 @@ static PyMethodDef TTLCache_methods[] = {
         "Update item to cache. Unlike dict.update, only accept a dict object.",
     },
     {"clear", (PyCFunction)TTLCache_clear, METH_NOARGS,
-     "clear()\n--\n\nClear cache."},
+     "clear()\n--\n\nClear cache, stats are kept."},
+    {
+        "stats",
+        (PyCFunction)TTLCache_stats,
+        CtsArg_METH,
+        "stats(reset=False)\n--\n\n"
+        "Return a dict of hits, misses, evictions, expirations, insertions "
+        "and latency histograms, with memory pressure under ``memory``, "
+        "reset all of them at once if ``reset`` is true.",
+    },
     {
         "setnx",
         (PyCFunction)TTLCache_setnx,
-        METH_VARARGS | METH_KEYWORDS,
-        USUAL_SETNX_METHOD_DOC,
+        CtsArg_METH,
+        CACHE_SETNX_METHOD_DOC,
     },
     {"_storage", (PyCFunction)TTLCache__storage, METH_NOARGS, NULL},
     {NULL, NULL, 0, NULL} /* Sentinel */
@@ -687,13 +1615,54 @@ static PyObject *TTLCache_tp_richcompare(PyObject *self, PyObject *other,
 
 PyDoc_STRVAR(
     TTLCache__doc__,
-    "TTLCache(ttl=None)\n--\n\n"
+    "TTLCache(ttl=None, max_bytes=None, sizeof=None, latency=False,\n"
+    "         on_evict=None, on_expire=None, soft_ttl=None, refresh=None,\n"
+    "         xfetch=0, memory_high=None, memory_limit=None,\n"
+    "         executor=None, timer=None)\n--\n\n"
     "A mapping that keys expire and unreachable after ``ttl`` seconds.\n"
     "\n"
     "Parameters\n"
     "----------\n"
     "ttl : int, optional\n"
     "  Key will expire after this many seconds, default is 60 (1 minute).\n"
+    "max_bytes : int, optional\n"
+    "  Max total weight of values, the least recently written keys are\n"
+    "  dropped first. Unbounded by default.\n"
+    "sizeof : typing.Callable[[typing.Any], int], optional\n"
+    "  Return weight of a value, default is ``value.__sizeof__()``.\n"
+    "latency : bool, optional\n"
+    "  Record latency histograms of get and set in :meth:`stats`.\n"
+    "on_evict : typing.Callable[[list], typing.Any], optional\n"
+    "  Called with a list of ``(key, value, 'evicted')`` tuples after an\n"
+    "  operation dropped entries to fit in ``max_bytes``.\n"
+    "on_expire : typing.Callable[[list], typing.Any], optional\n"
+    "  Called with a list of ``(key, value, 'expired')`` tuples after an\n"
+    "  operation dropped expired entries.\n"
+    "soft_ttl : int, optional\n"
+    "  Values are stale after this many seconds, less than ``ttl``. Reading\n"
+    "  a stale value returns it and calls ``refresh``.\n"
+    "refresh : typing.Callable[[typing.Any], typing.Any], optional\n"
+    "  Called with the key of a stale value, once until the key is written\n"
+    "  again, or again after another ``soft_ttl`` if it never is. It should\n"
+    "  write a new value. It runs inside the read that found the value\n"
+    "  stale, so that read waits for it, unless ``executor`` is given.\n"
+    "xfetch : float, optional\n"
+    "  Refresh before the soft expiry, or the expiry if no ``soft_ttl``, at\n"
+    "  random, more likely as it comes near and the longer the last\n"
+    "  refresh took, so hot keys do not all reload at once. 1.0 is a good\n"
+    "  choice, 0 disables it.\n"
+    "memory_high : float, optional\n"
+    "  Drop the least recently written keys when memory usage is above\n"
+    "  this fraction of ``memory_limit``, like :class:`CacheMap`.\n"
+    "memory_limit : int, optional\n"
+    "  Limit of the resident set size of the process in bytes, default is\n"
+    "  ``memory.max`` of the cgroup v2 of the process.\n"
+    "executor : concurrent.futures.Executor, optional\n"
+    "  Run ``refresh`` by ``executor.submit(refresh, key)``, the stale value\n"
+    "  is returned at once. Errors of the refresh are left in the future.\n"
+    "timer : typing.Callable[[], float], optional\n"
+    "  Return the time in seconds, default is :func:`time.time`. Expiry\n"
+    "  times in snapshots are of this clock.\n"
     "\n"
     "Examples\n"
     "--------\n"
@@ -739,7 +1708,7 @@ static PyTypeObject TTLCache_Type = {
     0,                                       /* tp_iternext */
     TTLCache_methods,                        /* tp_methods */
     0,                                       /* tp_members */
-    0,                                       /* tp_getset */
+    TTLCache_getset,                         /* tp_getset */
     0,                                       /* tp_base */
     0,                                       /* tp_dict */
     0,                                       /* tp_descr_get */
@@ -751,6 +1720,35 @@ static PyTypeObject TTLCache_Type = {
 };
 
 EXTERN_C_START
+int CtsTTLCache_Check(PyObject *ob) { return Py_TYPE(ob) == &TTLCache_Type; }
+
+PyObject *CtsTTLCache_Lookup(PyObject *ob, PyObject *key) {
+  CtsTTLCache *self = (CtsTTLCache *)ob;
+  CtsTTLCacheEntry *entry = TTLCache_GetTTLItemWithError(self, key);
+  if (!entry) {
+    ReturnIfErrorSet(NULL);
+    self->stats.misses++;
+    if (TTLCache_Flush(self)) {
+      return NULL; /* on_expire raised, the error is set */
+    }
+    return NULL; /* a miss, no error is set */
+  }
+  self->stats.hits++;
+  return TTLCache_HitValue(self, entry);
+}
+
+int CtsTTLCache_Store(PyObject *ob, PyObject *key, PyObject *value) {
+  return TTLCache_TimedSetItem((CtsTTLCache *)ob, key, value, -1);
+}
+
+PyObject *CtsTTLCache_FreeListStats(void) {
+  return CtsFreeList_AsDict(&TTLCacheEntry_freelist);
+}
+
+void CtsTTLCache_FreeListClear(void) {
+  CtsFreeList_Clear(&TTLCacheEntry_freelist, &TTLCacheEntry_Type);
+}
+
 int ctools_init_ttlcache(PyObject *module) {
   if (PyType_Ready(&TTLCacheEntry_Type) < 0) {
     return -1;
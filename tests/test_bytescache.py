@@ -0,0 +1,125 @@
+import gc
+import random
+import unittest
+
+import ctools
+
+
+class TestBytesCache(unittest.TestCase):
+    def test_mapping(self):
+        cache = ctools.BytesCache()
+        cache[b"a"] = b"1"
+        cache["b"] = "2"
+        cache[b"c"] = bytearray(b"3")
+        cache[b""] = memoryview(b"")
+        self.assertEqual(len(cache), 4)
+        self.assertEqual(cache[b"a"], b"1")
+        self.assertEqual(cache["b"], "2")
+        self.assertEqual(cache[b"b"], "2")
+        self.assertEqual(cache[b"c"], b"3")
+        self.assertEqual(cache[b""], b"")
+        self.assertIn("a", cache)
+        self.assertNotIn(b"d", cache)
+        self.assertNotIn(1, cache)
+        self.assertEqual(sorted(cache), [b"", b"a", b"b", b"c"])
+        del cache["a"]
+        self.assertNotIn(b"a", cache)
+        with self.assertRaises(KeyError):
+            cache[b"a"]
+        with self.assertRaises(KeyError):
+            del cache[b"a"]
+        with self.assertRaises(TypeError):
+            cache[1] = b"1"
+        with self.assertRaises(TypeError):
+            cache[b"a"] = 1
+        self.assertFalse(gc.is_tracked(cache))
+
+    def test_methods(self):
+        cache = ctools.BytesCache()
+        self.assertIsNone(cache.get(b"a"))
+        self.assertEqual(cache.get(b"a", 0), 0)
+        cache.set(b"a", b"x" * 1000)
+        self.assertEqual(cache.get(key=b"a"), b"x" * 1000)
+        self.assertEqual(cache.pop(b"a"), b"x" * 1000)
+        self.assertEqual(cache.pop(b"a", 0), 0)
+        cache[b"a"] = b"1"
+        cache.clear()
+        self.assertEqual(len(cache), 0)
+        self.assertEqual(cache.weight, 0)
+        self.assertEqual(cache.stats()["hits"], 1)
+
+    def test_same_as_dict(self):
+        cache = ctools.BytesCache()
+        mp = {}
+        rand = random.Random(0)
+        for _ in range(20000):
+            key = str(rand.randrange(500)).encode() * rand.choice((1, 30))
+            op = rand.random()
+            if op < 0.5:
+                value = bytes(rand.randrange(256)) * rand.choice((1, 2000))
+                cache[key] = mp[key] = value
+            elif op < 0.8:
+                self.assertEqual(cache.pop(key, None), mp.pop(key, None))
+            else:
+                self.assertEqual(cache.get(key), mp.get(key))
+        self.assertEqual(len(cache), len(mp))
+        self.assertEqual({k: cache[k] for k in cache}, mp)
+
+    def test_view(self):
+        cache = ctools.BytesCache()
+        cache[b"a"] = b"abc"
+        view = cache.view(b"a")
+        self.assertIsInstance(view, memoryview)
+        self.assertTrue(view.readonly)
+        self.assertEqual(view, b"abc")
+        self.assertIsNone(cache.view(b"b"))
+        # the memory of a view outlives the item
+        cache[b"a"] = b"xyz"
+        cache[b"b"] = b"abc"
+        self.assertEqual(view.tobytes(), b"abc")
+        del cache[b"a"]
+        cache.clear()
+        self.assertEqual(bytes(view), b"abc")
+        view.release()
+        cache[b"c"] = b"123"
+        self.assertEqual(cache[b"c"], b"123")
+
+    def test_capacity(self):
+        cache = ctools.BytesCache(3)
+        for key in (b"a", b"b", b"c"):
+            cache[key] = key
+        cache[b"a"]
+        cache[b"b"]
+        cache[b"d"] = b"d"
+        self.assertEqual(sorted(cache), [b"a", b"b", b"d"])
+        self.assertEqual(cache.stats()["evictions"], 1)
+        self.assertEqual(cache.evict(2), 2)
+        self.assertEqual(len(cache), 1)
+
+    def test_max_bytes(self):
+        cache = ctools.BytesCache(max_bytes=10000)
+        for i in range(100):
+            cache[str(i)] = bytes(500)
+            self.assertLessEqual(cache.weight, 10000)
+        self.assertLess(len(cache), 100)
+        self.assertGreater(len(cache), 10)
+        self.assertEqual(cache.max_bytes, 10000)
+        with self.assertRaises(ValueError):
+            cache[b"big"] = bytes(20000)
+
+    def test_large(self):
+        cache = ctools.BytesCache()
+        value = bytes(range(256)) * 1000
+        cache[b"large"] = value
+        self.assertGreaterEqual(cache.arena_bytes, len(value))
+        self.assertEqual(cache[b"large"], value)
+        view = cache.view(b"large")
+        del cache[b"large"]
+        self.assertEqual(view, value)
+        del view
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError):
+            ctools.BytesCache(0)
+        with self.assertRaises(ValueError):
+            ctools.BytesCache(max_bytes=0)
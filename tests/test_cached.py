@@ -0,0 +1,164 @@
+import unittest
+
+import ctools
+
+
+class TestCached(unittest.TestCase):
+    def test_cachemap(self):
+        cache = ctools.CacheMap(16)
+        calls = []
+
+        @ctools.cached(cache)
+        def square(x):
+            calls.append(x)
+            return x * x
+
+        self.assertIs(square.cache, cache)
+        self.assertEqual(square(3), 9)
+        self.assertEqual(square(3), 9)
+        self.assertEqual(square(4), 16)
+        self.assertEqual(calls, [3, 4])
+        stats = cache.stats()
+        self.assertEqual(stats["hits"], 1)
+        self.assertEqual(stats["misses"], 2)
+        self.assertEqual(cache[3], 9)
+
+    def test_ttlcache(self):
+        cache = ctools.TTLCache(60)
+        calls = []
+
+        @ctools.cached(cache)
+        def f(x, y):
+            calls.append((x, y))
+            return x + y
+
+        self.assertEqual(f(1, 2), 3)
+        self.assertEqual(f(1, 2), 3)
+        self.assertEqual(calls, [(1, 2)])
+        self.assertEqual(cache.stats()["hits"], 1)
+        self.assertEqual(cache[(1, 2)], 3)
+
+    def test_ttlcache_on_expire_error(self):
+        def on_expire(items):
+            raise RuntimeError(items)
+
+        now = [0]
+        cache = ctools.TTLCache(1, on_expire=on_expire, timer=lambda: now[0])
+
+        @ctools.cached(cache)
+        def f(x):
+            return x
+
+        self.assertEqual(f(1), 1)
+        now[0] = 2
+        with self.assertRaises(RuntimeError):
+            f(1)
+
+    def test_mapping(self):
+        cache = {}
+        calls = []
+
+        @ctools.cached(cache)
+        def f(x):
+            calls.append(x)
+            return [x]
+
+        self.assertIs(f("a"), f("a"))
+        self.assertEqual(calls, ["a"])
+        self.assertEqual(cache, {"a": ["a"]})
+
+    def test_default_cache(self):
+        @ctools.cached
+        def f(x):
+            return x
+
+        @ctools.cached()
+        def g(x):
+            return x
+
+        self.assertIsInstance(f.cache, ctools.CacheMap)
+        self.assertIsNot(f.cache, g.cache)
+        self.assertEqual(f(1), 1)
+        self.assertEqual(len(f.cache), 1)
+        self.assertEqual(len(g.cache), 0)
+
+    def test_kwargs(self):
+        calls = []
+
+        @ctools.cached({})
+        def f(x, y=0):
+            calls.append((x, y))
+            return x - y
+
+        self.assertEqual(f(3, y=1), 2)
+        self.assertEqual(f(3, y=1), 2)
+        self.assertEqual(f(3, 1), 2)
+        self.assertEqual(f(3), 3)
+        self.assertEqual(calls, [(3, 1), (3, 1), (3, 0)])
+
+    def test_typed(self):
+        calls = []
+
+        @ctools.cached({}, typed=True)
+        def f(x):
+            calls.append(x)
+            return x
+
+        f(1)
+        f(1.0)
+        f(1)
+        self.assertEqual(len(calls), 2)
+        self.assertEqual(type(calls[1]), float)
+
+        @ctools.cached({})
+        def g(x, y):
+            return x
+
+        g(1, 0)
+        self.assertEqual(type(g(1.0, 0)), int)
+
+    def test_exception_not_cached(self):
+        calls = []
+
+        @ctools.cached
+        def f(x):
+            calls.append(x)
+            raise ValueError(x)
+
+        for _ in range(2):
+            with self.assertRaises(ValueError):
+                f(1)
+        self.assertEqual(calls, [1, 1])
+        self.assertEqual(len(f.cache), 0)
+
+    def test_method(self):
+        class A:
+            def __init__(self, n):
+                self.n = n
+
+            @ctools.cached
+            def add(self, x):
+                return self.n + x
+
+        a, b = A(1), A(2)
+        self.assertEqual(a.add(1), 2)
+        self.assertEqual(b.add(1), 3)
+        self.assertEqual(A.add(a, 1), 2)
+        self.assertEqual(len(A.add.cache), 2)
+
+    def test_wrapper(self):
+        def func(x):
+            """doc"""
+            return x
+
+        wrapped = ctools.cached(func)
+        self.assertIs(wrapped.__wrapped__, func)
+        self.assertEqual(wrapped.__name__, "func")
+        self.assertEqual(wrapped.__doc__, "doc")
+        self.assertIn("func", repr(wrapped))
+
+    def test_invalid(self):
+        with self.assertRaises(TypeError):
+            ctools.cached({})(1)
+        with self.assertRaises(TypeError):
+            ctools.cached(None)(None)
@@ -1,3 +1,11 @@
+import asyncio
+import gc
+import marshal
+import os
+import random
+import tempfile
+import threading
+import time
 import unittest
 import uuid
 import sys
@@ -86,17 +94,8 @@ class DefaultMap(dict):
     def _storage(self):
         return self
 
-    def keys(self):
-        return list(super().keys())
-
-    def values(self):
-        return list(super().values())
-
-    def items(self):
-        return list(super().items())
-
     def __iter__(self):
-        return self.keys()
+        return iter(self.keys())
 
 
 class TestCacheMap(unittest.TestCase):
@@ -432,6 +431,861 @@ class TestCacheMap(unittest.TestCase):
         del cache, mapping
         self.assert_ref(key2, key1)
 
+    def test_evict_n(self):
+        cache = self.create_map(64)
+        for i in range(40):
+            cache[i] = i
+        self.assertEqual(cache.evict(0), 0)
+        self.assertEqual(cache.evict(), 1)
+        self.assertEqual(cache.evict(n=9), 9)
+        self.assertEqual(len(cache), 30)
+        self.assertEqual(cache.evict(100), 30)
+        self.assertEqual(len(cache), 0)
+        self.assertEqual(cache.evict(), 0)
+        with self.assertRaises(ValueError):
+            cache.evict(-1)
+
+    def test_popitem_victim(self):
+        cache = self.create_map(8)
+        for i in range(4):
+            cache[i] = i
+        evictions = cache.stats()["evictions"]
+        for _ in range(4):
+            key = cache.next_evict_key()
+            self.assertEqual(cache.popitem(), (key, key))
+        self.assertEqual(cache.stats()["evictions"], evictions)
+        with self.assertRaises(KeyError):
+            cache.popitem()
+
+    def test_many(self):
+        cache = self.create_map()
+        cache.set_many({1: "a", 2: "b"})
+        cache.set_many([(3, "c"), [4, "d"]])
+        cache.set_many(iter([(5, "e")]))
+        self.assertEqual(len(cache), 5)
+        self.assertEqual(cache.get_many([1, 3, 6]), ["a", "c", None])
+        self.assertEqual(cache.get_many((5, 6), default=0), ["e", 0])
+        self.assertEqual(cache.get_many(k for k in (2, 4)), ["b", "d"])
+        self.assertEqual(cache.delete_many([1, 2, 6]), 2)
+        self.assertNotIn(1, cache)
+        self.assertEqual(len(cache), 3)
+        with self.assertRaises(ValueError):
+            cache.set_many([(1, 2, 3)])
+        with self.assertRaises(TypeError):
+            cache.set_many([1])
+        with self.assertRaises(TypeError):
+            cache.get_many(1)
+        with self.assertRaises(TypeError):
+            cache.delete_many([[]])
+
+
+class TestCacheMapBatch(unittest.TestCase):
+    def test_evict_once(self):
+        for policy in ("lfu", "wtinylfu", "lru", "arc", "s3fifo", "clock"):
+            batches = []
+            cache = ctools.CacheMap(4, policy=policy, on_evict=batches.append)
+            cache.set_many((i, i) for i in range(10))
+            self.assertEqual(len(cache), 4, policy)
+            self.assertEqual(len(batches), 1, policy)
+            self.assertEqual(len(batches[0]), 6, policy)
+            self.assertEqual(cache.stats()["insertions"], 10)
+
+    def test_lru_order(self):
+        cache = ctools.CacheMap(3, policy="lru")
+        cache.set_many([(1, 1), (2, 2)])
+        cache.get_many([1])
+        cache.set_many([(3, 3), (4, 4)])
+        self.assertEqual(sorted(cache), [1, 3, 4])
+
+    def test_error_keeps_capacity(self):
+        cache = ctools.CacheMap(2, policy="lru")
+        with self.assertRaises(TypeError):
+            cache.set_many([(1, 1), (2, 2), (3, 3), ([], 4)])
+        self.assertEqual(len(cache), 2)
+        self.assertEqual(sorted(cache), [2, 3])
+
+    def test_stats(self):
+        cache = ctools.CacheMap(8)
+        cache.set_many({1: 1})
+        cache.get_many([1, 2, 1])
+        stats = cache.stats()
+        self.assertEqual(stats["hits"], 2)
+        self.assertEqual(stats["misses"], 1)
+
+
+class TestCacheMapEvict(unittest.TestCase):
+    def test_lfu_least_visited(self):
+        cache = ctools.CacheMap(2048)
+        for i in range(1000):
+            cache[i] = i
+        for i in range(100, 1000):
+            cache[i]
+        for i in range(500, 1000):
+            cache[i]
+        self.assertEqual(cache.evict(100), 100)
+        self.assertEqual(sorted(cache), list(range(100, 1000)))
+        self.assertEqual(cache.evict(600), 600)
+        self.assertEqual(len(cache), 300)
+        self.assertTrue(all(k >= 500 for k in cache))
+
+    def test_set_capacity(self):
+        evicted = []
+        cache = ctools.CacheMap(1000, on_evict=evicted.extend)
+        for i in range(1000):
+            cache[i] = i
+        for i in range(10, 1000):
+            cache[i]
+        cache.set_capacity(990)
+        self.assertEqual(len(cache), 990)
+        self.assertEqual(sorted(k for k, _, _ in evicted), list(range(10)))
+        self.assertEqual(cache.stats()["evictions"], 10)
+
+
+class TestCacheMapViews(unittest.TestCase):
+    def test_views(self):
+        cache = ctools.CacheMap(8)
+        cache.update({1: "a", 2: "b"})
+        keys, values, items = cache.keys(), cache.values(), cache.items()
+        self.assertEqual(len(keys), 2)
+        self.assertEqual(sorted(keys), [1, 2])
+        self.assertEqual(sorted(values), ["a", "b"])
+        self.assertEqual(sorted(items), [(1, "a"), (2, "b")])
+        self.assertIn(1, keys)
+        self.assertNotIn(3, keys)
+        self.assertIn("b", values)
+        self.assertIn((1, "a"), items)
+        self.assertNotIn((1, "b"), items)
+        self.assertNotIn(1, items)
+        cache[3] = "c"
+        self.assertEqual(len(items), 3)
+        self.assertIn(3, keys)
+        self.assertEqual(repr(cache.keys()), "cachemap_keys(%r)" % list(cache))
+
+    def test_no_hits(self):
+        for policy in ("lfu", "wtinylfu", "lru", "arc", "s3fifo", "clock"):
+            cache = ctools.CacheMap(3, policy=policy)
+            for i in range(3):
+                cache[i] = i
+            victim = cache.next_evict_key()
+            stats = cache.stats()
+            for _ in range(4):
+                list(cache.keys())
+                list(cache.values())
+                list(cache.items())
+                list(cache)
+                (victim, victim) in cache.items()
+            self.assertEqual(cache.next_evict_key(), victim, policy)
+            self.assertEqual(cache.stats(), stats, policy)
+
+    def test_changed_size(self):
+        cache = ctools.CacheMap(8)
+        cache.update({1: 1, 2: 2})
+        it = iter(cache.items())
+        next(it)
+        cache[3] = 3
+        with self.assertRaises(RuntimeError):
+            next(it)
+        with self.assertRaises(RuntimeError):
+            next(it)
+        it = iter(cache)
+        list(it)
+        cache[4] = 4
+        self.assertEqual(list(it), [])
+
+
+class TestLFUAging(unittest.TestCase):
+    def test_aging(self):
+        cache = ctools.CacheMap(64)
+        cache["hot"] = 1
+        entry = cache._storage()["hot"]
+        weight = entry.get_weight()
+        for _ in range(10):
+            cache["hot"]
+        self.assertEqual(entry.get_weight(), weight + 10)
+
+        # counters are halved after enough operations, so old hits fade
+        for i in range(63):
+            cache[i] = i
+        for _ in range(32):
+            for i in range(63):
+                cache[i]
+        self.assertLess(entry.get_weight(), weight + 10)
+        self.assertIn("hot", cache)
+
+    def test_evict_least_used(self):
+        cache = ctools.CacheMap(4)
+        for i in range(4):
+            cache[i] = i
+        for i in (0, 1, 3):
+            cache[i]
+        cache[4] = 4
+        self.assertNotIn(2, cache)
+        self.assertEqual(len(cache), 4)
+
+
+class TestCacheMapStats(unittest.TestCase):
+    def test_stats(self):
+        for policy in ("lfu", "wtinylfu", "lru", "arc", "s3fifo", "clock"):
+            cache = ctools.CacheMap(100, policy=policy)
+            for i in range(200):
+                cache[i] = i
+            cache[199] = 199
+            cache[199]
+            cache.get(199)
+            cache.get(-1)
+            cache.setdefault(199)
+            cache.setnx(-2, lambda k: k)
+            with self.assertRaises(KeyError):
+                cache[-1]
+            stats = cache.stats()
+            self.assertEqual(stats["hits"], 3, policy)
+            self.assertEqual(stats["misses"], 3, policy)
+            self.assertEqual(stats["insertions"], 201, policy)
+            self.assertEqual(stats["evictions"], 101, policy)
+            self.assertEqual(stats["expirations"], 0, policy)
+            self.assertIsNone(stats["latency"])
+            self.assertEqual(cache.hit_info(), (100, 3, 3))
+
+    def test_get_records_hit(self):
+        cache = ctools.CacheMap()
+        cache["a"] = 1
+        weight = cache._storage()["a"].get_weight()
+        self.assertEqual(cache.get("a"), 1)
+        self.assertEqual(cache._storage()["a"].get_weight(), weight + 1)
+
+    def test_reset(self):
+        cache = ctools.CacheMap()
+        cache[1] = 1
+        cache[1]
+        cache.clear()
+        self.assertEqual(cache.stats()["hits"], 1)
+        self.assertEqual(cache.stats(reset=True)["hits"], 1)
+        stats = cache.stats()
+        self.assertEqual(stats["hits"], 0)
+        self.assertEqual(stats["insertions"], 0)
+
+    def test_latency(self):
+        cache = ctools.CacheMap(latency=True)
+        cache[1] = 1
+        cache.set(2, 2)
+        cache[1]
+        cache.get(3)
+        latency = cache.stats()["latency"]
+        self.assertEqual(len(latency["get"]), 32)
+        self.assertEqual(sum(latency["get"]), 2)
+        self.assertEqual(sum(latency["set"]), 2)
+        cache.stats(reset=True)
+        self.assertEqual(sum(cache.stats()["latency"]["get"]), 0)
+
+
+class TestCacheMapOnEvict(unittest.TestCase):
+    def test_on_evict(self):
+        for policy in ("lfu", "wtinylfu", "lru", "arc", "s3fifo", "clock"):
+            batches = []
+            cache = ctools.CacheMap(10, policy=policy, on_evict=batches.append)
+            for i in range(10):
+                cache[i] = str(i)
+            self.assertEqual(batches, [])
+            cache[10] = "10"
+            self.assertEqual(len(batches), 1, policy)
+            ((key, value, reason),) = batches[0]
+            self.assertNotIn(key, cache)
+            self.assertEqual(value, str(key))
+            self.assertEqual(reason, "evicted")
+
+            # one burst is delivered as one batch
+            cache.set_capacity(5)
+            self.assertEqual(len(batches), 2)
+            self.assertEqual(len(batches[1]), 5)
+            cache.update({i: str(i) for i in range(20, 30)})
+            self.assertEqual(len(batches), 3)
+            self.assertEqual(len(batches[2]), 10)
+            cache.evict()
+            self.assertEqual(len(batches[3]), 1)
+
+    def test_reentrant(self):
+        cache = None
+
+        def on_evict(batch):
+            for key, value, _ in batch:
+                cache["last"] = value
+
+        cache = ctools.CacheMap(2, policy="lru", on_evict=on_evict)
+        cache[1] = 1
+        cache[2] = 2
+        cache[3] = 3
+        self.assertIn("last", cache)
+        self.assertEqual(len(cache), 2)
+
+    def test_error(self):
+        def on_evict(batch):
+            raise ValueError
+
+        cache = ctools.CacheMap(1, on_evict=on_evict)
+        cache[1] = 1
+        with self.assertRaises(ValueError):
+            cache[2] = 2
+        self.assertEqual(len(cache), 1)
+        with self.assertRaises(TypeError):
+            ctools.CacheMap(on_evict=1)
+
+
+class TestSingleflight(unittest.TestCase):
+    def create_map(self):
+        return ctools.CacheMap()
+
+    def run_threads(self, cache, fn, n=8):
+        results = []
+
+        def worker():
+            try:
+                results.append(cache.setnx("key", fn, singleflight=True))
+            except Exception as e:
+                results.append(e)
+
+        threads = [threading.Thread(target=worker) for _ in range(n)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        return results
+
+    def test_coalesce(self):
+        cache = self.create_map()
+        calls = []
+
+        def load(key):
+            calls.append(key)
+            time.sleep(0.2)
+            return object()
+
+        results = self.run_threads(cache, load)
+        self.assertEqual(calls, ["key"])
+        self.assertEqual(len(results), 8)
+        self.assertTrue(all(r is results[0] for r in results))
+        self.assertIs(cache["key"], results[0])
+
+    def test_error(self):
+        cache = self.create_map()
+        calls = []
+
+        def load(key):
+            calls.append(key)
+            time.sleep(0.2)
+            raise ValueError(key)
+
+        results = self.run_threads(cache, load)
+        self.assertEqual(len(calls), 1)
+        self.assertTrue(all(isinstance(r, ValueError) for r in results))
+        self.assertNotIn("key", cache)
+
+    def test_recursive(self):
+        cache = self.create_map()
+
+        def load(key):
+            return cache.setnx(key, load, singleflight=True)
+
+        with self.assertRaises(RuntimeError):
+            cache.setnx("key", load, singleflight=True)
+        self.assertEqual(cache.setnx("key", str, singleflight=True), "key")
+
+    def test_asetnx(self):
+        cache = self.create_map()
+        calls = []
+
+        async def load(key):
+            calls.append(key)
+            await asyncio.sleep(0.05)
+            return key * 2
+
+        async def main():
+            return await asyncio.gather(
+                *[ctools.asetnx(cache, "a", load) for _ in range(5)]
+            )
+
+        loop = asyncio.new_event_loop()
+        try:
+            self.assertEqual(loop.run_until_complete(main()), ["aa"] * 5)
+            self.assertEqual(calls, ["a"])
+            self.assertEqual(cache["a"], "aa")
+            result = loop.run_until_complete(ctools.asetnx(cache, "a", load))
+            self.assertEqual(result, "aa")
+            self.assertEqual(calls, ["a"])
+        finally:
+            loop.close()
+
+    def test_asetnx_error(self):
+        cache = self.create_map()
+
+        async def load(key):
+            await asyncio.sleep(0.05)
+            raise ValueError(key)
+
+        async def main():
+            return await asyncio.gather(
+                *[ctools.asetnx(cache, "a", load) for _ in range(3)],
+                return_exceptions=True
+            )
+
+        loop = asyncio.new_event_loop()
+        try:
+            results = loop.run_until_complete(main())
+        finally:
+            loop.close()
+        self.assertTrue(all(isinstance(r, ValueError) for r in results))
+        self.assertNotIn("a", cache)
+
+
+class TestWTinyLFUCacheMap(TestCacheMap):
+    def create_map(self, maxsize=257):
+        return ctools.CacheMap(maxsize, policy="wtinylfu")
+
+    def test_scan_resistance(self):
+        cache = self.create_map(100)
+        hot = ["hot%d" % i for i in range(50)]
+        for _ in range(5):
+            for k in hot:
+                cache[k] = k
+                self.assertEqual(cache[k], k)
+        for i in range(10000):
+            cache["scan%d" % i] = i
+        self.assertEqual(len(cache), 100)
+        self.assertGreaterEqual(sum(k in cache for k in hot), 45)
+
+    def test_evict(self):
+        cache = self.create_map(4)
+        for i in range(4):
+            cache[i] = i
+        key = cache.next_evict_key()
+        cache.evict()
+        self.assertNotIn(key, cache)
+        self.assertEqual(len(cache), 3)
+        cache.set_capacity(1)
+        self.assertEqual(len(cache), 1)
+        key = cache.next_evict_key()
+        self.assertEqual(cache.pop(key), key)
+        self.assertEqual(len(cache), 0)
+
+    def test_max_bytes(self):
+        for policy in ["lfu", "wtinylfu", "lru", "arc", "s3fifo", "clock"]:
+            cache = ctools.CacheMap(policy=policy, max_bytes=100, sizeof=len)
+            self.assertEqual(cache.max_bytes, 100)
+            for i in range(20):
+                cache[i] = "x" * 10
+                self.assertLessEqual(cache.weight, 100)
+            self.assertEqual(len(cache), 10)
+            self.assertEqual(cache.weight, 100)
+            cache.set("big", "y", weight=60)
+            self.assertLessEqual(cache.weight, 100)
+            if policy != "lfu":
+                # lfu may pick any of the equally used keys
+                self.assertIn("big", cache)
+                self.assertEqual(len(cache), 5)
+            cache.set("huge", "z", weight=101)
+            self.assertNotIn("huge", cache)
+            expect = sum(60 if k == "big" else 10 for k in cache)
+            self.assertEqual(cache.weight, expect)
+            cache.clear()
+            self.assertEqual(cache.weight, 0)
+
+        cache = ctools.CacheMap(max_bytes=1000)
+        cache[1] = b"x" * 600
+        cache[2] = b"x" * 600
+        self.assertEqual(len(cache), 1)
+        self.assertEqual(cache.weight, (b"x" * 600).__sizeof__())
+        self.assertIsNone(ctools.CacheMap().max_bytes)
+        with self.assertRaises(ValueError):
+            ctools.CacheMap().set(1, 1, weight=-1)
+
+    def test_policy(self):
+        with self.assertRaises(ValueError):
+            ctools.CacheMap(4, policy="unknown")
+        cache = ctools.CacheMap(4)
+        cache[1] = 1
+        with self.assertRaises(ValueError):
+            cache.__init__(4, policy="wtinylfu")
+
+
+class TestLRUCacheMap(TestCacheMap):
+    def create_map(self, maxsize=257):
+        return ctools.CacheMap(maxsize, policy="lru")
+
+    def test_order(self):
+        cache = self.create_map(3)
+        self.assertEqual(cache.policy, "lru")
+        for i in range(3):
+            cache[i] = i
+        self.assertEqual(cache[0], 0)
+        cache[3] = 3
+        self.assertNotIn(1, cache)
+        self.assertEqual(cache.next_evict_key(), 2)
+
+
+class TestClockCacheMap(TestCacheMap):
+    def create_map(self, maxsize=257):
+        return ctools.CacheMap(maxsize, policy="clock")
+
+    def test_second_chance(self):
+        cache = self.create_map(3)
+        for i in range(3):
+            cache[i] = i
+        self.assertEqual(cache[0], 0)
+        self.assertEqual(cache[1], 1)
+        cache[3] = 3
+        self.assertNotIn(2, cache)
+        self.assertEqual(cache.next_evict_key(), 0)
+
+
+class TestS3FIFOCacheMap(TestCacheMap):
+    def create_map(self, maxsize=257):
+        return ctools.CacheMap(maxsize, policy="s3fifo")
+
+    def test_one_hit_wonders(self):
+        cache = self.create_map(100)
+        hot = list(range(50))
+        for k in hot:
+            cache[k] = k
+            self.assertEqual(cache[k], k)
+        for i in range(1000, 2000):
+            cache[i] = i
+        self.assertEqual(len(cache), 100)
+        self.assertTrue(all(k in cache for k in hot))
+
+    def test_ghost(self):
+        cache = self.create_map(10)
+        for i in range(11):
+            cache[i] = i
+        self.assertNotIn(0, cache)
+        # a key coming back soon after eviction enters the main queue
+        cache[0] = 0
+        for i in range(100, 120):
+            cache[i] = i
+        self.assertIn(0, cache)
+
+
+class TestARCCacheMap(TestCacheMap):
+    def create_map(self, maxsize=257):
+        return ctools.CacheMap(maxsize, policy="arc")
+
+    def test_frequent_survive_scan(self):
+        cache = self.create_map(100)
+        hot = list(range(50))
+        for k in hot:
+            cache[k] = k
+            self.assertEqual(cache[k], k)
+        for i in range(1000, 2000):
+            cache[i] = i
+        self.assertEqual(len(cache), 100)
+        self.assertTrue(all(k in cache for k in hot))
+
+    def test_ghost_hit(self):
+        cache = self.create_map(4)
+        for i in range(5):
+            cache[i] = i
+        self.assertNotIn(0, cache)
+        cache[0] = 0
+        for i in range(10, 13):
+            cache[i] = i
+        self.assertIn(0, cache)
+
+
+class TestCacheMapSnapshot(unittest.TestCase):
+    def setUp(self):
+        fd, self.path = tempfile.mkstemp()
+        os.close(fd)
+        self.addCleanup(os.unlink, self.path)
+
+    def eviction_order(self, cache):
+        order = []
+        while cache:
+            key = cache.next_evict_key()
+            order.append(key)
+            cache.evict()
+        return order
+
+    def test_policies(self):
+        for policy in ("lfu", "wtinylfu", "lru", "clock", "s3fifo", "arc"):
+            cache = ctools.CacheMap(50, policy=policy)
+            other = ctools.CacheMap(50, policy=policy)
+            for i in range(200):
+                cache[i % 70] = str(i)
+                cache.get(i % 7)
+            self.assertEqual(cache.dump(self.path), len(cache))
+            self.assertEqual(other.load(self.path), len(cache))
+            self.assertEqual(dict(other.items()), dict(cache.items()))
+            if policy not in ("lfu", "wtinylfu"):
+                # both the ordered and the frequency policies are restored
+                self.assertEqual(self.eviction_order(other), self.eviction_order(cache))
+
+    def test_lfu_visits(self):
+        cache = ctools.CacheMap(3)
+        for i in range(3):
+            cache[i] = i
+        for _ in range(5):
+            cache[0]
+            cache[2]
+        cache.dump(self.path)
+        other = ctools.CacheMap(3)
+        other.load(self.path)
+        other[3] = 3
+        self.assertEqual(sorted(other), [0, 2, 3])
+
+    def test_values(self):
+        values = {
+            b"bytes": b"\x00\xff",
+            "str": "\u4e2d",
+            "int": -(2 ** 63),
+            "big": 2 ** 100,
+            "float": 1.5,
+            "none": None,
+            "tuple": (1, [2, {"3": 4}]),
+            "surrogate": "\udc80",
+        }
+        cache = ctools.CacheMap()
+        cache.update(values)
+        cache.dump(self.path)
+        other = ctools.CacheMap(policy="lru")
+        other.load(self.path)
+        self.assertEqual(dict(other.items()), values)
+
+    def test_serializer(self):
+        cache = ctools.CacheMap()
+        cache["a"] = {"b": [1, 2]}
+        cache.dump(self.path, serializer=marshal)
+        with self.assertRaises(AttributeError):
+            ctools.CacheMap().load(self.path, serializer=object())
+        other = ctools.CacheMap()
+        other.load(self.path, serializer=marshal)
+        self.assertEqual(other["a"], {"b": [1, 2]})
+
+    def test_failed_dump(self):
+        class Serializer:
+            @staticmethod
+            def dumps(value):
+                raise RuntimeError(value)
+
+        cache = ctools.CacheMap()
+        cache["a"] = 1
+        cache.dump(self.path)
+        cache["b"] = {"c": 2}
+        with self.assertRaises(RuntimeError):
+            cache.dump(self.path, serializer=Serializer)
+        # the previous snapshot is kept and the partial file removed
+        self.assertFalse(os.path.exists(self.path + ".tmp"))
+        other = ctools.CacheMap()
+        self.assertEqual(other.load(self.path), 1)
+        self.assertEqual(dict(other.items()), {"a": 1})
+
+    def test_failed_load_keeps_gc(self):
+        enabled = []
+
+        class Serializer:
+            @staticmethod
+            def loads(data):
+                enabled.append(gc.isenabled())
+                raise RuntimeError(data)
+
+        cache = ctools.CacheMap()
+        cache["a"] = {"b": 1}
+        cache.dump(self.path, serializer=marshal)
+        with self.assertRaises(RuntimeError):
+            ctools.CacheMap().load(self.path, serializer=Serializer)
+        # the collector is never switched off by a load
+        self.assertEqual(enabled, [True])
+        self.assertTrue(gc.isenabled())
+
+    def test_smaller(self):
+        cache = ctools.CacheMap(policy="lru")
+        for i in range(100):
+            cache[i] = i
+        cache.dump(self.path)
+        other = ctools.CacheMap(10, policy="lru")
+        self.assertEqual(other.load(self.path), 100)
+        self.assertEqual(sorted(other), list(range(90, 100)))
+
+    def test_error(self):
+        with self.assertRaises(OSError):
+            ctools.CacheMap().load(os.path.join(self.path, "missing"))
+        with self.assertRaises(OSError):
+            ctools.CacheMap().dump(os.path.join(self.path, "missing"))
+        ctools.TTLCache().dump(self.path)
+        with self.assertRaises(ValueError):
+            ctools.CacheMap().load(self.path)
+        cache = ctools.CacheMap()
+        cache.update({i: str(i) for i in range(10)})
+        cache.dump(self.path)
+        with open(self.path, "r+b") as f:
+            f.truncate(os.path.getsize(self.path) - 1)
+        with self.assertRaises(ValueError):
+            ctools.CacheMap().load(self.path)
+        with open(self.path, "wb") as f:
+            f.write(b"garbage")
+        with self.assertRaises(ValueError):
+            ctools.CacheMap().load(self.path)
+
+
+class TestCacheMapL2(unittest.TestCase):
+    def setUp(self):
+        fd, self.path = tempfile.mkstemp()
+        os.close(fd)
+        self.addCleanup(os.unlink, self.path)
+
+    def test_spill(self):
+        cache = ctools.CacheMap(10, policy="lru", l2_path=self.path)
+        for i in range(100):
+            cache[str(i)] = b"%d" % i
+        cache[100] = "not bytes"
+        cache[(1,)] = b"not spilled"
+        for i in range(11):
+            cache[-i] = b""
+        self.assertEqual(len(cache), 10)
+        self.assertEqual(cache.stats()["l2"]["writes"], 101)
+        self.assertNotIn("5", cache)
+        # a hit on disk moves the item back to memory
+        self.assertEqual(cache["5"], b"5")
+        self.assertIn("5", cache)
+        self.assertEqual(cache.get("6"), b"6")
+        self.assertEqual(cache.get_many(["7", "x"]), [b"7", None])
+        self.assertEqual(cache.setdefault("8", b"x"), b"8")
+        self.assertEqual(cache.setnx("9", lambda k: b"x"), b"9")
+        self.assertEqual(cache.get(0), b"")
+        self.assertIsNone(cache.get(100))
+        self.assertIsNone(cache.get((1,)))
+        stats = cache.stats()
+        self.assertEqual(stats["l2"]["hits"], 6)
+        self.assertEqual(stats["hits"], 6)
+
+    def test_delete(self):
+        cache = ctools.CacheMap(1, l2_path=self.path)
+        for key in (b"a", b"b", b"c", b"d", b"e"):
+            cache[key] = key
+        del cache[b"a"]
+        self.assertIsNone(cache.get(b"a"))
+        with self.assertRaises(KeyError):
+            del cache[b"a"]
+        self.assertEqual(cache.pop(b"b"), b"b")
+        self.assertIsNone(cache.pop(b"b"))
+        self.assertEqual(cache.delete_many([b"c", b"x"]), 1)
+        # a new value replaces the one on disk
+        cache[b"d"] = b"new"
+        cache[b"x"] = b"x"
+        self.assertEqual(cache[b"d"], b"new")
+        cache.clear()
+        self.assertIsNone(cache.get(b"e"))
+
+    def test_ring(self):
+        cache = ctools.CacheMap(1, policy="lru", l2_path=self.path, l2_max_bytes=2000)
+        for i in range(1000):
+            cache[i] = bytes(100)
+        self.assertLessEqual(os.path.getsize(self.path), 2000)
+        # old records are overwritten by new ones
+        self.assertIsNone(cache.get(0))
+        self.assertEqual(cache.get(997), bytes(100))
+        self.assertEqual(sum(cache.get(i) is not None for i in range(1000)), 17)
+        cache[-1] = bytes(5000)
+        cache[-2] = b""
+        self.assertIsNone(cache.get(-1))
+
+    def test_same_as_dict(self):
+        cache = ctools.CacheMap(50, l2_path=self.path)
+        mp = {}
+        rand = random.Random(0)
+        for _ in range(20000):
+            n = rand.randrange(-1000, 1000)
+            # bytes and str of the same text have the same hash
+            key = rand.choice((n, str(n), str(n).encode()))
+            op = rand.random()
+            if op < 0.4:
+                cache[key] = mp[key] = bytes(rand.randrange(50))
+            elif op < 0.5:
+                self.assertEqual(cache.pop(key, None), mp.pop(key, None))
+            else:
+                self.assertEqual(cache.get(key), mp.get(key))
+        for key, value in mp.items():
+            self.assertEqual(cache[key], value)
+
+    def test_threads(self):
+        # disk reads and writes release the GIL, the threads interleave
+        cache = ctools.CacheMap(20, policy="lru", l2_path=self.path)
+        errors = []
+
+        def worker(n):
+            keys = ["%d:%d" % (n, i) for i in range(300)]
+            for key in keys:
+                cache[key] = key.encode()
+            for key in keys:
+                if cache.get(key) != key.encode():
+                    errors.append(key)
+
+        threads = [threading.Thread(target=worker, args=(n,)) for n in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        self.assertEqual(errors, [])
+        self.assertEqual(len(cache), 20)
+
+    def test_error(self):
+        with self.assertRaises(ValueError):
+            ctools.CacheMap(l2_path=self.path, l2_max_bytes=0)
+        with self.assertRaises(OSError):
+            ctools.CacheMap(l2_path=os.path.join(self.path, "missing"))
+        self.assertNotIn("l2", ctools.CacheMap().stats())
+
+
+@unittest.skipUnless(sys.platform in ("linux", "darwin", "win32"), "no rss")
+class TestCacheMapMemoryPressure(unittest.TestCase):
+    def test_shrink(self):
+        for policy in ("lfu", "wtinylfu", "lru", "clock", "s3fifo", "arc"):
+            evicted = []
+            # any process is above a limit of one byte
+            cache = ctools.CacheMap(
+                1000, policy=policy, memory_high=0.5, memory_limit=1, on_evict=evicted.extend
+            )
+            for i in range(5000):
+                cache[i] = i
+            capacity = cache.hit_info()[0]
+            self.assertLess(capacity, 100)
+            self.assertLessEqual(len(cache), capacity)
+            self.assertEqual(len(evicted), 5000 - len(cache))
+            self.assertEqual(evicted[0][2], "evicted")
+            memory = cache.stats()["memory"]
+            self.assertEqual(memory["cap"], capacity)
+            self.assertEqual(memory["limit"], 1)
+            self.assertGreater(memory["usage"], 0)
+            self.assertGreater(memory["shrinks"], 0)
+            self.assertEqual(cache.stats(reset=True)["memory"]["shrinks"], memory["shrinks"])
+            self.assertEqual(cache.stats()["memory"]["shrinks"], 0)
+
+    def test_grow(self):
+        cache = ctools.CacheMap(1000, memory_high=0.5, memory_limit=1)
+        for i in range(5000):
+            cache[i] = i
+        self.assertLess(cache.hit_info()[0], 1000)
+        # the cap is kept by a new watermark, and raised as pressure is gone
+        cache.__init__(1000, memory_high=0.5, memory_limit=1 << 60)
+        self.assertLess(cache.hit_info()[0], 1000)
+        for i in range(50000):
+            cache[i] = i
+        self.assertEqual(cache.hit_info()[0], 1000)
+        self.assertEqual(len(cache), 1000)
+        self.assertIsNone(cache.stats()["memory"]["cap"])
+        cache.set_capacity(10)
+        self.assertEqual(len(cache), 10)
+
+    def test_error(self):
+        for high in (0, -1, 1.5):
+            with self.assertRaises(ValueError):
+                ctools.CacheMap(memory_high=high, memory_limit=1 << 30)
+        with self.assertRaises(TypeError):
+            ctools.CacheMap(memory_high="0.5", memory_limit=1 << 30)
+        with self.assertRaises(ValueError):
+            ctools.CacheMap(memory_high=0.5, memory_limit=0)
+        if not os.path.exists("/sys/fs/cgroup/cgroup.controllers"):
+            with self.assertRaises(ValueError):
+                ctools.CacheMap(memory_high=0.5)
+        self.assertNotIn("memory", ctools.CacheMap().stats())
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -1,6 +1,7 @@
 import unittest
 import uuid
 import sys
+import threading
 
 import ctools
 from ctools import _ctools
@@ -70,6 +71,50 @@ class TestChannel(unittest.TestCase):
         self.assertFalse(ch.recvable())
         self.assertTrue(ch.sendable())
 
+    def test_grow_and_shrink(self):
+        ch = ctools.Channel()
+        empty = sys.getsizeof(ch)
+        self.assertEqual(ch.size(), 2 ** 31 - 1)
+
+        for r in range(3):
+            for i in range(1000):
+                self.assertTrue(ch.send(i))
+            self.assertGreater(sys.getsizeof(ch), empty + 1000 * 8 - 1)
+            for i in range(500):
+                self.assertEqual(ch.recv(), (i, True))
+            for i in range(1000, 1500):
+                self.assertTrue(ch.send(i))
+            for i in range(500, 1500):
+                self.assertEqual(ch.recv(), (i, True))
+            self.assertEqual(ch.recv(), (None, False))
+            self.assertLess(sys.getsizeof(ch), empty + 8 * 16)
+
+    def test_bound_not_power_of_2(self):
+        ch = ctools.Channel(13)
+        for r in range(5):
+            for i in range(13):
+                self.assertTrue(ch.send(i))
+            self.assertFalse(ch.send(13))
+            for i in range(7):
+                self.assertEqual(ch.recv(), (i, True))
+            for i in range(13, 20):
+                self.assertTrue(ch.send(i))
+            self.assertFalse(ch.sendable())
+            for i in range(7, 20):
+                self.assertEqual(ch.recv(), (i, True))
+
+    def test_clear(self):
+        ch = ctools.Channel(4)
+        item = uuid.uuid1()
+        a = uuid.uuid1()
+        ch.send(item)
+        ch.send(item)
+        ch.clear()
+        self.assertRefEqual(item, a)
+        self.assertFalse(ch.recvable())
+        self.assertTrue(ch.send(1))
+        self.assertEqual(ch.recv(), (1, True))
+
     def test_safe_consume(self):
         ch = ctools.Channel(1)
         ev = uuid.uuid1()
@@ -108,6 +153,263 @@ class TestChannel(unittest.TestCase):
         self.assertIsNone(ch.recv()[0])
         self.assertRefEqual(ev, a)
 
+    def test_safe_consume_same_object(self):
+        ch = ctools.Channel(4)
+        ch.send(1)
+        ch.send(1)
+
+        def resend(item):
+            # the consumed item is replaced by the same object
+            ch.recv()
+            ch.send(item)
+            return True
+
+        self.assertTrue(ch.safe_consume(resend))
+        self.assertEqual(ch.recv(), (1, True))
+        self.assertEqual(ch.recv(), (1, True))
+        self.assertEqual(ch.recv(), (None, False))
+
+
+class TestLockFreeChannel(unittest.TestCase):
+    mode = "spsc"
+
+    def assertRefEqual(self, a, b, msg=None):
+        self.assertEqual(sys.getrefcount(a), sys.getrefcount(b), msg=msg)
+
+    def test_size_round_up(self):
+        ch = ctools.Channel(30, mode=self.mode)
+        self.assertEqual(ch.mode, self.mode)
+        self.assertEqual(ch.size(), 32)
+        with self.assertRaises(ValueError):
+            ctools.Channel(mode=self.mode)
+        with self.assertRaises(ValueError):
+            ctools.Channel(1, mode="foo")
+
+    def test_send_recv(self):
+        ch = ctools.Channel(32, mode=self.mode)
+        self.assertTrue(ch.sendable())
+        self.assertFalse(ch.recvable())
+        self.assertEqual(ch.recv(), (None, False))
+
+        for i in range(32):
+            self.assertTrue(ch.send(i))
+        self.assertFalse(ch.sendable())
+        self.assertTrue(ch.recvable())
+        self.assertFalse(ch.send(32))
+
+        for i in range(32):
+            self.assertEqual(ch.recv(), (i, True))
+        self.assertFalse(ch.recvable())
+        self.assertTrue(ch.sendable())
+
+    def test_ref(self):
+        ch = ctools.Channel(4, mode=self.mode)
+        item = uuid.uuid1()
+        a = uuid.uuid1()
+        ch.send(item)
+        ch.send(item)
+        ch.recv()
+        ch.clear()
+        self.assertFalse(ch.recvable())
+        self.assertRefEqual(item, a)
+        ch.send(item)
+        del ch
+        self.assertRefEqual(item, a)
+
+    def test_close(self):
+        ch = ctools.Channel(4, mode=self.mode)
+        ch.send(1)
+        ch.close(recv=False)
+        with self.assertRaises(IndexError):
+            ch.send(2)
+        self.assertEqual(ch.recv(), (1, True))
+        ch.close()
+        with self.assertRaises(IndexError):
+            ch.recv()
+
+    def test_threads(self):
+        ch = ctools.Channel(8, mode=self.mode)
+        count = 1000
+        received = []
+
+        def producer():
+            i = 0
+            while i < count:
+                if ch.send(i):
+                    i += 1
+
+        def consumer():
+            while len(received) < count:
+                item, ok = ch.recv()
+                if ok:
+                    received.append(item)
+
+        threads = [
+            threading.Thread(target=producer),
+            threading.Thread(target=consumer),
+        ]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        self.assertEqual(received, list(range(count)))
+
+    def test_safe_consume(self):
+        ch = ctools.Channel(2, mode="spsc")
+        ch.send(1)
+        self.assertFalse(ch.safe_consume(lambda x: False))
+        self.assertTrue(ch.recvable())
+        self.assertTrue(ch.safe_consume(lambda x: True))
+        self.assertFalse(ch.recvable())
+        ch.send(1)
+        ch.send(1)
+        self.assertTrue(ch.safe_consume(lambda x: ch.recv()[1]))
+        self.assertEqual(ch.recv(), (1, True))
+        self.assertFalse(ch.recvable())
+        with self.assertRaises(TypeError):
+            ctools.Channel(2, mode="mpmc").safe_consume(lambda x: True)
+
+
+class TestMPMCChannel(TestLockFreeChannel):
+    mode = "mpmc"
+
+
+class TestPriorityChannel(unittest.TestCase):
+    def assertRefEqual(self, a, b, msg=None):
+        self.assertEqual(sys.getrefcount(a), sys.getrefcount(b), msg=msg)
+
+    def test_priority(self):
+        ch = ctools.PriorityChannel(8, lanes=3)
+        self.assertEqual(ch.lanes, 3)
+        self.assertEqual(ch.size(), 8)
+        self.assertFalse(ch.recvable())
+        self.assertEqual(ch.recv(), (None, False))
+
+        for i, p in enumerate([0, 1, 2, 0, 2, 1]):
+            self.assertTrue(ch.send((p, i), priority=p))
+        self.assertEqual(len(ch), 6)
+        got = [ch.recv()[0] for _ in range(6)]
+        self.assertEqual(got, [(2, 2), (2, 4), (1, 1), (1, 5), (0, 0), (0, 3)])
+        self.assertFalse(ch.recvable())
+
+        with self.assertRaises(ValueError):
+            ch.send(1, priority=3)
+        with self.assertRaises(ValueError):
+            ch.send(1, priority=-1)
+        with self.assertRaises(ValueError):
+            ctools.PriorityChannel(lanes=33)
+        with self.assertRaises(ValueError):
+            ctools.PriorityChannel(0)
+        self.assertEqual(ctools.PriorityChannel(None).size(), 2**31 - 1)
+
+    def test_bound(self):
+        ch = ctools.PriorityChannel(2)
+        self.assertTrue(ch.send(1))
+        self.assertTrue(ch.send(2, priority=3))
+        self.assertFalse(ch.sendable())
+        self.assertFalse(ch.send(3, priority=1))
+        self.assertEqual(ch.recv(), (2, True))
+        self.assertTrue(ch.sendable())
+
+    def test_safe_consume_and_close(self):
+        ch = ctools.PriorityChannel(4)
+        item = uuid.uuid1()
+        a = uuid.uuid1()
+        ch.send(item, priority=1)
+        ch.send(2)
+        self.assertFalse(ch.safe_consume(lambda x: False))
+        self.assertEqual(len(ch), 2)
+        self.assertTrue(ch.safe_consume(lambda x: x == item))
+        self.assertEqual(len(ch), 1)
+        self.assertRefEqual(item, a)
+
+        ch.send(item)
+        ch.close(recv=False)
+        with self.assertRaises(IndexError):
+            ch.send(3)
+        self.assertEqual(ch.recv(), (2, True))
+        ch.clear()
+        self.assertEqual(len(ch), 0)
+        self.assertRefEqual(item, a)
+
+    def test_safe_consume_send_higher(self):
+        ch = ctools.PriorityChannel(4)
+        ch.send("low")
+
+        def f(item):
+            ch.send("high", priority=3)
+            return True
+
+        self.assertTrue(ch.safe_consume(f))
+        self.assertEqual(ch.recv(), ("high", True))
+        self.assertEqual(ch.recv(), (None, False))
+        ch.close()
+        with self.assertRaises(IndexError):
+            ch.recv()
+
+
+class TestSelect(unittest.TestCase):
+    def test_ready(self):
+        a = ctools.Channel(4)
+        b = ctools.PriorityChannel(4)
+        self.assertEqual(ctools.select([a, b], timeout=0), (None, None))
+        b.send(1, priority=2)
+        self.assertEqual(ctools.select([a, b]), (b, 1))
+        a.send(2)
+        self.assertEqual(ctools.select((a, b)), (a, 2))
+        self.assertEqual(ctools.select([a, b], timeout=0.01), (None, None))
+
+    def test_fairness(self):
+        a = ctools.Channel(16)
+        b = ctools.Channel(16)
+        for i in range(8):
+            a.send(i)
+            b.send(i)
+        got = [ctools.select([a, b])[0] for _ in range(8)]
+        self.assertIn(a, got)
+        self.assertIn(b, got)
+
+    def test_blocking(self):
+        a = ctools.Channel(4)
+        b = ctools.Channel(4, mode="mpmc")
+        timer = threading.Timer(0.05, b.send, (3,))
+        timer.start()
+        self.assertEqual(ctools.select([a, b]), (b, 3))
+        timer.join()
+
+        timer = threading.Timer(0.05, a.close)
+        timer.start()
+        with self.assertRaises(IndexError):
+            ctools.select([a], timeout=5)
+        timer.join()
+
+    def test_closed(self):
+        a = ctools.Channel(4)
+        b = ctools.Channel(4)
+        a.close()
+        b.send(1)
+        b.close(recv=False)
+        self.assertEqual(ctools.select([a, b]), (b, 1))
+        # b is drained and will never deliver again
+        with self.assertRaises(IndexError):
+            ctools.select([a, b])
+        c = ctools.PriorityChannel(4)
+        c.close(recv=False)
+        with self.assertRaises(IndexError):
+            ctools.select([c])
+        d = ctools.Channel(4)
+        self.assertEqual(ctools.select([b, d], timeout=0), (None, None))
+
+    def test_bad_args(self):
+        with self.assertRaises(TypeError):
+            ctools.select([ctools.Channel(), 1])
+        with self.assertRaises(ValueError):
+            ctools.select([ctools.Channel()], timeout=-1)
+        with self.assertRaises(ValueError):
+            ctools.select([])
+        with self.assertRaises(ValueError):
+            ctools.select(iter(()), timeout=None)
+
 
 if __name__ == "__main__":
     unittest.main()
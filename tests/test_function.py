@@ -1,6 +1,9 @@
+import inspect
 import unittest
 import random
 import string
+import subprocess
+import sys
 from datetime import datetime, timedelta
 
 import ctools
@@ -55,3 +58,103 @@ class TestFunction(unittest.TestCase):
 
         with self.assertRaises(TypeError):
             ctools.strhash(s, method="fnv1a")
+
+    def test_argument_types(self):
+        class Int(int):
+            pass
+
+        class Index:
+            def __index__(self):
+                return 7
+
+        h = ctools.jump_consistent_hash(7, 10)
+        self.assertEqual(ctools.jump_consistent_hash(Int(7), 10), h)
+        self.assertEqual(ctools.jump_consistent_hash(Index(), Int(10)), h)
+        self.assertEqual(ctools.jump_consistent_hash(2**64 + 7, 10), h)
+        with self.assertRaises(TypeError):
+            ctools.jump_consistent_hash(7.0, 10)
+        h = ctools.strhash("abc", "djb2")
+        self.assertEqual(ctools.strhash(b"abc", b"djb2"), h)
+        self.assertEqual(ctools.strhash(memoryview(b"abc"), "djb2"), h)
+        self.assertEqual(ctools.strhash(bytearray(b"abc"), "djb2"), h)
+        with self.assertRaises(TypeError):
+            ctools.strhash(1)
+        with self.assertRaises(ValueError):
+            ctools.strhash("abc", "")
+
+    def test_freelist_stats(self):
+        before = ctools.freelist_stats()
+        cache = ctools.CacheMap(10, policy="lru")
+        ttl = ctools.TTLCache()
+        for i in range(100):
+            cache[i] = i
+            ttl[i] = i
+            del ttl[i]
+        after = ctools.freelist_stats()
+        for name in ("CacheMapEntry", "TTLCacheEntry"):
+            created = sum(after[name][k] - before[name][k] for k in ("allocated", "reused"))
+            self.assertEqual(created, 100)
+            self.assertGreaterEqual(after[name]["reused"] - before[name]["reused"], 89)
+            self.assertLessEqual(after[name]["size"], 1024)
+        # entries coming from the free list start clean
+        self.assertEqual(sorted(cache), list(range(90, 100)))
+        self.assertEqual(cache.next_evict_key(), 90)
+
+    def test_freelist_freed_at_exit(self):
+        # the module frees the lists at exit, checked by the debug allocator
+        code = (
+            "import ctools\n"
+            "c, t = ctools.CacheMap(), ctools.TTLCache()\n"
+            "for i in range(2000):\n"
+            "    c[i] = t[i] = i\n"
+            "c.clear()\n"
+            "t.clear()\n"
+        )
+        proc = subprocess.run([sys.executable, "-X", "dev", "-c", code],
+                              stderr=subprocess.PIPE)
+        self.assertEqual(proc.returncode, 0, proc.stderr)
+
+
+class TestArgs(unittest.TestCase):
+    def test_keywords(self):
+        for cache in (ctools.CacheMap(), ctools.TTLCache(), ctools.SortedMap()):
+            cache[1] = "a"
+            self.assertEqual(cache.get(key=1), "a")
+            self.assertEqual(cache.get(2, default="b"), "b")
+            self.assertEqual(cache.get(default="b", key=2), "b")
+            # names built at runtime are not interned
+            self.assertEqual(cache.get(**{"".join(["ke", "y"]): 1}), "a")
+            self.assertEqual(cache.setdefault(key=3, default="c"), "c")
+            self.assertEqual(cache.pop(key=3, default=None), "c")
+        cache = ctools.CacheMap()
+        cache.set(key=1, value="a", weight=1)
+        self.assertEqual(cache.setnx(1, fn=str), "a")
+        self.assertEqual(ctools.jump_consistent_hash(1, 10), ctools.jump_consistent_hash(1, 10))
+
+    def test_errors(self):
+        cache = ctools.CacheMap()
+        with self.assertRaisesRegex(TypeError, "unexpected keyword argument 'k'"):
+            cache.get(k=1)
+        with self.assertRaisesRegex(TypeError, "multiple values for argument 'key'"):
+            cache.get(1, key=1)
+        with self.assertRaisesRegex(TypeError, "missing required argument 'key'"):
+            cache.get(default=1)
+        with self.assertRaisesRegex(TypeError, "missing required argument 'value'"):
+            cache.set(1, weight=1)
+        with self.assertRaisesRegex(TypeError, "at most 2 positional arguments"):
+            cache.get(1, 2, 3)
+        with self.assertRaises(TypeError):
+            cache.get()
+        with self.assertRaises(TypeError):
+            cache.get(**{1: 1})
+        # positional only parameters take no keyword
+        with self.assertRaisesRegex(TypeError, "unexpected keyword argument 's'"):
+            ctools.strhash(s="a")
+
+    def test_signature(self):
+        for method in (ctools.CacheMap.get, ctools.CacheMap.pop, ctools.CacheMap.setdefault,
+                       ctools.TTLCache.get, ctools.TTLCache.setdefault):
+            params = list(inspect.signature(method).parameters.values())
+            self.assertEqual([p.name for p in params], ["key", "default"])
+            for p in params:
+                self.assertEqual(p.kind, p.POSITIONAL_OR_KEYWORD)
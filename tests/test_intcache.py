@@ -0,0 +1,175 @@
+import array
+import gc
+import random
+import unittest
+import weakref
+from time import sleep
+
+import ctools
+
+
+class Value:
+    pass
+
+
+class TestIntCacheMap(unittest.TestCase):
+    def create_map(self, *args):
+        return ctools.IntCacheMap(*args)
+
+    def test_mapping(self):
+        cache = self.create_map()
+        cache[1] = "a"
+        cache[-(2 ** 63)] = "min"
+        cache[2 ** 63 - 1] = "max"
+        self.assertEqual(len(cache), 3)
+        self.assertEqual(cache[1], "a")
+        self.assertEqual(cache[-(2 ** 63)], "min")
+        self.assertIn(2 ** 63 - 1, cache)
+        self.assertNotIn(2, cache)
+        self.assertNotIn(2 ** 64, cache)
+        self.assertNotIn("1", cache)
+        del cache[1]
+        self.assertNotIn(1, cache)
+        with self.assertRaises(KeyError):
+            cache[1]
+        with self.assertRaises(KeyError):
+            del cache[1]
+        with self.assertRaises(TypeError):
+            cache["a"] = 1
+        with self.assertRaises(OverflowError):
+            cache[2 ** 64] = 1
+
+    def test_methods(self):
+        cache = self.create_map()
+        self.assertIsNone(cache.get(1))
+        self.assertEqual(cache.get(1, 0), 0)
+        cache.set(1, "a")
+        self.assertEqual(cache.get(key=1), "a")
+        self.assertEqual(cache.setdefault(1, "b"), "a")
+        self.assertEqual(cache.setdefault(2, "b"), "b")
+        self.assertEqual(cache.pop(2), "b")
+        self.assertEqual(cache.pop(2, 0), 0)
+        self.assertEqual(sorted(cache), [1])
+        self.assertEqual(list(cache.values()), ["a"])
+        self.assertEqual(list(cache.items()), [(1, "a")])
+        self.assertIn("1: 'a'", repr(cache))
+        cache.clear()
+        self.assertEqual(len(cache), 0)
+        self.assertEqual(cache.stats()["hits"], 2)
+
+    def test_same_as_dict(self):
+        cache = self.create_map()
+        mp = {}
+        rand = random.Random(0)
+        for _ in range(20000):
+            key = rand.randrange(-300, 300) * rand.choice((1, 2 ** 40))
+            op = rand.random()
+            if op < 0.5:
+                cache[key] = mp[key] = rand.random()
+            elif op < 0.8:
+                self.assertEqual(cache.pop(key, None), mp.pop(key, None))
+            else:
+                self.assertEqual(cache.get(key), mp.get(key))
+        self.assertEqual(len(cache), len(mp))
+        self.assertEqual(dict(cache.items()), mp)
+
+    def test_many(self):
+        cache = self.create_map()
+        cache.set_many({1: "a", 2: "b"})
+        cache.set_many([(3, "c")])
+        keys = array.array("q", [1, 3, 5])
+        self.assertEqual(cache.get_many(keys), ["a", "c", None])
+        self.assertEqual(cache.get_many([2, 5], default=0), ["b", 0])
+        self.assertEqual(cache.get_many(memoryview(keys)[::2]), ["a", None])
+        self.assertEqual(cache.get_many(array.array("B", [1, 2])), ["a", "b"])
+        self.assertEqual(cache.delete_many(array.array("i", [1, 5])), 1)
+        self.assertEqual(cache.delete_many([2, 3]), 2)
+        self.assertEqual(len(cache), 0)
+        with self.assertRaises(TypeError):
+            cache.get_many(array.array("d", [1.0]))
+        with self.assertRaises(OverflowError):
+            cache.get_many(array.array("Q", [2 ** 64 - 1]))
+        with self.assertRaises(TypeError):
+            cache.get_many(["a"])
+        with self.assertRaises(TypeError):
+            cache.set_many([("a", 1)])
+
+    def test_iter_changed_size(self):
+        cache = self.create_map()
+        cache.set_many((i, i) for i in range(4))
+        it = iter(cache)
+        next(it)
+        cache[10] = 10
+        with self.assertRaises(RuntimeError):
+            next(it)
+
+    def test_gc(self):
+        cache = self.create_map()
+        value = Value()
+        value.cache = cache
+        cache[1] = value
+        ref = weakref.ref(value)
+        del cache, value
+        gc.collect()
+        self.assertIsNone(ref())
+
+
+class TestIntCacheMapEvict(unittest.TestCase):
+    def test_capacity(self):
+        cache = ctools.IntCacheMap(3)
+        self.assertEqual(cache.capacity, 3)
+        for i in range(3):
+            cache[i] = i
+        cache[0]
+        cache[1]
+        cache[3] = 3
+        self.assertEqual(sorted(cache), [0, 1, 3])
+        stats = cache.stats()
+        self.assertEqual(stats["evictions"], 1)
+        self.assertEqual(stats["hits"], 2)
+        self.assertEqual(stats["insertions"], 4)
+
+    def test_set_many_evict_once(self):
+        cache = ctools.IntCacheMap(4)
+        cache.set_many((i, i) for i in range(10))
+        self.assertEqual(len(cache), 4)
+        self.assertEqual(cache.stats()["evictions"], 6)
+
+    def test_evict_n(self):
+        cache = ctools.IntCacheMap(1000)
+        cache.set_many((i, i) for i in range(500))
+        self.assertEqual(cache.evict(), 1)
+        self.assertEqual(cache.evict(99), 99)
+        self.assertEqual(cache.evict(1000), 400)
+        with self.assertRaises(ValueError):
+            cache.evict(-1)
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError):
+            ctools.IntCacheMap(0)
+        with self.assertRaises(ValueError):
+            ctools.IntCacheMap(2 ** 40)
+
+
+class TestIntTTLCache(TestIntCacheMap):
+    def create_map(self, *args):
+        return ctools.IntTTLCache(*args)
+
+    def test_expire(self):
+        cache = ctools.IntTTLCache(1)
+        self.assertEqual(cache.ttl, 1)
+        cache[1] = "a"
+        cache[2] = "b"
+        cache.set_many({3: "c"})
+        self.assertEqual(cache.get_many([1, 3]), ["a", "c"])
+        sleep(2.1)
+        self.assertNotIn(1, cache)
+        self.assertEqual(list(cache), [])
+        self.assertIsNone(cache.get(1))
+        cache[4] = "d"
+        self.assertEqual(list(cache), [4])
+        self.assertEqual(cache.stats()["expirations"], 3)
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError):
+            ctools.IntTTLCache(0)
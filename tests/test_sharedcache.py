@@ -0,0 +1,180 @@
+import mmap
+import multiprocessing
+import os
+import random
+import struct
+import sys
+import unittest
+
+import ctools
+
+
+def _worker(name, n):
+    from multiprocessing.shared_memory import SharedMemory
+
+    shm = SharedMemory(name)
+    cache = ctools.SharedCache(shm.buf)
+    for i in range(2000):
+        key = b"%d:%d" % (n, i % 100)
+        cache[key] = key * 3
+        if cache.get(key) != key * 3:
+            os._exit(1)
+        cache.get(b"shared")
+    del cache
+    shm.close()
+
+
+class TestSharedCache(unittest.TestCase):
+    def create_cache(self, capacity=1000, **kwargs):
+        buf = mmap.mmap(-1, ctools.SharedCache.nbytes(capacity, **kwargs))
+        return buf, ctools.SharedCache(buf, create=True, **kwargs)
+
+    def test_mapping(self):
+        buf, cache = self.create_cache()
+        self.assertEqual(cache.capacity, 1024)
+        self.assertEqual(cache.item_size, 1000)
+        self.assertEqual(cache.stripes, 64)
+        cache[b"a"] = b"1"
+        cache["b"] = bytearray(b"2")
+        cache[b""] = memoryview(b"")
+        self.assertEqual(len(cache), 3)
+        self.assertEqual(cache["a"], b"1")
+        self.assertEqual(cache[b"b"], b"2")
+        self.assertEqual(cache[b""], b"")
+        self.assertIn(b"a", cache)
+        self.assertNotIn(b"c", cache)
+        self.assertNotIn(1, cache)
+        del cache[b"a"]
+        self.assertNotIn(b"a", cache)
+        with self.assertRaises(KeyError):
+            cache[b"a"]
+        with self.assertRaises(KeyError):
+            del cache[b"a"]
+        with self.assertRaises(TypeError):
+            cache[1] = b"1"
+        with self.assertRaises(TypeError):
+            cache[b"a"] = "1"
+        with self.assertRaises(ValueError):
+            cache[b"a"] = bytes(1000)
+
+    def test_methods(self):
+        buf, cache = self.create_cache()
+        self.assertIsNone(cache.get(b"a"))
+        self.assertEqual(cache.get(b"a", 0), 0)
+        cache.set(b"a", b"x" * 999)
+        self.assertEqual(cache.get(key=b"a"), b"x" * 999)
+        cache.set(b"a", b"y")
+        self.assertEqual(cache.get(b"a"), b"y")
+        self.assertEqual(cache.pop(b"a"), b"y")
+        self.assertEqual(cache.pop(b"a", 0), 0)
+        stats = cache.stats(reset=True)
+        self.assertEqual(stats["hits"], 2)
+        self.assertEqual(stats["misses"], 2)
+        self.assertEqual(stats["insertions"], 1)
+        self.assertEqual(cache.stats()["hits"], 0)
+        cache[b"a"] = b"1"
+        cache.clear()
+        self.assertEqual(len(cache), 0)
+
+    def test_same_as_dict(self):
+        buf, cache = self.create_cache(2000, item_size=200)
+        mp = {}
+        rand = random.Random(0)
+        for _ in range(20000):
+            key = str(rand.randrange(500)).encode() * rand.choice((1, 30))
+            op = rand.random()
+            if op < 0.5:
+                value = bytes([rand.randrange(256)]) * rand.randrange(100)
+                cache[key] = mp[key] = value
+            elif op < 0.8:
+                self.assertEqual(cache.pop(key, None), mp.pop(key, None))
+            else:
+                self.assertEqual(cache.get(key), mp.get(key))
+        self.assertEqual(len(cache), len(mp))
+        self.assertEqual(cache.stats()["evictions"], 0)
+        for key, value in mp.items():
+            self.assertEqual(cache[key], value)
+
+    def test_evict(self):
+        buf, cache = self.create_cache(100, item_size=16, stripes=1)
+        self.assertEqual(cache.capacity, 100)
+        for i in range(10):
+            cache[b"hot%d" % i] = b"1"
+            cache[b"hot%d" % i]
+        for i in range(1000):
+            cache[b"%d" % i] = b"1"
+        self.assertEqual(len(cache), 100)
+        self.assertEqual(cache.stats()["evictions"], 910)
+        for i in range(10):
+            self.assertIn(b"hot%d" % i, cache)
+        self.assertEqual(cache.evict(), 1)
+        self.assertEqual(cache.evict(50), 50)
+        self.assertEqual(cache.evict(100), 49)
+        with self.assertRaises(ValueError):
+            cache.evict(-1)
+
+    def test_new_key_outlives_cold_ones(self):
+        buf, cache = self.create_cache(3, item_size=16, stripes=1)
+        for key in (b"a", b"b", b"c"):
+            cache[key] = key
+        # misses age the stripe, the visits of old keys are halved
+        for _ in range(130):
+            cache.get(b"x")
+        cache[b"d"] = b"d"
+        cache[b"e"] = b"e"
+        self.assertIn(b"d", cache)
+        self.assertIn(b"e", cache)
+
+    def test_attach(self):
+        buf, cache = self.create_cache()
+        cache[b"foo"] = b"bar"
+        other = ctools.SharedCache(buf)
+        self.assertEqual(other[b"foo"], b"bar")
+        self.assertEqual(other.capacity, cache.capacity)
+        with self.assertRaises(ValueError):
+            ctools.SharedCache(mmap.mmap(-1, 4096))
+        with self.assertRaises(ValueError):
+            ctools.SharedCache(mmap.mmap(-1, 4096), create=True)
+        with self.assertRaises(ValueError):
+            ctools.SharedCache(buf, create=True, stripes=0)
+        with self.assertRaises(ValueError):
+            ctools.SharedCache.nbytes(0)
+
+    @unittest.skipIf(sys.platform == "win32", "no dead owner detection")
+    def test_dead_owner(self):
+        buf, cache = self.create_cache(100, stripes=1)
+        cache[b"foo"] = b"bar"
+        p = multiprocessing.Process(target=int)
+        p.start()
+        p.join()
+        # the lock of the first stripe follows the 64 bytes header
+        struct.pack_into("N", buf, 64, p.pid)
+        self.assertIsNone(cache.get(b"foo"))
+        cache[b"foo"] = b"bar"
+        self.assertEqual(cache[b"foo"], b"bar")
+
+    @unittest.skipIf(sys.version_info < (3, 8), "shared_memory requires python 3.8")
+    def test_process(self):
+        from multiprocessing.shared_memory import SharedMemory
+
+        shm = SharedMemory(create=True, size=ctools.SharedCache.nbytes(1000, stripes=4))
+        try:
+            cache = ctools.SharedCache(shm.buf, create=True, stripes=4)
+            cache[b"shared"] = b"1"
+            procs = [multiprocessing.Process(target=_worker, args=(shm.name, n)) for n in range(4)]
+            for p in procs:
+                p.start()
+            for p in procs:
+                p.join(30)
+                self.assertEqual(p.exitcode, 0)
+            self.assertEqual(len(cache), 401)
+            self.assertEqual(cache.stats()["hits"], 16000)
+            self.assertEqual(cache[b"3:99"], b"3:99" * 3)
+            del cache
+        finally:
+            shm.close()
+            shm.unlink()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,210 @@
+import mmap
+import multiprocessing
+import struct
+import sys
+import threading
+import unittest
+
+import ctools
+
+
+def _consume_worker(name):
+    from multiprocessing.shared_memory import SharedMemory
+
+    shm = SharedMemory(name)
+    ch = ctools.SharedChannel(shm.buf)
+    while True:
+        msg, ok = ch.recv(timeout=None)
+        if not ok:
+            break
+    del ch
+    shm.close()
+
+
+def _send_worker(name, n, worker):
+    from multiprocessing.shared_memory import SharedMemory
+
+    shm = SharedMemory(name)
+    ch = ctools.SharedChannel(shm.buf)
+    for i in range(n):
+        ch.send(b"%d:%d" % (worker, i), timeout=None)
+    del ch
+    shm.close()
+
+
+def _recv_worker(name, results):
+    from multiprocessing.shared_memory import SharedMemory
+
+    shm = SharedMemory(name)
+    ch = ctools.SharedChannel(shm.buf)
+    received = []
+    while True:
+        msg, ok = ch.recv(timeout=None)
+        if not ok:
+            break
+        received.append(msg)
+    results.put(received)
+    del ch
+    shm.close()
+
+
+class TestSharedChannel(unittest.TestCase):
+    def create_channel(self, size=64):
+        buf = mmap.mmap(-1, ctools.SharedChannel.nbytes(size))
+        return buf, ctools.SharedChannel(buf, create=True)
+
+    def test_send_recv(self):
+        buf, ch = self.create_channel()
+        self.assertEqual(ch.size(), 64)
+        self.assertTrue(ch.sendable())
+        self.assertFalse(ch.recvable())
+        self.assertEqual(ch.recv(), (None, False))
+
+        self.assertTrue(ch.send(b"foo"))
+        self.assertTrue(ch.send(bytearray(b"bar")))
+        self.assertTrue(ch.recvable())
+        self.assertEqual(ch.recv(), (b"foo", True))
+        self.assertEqual(ch.recv(), (b"bar", True))
+        self.assertEqual(ch.recv(), (None, False))
+
+        with self.assertRaises(ValueError):
+            ch.send(b"x" * 64)
+        with self.assertRaises(TypeError):
+            ch.send("foo")
+
+        self.assertTrue(ch.send(data=b"baz", timeout=0))
+        self.assertEqual(ch.recv(timeout=None), (b"baz", True))
+        with self.assertRaises(TypeError):
+            ch.send()
+        with self.assertRaises(TypeError):
+            ch.recv(wait=1)
+
+    def test_full_and_wrap(self):
+        buf, ch = self.create_channel()
+        for i in range(100):
+            msg = str(i).encode() * (i % 7 + 1)
+            self.assertTrue(ch.send(msg))
+            self.assertEqual(ch.recv(), (msg, True))
+
+        buf, ch = self.create_channel()
+        for i in range(4):
+            self.assertTrue(ch.send(b"x" * 12))
+        self.assertFalse(ch.send(b"y" * 12))
+        self.assertFalse(ch.send(b"y" * 12, timeout=0.01))
+        self.assertEqual(ch.recv(), (b"x" * 12, True))
+        self.assertTrue(ch.send(b"y" * 12))
+
+    def test_attach(self):
+        buf, ch = self.create_channel()
+        ch.send(b"foo")
+        other = ctools.SharedChannel(buf)
+        self.assertEqual(other.recv(), (b"foo", True))
+        with self.assertRaises(ValueError):
+            ctools.SharedChannel(mmap.mmap(-1, 4096))
+        with self.assertRaises(ValueError):
+            ctools.SharedChannel(bytearray(8), create=True)
+
+    def test_close(self):
+        buf, ch = self.create_channel()
+        ch.send(b"foo")
+        ch.close(recv=False)
+        with self.assertRaises(IndexError):
+            ch.send(b"bar")
+        self.assertEqual(ch.recv(timeout=None), (b"foo", True))
+        self.assertEqual(ch.recv(timeout=None), (None, False))
+        ch.close()
+        with self.assertRaises(IndexError):
+            ch.recv()
+
+    def test_close_recv_wakes_sender(self):
+        buf, ch = self.create_channel()
+        while ch.send(b"x" * 12):
+            pass
+        rv = []
+        t = threading.Thread(target=lambda: rv.append(ch.send(b"y", timeout=None)))
+        t.start()
+        t.join(0.05)
+        self.assertTrue(t.is_alive())
+        ch.close(send=False)
+        t.join(5)
+        self.assertFalse(t.is_alive())
+        self.assertEqual(rv, [False])
+
+    def test_corrupted(self):
+        buf, ch = self.create_channel()
+        ch.send(b"foo")
+        # the first record follows the header of three cache lines
+        struct.pack_into("I", buf, 192, 1000)
+        with self.assertRaises(ValueError):
+            ch.recv()
+        struct.pack_into("I", buf, 192, 20)
+        with self.assertRaises(ValueError):
+            ch.recv()
+        struct.pack_into("I", buf, 192, 3)
+        self.assertEqual(ch.recv(), (b"foo", True))
+
+    def test_recv_timeout(self):
+        buf, ch = self.create_channel()
+        self.assertEqual(ch.recv(timeout=0.01), (None, False))
+        with self.assertRaises(ValueError):
+            ch.recv(timeout=-1)
+
+    @unittest.skipIf(sys.version_info < (3, 8), "shared_memory requires python 3.8")
+    def test_process(self):
+        from multiprocessing.shared_memory import SharedMemory
+
+        shm = SharedMemory(create=True, size=ctools.SharedChannel.nbytes(256))
+        try:
+            ch = ctools.SharedChannel(shm.buf, create=True)
+            p = multiprocessing.Process(target=_consume_worker, args=(shm.name,))
+            p.start()
+            for i in range(1000):
+                self.assertTrue(ch.send(b"x" * (i % 50), timeout=None))
+            ch.close(recv=False)
+            p.join(10)
+            self.assertEqual(p.exitcode, 0)
+            self.assertFalse(ch.recvable())
+            del ch
+        finally:
+            shm.close()
+            shm.unlink()
+
+    @unittest.skipIf(sys.version_info < (3, 8), "shared_memory requires python 3.8")
+    def test_many_processes(self):
+        from multiprocessing.shared_memory import SharedMemory
+
+        shm = SharedMemory(create=True, size=ctools.SharedChannel.nbytes(256))
+        try:
+            ch = ctools.SharedChannel(shm.buf, create=True)
+            results = multiprocessing.Queue()
+            senders = [
+                multiprocessing.Process(target=_send_worker, args=(shm.name, 2000, i))
+                for i in range(3)
+            ]
+            receivers = [
+                multiprocessing.Process(target=_recv_worker, args=(shm.name, results))
+                for _ in range(3)
+            ]
+            for p in senders + receivers:
+                p.start()
+            for p in senders:
+                p.join(30)
+                self.assertEqual(p.exitcode, 0)
+            ch.close(recv=False)
+            received = []
+            for _ in receivers:
+                received.extend(results.get(timeout=30))
+            for p in receivers:
+                p.join(10)
+                self.assertEqual(p.exitcode, 0)
+            # every message is delivered exactly once
+            expected = [b"%d:%d" % (w, i) for w in range(3) for i in range(2000)]
+            self.assertEqual(sorted(received), sorted(expected))
+            del ch
+        finally:
+            shm.close()
+            shm.unlink()
+
+
+if __name__ == "__main__":
+    unittest.main()
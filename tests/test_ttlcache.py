@@ -1,6 +1,10 @@
+import os
 import sys
+import tempfile
+import threading
 import unittest
 import uuid
+from concurrent.futures import ThreadPoolExecutor
 from contextlib import contextmanager
 from time import sleep
 
@@ -32,6 +36,16 @@ class A:
         return self.__repr__()
 
 
+class Clock:
+    """A timer of TTLCache moved by hand."""
+
+    def __init__(self):
+        self.now = 1000
+
+    def __call__(self):
+        return self.now
+
+
 class DefaultEntry:
     def __init__(self, o):
         self.o = o
@@ -427,6 +441,399 @@ class TestTTLCache(unittest.TestCase):
         del cache, mapping
         self.assert_ref(key2, key1)
 
+    def test_many(self):
+        cache = self.create_map()
+        cache.set_many({1: "a", 2: "b"})
+        cache.set_many([(3, "c"), [4, "d"]])
+        cache.set_many(iter([(5, "e")]))
+        self.assertEqual(len(cache), 5)
+        self.assertEqual(cache.get_many([1, 3, 6]), ["a", "c", None])
+        self.assertEqual(cache.get_many((5, 6), default=0), ["e", 0])
+        self.assertEqual(cache.get_many(k for k in (2, 4)), ["b", "d"])
+        self.assertEqual(cache.delete_many([1, 2, 6]), 2)
+        self.assertNotIn(1, cache)
+        self.assertEqual(len(cache), 3)
+        with self.assertRaises(ValueError):
+            cache.set_many([(1, 2, 3)])
+        with self.assertRaises(TypeError):
+            cache.set_many([1])
+        with self.assertRaises(TypeError):
+            cache.get_many(1)
+        with self.assertRaises(TypeError):
+            cache.delete_many([[]])
+
+
+class TestTTLCacheBatch(unittest.TestCase):
+    def test_expired(self):
+        expired = []
+        clock = Clock()
+        cache = ctools.TTLCache(1, on_expire=expired.append, timer=clock)
+        cache.set_many({1: 1, 2: 2})
+        clock.now += 2
+        self.assertEqual(cache.get_many([1, 2, 3]), [None, None, None])
+        self.assertEqual(len(expired), 1)
+        self.assertEqual(sorted(expired[0]), [(1, 1, "expired"), (2, 2, "expired")])
+        stats = cache.stats()
+        self.assertEqual(stats["misses"], 3)
+        self.assertEqual(stats["expirations"], 2)
+        cache.set_many({3: 3})
+        clock.now += 2
+        self.assertEqual(cache.delete_many([3]), 0)
+        self.assertEqual(len(cache), 0)
+
+    def test_shrink_once(self):
+        evicted = []
+        cache = ctools.TTLCache(max_bytes=3, sizeof=len, on_evict=evicted.append)
+        cache.set_many([("a", "x"), ("b", "xx"), ("c", "xx")])
+        self.assertEqual(sorted(cache), ["c"])
+        self.assertEqual(len(evicted), 1)
+        self.assertEqual([k for k, _, _ in evicted[0]], ["a", "b"])
+
+
+class TestTTLCacheMaxBytes(unittest.TestCase):
+    def test_max_bytes(self):
+        cache = ctools.TTLCache(max_bytes=100, sizeof=len)
+        self.assertEqual(cache.max_bytes, 100)
+        for i in range(20):
+            cache[i] = "x" * 10
+        self.assertEqual(len(cache), 10)
+        self.assertEqual(cache.weight, 100)
+        self.assertNotIn(9, cache)
+        self.assertIn(10, cache)
+        # rewriting a key makes it the most recently written one
+        cache[10] = "y" * 10
+        cache.set("big", "z", weight=20)
+        self.assertIn(10, cache)
+        self.assertNotIn(11, cache)
+        self.assertEqual(cache.weight, 100)
+        cache.pop(10)
+        self.assertEqual(cache.weight, 90)
+        cache.clear()
+        self.assertEqual(cache.weight, 0)
+
+    def test_default_sizeof(self):
+        cache = ctools.TTLCache(max_bytes=1000)
+        cache[1] = b"x" * 600
+        cache[2] = b"x" * 600
+        self.assertEqual(len(cache), 1)
+        self.assertIn(2, cache)
+        self.assertIsNone(ctools.TTLCache().max_bytes)
+
+
+class TestTTLCacheStats(unittest.TestCase):
+    def test_stats(self):
+        clock = Clock()
+        cache = ctools.TTLCache(1, max_bytes=20, sizeof=len, timer=clock)
+        cache["a"] = "x" * 10
+        cache["b"] = "x" * 10
+        cache["c"] = "x" * 10
+        cache["c"] = "y" * 10
+        cache["b"]
+        cache.get("c")
+        cache.get("a")
+        with self.assertRaises(KeyError):
+            cache["a"]
+        cache.setdefault("b")
+        stats = cache.stats()
+        self.assertEqual(stats["hits"], 3)
+        self.assertEqual(stats["misses"], 2)
+        self.assertEqual(stats["insertions"], 3)
+        self.assertEqual(stats["evictions"], 1)
+        self.assertEqual(stats["expirations"], 0)
+        self.assertIsNone(stats["latency"])
+
+        clock.now += 2
+        self.assertNotIn("b", cache)
+        cache.clear()
+        self.assertEqual(cache.stats()["hits"], 3)
+        stats = cache.stats(reset=True)
+        self.assertEqual(stats["expirations"], 1)
+        self.assertEqual(cache.stats()["expirations"], 0)
+
+    def test_latency(self):
+        cache = ctools.TTLCache(latency=True)
+        cache[1] = 1
+        cache[1]
+        cache.get(2)
+        latency = cache.stats()["latency"]
+        self.assertEqual(sum(latency["get"]), 2)
+        self.assertEqual(sum(latency["set"]), 1)
+
+
+class TestTTLCacheCallbacks(unittest.TestCase):
+    def test_on_expire(self):
+        expired = []
+        clock = Clock()
+        cache = ctools.TTLCache(1, on_expire=expired.append, timer=clock)
+        cache["a"] = 1
+        cache["b"] = 2
+        clock.now += 2
+        self.assertIsNone(cache.get("a"))
+        self.assertEqual(expired, [[("a", 1, "expired")]])
+        # writes sweep all expired keys in one batch
+        cache["c"] = 3
+        cache["d"] = 4
+        self.assertEqual(expired[1], [("b", 2, "expired")])
+        self.assertEqual(len(expired), 2)
+        self.assertEqual(len(cache), 2)
+
+    def test_on_evict(self):
+        evicted, expired = [], []
+        cache = ctools.TTLCache(
+            max_bytes=20,
+            sizeof=len,
+            on_evict=evicted.append,
+            on_expire=expired.append,
+        )
+        cache["a"] = "x" * 10
+        cache["b"] = "x" * 10
+        cache.set("c", "y", weight=20)
+        self.assertEqual(
+            evicted, [[("a", "x" * 10, "evicted"), ("b", "x" * 10, "evicted")]]
+        )
+        self.assertEqual(expired, [])
+        with self.assertRaises(TypeError):
+            ctools.TTLCache(on_expire=1)
+
+    def test_sweep_out_of_order(self):
+        expired = []
+        clock = Clock()
+        cache = ctools.TTLCache(100, on_expire=expired.extend, timer=clock)
+        cache["a"] = 1
+        cache.set_default_ttl(1)
+        cache["b"] = 2
+        clock.now += 2
+        # "b" expires before "a" written earlier, it is still swept
+        cache["c"] = 3
+        self.assertEqual(expired, [("b", 2, "expired")])
+        self.assertEqual(sorted(cache), ["a", "c"])
+
+
+class TestTTLCacheSingleflight(unittest.TestCase):
+    def test_coalesce(self):
+        cache = ctools.TTLCache()
+        calls = []
+        results = []
+
+        def load(key):
+            calls.append(key)
+            sleep(0.2)
+            return object()
+
+        def worker():
+            results.append(cache.setnx("key", load, singleflight=True))
+
+        threads = [threading.Thread(target=worker) for _ in range(8)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        self.assertEqual(calls, ["key"])
+        self.assertTrue(all(r is results[0] for r in results))
+        self.assertIs(cache["key"], results[0])
+
+
+class TestTTLCacheRefresh(unittest.TestCase):
+    def test_stale_while_revalidate(self):
+        refreshed = []
+        clock = Clock()
+        cache = ctools.TTLCache(3, soft_ttl=1, refresh=refreshed.append,
+                                timer=clock)
+        cache["a"] = 1
+        self.assertEqual(cache["a"], 1)
+        self.assertEqual(refreshed, [])
+        clock.now += 2
+        # stale values are still returned, refresh is called only once
+        self.assertEqual(cache["a"], 1)
+        self.assertEqual(cache.get("a"), 1)
+        self.assertEqual(refreshed, ["a"])
+        cache["a"] = 2
+        self.assertEqual(cache["a"], 2)
+        self.assertEqual(refreshed, ["a"])
+
+    def test_refresh_writes_back(self):
+        cache = None
+
+        def refresh(key):
+            cache[key] = cache.get(key) + 1
+
+        clock = Clock()
+        cache = ctools.TTLCache(3, soft_ttl=1, refresh=refresh, timer=clock)
+        cache["a"] = 1
+        clock.now += 2
+        self.assertEqual(cache["a"], 1)
+        self.assertEqual(cache["a"], 2)
+
+    def test_refresh_error(self):
+        calls = []
+
+        def refresh(key):
+            calls.append(key)
+            if len(calls) == 1:
+                raise RuntimeError(key)
+
+        clock = Clock()
+        cache = ctools.TTLCache(3, soft_ttl=1, refresh=refresh, timer=clock)
+        cache["a"] = 1
+        clock.now += 2
+        with self.assertRaises(RuntimeError):
+            cache["a"]
+        # the failed refresh is retried
+        self.assertEqual(cache["a"], 1)
+        self.assertEqual(calls, ["a", "a"])
+        self.assertEqual(cache["a"], 1)
+        self.assertEqual(calls, ["a", "a"])
+
+    def test_refresh_deletes(self):
+        cache = None
+
+        def refresh(key):
+            del cache[key]
+            raise KeyError(key)
+
+        clock = Clock()
+        cache = ctools.TTLCache(3, soft_ttl=1, refresh=refresh, timer=clock)
+        cache["a"] = object()
+        clock.now += 2
+        with self.assertRaises(KeyError):
+            cache["a"]
+        self.assertNotIn("a", cache)
+
+    def test_refresh_retried(self):
+        refreshed = []
+        clock = Clock()
+        cache = ctools.TTLCache(10, soft_ttl=2, refresh=refreshed.append,
+                                timer=clock)
+        cache["a"] = 1
+        clock.now += 3
+        self.assertEqual(cache["a"], 1)
+        clock.now += 1
+        self.assertEqual(cache["a"], 1)
+        self.assertEqual(refreshed, ["a"])
+        # never written back, refresh is called again a soft ttl later
+        clock.now += 2
+        self.assertEqual(cache["a"], 1)
+        self.assertEqual(refreshed, ["a", "a"])
+
+    def test_executor(self):
+        started = threading.Event()
+        release = threading.Event()
+        cache = None
+
+        def refresh(key):
+            started.set()
+            release.wait(10)
+            cache[key] = cache.get(key) + 1
+
+        clock = Clock()
+        with ThreadPoolExecutor(1) as executor:
+            cache = ctools.TTLCache(3, soft_ttl=1, refresh=refresh,
+                                    executor=executor, timer=clock)
+            cache["a"] = 1
+            clock.now += 2
+            # the stale value is returned before the refresh is done
+            self.assertEqual(cache["a"], 1)
+            self.assertTrue(started.wait(10))
+            self.assertEqual(cache["a"], 1)
+            release.set()
+        self.assertEqual(cache["a"], 2)
+
+    def test_xfetch(self):
+        refreshed = []
+        cache = ctools.TTLCache(2, refresh=refreshed.append, xfetch=1e9)
+
+        def load(key):
+            sleep(0.01)
+            return key
+
+        cache.setnx("a", load)
+        # a huge beta makes the early refresh almost certain
+        self.assertEqual(cache["a"], "a")
+        self.assertEqual(refreshed, ["a"])
+
+    def test_bad_args(self):
+        with self.assertRaises(ValueError):
+            ctools.TTLCache(10, soft_ttl=10)
+        with self.assertRaises(ValueError):
+            ctools.TTLCache(10, xfetch=-1)
+        with self.assertRaises(TypeError):
+            ctools.TTLCache(10, refresh=1)
+        with self.assertRaises(ValueError):
+            ctools.TTLCache(10, executor=ThreadPoolExecutor(1))
+        with self.assertRaises(TypeError):
+            ctools.TTLCache(10, timer=1)
+
+    def test_timer_error(self):
+        def timer():
+            raise RuntimeError("timer")
+
+        cache = ctools.TTLCache(10, timer=timer)
+        with self.assertRaises(RuntimeError):
+            cache["a"] = 1
+        with self.assertRaises(RuntimeError):
+            cache.get("a")
+        cache = ctools.TTLCache(10, timer=lambda: -1)
+        with self.assertRaises(ValueError):
+            cache["a"] = 1
+
+
+class TestTTLCacheSnapshot(unittest.TestCase):
+    def test_dump_load(self):
+        fd, path = tempfile.mkstemp()
+        os.close(fd)
+        self.addCleanup(os.unlink, path)
+        clock = Clock()
+        cache = ctools.TTLCache(1, timer=clock)
+        cache.update({"a": 1, "b": (2,)})
+        self.assertEqual(cache.dump(path), 2)
+        other = ctools.TTLCache(100, timer=clock)
+        other["a"] = 0
+        self.assertEqual(other.load(path), 2)
+        self.assertEqual(list(other.items()), [("a", 1), ("b", (2,))])
+        with self.assertRaises(ValueError):
+            ctools.CacheMap().load(path)
+        # the expiry is kept, entries expired since the dump are skipped
+        clock.now += 2
+        self.assertNotIn("a", other)
+        other = ctools.TTLCache(100, timer=clock)
+        self.assertEqual(other.load(path), 0)
+        self.assertEqual(len(other), 0)
+        self.assertEqual(cache.dump(path), 0)
+
+    def test_load_out_of_order(self):
+        fd, path = tempfile.mkstemp()
+        os.close(fd)
+        self.addCleanup(os.unlink, path)
+        clock = Clock()
+        cache = ctools.TTLCache(1, timer=clock)
+        cache["b"] = 2
+        cache.dump(path)
+        other = ctools.TTLCache(100, timer=clock)
+        other["a"] = 1
+        other.load(path)
+        clock.now += 2
+        other["c"] = 3
+        self.assertEqual(sorted(other._storage()), ["a", "c"])
+
+
+@unittest.skipUnless(sys.platform in ("linux", "darwin", "win32"), "no rss")
+class TestTTLCacheMemoryPressure(unittest.TestCase):
+    def test_shrink(self):
+        evicted = []
+        cache = ctools.TTLCache(memory_high=0.5, memory_limit=1, on_evict=evicted.extend)
+        for i in range(5000):
+            cache[i] = i
+        memory = cache.stats()["memory"]
+        self.assertLess(memory["cap"], 100)
+        self.assertLessEqual(len(cache), memory["cap"])
+        self.assertGreater(memory["shrinks"], 0)
+        # the least recently written keys are dropped
+        self.assertEqual(list(cache.keys()), list(range(5000 - len(cache), 5000)))
+        self.assertEqual(evicted[0], (0, 0, "evicted"))
+        with self.assertRaises(ValueError):
+            ctools.TTLCache(memory_high=0, memory_limit=1)
+        self.assertNotIn("memory", ctools.TTLCache().stats())
+
 
 if __name__ == "__main__":
     unittest.main()